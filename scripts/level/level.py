@@ -2,9 +2,21 @@
 
 import pathlib
 import argparse
+import struct
 import imageio.v3 as iio
+import numpy as np
 
-TOTAL_SCREENS = 164
+# The screens of the main map come first. The other maps (New Babe+
+# and Ghost of the Babe) follow, each starting at the screen a
+# teleport link of the main map leads to.
+MAIN_MAP_SCREENS = 164
+
+# See src/levelfile.h.
+LEVEL_FILE_MAGIC = b"JKLV"
+LEVEL_FILE_VERSION = 2
+LEVEL_MAPS_MAGIC = b"JKMT"
+LEVEL_MAPS_VERSION = 1
+LEVEL_FILE_HEADER_SIZE = 16
 
 TILE_WIDTH = 60
 TILE_HEIGHT = 45
@@ -65,64 +77,131 @@ class Line:
         return "Line(x:{}, y:{}, l:{}, b:{})".format(self.x, self.y, self.length, self.block)
 
 class Screen:
-    def __init__(self, rgba, mx, my):
-        self._blocks = []
-        self._teleport = 255
-        self._wind = 0
-        for y in range(my, my + TILE_HEIGHT):
-            for x in range(mx, mx + TILE_WIDTH):
-                c = Color(rgba[y][x])
-                if c.g == 0 and c.b == 255:
-                    self._teleport = c.r
-                    self._blocks.append(BLOCK_EMPTY)
-                elif c == RGBA_EMPTY:
-                    self._blocks.append(BLOCK_EMPTY)
-                elif c == RGB_SOLID:
-                    self._blocks.append(BLOCK_SOLID)
-                elif c == RGB_SLOPE:
-                    if is_block_edge(rgba, x + 1, y) and is_block_edge(rgba, x, y + 1):
-                        self._blocks.append(BLOCK_SLOPE_TL)
-                    elif is_block_edge(rgba, x - 1, y) and is_block_edge(rgba, x, y + 1):
-                        self._blocks.append(BLOCK_SLOPE_TR)
-                    elif is_block_edge(rgba, x + 1, y) and is_block_edge(rgba, x, y - 1):
-                        self._blocks.append(BLOCK_SLOPE_BL)
-                    elif is_block_edge(rgba, x - 1, y) and is_block_edge(rgba, x, y - 1):
-                        self._blocks.append(BLOCK_SLOPE_BR)
-                    else:
-                        print("Error: unknown slope type at {}:{}".format(x, y))
-                        exit(-1)
-                elif c == RGB_FAKE:
-                    self._blocks.append(BLOCK_FAKE)
-                elif c == RGB_ICE:
-                    self._blocks.append(BLOCK_ICE)
-                elif c == RGB_SNOW:
-                    self._blocks.append(BLOCK_SNOW)
-                elif c == RGB_WIND:
-                    self._wind = 1
-                    self._blocks.append(BLOCK_EMPTY)
-                elif c == RGB_SAND:
-                    self._blocks.append(BLOCK_SAND)
-                elif c == RGB_NOWIND:
-                    self._blocks.append(BLOCK_NOWIND)
-                elif c == RGB_WATER:
-                    self._blocks.append(BLOCK_WATER)
-                elif c == RGB_QUARK:
-                    self._blocks.append(BLOCK_QUARK)
-                else:
-                    print("Error: unknown block with color [{}, {}, {}]".format(c.r, c.g, c.b))
+    def __init__(self, blocks, wind, teleport):
+        self._blocks = blocks
+        self._wind = wind
+        self._teleport = teleport
+
+    def teleport(self):
+        return self._teleport
+
+    def empty(self):
+        return bool(np.all(self._blocks == BLOCK_EMPTY)) and self._teleport == 255 and self._wind == 0
 
     def to_bytearray(self):
-        arr = []
-        byte1 = 0xBE
-        byte2 = 0xBA
-        byte3 = self._wind
-        byte4 = self._teleport
-        arr.append(byte1)
-        arr.append(byte2)
-        arr.append(byte3)
-        arr.append(byte4)
-        arr.extend(self._blocks)
-        return bytearray(arr)
+        # Two blocks to a byte, the one of the even column in the low nibble.
+        blocks = self._blocks.astype(np.uint8).reshape(-1, 2)
+        return bytearray([self._wind, self._teleport]) + (blocks[:, 0] | blocks[:, 1] << 4).tobytes()
+
+def color_keys(rgba):
+    rgba = rgba.astype(np.uint32)
+    return rgba[..., 0] | rgba[..., 1] << 8 | rgba[..., 2] << 16 | rgba[..., 3] << 24
+
+def color_key(color):
+    return color.r | color.g << 8 | color.b << 16 | color.a << 24
+
+BLOCK_COLORS = [
+    (RGBA_EMPTY, BLOCK_EMPTY),
+    (RGB_SOLID, BLOCK_SOLID),
+    (RGB_FAKE, BLOCK_FAKE),
+    (RGB_ICE, BLOCK_ICE),
+    (RGB_SNOW, BLOCK_SNOW),
+    (RGB_WIND, BLOCK_EMPTY),
+    (RGB_SAND, BLOCK_SAND),
+    (RGB_NOWIND, BLOCK_NOWIND),
+    (RGB_WATER, BLOCK_WATER),
+    (RGB_QUARK, BLOCK_QUARK),
+]
+EDGE_COLORS = [RGB_SOLID, RGB_SLOPE, RGB_ICE, RGB_SNOW, RGB_SAND, RGB_FAKE]
+
+def read_blocks(rgba):
+    # Works out the block of every pixel of the image at once.
+    # Returns the blocks, and where the wind and the teleport links are.
+    keys = color_keys(rgba)
+    blocks = np.full(keys.shape, -1, dtype=np.int16)
+    for color, block in BLOCK_COLORS:
+        blocks[keys == color_key(color)] = block
+    teleports = (rgba[..., 1] == 0) & (rgba[..., 2] == 255)
+    blocks[teleports] = BLOCK_EMPTY
+    wind = keys == color_key(RGB_WIND)
+
+    # A slope's kind depends on which of its neighbours are edges.
+    edges = np.isin(keys, [color_key(color) for color in EDGE_COLORS])
+    def is_edge(dx, dy):
+        ys, xs = np.indices(keys.shape)
+        xs += dx
+        ys += dy
+        # NOTE: The bounds are those of a screen, but the coordinates
+        #       are in the whole image, so anything beyond the first
+        #       screen counts as out of bounds. This is what the old
+        #       per pixel code did, and the output is kept the same.
+        outside = (xs < 0) | (ys < 0) | (xs >= TILE_WIDTH) | (ys >= TILE_HEIGHT)
+        inside_edges = edges[np.clip(ys, 0, keys.shape[0] - 1), np.clip(xs, 0, keys.shape[1] - 1)]
+        return outside | inside_edges
+    right, left, below, above = is_edge(1, 0), is_edge(-1, 0), is_edge(0, 1), is_edge(0, -1)
+    kinds = np.select(
+        [right & below, left & below, right & above, left & above],
+        [BLOCK_SLOPE_TL, BLOCK_SLOPE_TR, BLOCK_SLOPE_BL, BLOCK_SLOPE_BR],
+        default=-1
+    )
+    slopes = (keys == color_key(RGB_SLOPE)) & ~teleports
+    blocks[slopes] = kinds[slopes]
+
+    unknown = np.argwhere(slopes & (blocks < 0))
+    if len(unknown) > 0:
+        print("Error: unknown slope type at {}:{}".format(unknown[0][1], unknown[0][0]))
+        exit(-1)
+    unknown = np.argwhere(blocks < 0)
+    if len(unknown) > 0:
+        c = Color(rgba[unknown[0][0]][unknown[0][1]])
+        print("Error: unknown block with color [{}, {}, {}]".format(c.r, c.g, c.b))
+        exit(-1)
+    return blocks, wind, teleports
+
+def read_screen(rgba, blocks, wind, teleports, mx, my):
+    tile = (slice(my, my + TILE_HEIGHT), slice(mx, mx + TILE_WIDTH))
+    # The last teleport link of the screen wins.
+    links = np.flatnonzero(teleports[tile])
+    teleport = int(rgba[tile][..., 0].flatten()[links[-1]]) if len(links) > 0 else 255
+    return Screen(blocks[tile], 1 if np.any(wind[tile]) else 0, teleport)
+
+def fnv1a(data):
+    hash = 0x811C9DC5
+    for byte in data:
+        hash = ((hash ^ byte) * 0x01000193) & 0xFFFFFFFF
+    return hash
+
+def file_header(magic, version, entries, body):
+    return magic + struct.pack("<HHII", version, entries, len(body), fnv1a(body))
+
+def level_file(screens):
+    # The screen table, followed by the screens.
+    body = bytearray()
+    offset = LEVEL_FILE_HEADER_SIZE + 4 * len(screens)
+    for screen in screens:
+        body += struct.pack("<I", offset)
+        offset += len(screen)
+    for screen in screens:
+        body += screen
+    return file_header(LEVEL_FILE_MAGIC, LEVEL_FILE_VERSION, len(screens), body) + body
+
+def map_table(maps):
+    body = bytearray()
+    for first, count in maps:
+        body += struct.pack("<HH", first, count)
+    return file_header(LEVEL_MAPS_MAGIC, LEVEL_MAPS_VERSION, len(maps), body) + body
+
+def split_maps(screens):
+    # Returns the first screen and the number of screens of each map.
+    starts = {0}
+    if len(screens) > MAIN_MAP_SCREENS:
+        starts.add(MAIN_MAP_SCREENS)
+    for screen in screens[:MAIN_MAP_SCREENS]:
+        if MAIN_MAP_SCREENS < screen.teleport() < len(screens):
+            starts.add(screen.teleport())
+    starts = sorted(starts)
+    ends = starts[1:] + [len(screens)]
+    return [(first, end - first) for first, end in zip(starts, ends)]
 
 def is_block_solid(block):
     return not (block == BLOCK_EMPTY or block == BLOCK_FAKE or block == BLOCK_NOWIND or block == BLOCK_QUARK or block == BLOCK_WATER)
@@ -130,17 +209,6 @@ def is_block_solid(block):
 def is_block_slope(block):
     return (block == BLOCK_SLOPE_TL or block == BLOCK_SLOPE_BL or block == BLOCK_SLOPE_TR or block == BLOCK_SLOPE_BR)
 
-def is_block_edge(rgba, x, y):
-    if x >= TILE_WIDTH or y >= TILE_HEIGHT:
-        return True
-    elif x < 0 or y < 0:
-        return True
-    c = Color(rgba[y][x])
-    if c == RGB_SOLID or c == RGB_SLOPE or c == RGB_ICE or c == RGB_SNOW or c == RGB_SAND or c == RGB_FAKE:
-        return True
-    else:
-        return False
-
 if __name__ == "__main__":
     parser = argparse.ArgumentParser()
     parser.add_argument("-i", "--input", help="Input file", required=True)
@@ -155,22 +223,27 @@ if __name__ == "__main__":
     output_path = pathlib.Path(args["output"])
     if not output_path.exists():
         output_path.mkdir(parents=True)
-    output_file = output_path.joinpath("level.bin")
+    maps_path = output_path.joinpath("maps")
+    if not maps_path.exists():
+        maps_path.mkdir()
     
     rgba = iio.imread(input_file, mode="RGBA")
     width = rgba.shape[1]
     height = rgba.shape[0]
 
-    screens = 0
-    with open(output_file, "wb") as file:
-        for x in range(0, width, TILE_WIDTH):
-            for y in range(0, height, TILE_HEIGHT):
-                screen = Screen(rgba, x, y)
-                bytes_arr = screen.to_bytearray()
-                file.write(bytes_arr)
-                screens += 1
-                if screens == TOTAL_SCREENS:
-                    break
-            if screens == TOTAL_SCREENS:
-                break
-        file.flush()
+    blocks, wind, teleports = read_blocks(rgba)
+    screens = []
+    for x in range(0, width, TILE_WIDTH):
+        for y in range(0, height, TILE_HEIGHT):
+            screens.append(read_screen(rgba, blocks, wind, teleports, x, y))
+    # The image is padded with empty tiles after the last map.
+    while len(screens) > MAIN_MAP_SCREENS and screens[-1].empty():
+        screens.pop()
+
+    maps = split_maps(screens)
+    with open(output_path.joinpath("level.bin"), "wb") as file:
+        file.write(map_table(maps))
+    for index, (first, count) in enumerate(maps):
+        with open(maps_path.joinpath("{}.bin".format(index)), "wb") as file:
+            file.write(level_file([screen.to_bytearray() for screen in screens[first:first + count]]))
+        print("Map {}: screens {} to {}".format(index, first, first + count - 1))
@@ -0,0 +1,190 @@
+#!/usr/bin/python3
+
+import os
+import pathlib
+import argparse
+import concurrent.futures
+import imageio.v3 as iio
+import numpy as np
+import struct
+
+# See src/telemetry.h.
+TELEMETRY_MAGIC = b"JKTL"
+TELEMETRY_VERSION = 1
+HEADER_FORMAT = "<4sHHII"
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+EVENT_DTYPE = np.dtype([
+    ("frame", "<u4"),
+    ("type", "<u2"),
+    ("screen", "<u2"),
+    ("x", "<i2"),
+    ("y", "<i2"),
+    ("distance", "<u2"),
+    ("from", "<u2"),
+])
+EVENT_START = 0
+EVENT_SCREEN = 1
+EVENT_LAND = 2
+EVENT_STUN = 3
+EVENT_END = 4
+SESSION_EXTENSION = ".jkt"
+
+# See src/level.h.
+SCREEN_WIDTH = 480
+SCREEN_HEIGHT = 360
+BLOCK_SIZE = 8
+# The heatmaps are scaled up to this many pixels per cell.
+HEATMAP_SCALE = 4
+
+class TelemetryError(Exception):
+    pass
+
+class Totals:
+    # What the sessions add up to, per screen. Everything is
+    # indexed by screen, and grows to the highest one seen.
+
+    def __init__(self, cell):
+        self.cell = cell
+        self.rows = -(-SCREEN_HEIGHT // cell)
+        self.columns = -(-SCREEN_WIDTH // cell)
+        self.sessions = 0
+        self.frames_per_second = None
+        self.visits = np.zeros(0, dtype=np.int64)
+        self.frames = np.zeros(0, dtype=np.int64)
+        self.landings = np.zeros((0, self.rows, self.columns), dtype=np.int64)
+        self.falls = np.zeros((0, self.rows, self.columns), dtype=np.int64)
+        self.fall_distance = np.zeros(0, dtype=np.int64)
+        self.max_fall = np.zeros(0, dtype=np.int64)
+
+    def _grow(self, screens):
+        extra = screens - len(self.visits)
+        if extra <= 0:
+            return
+        self.visits = np.concatenate([self.visits, np.zeros(extra, dtype=np.int64)])
+        self.frames = np.concatenate([self.frames, np.zeros(extra, dtype=np.int64)])
+        cells = np.zeros((extra, self.rows, self.columns), dtype=np.int64)
+        self.landings = np.concatenate([self.landings, cells])
+        self.falls = np.concatenate([self.falls, cells])
+        self.fall_distance = np.concatenate([self.fall_distance, np.zeros(extra, dtype=np.int64)])
+        self.max_fall = np.concatenate([self.max_fall, np.zeros(extra, dtype=np.int64)])
+
+    def add(self, other):
+        self._grow(len(other.visits))
+        screens = len(other.visits)
+        self.sessions += other.sessions
+        if self.frames_per_second is None:
+            self.frames_per_second = other.frames_per_second
+        self.visits[:screens] += other.visits
+        self.frames[:screens] += other.frames
+        self.landings[:screens] += other.landings
+        self.falls[:screens] += other.falls
+        self.fall_distance[:screens] += other.fall_distance
+        self.max_fall[:screens] = np.maximum(self.max_fall[:screens], other.max_fall)
+
+    def heat(self, events, screens):
+        # Counts the events in each cell of each screen.
+        columns = np.clip(events["x"].astype(np.int64) // self.cell, 0, self.columns - 1)
+        rows = np.clip(events["y"].astype(np.int64) // self.cell, 0, self.rows - 1)
+        index = (events["screen"].astype(np.int64) * self.rows + rows) * self.columns + columns
+        counts = np.bincount(index, minlength=screens * self.rows * self.columns)
+        return counts.reshape(screens, self.rows, self.columns)
+
+def read_session(path, cell):
+    data = pathlib.Path(path).read_bytes()
+    if len(data) < HEADER_SIZE:
+        raise TelemetryError("{}: too short for a header.".format(path))
+    magic, version, event_size, frames_per_kilosecond, _ = struct.unpack_from(HEADER_FORMAT, data)
+    if magic != TELEMETRY_MAGIC or version != TELEMETRY_VERSION or event_size != EVENT_DTYPE.itemsize:
+        raise TelemetryError("{}: not a telemetry session of version {}.".format(path, TELEMETRY_VERSION))
+    # A session that wasn't ended cleanly may stop half way through an event.
+    count = (len(data) - HEADER_SIZE) // EVENT_DTYPE.itemsize
+    events = np.frombuffer(data, dtype=EVENT_DTYPE, count=count, offset=HEADER_SIZE)
+
+    totals = Totals(cell)
+    totals.sessions = 1
+    totals.frames_per_second = frames_per_kilosecond / 1000
+    if count == 0:
+        return totals
+    screens = int(events["screen"].max()) + 1
+    totals._grow(screens)
+
+    # The time on a screen goes from the event the player entered it
+    # with to the next such event. Rewinds can make it go backwards.
+    bounds = events[np.isin(events["type"], [EVENT_START, EVENT_SCREEN, EVENT_END])]
+    entries = bounds[bounds["type"] != EVENT_END]
+    totals.visits = np.bincount(entries["screen"], minlength=screens).astype(np.int64)
+    spans = np.diff(bounds["frame"].astype(np.int64))
+    spans = np.maximum(spans, 0)
+    totals.frames = np.bincount(bounds["screen"][:-1], weights=spans, minlength=screens).astype(np.int64)
+
+    landings = events[events["type"] == EVENT_LAND]
+    falls = events[events["type"] == EVENT_STUN]
+    totals.landings = totals.heat(landings, screens)
+    totals.falls = totals.heat(falls, screens)
+    totals.fall_distance = np.bincount(falls["screen"], weights=falls["distance"], minlength=screens).astype(np.int64)
+    np.maximum.at(totals.max_fall, falls["screen"].astype(np.int64), falls["distance"].astype(np.int64))
+    return totals
+
+def find_sessions(inputs):
+    sessions = []
+    for input in inputs:
+        path = pathlib.Path(input)
+        if path.is_dir():
+            sessions.extend(sorted(path.rglob("*" + SESSION_EXTENSION)))
+        elif path.exists():
+            sessions.append(path)
+        else:
+            raise TelemetryError("{} does not exist.".format(path))
+    return sessions
+
+def write_heatmap(path, counts):
+    # The busiest cell is white.
+    peak = counts.max()
+    image = np.zeros(counts.shape, dtype=np.uint8) if peak == 0 else (counts * 255 // peak).astype(np.uint8)
+    image = np.repeat(np.repeat(image, HEATMAP_SCALE, axis=0), HEATMAP_SCALE, axis=1)
+    iio.imwrite(path, image)
+
+def write_report(totals, output_folder):
+    output_folder.mkdir(parents=True, exist_ok=True)
+    frames_per_second = totals.frames_per_second or 60
+    with open(output_folder.joinpath("screens.csv"), "w") as report:
+        report.write("screen,visits,seconds,landings,falls,mean_fall,max_fall\n")
+        for screen in range(len(totals.visits)):
+            landings = int(totals.landings[screen].sum())
+            falls = int(totals.falls[screen].sum())
+            if totals.visits[screen] == 0 and landings == 0:
+                continue
+            mean_fall = totals.fall_distance[screen] / falls if falls > 0 else 0
+            report.write("{},{},{:.2f},{},{},{:.1f},{}\n".format(
+                screen, totals.visits[screen], totals.frames[screen] / frames_per_second,
+                landings, falls, mean_fall, totals.max_fall[screen]))
+            write_heatmap(output_folder.joinpath("{}_landings.png".format(screen)), totals.landings[screen])
+            write_heatmap(output_folder.joinpath("{}_falls.png".format(screen)), totals.falls[screen])
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-i", "--input", help="Session files, or folders to look for them in", nargs="+", required=True)
+    parser.add_argument("-o", "--output", help="Output folder", required=True)
+    parser.add_argument("-c", "--cell", help="Side of the heatmaps' cells, in pixels", type=int, default=BLOCK_SIZE)
+    parser.add_argument("-j", "--jobs", help="Number of processes to read the sessions with", type=int, default=os.cpu_count())
+    args = vars(parser.parse_args())
+
+    totals = Totals(args["cell"])
+    skipped = 0
+    try:
+        sessions = find_sessions(args["input"])
+        # Each session is read and added up in a process of its
+        # own, and the sums are added up here as they come in.
+        with concurrent.futures.ProcessPoolExecutor(max_workers=max(1, args["jobs"])) as executor:
+            pending = { executor.submit(read_session, path, args["cell"]): path for path in sessions }
+            for future in concurrent.futures.as_completed(pending):
+                try:
+                    totals.add(future.result())
+                except TelemetryError as e:
+                    print("Warning: skipping {}".format(e))
+                    skipped += 1
+    except TelemetryError as e:
+        print("Error: {}".format(e))
+        exit(-1)
+    write_report(totals, pathlib.Path(args["output"]))
+    print("{} sessions read, {} skipped.".format(totals.sessions, skipped))
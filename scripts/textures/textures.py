@@ -4,37 +4,179 @@ import os
 import pathlib
 import json
 import argparse
+import hashlib
+import concurrent.futures
 import imageio.v3 as iio
 import numpy as np
 import math
+import struct
 import qoi
 
+# Rows between the restart points of a row index (see src/qoi.h).
+DEFAULT_ROW_INDEX_ROWS = 16
+# Side of the atlas the game decodes the tiles of a tileset into
+# (see TILED_ATLAS_SIZE in src/tiledscreens.c).
+TILESET_ATLAS_SIZE = 512
+# Codecs the game can load textures with (see src/codec.h).
+CODECS = ["qoi", "lz4", "raw"]
+# How fast the game decodes each codec, in bytes of pixels per second,
+# and reads files, in bytes per second. These are rough guesses for the
+# PSP and its Memory Stick: measure the decoding speeds with texbench,
+# and pass them with --codec-costs.
+DEFAULT_DECODE_RATES = { "qoi": 20e6, "lz4": 120e6, "raw": 400e6 }
+DEFAULT_IO_BANDWIDTH = 4e6
+TEX_FLAG_SWIZZLED = 0x01
+# Where the hashes of the last build of each entry are kept, in the
+# output folder. Entries whose inputs, settings and outputs are
+# unchanged are skipped.
+BUILD_CACHE_NAME = ".texcache.json"
+# Tiles of a tileset are encoded in batches of this many, in parallel.
+TILESET_ENCODE_BATCH = 1024
+
+class BuildError(Exception):
+    pass
+
+def fail(message):
+    # Errors are raised, rather than exiting, so that they make
+    # it out of the worker processes.
+    raise BuildError(message)
+
 def swizzle(in_pixels, width, height):
+    # Cut the image in blocks of 16 bytes by 8 rows, and store
+    # each of them contiguously, like the Graphics Engine wants
+    # (see src/swizzle.h).
     bytes_width = width * 4
-    row_blocks = int(bytes_width / 16);
-    swizzled_pixels = [0 for _ in range(bytes_width * height)]
-    for j in range(height):
-        for i in range(bytes_width):
-            block_x = int(i / 16)
-            block_y = int(j / 8)
-            x = (i - block_x * 16)
-            y = (j - block_y * 8)
-            block_index = block_x + (block_y * row_blocks)
-            block_offset = block_index * 16 * 8;
-            swizzled_pixels[block_offset + x + y * 16] = in_pixels[i + j * bytes_width]
-    out_pixels = []
-    for j in range(height):
-        line = []
-        for i in range(width):
-            line_offset = j * bytes_width + i * 4
-            line.append([
-                swizzled_pixels[line_offset], 
-                swizzled_pixels[line_offset + 1], 
-                swizzled_pixels[line_offset + 2], 
-                swizzled_pixels[line_offset + 3]
-            ])
-        out_pixels.append(line)
-    return np.array(out_pixels, dtype=np.uint8)
+    if bytes_width % 16 != 0 or height % 8 != 0:
+        fail("a {}x{} image can't be swizzled.".format(width, height))
+    blocks = np.asarray(in_pixels, dtype=np.uint8).reshape(height // 8, 8, bytes_width // 16, 16)
+    return np.ascontiguousarray(blocks.transpose(0, 2, 1, 3)).reshape(height, width, 4)
+
+def qoi_row_index(data, rows_per_entry):
+    # Walk the chunks of an encoded QOI image like the decoder does,
+    # and save the decoder's state every rows_per_entry rows.
+    width, height = struct.unpack(">II", data[4:12])
+    p = 14
+    px = [0, 0, 0, 255]
+    index = [[0, 0, 0, 0] for _ in range(64)]
+    run = 0
+    chunks_len = len(data) - 8
+    entries = []
+    entry_pixels = width * rows_per_entry
+    total_pixels = width * height
+    px_pos = 0
+    while px_pos < total_pixels:
+        if px_pos % entry_pixels == 0:
+            entry = struct.pack("<I4BB3x", p, *px, run)
+            entry += bytes(channel for color in index for channel in color)
+            entries.append(entry)
+        if run > 0:
+            # Go through the run up to the next entry in one step.
+            skip = min(run, entry_pixels - px_pos % entry_pixels)
+            run -= skip
+            px_pos += skip
+            continue
+        px_pos += 1
+        if p >= chunks_len:
+            continue
+        b1 = data[p]
+        p += 1
+        if b1 == 0xfe:
+            px[0:3] = data[p:p + 3]
+            p += 3
+        elif b1 == 0xff:
+            px[0:4] = data[p:p + 4]
+            p += 4
+        elif (b1 & 0xc0) == 0x00:
+            px = list(index[b1])
+        elif (b1 & 0xc0) == 0x40:
+            px[0] = (px[0] + ((b1 >> 4) & 0x03) - 2) & 0xff
+            px[1] = (px[1] + ((b1 >> 2) & 0x03) - 2) & 0xff
+            px[2] = (px[2] + (b1 & 0x03) - 2) & 0xff
+        elif (b1 & 0xc0) == 0x80:
+            b2 = data[p]
+            p += 1
+            vg = (b1 & 0x3f) - 32
+            px[0] = (px[0] + vg - 8 + ((b2 >> 4) & 0x0f)) & 0xff
+            px[1] = (px[1] + vg) & 0xff
+            px[2] = (px[2] + vg - 8 + (b2 & 0x0f)) & 0xff
+        else:
+            run = b1 & 0x3f
+        index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64] = list(px)
+    header = b"qoir" + struct.pack("<HHI", rows_per_entry, len(entries), width)
+    return header + b"".join(entries)
+
+def next_power_of_two(value):
+    return 1 << max(0, math.ceil(math.log2(value)))
+
+def tex_container(magic, payload, width, height, pitch, swizzled, pixel_bytes):
+    # See the .tex header in src/codec.h.
+    flags = TEX_FLAG_SWIZZLED if swizzled else 0
+    return magic + struct.pack("<HHHBBI", width, height, pitch, 4, flags, pixel_bytes) + payload
+
+class TextureWriter:
+    # Stores each texture with the codec that gets it onscreen the
+    # soonest, counting both the time to read the file and the time
+    # to decode it.
+    def __init__(self, io_bandwidth, decode_rates, keep_candidates):
+        self._io_bandwidth = io_bandwidth
+        self._decode_rates = decode_rates
+        self._keep_candidates = keep_candidates
+
+    def time_to_texture(self, codec, file_size, pixel_bytes):
+        return file_size / self._io_bandwidth + pixel_bytes / self._decode_rates[codec]
+
+    def write(self, output_path, rgba, pitch, should_swizzle, codec, row_index_rows):
+        height, width = rgba.shape[0], rgba.shape[1]
+        # Raw and LZ4 textures are stored with the pitch the game
+        # decodes them into, so they can go straight there, and
+        # swizzled if the game wants them so. QOI images can't be
+        # padded, so the game swizzles those itself if they aren't.
+        padded = np.zeros((height, pitch, 4), dtype=np.uint8)
+        padded[:, :width] = rgba
+        if should_swizzle:
+            if height % 8 != 0 or (pitch * 4) % 16 != 0:
+                fail("texture '{}' can't be swizzled.".format(output_path.stem))
+            padded = swizzle(padded.flatten(), pitch, height)
+        pixel_bytes = padded.nbytes
+        candidates = {}
+        for candidate in (CODECS if codec == "auto" else [codec]):
+            if candidate == "qoi":
+                candidates["qoi"] = qoi.encode(np.ascontiguousarray(padded if pitch == width else rgba))
+            elif candidate == "lz4":
+                import lz4.block
+                payload = lz4.block.compress(padded.tobytes(), store_size=False)
+                candidates["lz4"] = tex_container(b"TEXL", payload, width, height, pitch, should_swizzle, pixel_bytes)
+            elif candidate == "raw":
+                candidates["raw"] = tex_container(b"TEXR", padded.tobytes(), width, height, pitch, should_swizzle, pixel_bytes)
+            else:
+                fail("unknown codec '{}' for texture '{}'.".format(candidate, output_path.stem))
+        times = { name: self.time_to_texture(name, len(data), pixel_bytes) for name, data in candidates.items() }
+        chosen = min(times, key=times.get)
+        outputs = [output_path]
+        with open(output_path, "wb") as texture_file:
+            texture_file.write(candidates[chosen])
+        if chosen == "qoi" and row_index_rows > 0:
+            outputs.append(write_row_index(output_path, row_index_rows))
+        # Every candidate can be kept too, for texbench to measure.
+        if self._keep_candidates:
+            for name, data in candidates.items():
+                candidate_path = output_path.with_suffix(".{}.tex".format(name))
+                with open(candidate_path, "wb") as candidate_file:
+                    candidate_file.write(data)
+                outputs.append(candidate_path)
+                if name == "qoi" and row_index_rows > 0:
+                    outputs.append(write_row_index(candidate_path, row_index_rows))
+        estimates = ", ".join("{} {:.1f} ms ({} bytes)".format(name, times[name] * 1000, len(candidates[name])) for name in candidates)
+        print("Texture '{}': {} ({}).".format(output_path.stem, chosen, estimates))
+        return outputs
+
+def write_row_index(qoi_path, rows_per_entry):
+    with open(qoi_path, "rb") as qoi_file:
+        data = qoi_file.read()
+    index_path = qoi_path.with_suffix(".qri")
+    with open(index_path, "wb") as index_file:
+        index_file.write(qoi_row_index(data, rows_per_entry))
+    return index_path
 
 class Vector2:
     def __init__(self, x, y):
@@ -43,12 +185,9 @@ class Vector2:
 
 class Tile:
     def __init__(self, image, offset, size, vpad, hpad):
-        self._pixels = []
-        for y in range(size.y):
-            self._pixels.append([])
-            for x in range(size.x):
-                self._pixels[y].append([])
-                self._pixels[y][x] = image[offset.y + y][offset.x + x]
+        self._pixels = np.array(image[offset.y:offset.y + size.y, offset.x:offset.x + size.x], dtype=np.uint8)
+        if self._pixels.shape[:2] != (size.y, size.x):
+            fail("tile at {}:{} is out of the image.".format(offset.x, offset.y))
         self._size = Vector2(size.x, size.y)
         self._hpad = hpad
         self._vpad = vpad
@@ -69,65 +208,40 @@ class Tile:
             self._shrink_vertically(-vertical_delta)
         self._size.y = new_size.y
 
+    # With "center", each side gets (or loses) half of the delta.
+    def _sides(self, delta, padding, first, last):
+        if padding == "center":
+            delta = round(delta / 2)
+        before = delta if padding == first or padding == "center" else 0
+        after = delta if padding == last or padding == "center" else 0
+        return before, after
+
     def _grow_horizontally(self, horizontal_delta):
-        if self._hpad == "center":
-            horizontal_delta = round(horizontal_delta / 2)
-        if self._hpad == "left" or self._hpad == "center":
-            self._pixels = np.insert(self._pixels, [0 for _ in range(horizontal_delta)], [0, 0, 0, 0], axis=1)
-        if self._hpad == "right" or self._hpad == "center":
-            self._pixels = np.append(self._pixels, [[[0, 0, 0, 0] for _ in range(horizontal_delta)] for _ in range(self._size.y)], axis=1)
-    
+        left, right = self._sides(horizontal_delta, self._hpad, "left", "right")
+        self._pixels = np.pad(self._pixels, ((0, 0), (left, right), (0, 0)))
+
     def _shrink_horizontally(self, horizontal_delta):
-        if self._hpad == "center":
-            horizontal_delta = round(horizontal_delta / 2)
-        if self._hpad == "left" or self._hpad == "center":
-            for _ in range(horizontal_delta):
-                self._pixels = np.delete(self._pixels, 0, axis=1)
-        if self._hpad == "right" or self._hpad == "center":
-            for _ in range(horizontal_delta):
-                self._pixels = np.delete(self._pixels, self._pixels.shape[1] - 1, axis=1)
-    
+        left, right = self._sides(horizontal_delta, self._hpad, "left", "right")
+        self._pixels = self._pixels[:, left:self._pixels.shape[1] - right]
+
     def _grow_vertically(self, vertical_delta):
-        if self._vpad == "center":
-            vertical_delta = round(vertical_delta / 2)
-        if self._vpad == "top" or self._vpad == "center":
-            self._pixels = np.insert(self._pixels, [0 for _ in range(vertical_delta)], [[0, 0, 0, 0] for _ in range(self._size.x)], axis=0)
-        if self._vpad == "bottom" or self._vpad == "center":
-            self._pixels = np.append(self._pixels, [[[0, 0, 0, 0] for _ in range(self._size.x)] for _ in range(vertical_delta)], axis=0)
+        top, bottom = self._sides(vertical_delta, self._vpad, "top", "bottom")
+        self._pixels = np.pad(self._pixels, ((top, bottom), (0, 0), (0, 0)))
 
     def _shrink_vertically(self, vertical_delta):
-        if self._vpad == "center":
-            vertical_delta = round(vertical_delta / 2)
-        if self._vpad == "top" or self._vpad == "center":
-            for _ in range(vertical_delta):
-                self._pixels = np.delete(self._pixels, 0, axis=0)
-        if self._vpad == "bottom" or self._vpad == "center":
-            for _ in range(vertical_delta):
-                self._pixels = np.delete(self._pixels, self._pixels.shape[0] - 1, axis=0)
-    
+        top, bottom = self._sides(vertical_delta, self._vpad, "top", "bottom")
+        self._pixels = self._pixels[top:self._pixels.shape[0] - bottom]
+
+    # The box is one pixel wider than the opaque pixels on each side,
+    # where there's room for it.
     def get_bounding_box(self):
-        top_left = Vector2(0, 0)
-        bottom_right = Vector2(self._size.x, self._size.y)
-        left_boundary_found = False
-        right_boundary_found = False
-        for x in range(self._size.x):
-            for y in range(self._size.y):
-                left_boundary_found = left_boundary_found or self._pixels[y][x][3] > 0
-                right_boundary_found = right_boundary_found or self._pixels[y][(self._size.x - 1) - x][3] > 0
-            if not left_boundary_found:
-                top_left.x = x
-            if not right_boundary_found:
-                bottom_right.x = self._size.x - x
-        top_boundary_found = False
-        bottom_boundary_found = False
-        for y in range(self._size.y):
-            for x in range(self._size.x):
-                top_boundary_found = top_boundary_found or self._pixels[y][x][3] > 0
-                bottom_boundary_found = bottom_boundary_found or self._pixels[(self._size.y - 1) - y][x][3] > 0
-            if not top_boundary_found:
-                top_left.y = y
-            if not bottom_boundary_found:
-                bottom_right.y = self._size.y - y
+        opaque = self._pixels[:, :, 3] > 0
+        columns = np.flatnonzero(opaque.any(axis=0))
+        rows = np.flatnonzero(opaque.any(axis=1))
+        if len(columns) == 0:
+            return Vector2(self._size.x - 1, self._size.y - 1), Vector2(1, 1)
+        top_left = Vector2(max(int(columns[0]) - 1, 0), max(int(rows[0]) - 1, 0))
+        bottom_right = Vector2(min(int(columns[-1]) + 2, self._size.x), min(int(rows[-1]) + 2, self._size.y))
         return top_left, bottom_right
 
     def get_pixels(self):
@@ -142,26 +256,30 @@ class Tilemap:
         self._total_tiles = json_data["totalTiles"]
         self._vertical_padding = json_data["vpad"]
         self._horizontal_padding = json_data["hpad"]
+        # Tilemaps are padded to a power of two in each direction.
+        # Textures keep their size, and the game decodes them into
+        # buffers with a power of two pitch (see TextureWriter).
+        self._pad = json_data.get("pad", True)
     
-    def _generate_image(self, tiles, top_left, bottom_right, output_folder, should_swizzle):
-        pixels = []
-        new_size = Vector2(bottom_right.x - top_left.x - 1, bottom_right.y - top_left.y - 1)
-        width2 = math.log2(new_size.x)
-        height2 = math.log2(new_size.y)
-        if width2 - int(width2) > 0:
-            new_size.x = int(pow(2, math.ceil(width2)))
-        if height2 - int(height2) > 0:
-            new_size.y = int(pow(2, math.ceil(height2)))
+    def _generate_image(self, tiles, top_left, bottom_right, output_folder, should_swizzle, row_index_rows, codec, writer):
+        if self._pad:
+            new_size = Vector2(bottom_right.x - top_left.x - 1, bottom_right.y - top_left.y - 1)
+            width2 = math.log2(new_size.x)
+            height2 = math.log2(new_size.y)
+            if width2 - int(width2) > 0:
+                new_size.x = int(pow(2, math.ceil(width2)))
+            if height2 - int(height2) > 0:
+                new_size.y = int(pow(2, math.ceil(height2)))
+        else:
+            new_size = Vector2(self._tile_size.x, self._tile_size.y)
         for tile in tiles:
             tile.crop_to(new_size)
-            pixels.extend(tile.get_pixels())
-        output_path = output_folder.joinpath(self._name + ".qoi")
-        rgba = np.array(pixels, dtype=np.uint8)
-        if should_swizzle == True:
-            rgba = swizzle(rgba.flatten(), new_size.x, new_size.y)
-        qoi.write(output_path, rgba)
-
-    def extract(self, image, output_folder, should_swizzle):
+        output_path = output_folder.joinpath(self._name + ".tex")
+        rgba = np.concatenate([tile.get_pixels() for tile in tiles], axis=0)
+        pitch = new_size.x if self._pad else next_power_of_two(new_size.x)
+        return writer.write(output_path, rgba, pitch, should_swizzle, codec, row_index_rows)
+
+    def extract(self, image, output_folder, should_swizzle, row_index_rows, codec, writer):
         tilestrip_images = []
         tiles_read = 0
         top_left = Vector2(self._tile_size.x, self._tile_size.y)
@@ -178,19 +296,23 @@ class Tilemap:
                 tilestrip_images.append(tile)
                 tiles_read += 1
                 if tiles_read == self._total_tiles:
-                    return self._generate_image(tilestrip_images, top_left, bottom_right, output_folder, should_swizzle)
+                    return self._generate_image(tilestrip_images, top_left, bottom_right, output_folder, should_swizzle, row_index_rows, codec, writer)
 
 class TextureFile:
     def __init__(self, json_data, input_folder):
         self._file = json_data["file"]
-        self._swizzle = True
-        if json_data.get("swizzle") is not None:
-            self._swizzle = json_data["swizzle"]
+        self._swizzle = json_data.get("swizzle", True)
+        self._codec = json_data.get("codec", "auto")
         self._path = pathlib.Path(input_folder).joinpath(self._file)
         self._tilemaps = []
+        # Single textures (the screens) get a row index by default,
+        # so that the game can decode them a few rows at a time.
+        self._row_index_rows = DEFAULT_ROW_INDEX_ROWS if json_data.get("texture") is not None else 0
+        if json_data.get("rowIndex") is not None:
+            self._row_index_rows = json_data["rowIndex"]
         if json_data.get("texture") is not None:
             texture_data = json_data["texture"]
-            tilemap = { "name": texture_data["name"], "offset": [0, 0], "tileSize": texture_data["size"], "sizeInTiles": [1, 1], "totalTiles": 1, "vpad": "bottom", "hpad": "right" }
+            tilemap = { "name": texture_data["name"], "offset": [0, 0], "tileSize": texture_data["size"], "sizeInTiles": [1, 1], "totalTiles": 1, "vpad": "bottom", "hpad": "right", "pad": False }
             self._tilemaps.append(Tilemap(tilemap))
             self._is_texture = True
         else:
@@ -198,7 +320,10 @@ class TextureFile:
                 self._tilemaps.append(Tilemap(tilemap)) 
             self._is_texture = False
     
-    def extract_all(self, output_path):
+    def inputs(self):
+        return [self._path]
+
+    def extract_all(self, output_path, writer):
         image = iio.imread(self._path, mode="RGBA")
         output_folder = pathlib.Path(output_path)
         if not self._is_texture:
@@ -208,16 +333,138 @@ class TextureFile:
         output_folder = output_folder.joinpath(relative_output)
         if not output_folder.exists():
             output_folder.mkdir(parents=True, exist_ok=True)
+        outputs = []
         for tilemap in self._tilemaps:
-            tilemap.extract(image, output_folder, self._swizzle)
+            outputs.extend(tilemap.extract(image, output_folder, self._swizzle, self._row_index_rows, self._codec, writer))
+        return outputs
+
+class Tileset:
+    # Cuts a set of images of the same size in tiles, and keeps only
+    # one copy of each tile. The tiles go in a store, each as a small
+    # QOI image found through a table of offsets, and each image
+    # becomes a map of the tiles it's made of.
+    def __init__(self, json_data, input_folder):
+        self._name = json_data["name"]
+        self._maps_name = json_data["maps"]
+        self._output = json_data["output"]
+        self._paths = [pathlib.Path(input_folder).joinpath(json_data["files"].format(i + 1)) for i in range(json_data["count"])]
+        self._size = Vector2(json_data["size"][0], json_data["size"][1])
+        self._tile_size = Vector2(json_data["tileSize"][0], json_data["tileSize"][1])
+
+    def inputs(self):
+        return self._paths
+
+    def extract_all(self, output_path, executor):
+        columns = math.ceil(self._size.x / self._tile_size.x)
+        rows = math.ceil(self._size.y / self._tile_size.y)
+        slots = (TILESET_ATLAS_SIZE // self._tile_size.x) * (TILESET_ATLAS_SIZE // self._tile_size.y)
+        tile_ids = {}
+        unique_tiles = []
+        maps = []
+        for path in self._paths:
+            image = iio.imread(path, mode="RGBA")[:self._size.y, :self._size.x]
+            # The last row and column of tiles may stick out of the image.
+            padded = np.zeros((rows * self._tile_size.y, columns * self._tile_size.x, 4), dtype=np.uint8)
+            padded[:image.shape[0], :image.shape[1]] = image
+            # Cut the image in tiles, in one go.
+            image_tiles = np.ascontiguousarray(padded.reshape(rows, self._tile_size.y, columns, self._tile_size.x, 4).transpose(0, 2, 1, 3, 4))
+            screen_tiles = set()
+            for tile in image_tiles.reshape(rows * columns, self._tile_size.y, self._tile_size.x, 4):
+                key = tile.tobytes()
+                tile_id = tile_ids.get(key)
+                if tile_id is None:
+                    tile_id = len(unique_tiles)
+                    tile_ids[key] = tile_id
+                    unique_tiles.append(tile)
+                maps.append(tile_id)
+                screen_tiles.add(tile_id)
+            # The game needs all the tiles of a screen in the atlas at once.
+            if len(screen_tiles) > slots:
+                fail("'{}' has {} different tiles, but the atlas only holds {}.".format(path, len(screen_tiles), slots))
+        if len(unique_tiles) > 0xFFFF:
+            fail("tileset '{}' has too many tiles ({}).".format(self._name, len(unique_tiles)))
+        batches = [unique_tiles[i:i + TILESET_ENCODE_BATCH] for i in range(0, len(unique_tiles), TILESET_ENCODE_BATCH)]
+        tiles = [tile for batch in executor.map(encode_tiles, batches) for tile in batch]
+
+        output_folder = pathlib.Path(output_path).joinpath(self._output)
+        output_folder.mkdir(parents=True, exist_ok=True)
+        offset = 12 + 4 * (len(tiles) + 1)
+        offsets = []
+        for tile in tiles:
+            offsets.append(offset)
+            offset += len(tile)
+        offsets.append(offset)
+        store_path = output_folder.joinpath(self._name + ".bin")
+        maps_path = output_folder.joinpath(self._maps_name + ".bin")
+        with open(store_path, "wb") as store_file:
+            store_file.write(b"TILS" + struct.pack("<HHI", self._tile_size.x, self._tile_size.y, len(tiles)))
+            store_file.write(struct.pack("<{}I".format(len(offsets)), *offsets))
+            for tile in tiles:
+                store_file.write(tile)
+        with open(maps_path, "wb") as maps_file:
+            maps_file.write(b"TMAP" + struct.pack("<HHI", columns, rows, len(self._paths)))
+            maps_file.write(struct.pack("<{}H".format(len(maps)), *maps))
+        print("Tileset '{}': {} tiles, {} of them unique ({} bytes).".format(self._name, len(maps), len(tiles), offset))
+        return [store_path, maps_path]
+
+def encode_tiles(tiles):
+    return [qoi.encode(tile) for tile in tiles]
+
+class BuildCache:
+    # Remembers a hash of everything that goes into each entry of the
+    # descriptor: the entry itself, the settings, this script and the
+    # contents of the input files.
+    def __init__(self, output_folder, settings, force):
+        self._path = pathlib.Path(output_folder).joinpath(BUILD_CACHE_NAME)
+        self._entries = {}
+        if self._path.exists() and not force:
+            with open(self._path) as cache_file:
+                self._entries = json.load(cache_file)
+        self._output_folder = pathlib.Path(output_folder)
+        with open(__file__, "rb") as script_file:
+            self._base = hashlib.sha256(script_file.read() + json.dumps(settings, sort_keys=True).encode()).hexdigest()
+
+    def hash(self, key, inputs):
+        digest = hashlib.sha256((self._base + key).encode())
+        for path in inputs:
+            with open(path, "rb") as input_file:
+                digest.update(hashlib.sha256(input_file.read()).digest())
+        return digest.hexdigest()
+
+    def is_fresh(self, key, digest):
+        entry = self._entries.get(key)
+        return entry is not None and entry["hash"] == digest and all(self._output_folder.joinpath(path).exists() for path in entry["outputs"])
+
+    def update(self, key, digest, outputs):
+        self._entries[key] = { "hash": digest, "outputs": [str(pathlib.Path(path).relative_to(self._output_folder)) for path in outputs] }
+
+    def save(self, keys):
+        # Entries that are no longer in the descriptor are forgotten.
+        entries = { key: self._entries[key] for key in keys if key in self._entries }
+        with open(self._path, "w") as cache_file:
+            json.dump(entries, cache_file, indent=1, sort_keys=True)
+
+def extract_texture_file(file, input_folder, output_folder, writer):
+    return TextureFile(file, input_folder).extract_all(output_folder, writer)
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser()
     parser.add_argument("-i", "--input", help="Input folder", required=True)
     parser.add_argument("-o", "--output", help="Output folder", required=True)
     parser.add_argument("-d", "--descriptor", help="Atlas descriptor file", required=True)
+    parser.add_argument("-b", "--io-bandwidth", help="Bytes per second the game reads files at", type=float, default=DEFAULT_IO_BANDWIDTH)
+    parser.add_argument("-c", "--codec-costs", help="Decoding speeds of the codecs, as written by texbench -c")
+    parser.add_argument("-k", "--keep-candidates", help="Also write the texture with every codec, as <name>.<codec>.tex", action="store_true")
+    parser.add_argument("-j", "--jobs", help="Number of processes to build with", type=int, default=os.cpu_count())
+    parser.add_argument("-f", "--force", help="Rebuild everything, even what hasn't changed", action="store_true")
     args = vars(parser.parse_args())
 
+    decode_rates = dict(DEFAULT_DECODE_RATES)
+    if args["codec_costs"] is not None:
+        with open(args["codec_costs"]) as costs_file:
+            decode_rates.update(json.load(costs_file))
+    writer = TextureWriter(args["io_bandwidth"], decode_rates, args["keep_candidates"])
+
     descriptor_path = args["descriptor"]
     input_folder = args["input"]
     output_folder = args["output"]
@@ -233,10 +480,47 @@ if __name__ == "__main__":
         print("Error: failed to read descriptor file: {}.".format(str(e)))
         exit(-1)
 
-    for file in json_data:
-        texture_path = pathlib.Path(input_folder).joinpath(file["file"])
-        if not texture_path.exists():
-            print("Error: file '{}' does not exist.".format(texture_path))
-            exit(-1)
-        texture_file = TextureFile(file, input_folder)
-        texture_file.extract_all(output_folder)
+    pathlib.Path(output_folder).mkdir(parents=True, exist_ok=True)
+    settings = { "io_bandwidth": args["io_bandwidth"], "decode_rates": decode_rates, "keep_candidates": args["keep_candidates"] }
+    cache = BuildCache(output_folder, settings, args["force"])
+    keys = []
+    skipped = 0
+    try:
+        with concurrent.futures.ProcessPoolExecutor(max_workers=max(1, args["jobs"])) as executor:
+            # The textures are built in parallel, each in a process
+            # of its own. Tilesets are built here, and encode their
+            # tiles in parallel.
+            pending = {}
+            tilesets = []
+            for file in json_data:
+                # Entries listed twice are only built once.
+                key = json.dumps(file, sort_keys=True)
+                if key in keys:
+                    continue
+                keys.append(key)
+                if file.get("tileset") is not None:
+                    entry = Tileset(file["tileset"], input_folder)
+                else:
+                    entry = TextureFile(file, input_folder)
+                for path in entry.inputs():
+                    if not path.exists():
+                        fail("file '{}' does not exist.".format(path))
+                digest = cache.hash(key, entry.inputs())
+                if cache.is_fresh(key, digest):
+                    skipped += 1
+                elif file.get("tileset") is not None:
+                    tilesets.append((key, digest, entry))
+                else:
+                    pending[executor.submit(extract_texture_file, file, input_folder, output_folder, writer)] = (key, digest)
+            for key, digest, tileset in tilesets:
+                cache.update(key, digest, tileset.extract_all(output_folder, executor))
+            for future in concurrent.futures.as_completed(pending):
+                key, digest = pending[future]
+                cache.update(key, digest, future.result())
+    except BuildError as e:
+        print("Error: {}".format(e))
+        exit(-1)
+    finally:
+        cache.save(keys)
+    if skipped > 0:
+        print("{} of {} entries are up to date.".format(skipped, len(keys)))
@@ -1,5 +1,49 @@
 #include "alloc.h"
+#include "panic.h"
+#include <pspkernel.h>
 #include <pspgu.h>
+#include <malloc.h>
+#include <stdio.h>
+
+// Heap blocks start with a header, right before what's handed out,
+// which tells what to count them as when they're freed.
+#define MEMORY_HEADER_SIZE 16
+#define MEMORY_MAGIC 0x4D454D4A
+// There are only a few of these, so they're kept in small tables.
+#define MEMORY_MAX_VRAM_BLOCKS 32
+#define MEMORY_MAX_STATIC_POOLS 16
+
+typedef struct {
+    unsigned int size;
+    unsigned short category;
+    // how far the header is from the start of the block
+    unsigned short offset;
+    unsigned int magic;
+    unsigned int reserved;
+} MemoryHeader;
+
+typedef struct {
+    const void *ptr;
+    unsigned int size;
+    MemoryCategory category;
+} MemoryBlock;
+
+static const char *const categoryNames[MEMORY_CATEGORIES] = {
+    "files",
+    "textures",
+    "level",
+    "display",
+    "sprites",
+    "audio",
+    "replay",
+    "telemetry",
+    "arenas",
+};
+
+static MemoryUsage usage[MEMORY_POOLS][MEMORY_CATEGORIES];
+static MemoryUsage totals[MEMORY_POOLS];
+static MemoryBlock vramBlocks[MEMORY_MAX_VRAM_BLOCKS];
+static MemoryBlock staticPools[MEMORY_MAX_STATIC_POOLS];
 
 unsigned int getVramMemorySize(unsigned int width, unsigned int height, unsigned int psm) {
     switch (psm) {
@@ -19,3 +63,159 @@ unsigned int getVramMemorySize(unsigned int width, unsigned int height, unsigned
             return 0;
     }
 }
+
+static void addUsage(MemoryUsage *u, int bytes, int blocks) {
+    unsigned int current = __atomic_add_fetch(&u->current, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&u->count, blocks, __ATOMIC_RELAXED);
+    // Racing threads may miss a peak by an allocation, which is fine.
+    if (current > __atomic_load_n(&u->peak, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&u->peak, current, __ATOMIC_RELAXED);
+    }
+}
+
+static void countMemory(MemoryPool pool, MemoryCategory category, int bytes, int blocks) {
+    addUsage(&usage[pool][category], bytes, blocks);
+    addUsage(&totals[pool], bytes, blocks);
+}
+
+void *memAlloc(MemoryCategory category, unsigned int size) {
+    return memAlign(category, MEMORY_HEADER_SIZE, size);
+}
+
+void *memAlign(MemoryCategory category, unsigned int alignment, unsigned int size) {
+    // The header takes a whole alignment's worth before the data.
+    if (alignment < MEMORY_HEADER_SIZE) {
+        alignment = MEMORY_HEADER_SIZE;
+    }
+    char *block = (char *) memalign(alignment, alignment + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    char *ptr = block + alignment;
+    MemoryHeader *header = (MemoryHeader *) (ptr - MEMORY_HEADER_SIZE);
+    header->size = size;
+    header->category = category;
+    header->offset = alignment - MEMORY_HEADER_SIZE;
+    header->magic = MEMORY_MAGIC;
+    countMemory(MEMORY_HEAP, category, size, 1);
+    return ptr;
+}
+
+void memFree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    MemoryHeader *header = (MemoryHeader *) ((char *) ptr - MEMORY_HEADER_SIZE);
+    if (header->magic != MEMORY_MAGIC) {
+        panic("Freeing memory at %p, which wasn't allocated or was freed already", ptr);
+    }
+    header->magic = 0;
+    countMemory(MEMORY_HEAP, header->category, -(int) header->size, -1);
+    free((char *) header - header->offset);
+}
+
+static MemoryBlock *findBlock(MemoryBlock *blocks, int count, const void *ptr) {
+    for (int i = 0; i < count; i++) {
+        if (blocks[i].ptr == ptr) {
+            return &blocks[i];
+        }
+    }
+    return NULL;
+}
+
+void *memVramAlloc(MemoryCategory category, unsigned int size) {
+    MemoryBlock *block = findBlock(vramBlocks, MEMORY_MAX_VRAM_BLOCKS, NULL);
+    if (block == NULL) {
+        panic("Too many VRAM allocations");
+    }
+    void *ptr = vramalloc(size);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    block->ptr = ptr;
+    block->size = size;
+    block->category = category;
+    countMemory(MEMORY_VRAM, category, size, 1);
+    return ptr;
+}
+
+void memVramFree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    MemoryBlock *block = findBlock(vramBlocks, MEMORY_MAX_VRAM_BLOCKS, ptr);
+    if (block == NULL) {
+        panic("Freeing VRAM at %p, which wasn't allocated or was freed already", ptr);
+    }
+    countMemory(MEMORY_VRAM, block->category, -(int) block->size, -1);
+    block->ptr = NULL;
+    vfree(ptr);
+}
+
+void memAddStatic(MemoryCategory category, const void *pool, unsigned int size) {
+    if (findBlock(staticPools, MEMORY_MAX_STATIC_POOLS, pool) != NULL) {
+        return;
+    }
+    MemoryBlock *block = findBlock(staticPools, MEMORY_MAX_STATIC_POOLS, NULL);
+    if (block == NULL) {
+        panic("Too many static pools");
+    }
+    block->ptr = pool;
+    block->size = size;
+    block->category = category;
+    countMemory(MEMORY_STATIC, category, size, 1);
+}
+
+void getMemoryStats(MemoryStats *stats) {
+    for (int pool = 0; pool < MEMORY_POOLS; pool++) {
+        for (int category = 0; category < MEMORY_CATEGORIES; category++) {
+            stats->usage[pool][category] = usage[pool][category];
+        }
+        stats->totals[pool] = totals[pool];
+    }
+    struct mallinfo info = mallinfo();
+    stats->heapSize = info.arena;
+    stats->heapFree = info.fordblks;
+    stats->heapFreeChunks = info.ordblks;
+    stats->systemFree = sceKernelTotalFreeMemSize();
+    stats->systemLargestFree = sceKernelMaxFreeMemSize();
+    stats->vramFree = vmemavail();
+    stats->vramLargestFree = vlargestblock();
+}
+
+#ifdef DEBUG
+static unsigned int toKilobytes(unsigned int bytes) {
+    return (bytes + 1023) / 1024;
+}
+
+static void printUsageRow(const char *name, const MemoryUsage *row) {
+    printf("%-10s", name);
+    for (int pool = 0; pool < MEMORY_POOLS; pool++) {
+        printf(" | %6u %6u %4u", toKilobytes(row[pool].current), toKilobytes(row[pool].peak), row[pool].count);
+    }
+    printf("\n");
+}
+#endif
+
+void dumpMemoryStats(void) {
+#ifdef DEBUG
+    MemoryStats stats;
+    getMemoryStats(&stats);
+    printf("%-10s | %-18s | %-18s | %-18s\n", "KB", "heap now, peak, n", "vram now, peak, n", "static now, peak, n");
+    for (int category = 0; category < MEMORY_CATEGORIES; category++) {
+        MemoryUsage row[MEMORY_POOLS];
+        for (int pool = 0; pool < MEMORY_POOLS; pool++) {
+            row[pool] = stats.usage[pool][category];
+        }
+        printUsageRow(categoryNames[category], row);
+    }
+    printUsageRow("total", stats.totals);
+    // How much of the free space can't be had in a single piece.
+    unsigned int vramFragmentation = (stats.vramFree > 0) ? 100 - stats.vramLargestFree * 100 / stats.vramFree : 0;
+    printf("Heap: %u KB taken, %u KB of it free in %u pieces, %u KB left to grow into (at most %u KB at once)\n",
+           toKilobytes(stats.heapSize), toKilobytes(stats.heapFree), stats.heapFreeChunks,
+           toKilobytes(stats.systemFree), toKilobytes(stats.systemLargestFree));
+    printf("VRAM: %u KB free, at most %u KB at once (%u%% fragmented)\n",
+           toKilobytes(stats.vramFree), toKilobytes(stats.vramLargestFree), vramFragmentation);
+#endif
+}
@@ -2,8 +2,73 @@
 #define __ALLOC_H__
 
 #include <vram.h>
-#include <malloc.h>
+
+// Every allocation the game makes goes through here, tagged with
+// what it's for, so that what each part of the game costs (and
+// what a new one will) can be told. The heap and VRAM are counted
+// as they're allocated and freed, and the large static pools are
+// counted once they're registered.
+
+typedef enum {
+    // files being read, or copies of those being written
+    MEMORY_FILES,
+    // the level's screens, and what they're decoded through
+    MEMORY_TEXTURES,
+    // the level's tables
+    MEMORY_LEVEL,
+    // the frame and depth buffers
+    MEMORY_DISPLAY,
+    // the player's sprites and the HUD's glyphs
+    MEMORY_SPRITES,
+    MEMORY_AUDIO,
+    // the rewind history and the ghost's runs
+    MEMORY_REPLAY,
+    MEMORY_TELEMETRY,
+    // what's reserved for the frame and state arenas (see arena.h)
+    MEMORY_ARENAS,
+    MEMORY_CATEGORIES
+} MemoryCategory;
+
+typedef enum {
+    MEMORY_HEAP,
+    MEMORY_VRAM,
+    MEMORY_STATIC,
+    MEMORY_POOLS
+} MemoryPool;
+
+typedef struct {
+    // bytes allocated now, and the most there have been
+    unsigned int current, peak;
+    // allocations alive now
+    unsigned int count;
+} MemoryUsage;
+
+typedef struct {
+    MemoryUsage usage[MEMORY_POOLS][MEMORY_CATEGORIES];
+    MemoryUsage totals[MEMORY_POOLS];
+    // what the heap has taken so far, what's free in it and in how
+    // many pieces, and what it may still grow into (largest first)
+    unsigned int heapSize, heapFree, heapFreeChunks;
+    unsigned int systemFree, systemLargestFree;
+    // what's free of VRAM, and the largest piece of it
+    unsigned int vramFree, vramLargestFree;
+} MemoryStats;
 
 unsigned int getVramMemorySize(unsigned int width, unsigned int height, unsigned int psm);
 
+// Like malloc, memalign and free. Everything allocated
+// from the heap has to be freed with memFree.
+void *memAlloc(MemoryCategory category, unsigned int size);
+void *memAlign(MemoryCategory category, unsigned int alignment, unsigned int size);
+void memFree(void *ptr);
+// Like vramalloc and vfree.
+void *memVramAlloc(MemoryCategory category, unsigned int size);
+void memVramFree(void *ptr);
+// Counts a static pool, the first time it's registered.
+void memAddStatic(MemoryCategory category, const void *pool, unsigned int size);
+
+void getMemoryStats(MemoryStats *stats);
+// Prints the stats to the debug output.
+void dumpMemoryStats(void);
+
 #endif
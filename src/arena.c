@@ -0,0 +1,276 @@
+#include "arena.h"
+#include "panic.h"
+#include <string.h>
+#ifdef DEBUG
+#include <stdio.h>
+#endif
+
+#define ARENA_ALIGNMENT 16
+// The arenas start on a cache line.
+#define ARENA_BASE_ALIGNMENT 64
+
+// What's allocated for a frame is small: the staging
+// of textures being swizzled and the like.
+#define FRAME_ARENA_SIZE 0x20000
+#ifdef TILED_SCREENS
+// The tile atlas alone takes 1 MB.
+#define STATE_ARENA_SIZE 0x200000
+#else
+#define STATE_ARENA_SIZE 0x100000
+#endif
+// Enough for the reads in flight, the maps around the current
+// screen and the music. Bigger files come from the heap.
+#define FILE_POOL_SIZE 0x200000
+
+// The smallest block is 4 KB, the biggest 2 MB.
+#define BUFFER_POOL_MIN_SHIFT 12
+#define BUFFER_POOL_USED 0x504F4F4C
+#define BUFFER_POOL_FREE 0x46524545
+
+// Each block starts with a header, which tells its size
+// when it's freed and links it to the others when it's free.
+typedef struct {
+    unsigned int magic;
+    unsigned int sizeClass;
+    void *next;
+#if __SIZEOF_POINTER__ == 4
+    unsigned int reserved;
+#endif
+} BufferPoolHeader;
+
+#ifdef DEBUG
+// Each allocation is preceded by a header, and followed by guard
+// bytes up to its aligned size and a whole alignment past it.
+#define ARENA_MAGIC 0x4152454E
+#define ARENA_GUARD_SIZE ARENA_ALIGNMENT
+#define ARENA_GUARD_BYTE 0xFD
+// What's been reset is overwritten, so that it shows if it's still used.
+#define ARENA_POISON_BYTE 0xDD
+
+typedef struct {
+    unsigned int size;
+    unsigned int magic;
+    unsigned int reserved[2];
+} ArenaHeader;
+#endif
+
+static Arena frameArena, stateArena;
+static BufferPool filePool;
+
+static unsigned int alignSize(unsigned int size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+static void raiseMark(unsigned int *mark, unsigned int value) {
+    // Racing threads may miss a mark by an allocation, which is fine.
+    if (value > __atomic_load_n(mark, __ATOMIC_RELAXED)) {
+        __atomic_store_n(mark, value, __ATOMIC_RELAXED);
+    }
+}
+
+void arenaCreate(Arena *arena, const char *name, unsigned int size) {
+    memset(arena, 0, sizeof(Arena));
+    arena->name = name;
+    arena->size = size;
+    arena->base = (char *) memAlign(MEMORY_ARENAS, ARENA_BASE_ALIGNMENT, size);
+    if (arena->base == NULL) {
+        panic("Failed to allocate the %s arena (%u bytes)", name, size);
+    }
+}
+
+void *arenaAlloc(Arena *arena, unsigned int size) {
+    unsigned int total = alignSize(size);
+#ifdef DEBUG
+    total += sizeof(ArenaHeader) + ARENA_GUARD_SIZE;
+#endif
+    unsigned int offset = __atomic_fetch_add(&arena->used, total, __ATOMIC_RELAXED);
+    if (offset + total > arena->size) {
+        panic("The %s arena is out of memory\nAllocating %u bytes with %u of %u used", arena->name, size, offset, arena->size);
+    }
+    raiseMark(&arena->highWater, offset + total);
+    raiseMark(&arena->highCount, __atomic_add_fetch(&arena->count, 1, __ATOMIC_RELAXED));
+    char *ptr = arena->base + offset;
+#ifdef DEBUG
+    ArenaHeader *header = (ArenaHeader *) ptr;
+    header->size = size;
+    header->magic = ARENA_MAGIC;
+    ptr += sizeof(ArenaHeader);
+    memset(ptr + size, ARENA_GUARD_BYTE, alignSize(size) - size + ARENA_GUARD_SIZE);
+#endif
+    return ptr;
+}
+
+#ifdef DEBUG
+static void checkGuards(const Arena *arena) {
+    unsigned int offset = 0;
+    while (offset < arena->used) {
+        const ArenaHeader *header = (const ArenaHeader *) (arena->base + offset);
+        if (header->magic != ARENA_MAGIC) {
+            panic("The %s arena is corrupted at %p", arena->name, header);
+        }
+        const unsigned char *data = (const unsigned char *) (header + 1);
+        unsigned int end = alignSize(header->size) + ARENA_GUARD_SIZE;
+        for (unsigned int i = header->size; i < end; i++) {
+            if (data[i] != ARENA_GUARD_BYTE) {
+                panic("The %s arena's allocation of %u bytes at %p was overrun", arena->name, header->size, data);
+            }
+        }
+        offset += sizeof(ArenaHeader) + end;
+    }
+}
+#endif
+
+void arenaReset(Arena *arena) {
+#ifdef DEBUG
+    checkGuards(arena);
+    memset(arena->base, ARENA_POISON_BYTE, arena->used);
+#endif
+    arena->used = 0;
+    arena->count = 0;
+}
+
+void arenaDestroy(Arena *arena) {
+    arenaReset(arena);
+    memFree(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+}
+
+void bufferPoolCreate(BufferPool *pool, const char *name, unsigned int size) {
+    memset(pool, 0, sizeof(BufferPool));
+    pool->name = name;
+    pool->size = size;
+    pool->base = (char *) memAlign(MEMORY_FILES, ARENA_BASE_ALIGNMENT, size);
+    if (pool->base == NULL || semaphoreCreate(&pool->lock, name, 1) < 0) {
+        panic("Failed to allocate the %s pool (%u bytes)", name, size);
+    }
+}
+
+void *bufferPoolAlloc(BufferPool *pool, unsigned int size) {
+    unsigned int sizeClass = 0;
+    while (sizeClass < BUFFER_POOL_CLASSES && (1u << (BUFFER_POOL_MIN_SHIFT + sizeClass)) < size + sizeof(BufferPoolHeader)) {
+        ++sizeClass;
+    }
+    BufferPoolHeader *header = NULL;
+    if (sizeClass < BUFFER_POOL_CLASSES) {
+        unsigned int blockSize = 1u << (BUFFER_POOL_MIN_SHIFT + sizeClass);
+        semaphoreWait(&pool->lock);
+        header = (BufferPoolHeader *) pool->freeBlocks[sizeClass];
+        if (header != NULL) {
+            pool->freeBlocks[sizeClass] = header->next;
+        } else if (pool->size - pool->carved >= blockSize) {
+            header = (BufferPoolHeader *) (pool->base + pool->carved);
+            pool->carved += blockSize;
+        }
+        if (header != NULL) {
+            pool->used += blockSize;
+            raiseMark(&pool->highWater, pool->used);
+        }
+        semaphoreSignal(&pool->lock);
+    }
+    if (header == NULL) {
+        // Too big for the pool, or there's no room left in it.
+        void *ptr = memAlloc(MEMORY_FILES, size);
+        if (ptr != NULL) {
+            __atomic_add_fetch(&pool->fallbacks, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&pool->totalFallbacks, 1, __ATOMIC_RELAXED);
+        }
+        return ptr;
+    }
+    header->magic = BUFFER_POOL_USED;
+    header->sizeClass = sizeClass;
+    return header + 1;
+}
+
+void bufferPoolFree(BufferPool *pool, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if ((char *) ptr < pool->base || (char *) ptr >= pool->base + pool->size) {
+        __atomic_sub_fetch(&pool->fallbacks, 1, __ATOMIC_RELAXED);
+        memFree(ptr);
+        return;
+    }
+    BufferPoolHeader *header = ((BufferPoolHeader *) ptr) - 1;
+    if (header->magic != BUFFER_POOL_USED) {
+        panic("Freeing a buffer at %p of the %s pool, which was freed already", ptr, pool->name);
+    }
+    header->magic = BUFFER_POOL_FREE;
+    semaphoreWait(&pool->lock);
+    header->next = pool->freeBlocks[header->sizeClass];
+    pool->freeBlocks[header->sizeClass] = header;
+    pool->used -= 1u << (BUFFER_POOL_MIN_SHIFT + header->sizeClass);
+    semaphoreSignal(&pool->lock);
+}
+
+void bufferPoolDestroy(BufferPool *pool) {
+    semaphoreDestroy(&pool->lock);
+    memFree(pool->base);
+    pool->base = NULL;
+    pool->size = 0;
+}
+
+void initArenas(void) {
+    arenaCreate(&frameArena, "frame", FRAME_ARENA_SIZE);
+    arenaCreate(&stateArena, "state", STATE_ARENA_SIZE);
+    bufferPoolCreate(&filePool, "file", FILE_POOL_SIZE);
+}
+
+void endArenas(void) {
+    arenaDestroy(&frameArena);
+    arenaDestroy(&stateArena);
+    bufferPoolDestroy(&filePool);
+}
+
+void *frameAlloc(unsigned int size) {
+    return arenaAlloc(&frameArena, size);
+}
+
+void *stateAlloc(unsigned int size) {
+    return arenaAlloc(&stateArena, size);
+}
+
+void *fileAlloc(unsigned int size) {
+    return bufferPoolAlloc(&filePool, size);
+}
+
+void fileFree(void *ptr) {
+    bufferPoolFree(&filePool, ptr);
+}
+
+void resetFrameArena(void) {
+    arenaReset(&frameArena);
+}
+
+void releaseStateArena(void) {
+    arenaReset(&stateArena);
+}
+
+void getArenaStats(ArenaStats *outStats) {
+    outStats->frameHighWater = __atomic_load_n(&frameArena.highWater, __ATOMIC_RELAXED);
+    outStats->stateHighWater = __atomic_load_n(&stateArena.highWater, __ATOMIC_RELAXED);
+    outStats->frameSize = frameArena.size;
+    outStats->stateSize = stateArena.size;
+    outStats->fileHighWater = __atomic_load_n(&filePool.highWater, __ATOMIC_RELAXED);
+    outStats->fileSize = filePool.size;
+}
+
+#ifdef DEBUG
+static void printArena(const Arena *arena) {
+    printf("Arena %-5s: %u KB now in %u allocations, at most %u KB in %u, of %u KB\n",
+           arena->name, (arena->used + 1023) / 1024, arena->count,
+           (arena->highWater + 1023) / 1024, arena->highCount, arena->size / 1024);
+}
+#endif
+
+void dumpArenaStats(void) {
+#ifdef DEBUG
+    // Debug builds count the guards too.
+    printArena(&frameArena);
+    printArena(&stateArena);
+    printf("Pool  %-5s: %u KB now, at most %u KB, %u KB of %u KB carved, %u buffers from the heap now, %u ever\n",
+           filePool.name, (filePool.used + 1023) / 1024, (filePool.highWater + 1023) / 1024,
+           filePool.carved / 1024, filePool.size / 1024, __atomic_load_n(&filePool.fallbacks, __ATOMIC_RELAXED),
+           __atomic_load_n(&filePool.totalFallbacks, __ATOMIC_RELAXED));
+#endif
+}
@@ -0,0 +1,98 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "alloc.h"
+#include "thread.h"
+
+// Memory that's all given back at once. Allocating from an arena is
+// a pointer bump, and there's no freeing its allocations one by one:
+// the whole arena is reset instead.
+//
+// There are two of them. The frame arena is reset when a frame
+// starts, so what's allocated from it lasts for the frame's update
+// and render. The state arena is released by switchState, between
+// the old state's cleanup and the new one's init, so what a state
+// allocates from it lasts until the state is left.
+//
+// In debug builds every allocation is fenced by guard words, which
+// are checked when the arena is reset.
+//
+// The files being read and written don't fit either: they come and go
+// in any order, and for as long as their owners need them. They come
+// from a buffer pool instead. Its memory is reserved once and carved
+// into blocks of powers of two. A freed block is only ever reused for
+// buffers of its own size, so the pool can't fragment the way the
+// heap does. Once all of it has been carved, buffers come from the
+// heap again, and are counted so that the pool can be sized.
+
+#define BUFFER_POOL_CLASSES 10
+
+typedef struct {
+    const char *name;
+    char *base;
+    unsigned int size;
+    // bytes allocated now, and the most there have been
+    unsigned int used, highWater;
+    // allocations made since the reset, and the most there have been
+    unsigned int count, highCount;
+} Arena;
+
+typedef struct {
+    const char *name;
+    char *base;
+    unsigned int size;
+    // how much of it has been carved into blocks
+    unsigned int carved;
+    // the freed blocks of each size, linked through their headers
+    void *freeBlocks[BUFFER_POOL_CLASSES];
+    // bytes in the blocks handed out, and the most there have been
+    unsigned int used, highWater;
+    // buffers that came from the heap: alive now, and ever
+    unsigned int fallbacks, totalFallbacks;
+    Semaphore lock;
+} BufferPool;
+
+typedef struct {
+    // the most bytes the frame and state arenas have held
+    unsigned int frameHighWater, stateHighWater;
+    unsigned int frameSize, stateSize;
+    // the most bytes in the file pool's blocks, and its size
+    unsigned int fileHighWater, fileSize;
+} ArenaStats;
+
+// Reserves the arena's memory from the heap.
+void arenaCreate(Arena *arena, const char *name, unsigned int size);
+// Returns memory aligned to 16 bytes, or panics if the arena is full.
+// It's safe to call from more than one thread at once.
+void *arenaAlloc(Arena *arena, unsigned int size);
+// Frees everything allocated from the arena. Nothing may be
+// allocating from it meanwhile.
+void arenaReset(Arena *arena);
+void arenaDestroy(Arena *arena);
+
+void bufferPoolCreate(BufferPool *pool, const char *name, unsigned int size);
+// Returns memory aligned to 16 bytes, or NULL if there's none left at
+// all. Like bufferPoolFree, it's safe to call from any thread.
+void *bufferPoolAlloc(BufferPool *pool, unsigned int size);
+void bufferPoolFree(BufferPool *pool, void *ptr);
+void bufferPoolDestroy(BufferPool *pool);
+
+void initArenas(void);
+void endArenas(void);
+// Valid until the next frame starts.
+void *frameAlloc(unsigned int size);
+// Valid until the current state is left.
+void *stateAlloc(unsigned int size);
+// The buffers of the files being read or written, from the file pool.
+void *fileAlloc(unsigned int size);
+void fileFree(void *ptr);
+void resetFrameArena(void);
+void releaseStateArena(void);
+// Tells, from any thread, the most of the arenas
+// and the file pool that has been used.
+void getArenaStats(ArenaStats *outStats);
+// Prints how much of the arenas and the file pool
+// is used, and the most that has been.
+void dumpArenaStats(void);
+
+#endif
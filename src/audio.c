@@ -0,0 +1,349 @@
+#include "audio.h"
+#include "alloc.h"
+#include "arena.h"
+#include "loader.h"
+#include "mixer.h"
+#include "panic.h"
+#include "qoa.h"
+#include "spsc.h"
+#include "thread.h"
+#include <pspaudio.h>
+#include <pspiofilemgr.h>
+#include <stdio.h>
+
+// The rate the PSP's audio channels play at.
+#define AUDIO_RATE 44100
+// Samples (per channel) in each output buffer, about 23 ms.
+#define AUDIO_SAMPLES 1024
+// Higher than the main thread, so that a frame that's slow to draw
+// doesn't make the sound skip. It spends nearly all of its time
+// waiting in sceAudioOutputBlocking, so it takes little from it.
+#define AUDIO_THREAD_PRIORITY 0x12
+#define AUDIO_STACK_SIZE 0x4000
+#define AUDIO_MAX_VOICES 8
+#define AUDIO_MUSIC_VOLUME 160
+
+#define MUSIC_PATH "assets/audio/music.qoa"
+// The frames read at a time, about 0.93 s of music (33 KB in
+// stereo). A chunk only takes the loader a few milliseconds,
+// so the screens queued behind it aren't held up for long,
+// and the chunk being played leaves plenty of time for the
+// next one to come in.
+#define MUSIC_CHUNK_FRAMES 8
+
+static const char *const effectPaths[SOUND_COUNT] = {
+    "assets/audio/jump.qoa",
+    "assets/audio/land.qoa",
+    "assets/audio/bump.qoa",
+};
+
+typedef enum {
+    CHUNK_EMPTY,
+    CHUNK_LOADING,
+    // the mixer is (or will be) playing it
+    CHUNK_READY,
+    // the mixer is done with it
+    CHUNK_PLAYED,
+} MusicChunkState;
+
+typedef struct {
+    LoaderFile file;
+    // where the mixer is in the chunk
+    unsigned int offset;
+    // only the mixer moves it on from ready to played,
+    // and only the main thread moves it on from the others
+    int state;
+} MusicChunk;
+
+static int running;
+static int channel;
+static Thread mixerThread;
+// The effects, as they start out when played. The simulation
+// pushes the ones to play, which the mixer takes into a voice.
+static MixerVoice effects[SOUND_COUNT];
+static SpscQueue soundQueue;
+// Only ever used by the mixer.
+static MixerVoice voices[AUDIO_MAX_VOICES];
+static int mix[AUDIO_SAMPLES * 2];
+static short output[2][AUDIO_SAMPLES * 2] __attribute__((aligned(64)));
+
+static QoaDesc music;
+static int hasMusic;
+static MusicChunk chunks[2];
+// Used by the main thread: the next frame and chunk to
+// read, and the chunk being read, if any.
+static unsigned int nextFrame, nextChunk;
+static MusicChunk *loadingChunk;
+// Used by the mixer: the chunk being played, and its frame being played.
+static unsigned int playingChunk;
+static short musicSamples[QOA_FRAME_LEN * 2];
+static MixerVoice musicVoice;
+static int musicStarted;
+static unsigned int underruns;
+
+// Not having a sound is fine, so the files aren't read with
+// the loader before checking, since it panics if one is missing.
+static int hasFile(const char *path) {
+    SceUID fd = sceIoOpen(path, PSP_O_RDONLY, 0444);
+    if (fd < 0) {
+        return 0;
+    }
+    sceIoClose(fd);
+    return 1;
+}
+
+static int isPlayable(const QoaDesc *desc) {
+    return desc->channels <= 2 && desc->samplerate == AUDIO_RATE;
+}
+
+static void loadEffect(SoundEffect sound) {
+    const char *path = effectPaths[sound];
+#define loadEffectPanic(msg, ...) panic("Error while loading %s\n" msg, path, ##__VA_ARGS__)
+    MixerVoice *effect = &effects[sound];
+    effect->samples = NULL;
+    if (!hasFile(path)) {
+        return;
+    }
+    unsigned int size;
+    unsigned char *data = (unsigned char *) readFile(path, &size);
+    QoaDesc desc;
+    if (qoaDecodeHeader(data, size, &desc) || !isPlayable(&desc)) {
+        loadEffectPanic("Not 44100 Hz mono or stereo QOA");
+    }
+    // Every frame is decoded whole, so there's room for a full last one.
+    unsigned int frames = qoaFrameCount(&desc);
+    short *samples = (short *) stateAlloc(frames * QOA_FRAME_LEN * desc.channels * sizeof(short));
+    unsigned int offset = QOA_HEADER_SIZE, decoded = 0;
+    for (unsigned int i = 0; i < frames; i++) {
+        unsigned int frameSamples;
+        unsigned int frameSize = qoaDecodeFrame(data + offset, size - offset, desc.channels, samples + decoded * desc.channels, &frameSamples);
+        if (frameSize == 0) {
+            loadEffectPanic("Bad frame %u", i);
+        }
+        offset += frameSize;
+        decoded += frameSamples;
+    }
+    unloadFile(data);
+    effect->samples = samples;
+    effect->channels = desc.channels;
+    effect->length = decoded;
+    effect->position = 0;
+    effect->volume = MIXER_VOLUME_MAX;
+#undef loadEffectPanic
+}
+
+static void openMusic(void) {
+    hasMusic = 0;
+    // Only the header is read here, the rest is streamed.
+    SceUID fd = sceIoOpen(MUSIC_PATH, PSP_O_RDONLY, 0444);
+    if (fd < 0) {
+        return;
+    }
+    unsigned char header[QOA_HEADER_SIZE + 8];
+    int bytes = sceIoRead(fd, header, sizeof(header));
+    sceIoClose(fd);
+    if (bytes != sizeof(header) || qoaDecodeHeader(header, sizeof(header), &music) || !isPlayable(&music)) {
+        panic("Error while loading " MUSIC_PATH "\nNot 44100 Hz mono or stereo QOA");
+    }
+    for (int i = 0; i < 2; i++) {
+        chunks[i].file.buffer = NULL;
+        initLoaderFence(&chunks[i].file.fence);
+        chunks[i].state = CHUNK_EMPTY;
+    }
+    nextFrame = 0;
+    nextChunk = 0;
+    loadingChunk = NULL;
+    playingChunk = 0;
+    musicVoice.samples = musicSamples;
+    musicVoice.channels = music.channels;
+    musicVoice.length = 0;
+    musicVoice.position = 0;
+    musicVoice.volume = AUDIO_MUSIC_VOLUME;
+    musicStarted = 0;
+    underruns = 0;
+    hasMusic = 1;
+}
+
+// Decodes the next frame of music. Returns 0 if the
+// chunk it's in hasn't been read yet.
+static int decodeMusicFrame(void) {
+    MusicChunk *chunk = &chunks[playingChunk];
+    if (__atomic_load_n(&chunk->state, __ATOMIC_ACQUIRE) != CHUNK_READY) {
+        return 0;
+    }
+    const unsigned char *data = (const unsigned char *) chunk->file.buffer;
+    unsigned int samples;
+    unsigned int frameSize = qoaDecodeFrame(data + chunk->offset, chunk->file.size - chunk->offset, music.channels, musicSamples, &samples);
+    if (frameSize == 0) {
+        panic("Error while streaming " MUSIC_PATH "\nBad frame at %u", chunk->offset);
+    }
+    chunk->offset += frameSize;
+    if (chunk->offset == chunk->file.size) {
+        // Give the chunk back, to be read into again.
+        __atomic_store_n(&chunk->state, CHUNK_PLAYED, __ATOMIC_RELEASE);
+        playingChunk ^= 1;
+    }
+    musicVoice.length = samples;
+    musicVoice.position = 0;
+    return 1;
+}
+
+static void mixMusic(void) {
+    int *out = mix;
+    unsigned int frames = AUDIO_SAMPLES;
+    while (frames > 0) {
+        if (musicVoice.position == musicVoice.length && !decodeMusicFrame()) {
+            // The next chunk is late, so the music skips.
+            underruns += musicStarted;
+            return;
+        }
+        musicStarted = 1;
+        unsigned int mixed = mixVoice(out, frames, &musicVoice);
+        out += 2 * mixed;
+        frames -= mixed;
+    }
+}
+
+static void startQueuedSounds(void) {
+    const MixerVoice *effect;
+    while ((effect = (const MixerVoice *) spscPop(&soundQueue)) != NULL) {
+        // If all the voices are taken, the sound that's
+        // furthest along makes way for the new one.
+        MixerVoice *voice = &voices[0];
+        for (int i = 0; i < AUDIO_MAX_VOICES; i++) {
+            if (voices[i].samples == NULL) {
+                voice = &voices[i];
+                break;
+            }
+            if (voices[i].position > voice->position) {
+                voice = &voices[i];
+            }
+        }
+        *voice = *effect;
+    }
+}
+
+static void mixerMain(void *arg) {
+    int buffer = 0;
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        startQueuedSounds();
+        clearMix(mix, AUDIO_SAMPLES);
+        if (hasMusic) {
+            mixMusic();
+        }
+        for (int i = 0; i < AUDIO_MAX_VOICES; i++) {
+            MixerVoice *voice = &voices[i];
+            if (voice->samples != NULL) {
+                mixVoice(mix, AUDIO_SAMPLES, voice);
+                if (voice->position == voice->length) {
+                    voice->samples = NULL;
+                }
+            }
+        }
+        resolveMix(output[buffer], mix, AUDIO_SAMPLES);
+        // This waits for the other buffer to finish playing before
+        // queueing this one, so one is mixed while the other plays.
+        sceAudioOutputBlocking(channel, PSP_AUDIO_VOLUME_MAX, output[buffer]);
+        buffer ^= 1;
+    }
+}
+
+void startAudio(void) {
+    memAddStatic(MEMORY_AUDIO, musicSamples, sizeof(musicSamples));
+    memAddStatic(MEMORY_AUDIO, output, sizeof(output));
+    int audible = 0;
+    for (int i = 0; i < SOUND_COUNT; i++) {
+        loadEffect(i);
+        audible |= effects[i].samples != NULL;
+    }
+    openMusic();
+    if (!audible && !hasMusic) {
+        return;
+    }
+    for (int i = 0; i < AUDIO_MAX_VOICES; i++) {
+        voices[i].samples = NULL;
+    }
+    spscInit(&soundQueue);
+    channel = sceAudioChReserve(PSP_AUDIO_NEXT_CHANNEL, AUDIO_SAMPLES, PSP_AUDIO_FORMAT_STEREO);
+    if (channel < 0) {
+        panic("Failed to reserve an audio channel.");
+    }
+    running = 1;
+    if (threadCreate(&mixerThread, "MixerThread", AUDIO_THREAD_PRIORITY, AUDIO_STACK_SIZE, &mixerMain, NULL)) {
+        panic("Failed to start the mixer thread.");
+    }
+    streamAudio();
+}
+
+void streamAudio(void) {
+    if (!hasMusic) {
+        return;
+    }
+    if (loadingChunk != NULL) {
+        if (!LOADER_FENCE_READY(&loadingChunk->file.fence)) {
+            return;
+        }
+        loadingChunk->offset = 0;
+        __atomic_store_n(&loadingChunk->state, CHUNK_READY, __ATOMIC_RELEASE);
+        loadingChunk = NULL;
+    }
+    // Only one chunk is read at a time, into the buffer the mixer
+    // has finished with. The music's reads go through the loader's
+    // queue along with the screens', so they take turns, and there's
+    // never more than one chunk in the way of a screen.
+    MusicChunk *chunk = &chunks[nextChunk];
+    int state = __atomic_load_n(&chunk->state, __ATOMIC_ACQUIRE);
+    if (state == CHUNK_READY) {
+        return;
+    }
+    if (state == CHUNK_PLAYED) {
+        unloadFile(chunk->file.buffer);
+        chunk->file.buffer = NULL;
+    }
+    unsigned int totalFrames = qoaFrameCount(&music);
+    unsigned int frames = totalFrames - nextFrame;
+    if (frames > MUSIC_CHUNK_FRAMES) {
+        frames = MUSIC_CHUNK_FRAMES;
+    }
+    unsigned int offset = qoaFrameOffset(&music, nextFrame);
+    chunk->state = CHUNK_LOADING;
+    lazyReadFileRange(MUSIC_PATH, offset, qoaFrameOffset(&music, nextFrame + frames) - offset, &chunk->file);
+    loadingChunk = chunk;
+    // The music loops.
+    nextFrame = (nextFrame + frames) % totalFrames;
+    nextChunk ^= 1;
+}
+
+void playSound(SoundEffect sound) {
+    // If the mixer has fallen behind, the sound is dropped.
+    if (__atomic_load_n(&running, __ATOMIC_RELAXED) && effects[sound].samples != NULL) {
+        spscPush(&soundQueue, &effects[sound]);
+    }
+}
+
+void stopAudio(void) {
+    if (!running) {
+        return;
+    }
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    threadJoin(&mixerThread);
+    sceAudioChRelease(channel);
+    // The effects' samples go with the state arena.
+    for (int i = 0; i < SOUND_COUNT; i++) {
+        effects[i].samples = NULL;
+    }
+    if (hasMusic) {
+        // The chunk being read is handed over once it's in.
+        for (int i = 0; i < 2; i++) {
+            waitLoaderFence(&chunks[i].file.fence);
+            unloadFile(chunks[i].file.buffer);
+            chunks[i].file.buffer = NULL;
+        }
+        hasMusic = 0;
+#ifdef DEBUG
+        if (underruns > 0) {
+            printf("Audio: the music skipped %u times\n", underruns);
+        }
+#endif
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef __AUDIO_H__
+#define __AUDIO_H__
+
+// The music and the sound effects. The effects are short, so they
+// are decoded whole when the game starts. The music is streamed:
+// it's read through the loader a chunk of frames at a time, into
+// one of two buffers while the other one is played, and only the
+// frame being played is ever decoded. Both are mixed on a thread
+// of their own, which feeds the PSP's audio output.
+//
+// The files are QOA (see qoa.h), at 44100 Hz, mono or stereo. Any
+// of them may be missing, in which case it's simply not played.
+
+typedef enum {
+    SOUND_JUMP,
+    SOUND_LAND,
+    SOUND_BUMP,
+    SOUND_COUNT
+} SoundEffect;
+
+// Reads the effects and starts the mixer. Like the other
+// functions but playSound, it's called from the main thread.
+void startAudio(void);
+// Keeps the next chunk of music coming. Call it every frame.
+void streamAudio(void);
+// Plays the effect from its start. It can be called from another
+// thread than the others, but always the same one.
+void playSound(SoundEffect sound);
+// Stops the mixer and frees everything.
+void stopAudio(void);
+
+#endif
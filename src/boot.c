@@ -0,0 +1,105 @@
+#include "state.h"
+#include "level.h"
+#include "king.h"
+#include "resume.h"
+#include <pspkernel.h>
+#include <stdio.h>
+
+// The splash is a progress bar across the middle
+// of the screen, filled in as the reads complete.
+#define BOOT_BAR_WIDTH 240
+#define BOOT_BAR_HEIGHT 4
+#define BOOT_BAR_X ((PSP_SCREEN_WIDTH - BOOT_BAR_WIDTH) / 2)
+#define BOOT_BAR_Y ((PSP_SCREEN_HEIGHT - BOOT_BAR_HEIGHT) / 2)
+#define BOOT_BAR_COLOR 0xFF303030
+#define BOOT_BAR_FILL_COLOR 0xFFE0E0E0
+// the map table, the start map and the king's sprites
+#define BOOT_READS 3
+
+// Times of the boot's milestones, in microseconds
+// from the moment the boot state was entered.
+static SceInt64 bootStart;
+static unsigned int splashTime, assetsTime;
+static int readsDone, interactive;
+
+static unsigned int getBootTime(void) {
+    return (unsigned int) (sceKernelGetSystemTimeWide() - bootStart);
+}
+
+// NOTE: The engine enters this state before the Graphics Engine
+//       is initialized, so that the reads overlap with that.
+static void init(void) {
+    bootStart = sceKernelGetSystemTimeWide();
+    splashTime = 0;
+    assetsTime = 0;
+    readsDone = 0;
+    interactive = 0;
+    setClearFlags(GU_DEPTH_BUFFER_BIT | GU_COLOR_BUFFER_BIT);
+    kingPreloadSprites();
+    // A saved game is resumed from its screen, so only that
+    // screen's map is read, and only it and its neighbours
+    // are decoded once the game takes over.
+    preloadLevel(getStartScreen());
+}
+
+// NOTE: The engine only runs this state on the main thread,
+//       so it can switch to the game from here.
+static void update(float delta) {
+    // The level's reads are moved along by asking.
+    int levelReads = isLevelPreloaded() ? 2 : 0;
+    readsDone = levelReads + areKingSpritesPreloaded();
+    if (readsDone == BOOT_READS) {
+        assetsTime = getBootTime();
+        // The game holds the splash on screen until the
+        // rows in view of the first screen are decoded.
+        switchState(&GAME);
+    }
+}
+
+static void drawBar(short width, unsigned int color) {
+    Vertex *vertices = (Vertex *) sceGuGetMemory(2 * sizeof(Vertex));
+    vertices[0].x = BOOT_BAR_X;
+    vertices[0].y = BOOT_BAR_Y;
+    vertices[0].z = RENDER_LAYER_SPRITES;
+    vertices[1].x = BOOT_BAR_X + width;
+    vertices[1].y = BOOT_BAR_Y + BOOT_BAR_HEIGHT;
+    vertices[1].z = RENDER_LAYER_SPRITES;
+    sceGuColor(color);
+    sceGuDrawArray(GU_SPRITES, GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D, 2, NULL, vertices);
+}
+
+static void render(void) {
+    if (splashTime == 0) {
+        splashTime = getBootTime();
+        // Draw the splash where the game starts scrolled to,
+        // so that it stays put while the game holds it.
+        setBackgroundScroll(getStartScroll());
+    }
+    sceGuDisable(GU_TEXTURE_2D);
+    drawBar(BOOT_BAR_WIDTH, BOOT_BAR_COLOR);
+    if (readsDone > 0) {
+        drawBar(BOOT_BAR_WIDTH * readsDone / BOOT_READS, BOOT_BAR_FILL_COLOR);
+    }
+    sceGuEnable(GU_TEXTURE_2D);
+}
+
+static void cleanup(void) {
+}
+
+void markBootInteractive(void) {
+    if (interactive) {
+        return;
+    }
+    interactive = 1;
+#ifdef DEBUG
+    printf("Boot: splash at %u ms, assets read at %u ms, first interactive frame at %u ms\n",
+           splashTime / 1000, assetsTime / 1000, getBootTime() / 1000);
+#endif
+}
+
+const GameState BOOT = {
+    .init = &init,
+    .update = &update,
+    .render = &render,
+    .cleanup = &cleanup,
+};
@@ -0,0 +1,17 @@
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#define FNV_OFFSET_BASIS 0x811C9DC5u
+#define FNV_PRIME 0x01000193u
+
+// 32-bit FNV-1a, as computed by the asset scripts.
+static inline unsigned int fnv1a(const void *data, unsigned int size) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    unsigned int hash = FNV_OFFSET_BASIS;
+    for (unsigned int i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+#endif
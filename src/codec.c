@@ -0,0 +1,163 @@
+#include "codec.h"
+#include "lz4.h"
+#include "swizzle.h"
+#include <string.h>
+
+static unsigned int readLe16(const unsigned char *bytes) {
+    return bytes[0] | bytes[1] << 8;
+}
+
+static unsigned int readLe32(const unsigned char *bytes) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (unsigned int) bytes[3] << 24;
+}
+
+// QOI
+
+static void fromQoiDescriptor(const QoiDescriptor *qoi, TextureDescriptor *desc) {
+    desc->width = qoi->width;
+    desc->height = qoi->height;
+    desc->channels = qoi->channels;
+    desc->swizzled = 0;
+    desc->pitch = qoi->width;
+}
+
+static int qoiCodecProbe(const void *data, unsigned int size, TextureDescriptor *desc) {
+    QoiDescriptor qoi;
+    if (qoiProbe(data, size, &qoi)) {
+        return -1;
+    }
+    fromQoiDescriptor(&qoi, desc);
+    return 0;
+}
+
+static int qoiCodecDecode(const void *data, unsigned int size, TextureDescriptor *desc, void *out, unsigned int pitch) {
+    QoiDescriptor qoi;
+    if (qoiDecodeRect(data, size, &qoi, out, pitch, 0, 0)) {
+        return -1;
+    }
+    fromQoiDescriptor(&qoi, desc);
+    return 0;
+}
+
+static int qoiCodecDecodeRows(
+    const void *data, unsigned int size, const QoiRowIndex *rowIndex,
+    unsigned int firstRow, unsigned int rows, unsigned int pitch, TextureDescriptor *desc, void *out
+) {
+    QoiDescriptor qoi;
+    if (rowIndex == NULL || qoiDecodeRows(data, size, rowIndex, firstRow, rows, pitch, &qoi, out)) {
+        return -1;
+    }
+    fromQoiDescriptor(&qoi, desc);
+    return 0;
+}
+
+// The .tex container
+
+static int texProbe(const void *data, unsigned int size, unsigned int magic, TextureDescriptor *desc) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    if (data == NULL || size < TEX_HEADER_SIZE || readLe32(bytes) != magic) {
+        return -1;
+    }
+    desc->width = readLe16(bytes + 4);
+    desc->height = readLe16(bytes + 6);
+    desc->pitch = readLe16(bytes + 8);
+    desc->channels = bytes[10];
+    desc->swizzled = (bytes[11] & TEX_FLAG_SWIZZLED) != 0;
+    if (
+        desc->width == 0 || desc->height == 0 || desc->pitch < desc->width ||
+        desc->channels < 3 || desc->channels > 4 ||
+        desc->height > 0xFFFFFFFFu / (desc->pitch * desc->channels) ||
+        readLe32(bytes + 12) != desc->pitch * desc->height * desc->channels
+    ) {
+        return -1;
+    }
+    if (desc->swizzled && ((desc->pitch * desc->channels) % SWIZZLE_BLOCK_WIDTH != 0 || desc->height % SWIZZLE_BLOCK_HEIGHT != 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Swizzled rows only make sense with the pitch they were swizzled for,
+// and in whole bands. Linear rows can go anywhere they fit.
+static int texCanCopyRows(const TextureDescriptor *desc, unsigned int pitch, unsigned int firstRow, unsigned int endRow) {
+    if (!desc->swizzled) {
+        return desc->width <= pitch;
+    }
+    return pitch == desc->pitch && firstRow % SWIZZLE_BLOCK_HEIGHT == 0 &&
+        (endRow % SWIZZLE_BLOCK_HEIGHT == 0 || endRow == desc->height);
+}
+
+// Raw
+
+static int rawCodecProbe(const void *data, unsigned int size, TextureDescriptor *desc) {
+    if (texProbe(data, size, TEX_MAGIC_RAW, desc) || size - TEX_HEADER_SIZE < desc->pitch * desc->height * desc->channels) {
+        return -1;
+    }
+    return 0;
+}
+
+static int rawCodecDecodeRows(
+    const void *data, unsigned int size, const QoiRowIndex *rowIndex,
+    unsigned int firstRow, unsigned int rows, unsigned int pitch, TextureDescriptor *desc, void *out
+) {
+    if (rawCodecProbe(data, size, desc) || out == NULL) {
+        return -1;
+    }
+    if (firstRow >= desc->height || rows == 0) {
+        return 0;
+    }
+    unsigned int endRow = (rows > desc->height - firstRow) ? desc->height : firstRow + rows;
+    if (!texCanCopyRows(desc, pitch, firstRow, endRow)) {
+        return -1;
+    }
+    const char *pixels = ((const char *) data) + TEX_HEADER_SIZE;
+    unsigned int srcPitch = desc->pitch * desc->channels;
+    unsigned int destPitch = pitch * desc->channels;
+    // A band of swizzled rows takes up the same bytes as the
+    // linear rows would, so it's copied like them.
+    if (srcPitch == destPitch) {
+        memcpy(((char *) out) + firstRow * destPitch, pixels + firstRow * srcPitch, (endRow - firstRow) * srcPitch);
+        return 0;
+    }
+    for (unsigned int row = firstRow; row < endRow; row++) {
+        memcpy(((char *) out) + row * destPitch, pixels + row * srcPitch, desc->width * desc->channels);
+    }
+    return 0;
+}
+
+static int rawCodecDecode(const void *data, unsigned int size, TextureDescriptor *desc, void *out, unsigned int pitch) {
+    return rawCodecDecodeRows(data, size, NULL, 0, ~0u, pitch, desc, out);
+}
+
+// LZ4
+
+static int lz4CodecProbe(const void *data, unsigned int size, TextureDescriptor *desc) {
+    return texProbe(data, size, TEX_MAGIC_LZ4, desc);
+}
+
+// The block is decompressed in one go, straight into the
+// texture, so the texture must have the stored pitch.
+static int lz4CodecDecode(const void *data, unsigned int size, TextureDescriptor *desc, void *out, unsigned int pitch) {
+    if (lz4CodecProbe(data, size, desc) || out == NULL || pitch != desc->pitch) {
+        return -1;
+    }
+    unsigned int pixelBytes = desc->pitch * desc->height * desc->channels;
+    int written = lz4Decompress(((const char *) data) + TEX_HEADER_SIZE, size - TEX_HEADER_SIZE, out, pixelBytes);
+    return (written == (int) pixelBytes) ? 0 : -1;
+}
+
+static const TextureCodec textureCodecs[] = {
+    { "qoi", &qoiCodecProbe, &qoiCodecDecode, &qoiCodecDecodeRows, 1 },
+    { "lz4", &lz4CodecProbe, &lz4CodecDecode, NULL, 0 },
+    { "raw", &rawCodecProbe, &rawCodecDecode, &rawCodecDecodeRows, 0 },
+};
+
+const TextureCodec *findTextureCodec(const void *data, unsigned int size) {
+    TextureDescriptor desc;
+    for (unsigned int i = 0; i < sizeof(textureCodecs) / sizeof(textureCodecs[0]); i++) {
+        if (textureCodecs[i].probe(data, size, &desc) == 0) {
+            return &textureCodecs[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#include "qoi.h"
+
+// Textures can be stored with any of a few codecs, which trade
+// the size of the file (the time to read it) for the time it takes
+// to decode it. The asset pipeline picks one for each texture, and
+// the codec of a file is told by its first bytes: QOI images start
+// with their own magic, the others come in a .tex container.
+//
+// struct tex_header_t {
+//     uint32_t magic;    // "TEXR" (raw) or "TEXL" (LZ4)
+//     uint16_t width;    // of the image, in pixels
+//     uint16_t height;
+//     uint16_t pitch;    // pixels from a stored row to the next
+//     uint8_t  channels; // 3 = RGB, 4 = RGBA
+//     uint8_t  flags;    // TEX_FLAG_*
+//     uint32_t size;     // bytes of pixels, once decompressed
+// };
+//
+// followed by the pixels, as they are or as an LZ4 block. All values
+// are little-endian. A new codec (a format the Graphics Engine reads
+// natively, say) only needs a magic and an entry in the codec table.
+
+// "TEXR" and "TEXL", as read from the files.
+#define TEX_MAGIC_RAW 0x52584554
+#define TEX_MAGIC_LZ4 0x4C584554
+#define TEX_HEADER_SIZE 16
+// The pixels are swizzled for rows of pitch pixels (see swizzle.h).
+#define TEX_FLAG_SWIZZLED 0x01
+
+typedef struct {
+    unsigned int width;
+    unsigned int height;
+    unsigned char channels;
+    // If set, the pixels are stored swizzled, and can only go
+    // into a texture with rows of the stored pitch.
+    unsigned char swizzled;
+    // pixels from a stored row to the next
+    unsigned int pitch;
+} TextureDescriptor;
+
+typedef struct {
+    const char *name;
+    // Reads the header, returns -1 if it's invalid.
+    int (*probe)(const void *data, unsigned int size, TextureDescriptor *desc);
+    // Decodes the whole image into out, with rows pitch pixels
+    // apart. Returns -1 on failure.
+    int (*decode)(const void *data, unsigned int size, TextureDescriptor *desc, void *out, unsigned int pitch);
+    // Decodes the given rows only, like qoiDecodeRows does, or is
+    // NULL if the codec can only decode whole images.
+    int (*decodeRows)(
+        const void *data, unsigned int size, const QoiRowIndex *rowIndex,
+        unsigned int firstRow, unsigned int rows, unsigned int pitch, TextureDescriptor *desc, void *out
+    );
+    // Whether decodeRows needs the image's row index (.qri).
+    int needsRowIndex;
+} TextureCodec;
+
+// Returns NULL if the data isn't in any known format.
+const TextureCodec *findTextureCodec(const void *data, unsigned int size);
+
+#endif
@@ -0,0 +1,132 @@
+#include "decoder.h"
+#include "spsc.h"
+#include "swizzle.h"
+#include "thread.h"
+#include <stddef.h>
+#ifdef __psp__
+#include <pspkernel.h>
+#endif
+
+#define DECODER_STACK_SIZE 0x4000
+// Rows of the screens, which are 512 pixels of 8888 wide.
+#define DECODER_SWIZZLE_MAX_PITCH 2048
+
+static Thread decoderThread;
+static Semaphore jobsAvailable;
+static SpscQueue submitted, decoded;
+// Only ever used by the worker.
+static char swizzleStaging[DECODER_SWIZZLE_MAX_PITCH * SWIZZLE_BLOCK_HEIGHT] __attribute__((aligned(16)));
+
+// Swizzling goes a band at a time, so the rows can't end halfway
+// through one: that would mix swizzled and linear rows in it.
+static int canSwizzle(const DecodeJob *job) {
+    unsigned int rowBytes = job->pitch * job->desc.channels;
+    unsigned int endRow = job->firstRow + job->rows;
+    return rowBytes <= DECODER_SWIZZLE_MAX_PITCH && rowBytes % SWIZZLE_BLOCK_WIDTH == 0 &&
+        job->desc.height % SWIZZLE_BLOCK_HEIGHT == 0 && job->firstRow % SWIZZLE_BLOCK_HEIGHT == 0 &&
+        (endRow % SWIZZLE_BLOCK_HEIGHT == 0 || endRow >= job->desc.height);
+}
+
+static void decodeJob(DecodeJob *job) {
+    // Don't bother decoding if the image has been
+    // requested again since the job was submitted.
+    if (__atomic_load_n(job->currentGeneration, __ATOMIC_RELAXED) != job->generation) {
+        job->result = DECODE_SKIPPED;
+        return;
+    }
+    const TextureCodec *codec = findTextureCodec(job->data, job->size);
+    if (codec == NULL || codec->probe(job->data, job->size, &job->desc)) {
+        job->result = DECODE_FAILED;
+        return;
+    }
+    int wholeImage = job->rows == 0;
+    if (wholeImage) {
+        job->firstRow = 0;
+        job->rows = job->desc.height;
+    }
+    // Check the bands before anything is written.
+    if (job->swizzle && !canSwizzle(job)) {
+        job->result = DECODE_FAILED;
+        return;
+    }
+    int failed;
+    if (wholeImage) {
+        failed = codec->decode(job->data, job->size, &job->desc, job->dest, job->pitch);
+    } else if (codec->decodeRows != NULL) {
+        failed = codec->decodeRows(job->data, job->size, job->rowIndex, job->firstRow, job->rows, job->pitch, &job->desc, job->dest);
+    } else {
+        failed = 1;
+    }
+    if (failed) {
+        job->result = DECODE_FAILED;
+        return;
+    }
+    unsigned int rowBytes = job->pitch * job->desc.channels;
+    unsigned int endRow = job->firstRow + job->rows;
+    if (endRow > job->desc.height) {
+        endRow = job->desc.height;
+    }
+    if (job->swizzle && !job->desc.swizzled && endRow > job->firstRow) {
+        unsigned int width = (job->desc.width * job->desc.channels + SWIZZLE_BLOCK_WIDTH - 1) & ~(SWIZZLE_BLOCK_WIDTH - 1);
+        swizzleRows(job->dest, rowBytes, width, job->firstRow, endRow - job->firstRow, swizzleStaging);
+    }
+#ifdef __psp__
+    // The Graphics Engine doesn't see the data cache, so the
+    // pixels must be in RAM before anyone is told they're done.
+    if (endRow > job->firstRow) {
+        sceKernelDcacheWritebackRange(((char *) job->dest) + job->firstRow * rowBytes, (endRow - job->firstRow) * rowBytes);
+    }
+#endif
+    job->result = DECODE_DONE;
+}
+
+static void decoderMain(void *arg) {
+    for (;;) {
+        semaphoreWait(&jobsAvailable);
+        // Every job comes with a signal, so a signal
+        // without a job means it's time to stop.
+        DecodeJob *job = spscPop(&submitted);
+        if (job == NULL) {
+            break;
+        }
+        decodeJob(job);
+        // No more jobs than the queue holds can be
+        // in flight, so there's always room for it.
+        spscPush(&decoded, job);
+    }
+}
+
+// Returns -1 if the worker couldn't be started.
+int startDecoder(int priority) {
+    spscInit(&submitted);
+    spscInit(&decoded);
+    if (semaphoreCreate(&jobsAvailable, "DecoderJobsSema", 0) < 0) {
+        return -1;
+    }
+    if (threadCreate(&decoderThread, "DecoderThread", priority, DECODER_STACK_SIZE, &decoderMain, NULL) < 0) {
+        semaphoreDestroy(&jobsAvailable);
+        return -1;
+    }
+    return 0;
+}
+
+void stopDecoder(void) {
+    semaphoreSignal(&jobsAvailable);
+    threadJoin(&decoderThread);
+    semaphoreDestroy(&jobsAvailable);
+}
+
+// Returns 0 if too many jobs are waiting to be decoded or collected.
+int submitDecodeJob(DecodeJob *job) {
+    job->result = DECODE_PENDING;
+    if (!spscPush(&submitted, job)) {
+        return 0;
+    }
+    semaphoreSignal(&jobsAvailable);
+    return 1;
+}
+
+// Returns NULL if no job has finished since the last call.
+DecodeJob *pollDecodedJob(void) {
+    return spscPop(&decoded);
+}
@@ -0,0 +1,52 @@
+#ifndef __DECODER_H__
+#define __DECODER_H__
+
+#include "codec.h"
+
+// Decodes textures on a worker thread, with whichever codec
+// they're stored with (see codec.h). Jobs are submitted
+// by a single producer and the finished ones are collected by a
+// single consumer, which may be the same thread. No more than
+// SPSC_CAPACITY jobs may be in flight, from submission to collection.
+
+typedef enum {
+    DECODE_PENDING,
+    DECODE_DONE,
+    DECODE_SKIPPED,
+    DECODE_FAILED,
+} DecodeResult;
+
+typedef struct {
+    // the encoded texture
+    const void *data;
+    unsigned int size;
+    // where the pixels go, with rows pitch pixels apart
+    void *dest;
+    unsigned int pitch;
+    // If rows isn't 0, only the given rows are decoded, which
+    // needs a codec that can and the row index, if it needs one.
+    // Otherwise the whole image is, and the worker sets the rows
+    // to cover all of it.
+    const QoiRowIndex *rowIndex;
+    unsigned int firstRow, rows;
+    // If set, the rows end up swizzled (see swizzle.h), so they
+    // must start and end on a band of them. Textures stored
+    // swizzled already are left as they are.
+    int swizzle;
+    // The job is skipped if the generation it points to has
+    // moved past the one it was submitted for (it's stale).
+    const unsigned int *currentGeneration;
+    unsigned int generation;
+    // filled in by the worker
+    TextureDescriptor desc;
+    DecodeResult result;
+    // free for the submitter to use
+    void *user;
+} DecodeJob;
+
+int startDecoder(int priority);
+void stopDecoder(void);
+int submitDecodeJob(DecodeJob *job);
+DecodeJob *pollDecodedJob(void);
+
+#endif
@@ -2,6 +2,7 @@
 #include <pspdisplay.h>
 #include <string.h>
 #include "alloc.h"
+#include "arena.h"
 #include "state.h"
 
 PSP_MODULE_INFO("Jump King", PSP_MODULE_USER, 1, 0);
@@ -9,6 +10,19 @@ PSP_MAIN_THREAD_ATTR(THREAD_ATTR_USER);
 
 #define BUFFER_WIDTH 512
 #define BUFFER_HEIGHT STATE_SCREEN_HEIGHT
+#ifdef TRIPLE_BUFFERING
+// Three 32-bit buffers as tall as a level screen don't fit
+// in VRAM, so the triple buffered mode uses 16-bit buffers.
+#define BUFFER_PSM GU_PSM_5650
+#define BUFFER_DISPLAY_PSM PSP_DISPLAY_PIXEL_FORMAT_565
+#else
+#define BUFFER_PSM GU_PSM_8888
+#endif
+
+#define PREVIOUS_BUFFER(i) (((i) + ENGINE_BUFFER_COUNT - 1) % ENGINE_BUFFER_COUNT)
+#define NEXT_BUFFER(i) (((i) + 1) % ENGINE_BUFFER_COUNT)
+
+#define MAX_DISPLAY_BUFFER_UPDATES 16
 
 #define VIRTUAL_WIDTH 4096
 #define VIRTUAL_HEIGHT 4096
@@ -18,16 +32,32 @@ PSP_MAIN_THREAD_ATTR(THREAD_ATTR_USER);
 typedef struct {
     short x, y;
     short width, height;
+    // how many buffers still have to receive the update
+    short pendingBuffers;
 } DisplayBufferUpdate;
 
 SceCtrlData __ctrlData;
 SceCtrlLatch __latchData;
 
 static char displayList[DISPLAY_LIST_SIZE] __attribute__((aligned(64)));
-static DisplayBufferUpdate dispBufferUpdates[8];
-static int running, clearFlags;
+static DisplayBufferUpdate dispBufferUpdates[MAX_DISPLAY_BUFFER_UPDATES];
+static volatile int running;
+static int clearFlags;
 static int queuedDispBufferUpdates;
-static void *drawBuffer, *dispBuffer, *depthBuffer;
+static void *frameBuffers[ENGINE_BUFFER_COUNT];
+#ifndef PAINTERS_ORDER
+static void *depthBuffer;
+#endif
+static unsigned int drawIndex, scrollOffset;
+// set by holdFrame, until the next frame starts
+static int frameHeld;
+#ifdef TRIPLE_BUFFERING
+static unsigned int queuedVcount;
+static int frameQueued;
+#endif
+#ifdef PRERENDER
+static void *prerenderSurface;
+#endif
 
 static int exitCallback(int arg1, int arg2, void *common) {
     running = 0;
@@ -50,22 +80,131 @@ static int setupCallbacks(void) {
     return 0;
 }
 
+static void pollInput(void) {
+    sceCtrlReadBufferPositive(&__ctrlData, 1);
+    sceCtrlReadLatch(&__latchData);
+}
+
+#ifdef PIPELINED_UPDATE
+// The update thread runs one frame ahead of the renderer.
+// It has a lower priority than the main thread, so it only
+// gets the CPU while the main thread waits for the vblank
+// or for the Graphics Engine to finish the display list.
+#define UPDATE_THREAD_PRIORITY 0x21
+
+static SceUID updateThreadId, updateStartSema, updateDoneSema;
+static volatile int updateThreadRunning;
+
+static int updateThread(SceSize args, void *argp) {
+    const float delta = *((float *) argp);
+    for (;;) {
+        sceKernelWaitSema(updateStartSema, 1, NULL);
+        if (!updateThreadRunning) {
+            break;
+        }
+        pollInput();
+        updateCurrentState(delta);
+        sceKernelSignalSema(updateDoneSema, 1);
+    }
+    return 0;
+}
+
+static void startUpdateThread(float delta) {
+    updateStartSema = sceKernelCreateSema("UpdateStartSema", 0, 0, 1, NULL);
+    updateDoneSema = sceKernelCreateSema("UpdateDoneSema", 0, 0, 1, NULL);
+    if (updateStartSema < 0 || updateDoneSema < 0) {
+        panic("Failed to create the update semaphores.");
+    }
+    updateThreadId = sceKernelCreateThread("UpdateThread", &updateThread, UPDATE_THREAD_PRIORITY, 0x4000, THREAD_ATTR_USER, NULL);
+    if (updateThreadId < 0) {
+        panic("Failed to create the update thread.");
+    }
+    updateThreadRunning = 1;
+    // The thread gets its own copy of the argument.
+    sceKernelStartThread(updateThreadId, sizeof(delta), &delta);
+}
+
+static void stopUpdateThread(void) {
+    // Wait for the last update to finish, then wake
+    // the thread up one last time so that it can exit.
+    sceKernelWaitSema(updateDoneSema, 1, NULL);
+    updateThreadRunning = 0;
+    sceKernelSignalSema(updateStartSema, 1);
+    sceKernelWaitThreadEnd(updateThreadId, NULL);
+    sceKernelDeleteThread(updateThreadId);
+    sceKernelDeleteSema(updateDoneSema);
+    sceKernelDeleteSema(updateStartSema);
+}
+#endif
+
 static void startFrame(void) {
+    // What the last frame allocated is no longer needed.
+    resetFrameArena();
     sceGuStart(GU_DIRECT, displayList);
-    sceGuClear(clearFlags);
+#ifdef TRIPLE_BUFFERING
+    // The GU only knows about two buffers, so we have
+    // to tell it which one to draw to.
+    sceGuDrawBufferList(BUFFER_PSM, ((char *) frameBuffers[drawIndex]) + scrollOffset, BUFFER_WIDTH);
+#endif
+    if (clearFlags) {
+        sceGuClear(clearFlags);
+    }
 
-    unsigned int *disp = vabsptr(dispBuffer);
-    unsigned int *draw = vabsptr(drawBuffer);
-    for (int i = 0; i < queuedDispBufferUpdates; i++) {
-        DisplayBufferUpdate *u = &dispBufferUpdates[i];
-        sceGuCopyImage(GU_PSM_8888, u->x, u->y, u->width, u->height, BUFFER_WIDTH, draw, u->x, u->y, BUFFER_WIDTH, disp);
+    // Copy the areas that have been drawn only in the previous
+    // buffer to the one we're drawing to. Each update travels
+    // from buffer to buffer until all of them have received it.
+    // A held frame has already copied them to this buffer.
+    if (!frameHeld) {
+        unsigned int *prev = vabsptr(frameBuffers[PREVIOUS_BUFFER(drawIndex)]);
+        unsigned int *draw = vabsptr(frameBuffers[drawIndex]);
+        int pending = 0;
+        for (int i = 0; i < queuedDispBufferUpdates; i++) {
+            DisplayBufferUpdate *u = &dispBufferUpdates[i];
+            sceGuCopyImage(BUFFER_PSM, u->x, u->y, u->width, u->height, BUFFER_WIDTH, prev, u->x, u->y, BUFFER_WIDTH, draw);
+            if (--u->pendingBuffers > 0) {
+                dispBufferUpdates[pending++] = *u;
+            }
+        }
+        queuedDispBufferUpdates = pending;
     }
-    queuedDispBufferUpdates = 0;
+    frameHeld = 0;
 }
 
 static void endFrame(void) {
     // Start rendering.
     sceGuFinish();
+    if (frameHeld) {
+        // Keep showing what's on screen, at the same pace, and
+        // draw the next frame to the same buffer.
+        sceGuSync(GU_SYNC_WHAT_DONE, GU_SYNC_FINISH);
+        if (!sceDisplayIsVblank()) {
+            sceDisplayWaitVblankStartCB();
+        }
+#ifdef TRIPLE_BUFFERING
+        // Any frame that was queued is on screen now.
+        frameQueued = 0;
+#endif
+        return;
+    }
+#ifdef TRIPLE_BUFFERING
+    // Wait for the frame to finish rendering.
+    sceGuSync(GU_SYNC_WHAT_DONE, GU_SYNC_FINISH);
+    // If the previous frame is still waiting for its V-blank, queueing
+    // this one would replace it, and the buffer we're going to draw to
+    // next would stay on screen. This only blocks if we're more than
+    // one frame ahead of the display.
+    if (frameQueued && sceDisplayGetVcount() == queuedVcount) {
+        sceDisplayWaitVblankStartCB();
+    } else {
+        // We didn't wait in a CB function, so give the
+        // loader's callbacks a chance to run anyway.
+        sceKernelCheckCallback();
+    }
+    // Show the frame on the next V-blank, without waiting for it.
+    sceDisplaySetFrameBuf(((char *) vabsptr(frameBuffers[drawIndex])) + scrollOffset, BUFFER_WIDTH, BUFFER_DISPLAY_PSM, PSP_DISPLAY_SETBUF_NEXTFRAME);
+    queuedVcount = sceDisplayGetVcount();
+    frameQueued = 1;
+#else
     // Wait for the next V-blank interval.
     if (!sceDisplayIsVblank()) {
         sceDisplayWaitVblankStartCB();
@@ -74,29 +213,50 @@ static void endFrame(void) {
     sceGuSync(GU_SYNC_WHAT_DONE, GU_SYNC_FINISH);
     // Swap the buffers.
     sceGuSwapBuffers();
+#endif
+    drawIndex = NEXT_BUFFER(drawIndex);
 }
 
 static void initGu(void) {
-    // Reserve VRAM for draw, display and depth buffers.
-    drawBuffer = vrelptr(vramalloc(getVramMemorySize(BUFFER_WIDTH, BUFFER_HEIGHT, GU_PSM_8888)));
-    dispBuffer = vrelptr(vramalloc(getVramMemorySize(BUFFER_WIDTH, BUFFER_HEIGHT, GU_PSM_8888)));
-    depthBuffer = vrelptr(vramalloc(getVramMemorySize(BUFFER_WIDTH, PSP_SCREEN_HEIGHT, GU_PSM_4444)));
+    memAddStatic(MEMORY_DISPLAY, displayList, sizeof(displayList));
+    // Reserve VRAM for the frame and depth buffers.
+    for (int i = 0; i < ENGINE_BUFFER_COUNT; i++) {
+        frameBuffers[i] = vrelptr(memVramAlloc(MEMORY_DISPLAY, getVramMemorySize(BUFFER_WIDTH, BUFFER_HEIGHT, BUFFER_PSM)));
+    }
+    drawIndex = 0;
+    scrollOffset = 0;
+    frameHeld = 0;
+#ifdef TRIPLE_BUFFERING
+    frameQueued = 0;
+#endif
+#ifndef PAINTERS_ORDER
+    depthBuffer = vrelptr(memVramAlloc(MEMORY_DISPLAY, getVramMemorySize(BUFFER_WIDTH, PSP_SCREEN_HEIGHT, GU_PSM_4444)));
+#endif
     // Initialize the graphics utility.
     sceGuInit();
     sceGuStart(GU_DIRECT, displayList);
     // Set up the buffers.
-    sceGuDrawBuffer(GU_PSM_8888, drawBuffer, BUFFER_WIDTH);
-    sceGuDispBuffer(PSP_SCREEN_WIDTH, PSP_SCREEN_HEIGHT, dispBuffer, BUFFER_WIDTH);
+    sceGuDrawBuffer(BUFFER_PSM, frameBuffers[drawIndex], BUFFER_WIDTH);
+    sceGuDispBuffer(PSP_SCREEN_WIDTH, PSP_SCREEN_HEIGHT, frameBuffers[PREVIOUS_BUFFER(drawIndex)], BUFFER_WIDTH);
+#ifndef PAINTERS_ORDER
     sceGuDepthBuffer(depthBuffer, BUFFER_WIDTH);
+#endif
     // Set up viewport.
     sceGuOffset((VIRTUAL_WIDTH - PSP_SCREEN_WIDTH) / 2, (VIRTUAL_HEIGHT - PSP_SCREEN_HEIGHT) / 2);
     sceGuViewport(VIRTUAL_WIDTH / 2, VIRTUAL_HEIGHT / 2, PSP_SCREEN_WIDTH, PSP_SCREEN_HEIGHT);
     sceGuScissor(0, 0, PSP_SCREEN_WIDTH, PSP_SCREEN_HEIGHT);
     sceGuEnable(GU_SCISSOR_TEST);
+#ifdef PAINTERS_ORDER
+    // Visibility only depends on the draw order,
+    // so don't test or write depth at all.
+    sceGuDisable(GU_DEPTH_TEST);
+    sceGuDepthMask(GU_TRUE);
+#else
     // Set up depth test.
     sceGuDepthRange(65535, 0);
     sceGuDepthFunc(GU_GEQUAL);
     sceGuEnable(GU_DEPTH_TEST);
+#endif
     // Enable texture support.
     sceGuEnable(GU_TEXTURE_2D);
     // Set the default clear values.
@@ -106,8 +266,9 @@ static void initGu(void) {
     sceGuFinish();
     // Wait for render to finish.
     sceGuSync(GU_SYNC_WHAT_DONE, GU_SYNC_FINISH);
-    // Wait for the next V-blank interval.
-    sceDisplayWaitVblankStart();
+    // Wait for the next V-blank interval, letting the
+    // loader's callbacks move the boot's reads along.
+    sceDisplayWaitVblankStartCB();
     // Start displaying frames.
     sceGuDisplay(GU_TRUE);
 }
@@ -116,17 +277,25 @@ static void endGu(void) {
     sceGuDisplay(GU_FALSE);
     sceGuTerm();
     // Remember to free the buffers.
-    vfree(vabsptr(depthBuffer));
-    vfree(vabsptr(dispBuffer));
-    vfree(vabsptr(drawBuffer));
+#ifndef PAINTERS_ORDER
+    memVramFree(vabsptr(depthBuffer));
+#endif
+    for (int i = 0; i < ENGINE_BUFFER_COUNT; i++) {
+        memVramFree(vabsptr(frameBuffers[i]));
+    }
 }
 
 static void init(void) {
     running = 1;
     // Set the default clear flags.
-    clearFlags = GU_DEPTH_BUFFER_BIT | GU_COLOR_BUFFER_BIT;
+    setClearFlags(GU_DEPTH_BUFFER_BIT | GU_COLOR_BUFFER_BIT);
     // Initialize resource loader.
     initLoader();
+    // Reserve the arenas before the first state allocates from them.
+    initArenas();
+    // Enter the boot state, which starts reading the game's
+    // assets in the background while the rest is initialized.
+    switchState(&BOOT);
     // Set up the input mode.
     sceCtrlSetSamplingCycle(0);
     sceCtrlSetSamplingMode(PSP_CTRL_MODE_DIGITAL);
@@ -134,54 +303,141 @@ static void init(void) {
     initGu();
     // Set up callbacks.
     setupCallbacks();
-    // Set the initial game state.
-    switchState(&GAME);
+}
+
+// Shows the boot state's splash until it switches to the game.
+// It runs on the main thread alone, even with PIPELINED_UPDATE,
+// so that the states can be switched from the update.
+static void boot(float delta) {
+    while (running && getCurrentState() == &BOOT) {
+        pollInput();
+        updateCurrentState(delta);
+        pollLoader();
+        startFrame();
+        renderCurrentState();
+        endFrame();
+    }
 }
 
 static void cleanup(void) {
     cleanupCurrentState();
     endGu();
     endLoader();
+    endArenas();
     sceKernelExitGame();
 }
 
 void setClearFlags(int flags) {
+#ifdef PAINTERS_ORDER
+    // There's no depth buffer to clear.
+    flags &= ~GU_DEPTH_BUFFER_BIT;
+#endif
     clearFlags = flags;
 }
 
 void queueDisplayBufferUpdate(short x, short y, short w, short h) {
+    if (queuedDispBufferUpdates == MAX_DISPLAY_BUFFER_UPDATES) {
+        panic("Too many display buffer updates queued (the maximum is %d)", MAX_DISPLAY_BUFFER_UPDATES);
+    }
     dispBufferUpdates[queuedDispBufferUpdates].x = x;
     dispBufferUpdates[queuedDispBufferUpdates].y = y;
     dispBufferUpdates[queuedDispBufferUpdates].width = w;
     dispBufferUpdates[queuedDispBufferUpdates].height = h;
+    dispBufferUpdates[queuedDispBufferUpdates].pendingBuffers = ENGINE_BUFFER_COUNT - 1;
     ++queuedDispBufferUpdates;
 }
 
+void holdFrame(void) {
+    frameHeld = 1;
+}
+
 void setBackgroundScroll(short offset) {
     if (offset > PSP_SCREEN_MAX_SCROLL) {
         panic("Scroll value too big. Got %d but the maximum is %d", offset, PSP_SCREEN_MAX_SCROLL);
     } else if (offset < 0) {
         panic("Scroll value is negative. Got %d", offset);
     }
-    unsigned int bufferOffset = getVramMemorySize(BUFFER_WIDTH, (unsigned int) offset, GU_PSM_8888);
-    sceGuDrawBuffer(GU_PSM_8888, ((char *) drawBuffer) + bufferOffset, BUFFER_WIDTH);
-    sceGuDispBuffer(PSP_SCREEN_WIDTH, PSP_SCREEN_HEIGHT, ((char *) dispBuffer) + bufferOffset, BUFFER_WIDTH);
+    scrollOffset = getVramMemorySize(BUFFER_WIDTH, (unsigned int) offset, BUFFER_PSM);
+#ifdef TRIPLE_BUFFERING
+    // The display offset is applied when the frame is queued.
+    sceGuDrawBufferList(BUFFER_PSM, ((char *) frameBuffers[drawIndex]) + scrollOffset, BUFFER_WIDTH);
+#else
+    sceGuDrawBuffer(BUFFER_PSM, ((char *) frameBuffers[drawIndex]) + scrollOffset, BUFFER_WIDTH);
+    sceGuDispBuffer(PSP_SCREEN_WIDTH, PSP_SCREEN_HEIGHT, ((char *) frameBuffers[PREVIOUS_BUFFER(drawIndex)]) + scrollOffset, BUFFER_WIDTH);
+#endif
+}
+
+#ifdef PRERENDER
+int initPrerenderSurface(void) {
+    // The surface only holds what's in view. It's optional,
+    // so it's only allocated if there's room for it.
+    unsigned int size = getVramMemorySize(BUFFER_WIDTH, PSP_SCREEN_HEIGHT, BUFFER_PSM);
+    prerenderSurface = (vlargestblock() >= size) ? memVramAlloc(MEMORY_DISPLAY, size) : NULL;
+    return prerenderSurface != NULL;
+}
+
+void beginPrerender(void) {
+    // Redirect drawing to the surface...
+    sceGuDrawBufferList(BUFFER_PSM, vrelptr(prerenderSurface), BUFFER_WIDTH);
+}
+
+void endPrerender(void) {
+    // ...and back to the frame buffer.
+    sceGuDrawBufferList(BUFFER_PSM, ((char *) frameBuffers[drawIndex]) + scrollOffset, BUFFER_WIDTH);
+}
+
+void presentPrerender(void) {
+    // Copy the surface to the view in the draw buffer.
+    char *view = ((char *) vabsptr(frameBuffers[drawIndex])) + scrollOffset;
+    sceGuCopyImage(BUFFER_PSM, 0, 0, PSP_SCREEN_WIDTH, PSP_SCREEN_HEIGHT, BUFFER_WIDTH, prerenderSurface, 0, 0, BUFFER_WIDTH, view);
+}
+
+void endPrerenderSurface(void) {
+    if (prerenderSurface != NULL) {
+        memVramFree(prerenderSurface);
+        prerenderSurface = NULL;
+    }
 }
+#endif
 
 int main(void) {
     init();
     const float delta = 1.0f / sceDisplayGetFramePerSec();
+    boot(delta);
+#ifdef PIPELINED_UPDATE
+    startUpdateThread(delta);
+    // Simulate the first frame.
+    sceKernelSignalSema(updateStartSema, 1);
+    while (running) {
+        // Wait for the update of the frame we're about to render.
+        sceKernelWaitSema(updateDoneSema, 1, NULL);
+        // Start the frame while the update is stopped,
+        // since that resets the frame arena it shares.
+        startFrame();
+        // Start the update of the next frame. It will run
+        // while this thread waits on the Graphics Engine.
+        sceKernelSignalSema(updateStartSema, 1);
+        // Collect the textures that finished loading.
+        pollLoader();
+        // Render the current state from the published snapshot.
+        renderCurrentState();
+        endFrame();
+    }
+    stopUpdateThread();
+#else
     while (running) {
         // Poll input.
-        sceCtrlReadBufferPositive(&__ctrlData, 1);
-        sceCtrlReadLatch(&__latchData);
+        pollInput();
         // Update the current state.
         updateCurrentState(delta);
+        // Collect the textures that finished loading.
+        pollLoader();
         // Render the current state.
         startFrame();
         renderCurrentState();
         endFrame();
     }
+#endif
     cleanup();
     return 0;
 }
@@ -7,9 +7,38 @@
 #define PSP_SCREEN_HEIGHT 272
 #define PSP_SCREEN_MAX_SCROLL (STATE_SCREEN_HEIGHT - PSP_SCREEN_HEIGHT)
 
+// The number of frame buffers the engine cycles through.
+// States that don't clear the color buffer need to keep
+// track of what they have drawn in each one of them.
+#ifdef TRIPLE_BUFFERING
+#define ENGINE_BUFFER_COUNT 3
+#else
+#define ENGINE_BUFFER_COUNT 2
+#endif
+
+// Render layers, from the farthest to the nearest.
+// They're used as the depth of the vertices. When the game
+// is built with PAINTERS_ORDER there is no depth buffer,
+// and the layers have to be drawn in this order.
+typedef enum {
+    RENDER_LAYER_MIDGROUND,
+    RENDER_LAYER_HUD,
+    RENDER_LAYER_SPRITES,
+} RenderLayer;
+
 void setClearFlags(int flags);
 void queueDisplayBufferUpdate(short x, short y, short w, short h);
+// Keeps what's on screen for one more frame: this frame isn't shown,
+// and the next one is drawn to the same buffer, over what this one drew.
+void holdFrame(void);
 void setBackgroundScroll(short offset);
+#ifdef PRERENDER
+int initPrerenderSurface(void);
+void beginPrerender(void);
+void endPrerender(void);
+void presentPrerender(void);
+void endPrerenderSurface(void);
+#endif
 
 // Singletons.
 extern SceCtrlData __ctrlData;
@@ -1,84 +1,411 @@
 #include "state.h"
 #include "level.h"
 #include "king.h"
+#include "snapshot.h"
+#include "resume.h"
+#include "rewind.h"
+#include "ghost.h"
+#include "hud.h"
+#include "telemetry.h"
+#include "audio.h"
+#include "arena.h"
 #include <math.h>
 
 #define SCREEN_SCROLL_SPEED 0.1f
+// How many frames each frame the rewind trigger is held goes back.
+#define REWIND_STEP 2
 
-static short kingSX[2], kingSY[2];
-static short prevKingSX[2], prevKingSY[2];
-static unsigned int vBuffer, frameCounter, currentScreenIndex;
+#ifdef PRERENDER
+// How close (in pixels) the player has to be to the top or
+// the bottom of the screen for the screen above or below to
+// be pre-rendered, and how many lines are rendered per frame.
+#define PRERENDER_EDGE_DISTANCE (PSP_SCREEN_HEIGHT / 2)
+#define PRERENDER_BAND_LINES 34
+#define PRERENDER_NONE ((unsigned int) -1)
+#endif
+
+static short kingSX[ENGINE_BUFFER_COUNT], kingSY[ENGINE_BUFFER_COUNT];
+static short prevKingSX[ENGINE_BUFFER_COUNT], prevKingSY[ENGINE_BUFFER_COUNT];
+// Where the ghost's sprite was drawn (top-left), if it was, in each buffer.
+static short ghostSX[ENGINE_BUFFER_COUNT], ghostSY[ENGINE_BUFFER_COUNT];
+static int ghostDrawn[ENGINE_BUFFER_COUNT];
+static unsigned int vBuffer, frameCounter;
+// The screen being shown, and the frame it was entered at (for its
+// split time), as taken in from the snapshots.
+static SnapshotView shown;
+static int rewinding;
 static short currentScroll, targetScroll, minScroll, maxScroll;
 
+// The update only touches the simulation state and hands
+// the results to the renderer through the snapshot buffer,
+// so that the engine can run it on a separate thread.
+static King king;
+// The screen the king collides against, copied out of its map, which
+// the renderer may drop meanwhile. It isn't loaded while the map of
+// the screen the king has teleported to is still streamed in.
+static LevelScreen simScreen;
+static unsigned int simScreenIndex;
+static int simScreenLoaded;
+// What the next snapshot is made from. Its king is
+// only filled in when the snapshot is published.
+static GameSnapshot sim;
+static SnapshotBuffer snapshots;
+
+#ifdef PRERENDER
+// The screen being pre-rendered in the engine's spare surface,
+// the scroll it will be entered at and how many of its lines
+// are done. The surface is presented instead of redrawing the
+// screen when the player enters it.
+static int prerenderAvailable, presentingPrerender;
+static unsigned int prerenderScreenIndex;
+static short prerenderScroll, prerenderLines;
+#endif
+
+static void publishSnapshot(void) {
+    sim.king = king;
+    *snapshotBack(&snapshots) = sim;
+    snapshotPublish(&snapshots);
+}
+
+// Copies the screen for the king to collide against. Returns 0,
+// leaving the last one there, if its map's screen data isn't in.
+static int loadSimScreen(unsigned int index) {
+    if (!copyLevelScreenData(index, &simScreen)) {
+        return 0;
+    }
+    simScreenIndex = index;
+    return 1;
+}
+
+// Saves where the player is, unless they've left the level.
+static void saveGame(const GameSnapshot *snapshot) {
+    if (getLevelMap(snapshot->screenIndex) == LEVEL_NO_MAP) {
+        return;
+    }
+    ResumeState state;
+    state.king = snapshot->king;
+    state.screenIndex = snapshot->screenIndex;
+    state.scroll = currentScroll;
+    state.frame = snapshot->frame;
+    saveResumeState(&state);
+}
+
+// Records the frame the snapshot shows into the player's run, which
+// becomes a ghost to race against. Rewound frames are recorded over.
+static void recordGhost(const GameSnapshot *snapshot) {
+    GhostFrame frame;
+    frame.screenX = snapshot->king.screenX;
+    frame.screenY = snapshot->king.screenY;
+    frame.spriteIndex = snapshot->king.spriteIndex;
+    frame.spriteUOffset = snapshot->king.spriteUOffset;
+    recordGhostFrame(snapshot->frame, snapshot->screenIndex, &frame);
+}
+
+// Plays the sounds of what the king did in the frame.
+static void playKingSounds(const King *before, const King *after) {
+    if (after->jumps != before->jumps) {
+        playSound(SOUND_JUMP);
+    }
+    if (before->inAir && !after->inAir) {
+        playSound(SOUND_LAND);
+    } else if (after->inAir && before->velocityX * after->velocityX < 0.0f) {
+        // The king bounced off a wall.
+        playSound(SOUND_BUMP);
+    }
+}
+
 static void init(void) {
-    currentScreenIndex = 0;
-    kingSX[0] = 0; kingSX[1] = 0;
-    kingSY[0] = 0; kingSY[1] = 0;
+    // Pick up where the player left off, if they have played.
+    const ResumeState *resume = loadResumeState();
+    shown.screenIndex = getStartScreen();
+    shown.screenChanges = 0;
+    rewinding = 0;
+    for (int i = 0; i < ENGINE_BUFFER_COUNT; i++) {
+        kingSX[i] = 0;
+        kingSY[i] = 0;
+        ghostDrawn[i] = 0;
+    }
     vBuffer = 0;
     frameCounter = 0;
 
     // Tell the engine to only clear the depth buffer.
     // We don't want to clear the color buffer, since
     // we can't redraw the level background fast enough
-    // for every frame.
+    // for every frame. With PAINTERS_ORDER nothing
+    // gets cleared at all.
     setClearFlags(GU_DEPTH_BUFFER_BIT);
-    // Load the level.
-    loadLevel(0);
+    // Load the player's sprites. The boot has read them already.
+    kingLoadSprites();
+    loadHud();
+#ifdef PRERENDER
+    // Set aside VRAM for pre-rendering before the level takes the rest.
+    prerenderAvailable = initPrerenderSurface();
+    presentingPrerender = 0;
+    prerenderScreenIndex = PRERENDER_NONE;
+#endif
+    // Load the level. This goes last, since the level
+    // takes whatever is left of VRAM for its textures.
+    // Its data has been read by the boot, and its first
+    // screen is decoded in the background: the splash stays
+    // on screen until render finds the screen ready.
+    loadLevel(shown.screenIndex);
+    // Only the table of the ghost's trace is read here,
+    // its segments are streamed in as the screens are.
+    loadGhost();
+    startAudio();
     // Initialize the player.
-    kingCreate();
+    if (resume != NULL) {
+        king = resume->king;
+    } else {
+        kingCreate(&king);
+    }
+
+    // Initialize the simulation.
+    sim.screenIndex = shown.screenIndex;
+    simScreenLoaded = loadSimScreen(sim.screenIndex);
+    sim.screenChanges = shown.screenChanges;
+    sim.entryScroll = -1;
+    sim.frame = (resume != NULL) ? resume->frame : 0;
+    sim.rewinding = 0;
+    initRewind();
+    publishSnapshot();
+    shown.entryFrame = sim.frame;
+    startTelemetry(sim.frame, sim.screenIndex, &king);
 
     // Initialize screen scroll.
-    currentScroll = PSP_SCREEN_MAX_SCROLL;
-    targetScroll = PSP_SCREEN_MAX_SCROLL;
+    currentScroll = getStartScroll();
+    targetScroll = currentScroll;
     minScroll = currentScroll;
     maxScroll = currentScroll;
     setBackgroundScroll(currentScroll);
 }
 
-static void update(float delta) {
+#ifdef PRERENDER
+// Renders a band of the screen the player is most likely
+// to enter next, at the scroll it will be entered at.
+static void prerenderNextScreen(const King *king) {
+    unsigned int index;
+    short scroll;
+    if (king->screenY < PRERENDER_EDGE_DISTANCE) {
+        // Near the top: the screen above is entered from the bottom.
+        index = shown.screenIndex + 1;
+        scroll = PSP_SCREEN_MAX_SCROLL;
+    } else if (king->screenY > LEVEL_SCREEN_HEIGHT - PRERENDER_EDGE_DISTANCE) {
+        // Near the bottom: the screen below is entered from the top.
+        if (shown.screenIndex == 0) {
+            return;
+        }
+        index = shown.screenIndex - 1;
+        scroll = 0;
+    } else {
+        return;
+    }
+    if (index != prerenderScreenIndex || scroll != prerenderScroll) {
+        prerenderScreenIndex = index;
+        prerenderScroll = scroll;
+        prerenderLines = 0;
+    }
+    if (prerenderLines == PSP_SCREEN_HEIGHT) {
+        return;
+    }
+    short lines = PSP_SCREEN_HEIGHT - prerenderLines;
+    if (lines > PRERENDER_BAND_LINES) {
+        lines = PRERENDER_BAND_LINES;
+    }
+    beginPrerender();
+    if (renderAdjacentLevelScreenLines(index, scroll, prerenderLines, lines)) {
+        prerenderLines += lines;
+    }
+    endPrerender();
+}
+#endif
+
+// Simulates a frame with the given input.
+static void step(const KingInput *input, float delta) {
+    // If the player has gone through a teleport link into another
+    // map, wait for the map's screen data to be streamed in.
+    if (!simScreenLoaded) {
+        simScreenLoaded = loadSimScreen(sim.screenIndex);
+        if (!simScreenLoaded) {
+            ++sim.frame;
+            return;
+        }
+    }
+
     // Update the player.
-    LevelScreen *screen = getLevelScreen(currentScreenIndex);
-    unsigned int newScreenIndex = currentScreenIndex;
-    kingUpdate(delta, screen, &newScreenIndex);
+    unsigned int newScreenIndex = sim.screenIndex;
+    kingUpdate(&king, input, delta, &simScreen, &newScreenIndex);
 
     // Check if we need to change the screen.
-    if (newScreenIndex != currentScreenIndex) {
+    if (newScreenIndex != sim.screenIndex) {
         // Check if we're moving vertically in the world.
         // The teleportIndex stores the screen the game
         // has to switch to if the player goes walks 
         // out of the level screen bounds from
         // the left or the right side.
-        if (newScreenIndex != screen->teleportIndex) {
-            if (newScreenIndex > currentScreenIndex) {
-                // If the player has moved up a screen,
-                // we want to render the new screen from
-                // the bottom.
-                targetScroll = PSP_SCREEN_MAX_SCROLL;
-                currentScroll = targetScroll;
-            } else {
-                // If the player has moved down a screen,
-                // we want to render the new screen from
-                // the top.
-                targetScroll = 0;
-                currentScroll = targetScroll;
-            }
+        int teleported = newScreenIndex == simScreen.teleportIndex;
+        // Maps are only left through teleport links.
+        int leftMap = getLevelMap(newScreenIndex) != getLevelMap(sim.screenIndex);
+        // The new screen is rendered from the bottom if the player has
+        // moved up, from the top if they've moved down, and horizontal
+        // transitions keep the current scroll.
+        snapshotChangeScreen(&sim, newScreenIndex, teleported, PSP_SCREEN_MAX_SCROLL);
+        // If the player has left the level, keep
+        // colliding against the last valid screen.
+        if ((teleported || !leftMap) && loadSimScreen(sim.screenIndex)) {
+            simScreenLoaded = 1;
+        } else if (teleported && getLevelMap(sim.screenIndex) != LEVEL_NO_MAP) {
+            simScreenLoaded = 0;
+        }
+    }
+
+    ++sim.frame;
+}
+
+// Goes back REWIND_STEP frames, or as far as the history reaches:
+// the snapshot before the frame is restored, and the frames after it
+// are simulated again with the inputs they were first simulated with.
+static void rewind(float delta) {
+    unsigned int start = getRewindStart(sim.frame);
+    unsigned int target = (sim.frame - start > REWIND_STEP) ? sim.frame - REWIND_STEP : start;
+    RewindState state;
+    unsigned int frame;
+    if (target == sim.frame || findRewindSnapshot(target, &state, &frame)) {
+        return;
+    }
+    // Snapshots are only taken where the screen data is there,
+    // but its map may have been dropped since.
+    if (!loadSimScreen(state.screenIndex)) {
+        return;
+    }
+    unsigned int screenIndex = sim.screenIndex;
+    unsigned int screenChanges = sim.screenChanges;
+    king = state.king;
+    sim.screenIndex = state.screenIndex;
+    simScreenLoaded = 1;
+    sim.frame = frame;
+    while (sim.frame < target) {
+        KingInput input;
+        getRewindInput(sim.frame, &input);
+        step(&input, delta);
+    }
+    // Whatever screens were gone through, the renderer only needs
+    // to know if it ends up on another one, which it keeps the
+    // scroll on.
+    sim.screenChanges = (sim.screenIndex != screenIndex) ? screenChanges + 1 : screenChanges;
+    sim.entryScroll = -1;
+}
+
+static void update(float delta) {
+#ifdef DEBUG
+    // SELECT shows where the memory has gone.
+    if (Latch.uiMake & PSP_CTRL_SELECT) {
+        dumpMemoryStats();
+        dumpArenaStats();
+    }
+#endif
+    if (Input.Buttons & PSP_CTRL_LTRIGGER) {
+        rewind(delta);
+        sim.rewinding = 1;
+        publishSnapshot();
+        return;
+    }
+    // Once the trigger is released, the game goes on from
+    // where it's been rewound to, with a new history.
+    if (sim.rewinding) {
+        truncateRewind(sim.frame);
+        sim.rewinding = 0;
+    }
+
+    KingInput input;
+    input.direction = (Input.Buttons & PSP_CTRL_LEFT) ? -1 : (Input.Buttons & PSP_CTRL_RIGHT) ? +1 : 0;
+    input.jump = (Input.Buttons & PSP_CTRL_CROSS) != 0;
+    // Only states the simulation can be put back
+    // in are kept: in the level, with screen data.
+    RewindState state;
+    state.king = king;
+    state.screenIndex = sim.screenIndex;
+    int restorable = simScreenLoaded && simScreenIndex == sim.screenIndex;
+    recordRewindFrame(sim.frame, restorable ? &state : NULL, &input);
+    // Rewound frames that are simulated again aren't
+    // recorded, since they've been recorded already.
+    King before = king;
+    unsigned int frame = sim.frame, screenIndex = sim.screenIndex;
+    step(&input, delta);
+    recordTelemetry(frame, screenIndex, sim.screenIndex, &before, &king);
+    playKingSounds(&before, &king);
+    publishSnapshot();
+}
+
+// NOTE: The layers are drawn back to front: first the
+//       midground (the full screen, the new lines and the
+//       area behind the player), then the player.
+//       This order must be kept, since the depth buffer
+//       is disabled when building with PAINTERS_ORDER.
+static void render(void) {
+    const GameSnapshot *snapshot = snapshotFront(&snapshots);
+
+    // Check if the simulation has changed the screen.
+    if (snapshotTakeScreen(&shown, snapshot)) {
+        if (shown.entryScroll >= 0) {
+            currentScroll = shown.entryScroll;
+            targetScroll = currentScroll;
             minScroll = currentScroll;
             maxScroll = currentScroll;
             setBackgroundScroll(currentScroll);
         }
-        currentScreenIndex = newScreenIndex;
         frameCounter = 0;
-        // Trigger the level texture loader.
-        getLevelScreen(currentScreenIndex);
+#ifdef PRERENDER
+        // If the new screen has been pre-rendered, it can
+        // be copied in instead of being drawn again.
+        presentingPrerender = prerenderScreenIndex == shown.screenIndex
+                              && prerenderScroll == currentScroll
+                              && prerenderLines == PSP_SCREEN_HEIGHT;
+        prerenderScreenIndex = PRERENDER_NONE;
+#endif
+        // Trigger the level texture loader. While rewinding, the
+        // screens may only be skipped through, so their neighbours
+        // are left for when the rewind stops.
+        if (snapshot->rewinding) {
+            seekLevelScreen(shown.screenIndex);
+        } else {
+            getLevelScreen(shown.screenIndex);
+            // Every new screen is a point the game can be resumed from.
+            saveGame(snapshot);
+        }
+    } else if (rewinding && !snapshot->rewinding) {
+        getLevelScreen(shown.screenIndex);
     }
-}
+    rewinding = snapshot->rewinding;
+    streamLevelScreens();
+    // After the screens, so that their reads are queued first.
+    streamAudio();
+    recordGhost(snapshot);
+    flushTelemetry(snapshot->frame);
+    retryResumeState();
 
-static void render(void) {
-    if (frameCounter < 2) {
-        // Render the entire screen for the two frames.
-        // This has to be done twice, one time for each
-        // buffer. See explanation at the end of the function.
+    // Until the rows in view of the current screen's texture are
+    // ready, draw nothing and keep the last frame on screen.
+    if (!isLevelScreenReady(currentScroll, currentScroll + PSP_SCREEN_HEIGHT)) {
+        holdFrame();
+        return;
+    }
+    markBootInteractive();
+
+    if (frameCounter < ENGINE_BUFFER_COUNT) {
+        // Render the entire screen for the first frames.
+        // This has to be done once for each buffer.
+        // See explanation at the end of the function.
+#ifdef PRERENDER
+        if (presentingPrerender) {
+            presentPrerender();
+        } else {
+            renderLevelScreen(currentScroll);
+        }
+#else
         renderLevelScreen(currentScroll);
+#endif
+        resetHud(vBuffer, currentScroll);
         ++frameCounter;
     } else {
         // Only decrement by half here since we need the
@@ -102,14 +429,24 @@ static void render(void) {
         kingSX[vBuffer] -= PLAYER_SPRITE_HALFW;
         kingSY[vBuffer] -= PLAYER_SPRITE_HALFH;
         
-        if (targetScroll != currentScroll) {
-            // Linear interpolate between the current screen scroll value
-            // and the target screen scroll value.
-            currentScroll = currentScroll + (short) ceilf(((float) (targetScroll - currentScroll)) * SCREEN_SCROLL_SPEED);
+        // Linear interpolate between the current screen scroll value
+        // and the target screen scroll value. Only scroll to rows
+        // of the texture that have been decoded.
+        short nextScroll = currentScroll + (short) ceilf(((float) (targetScroll - currentScroll)) * SCREEN_SCROLL_SPEED);
+        if (nextScroll != currentScroll && isLevelScreenReady(nextScroll, nextScroll + PSP_SCREEN_HEIGHT)) {
+            // The HUD stays put in the view, so paint
+            // over it before the view moves away from it.
+            eraseHud(vBuffer, currentScroll);
+            currentScroll = nextScroll;
             // Scroll the screen.
             setBackgroundScroll(currentScroll);
             // Workaround to clear scrolling artifacts.
             forceCleanLevelArtifactAt(prevKingSX[vBuffer], prevKingSY[vBuffer], PLAYER_SPRITE_WIDTH, PLAYER_SPRITE_HEIGHT);
+            touchHud(prevKingSX[vBuffer], prevKingSY[vBuffer], PLAYER_SPRITE_WIDTH, PLAYER_SPRITE_HEIGHT);
+            if (ghostDrawn[vBuffer]) {
+                forceCleanLevelArtifactAt(ghostSX[vBuffer], ghostSY[vBuffer], PLAYER_SPRITE_WIDTH, PLAYER_SPRITE_HEIGHT);
+                touchHud(ghostSX[vBuffer], ghostSY[vBuffer], PLAYER_SPRITE_WIDTH, PLAYER_SPRITE_HEIGHT);
+            }
         }
 
         // Render new screen lines.
@@ -135,30 +472,77 @@ static void render(void) {
         // Paint over where the king was in the previous frame.
         // Add a 4 pixel padding to account for the error introduced by the fixed update loop.
         renderLevelScreenSection(kingSX[vBuffer] - 8, kingSY[vBuffer] - 8, PLAYER_SPRITE_WIDTH + 16, PLAYER_SPRITE_HEIGHT + 16, currentScroll);
+        touchHud(kingSX[vBuffer] - 8, kingSY[vBuffer] - 8, PLAYER_SPRITE_WIDTH + 16, PLAYER_SPRITE_HEIGHT + 16);
+        // And where the ghost was, the same way.
+        if (ghostDrawn[vBuffer]) {
+            renderLevelScreenSection(ghostSX[vBuffer] - 8, ghostSY[vBuffer] - 8, PLAYER_SPRITE_WIDTH + 16, PLAYER_SPRITE_HEIGHT + 16, currentScroll);
+            touchHud(ghostSX[vBuffer] - 8, ghostSY[vBuffer] - 8, PLAYER_SPRITE_WIDTH + 16, PLAYER_SPRITE_HEIGHT + 16);
+        }
     }
 
+    // Render the HUD over the level, and under the sprites.
+    HudStats stats;
+    stats.frames = snapshot->frame;
+    // A rewind can go back to before the screen was entered.
+    stats.screenFrames = (snapshot->frame > shown.entryFrame) ? snapshot->frame - shown.entryFrame : 0;
+    stats.jumps = snapshot->king.jumps;
+    stats.falls = snapshot->king.falls;
+    renderHud(vBuffer, &stats, currentScroll);
+
     prevKingSX[vBuffer] = kingSX[vBuffer];
     prevKingSY[vBuffer] = kingSY[vBuffer];
     
+    // Render the ghost behind the player. Until its segment
+    // has been read, it's left out.
+    GhostFrame ghost;
+    ghostDrawn[vBuffer] = getGhostFrame(snapshot->frame, shown.screenIndex, &ghost) == 0;
+    if (ghostDrawn[vBuffer]) {
+        kingRenderGhost(ghost.screenX, ghost.screenY, ghost.spriteIndex, ghost.spriteUOffset, currentScroll);
+        ghostSX[vBuffer] = ghost.screenX - PLAYER_SPRITE_HALFW;
+        ghostSY[vBuffer] = ghost.screenY - PLAYER_SPRITE_HEIGHT;
+    }
+
     // Render the player.
-    kingRender(&kingSX[vBuffer], &kingSY[vBuffer], currentScroll);
+    kingRender(&snapshot->king, &kingSX[vBuffer], &kingSY[vBuffer], currentScroll);
+
+#ifdef PRERENDER
+    // Once the current screen is in every buffer, the surface
+    // is free to prepare the next one with what's left of the frame.
+    if (prerenderAvailable && frameCounter >= ENGINE_BUFFER_COUNT) {
+        prerenderNextScreen(&snapshot->king);
+    }
+#endif
 
-    // The last line flips the buffer selector.
-    // This is done because the PSP is double buffered, meaning
-    // that while one frame is being shown on the screen,
-    // the other is being drawn by the Graphics Engine to a
+    // The last line moves the buffer selector to the next buffer.
+    // This is done because the PSP is double (or triple) buffered,
+    // meaning that while one frame is being shown on the screen,
+    // the next is being drawn by the Graphics Engine to a
     // separate buffer. This is done to avoid tearing.
     // To compensate for this, we need to remember at which
     // screen coordinates the player's sprite was drawn at, 
     // for each buffer, and paint over them in the right order.
     // For more information on double buffering check out:
     // https://en.wikipedia.org/wiki/Multiple_buffering#Double_buffering_in_computer_graphics
-    vBuffer = !vBuffer;
+    vBuffer = (vBuffer + 1) % ENGINE_BUFFER_COUNT;
 }
 
 static void cleanup(void) {
-    kingDestroy();
+    // Save the game as it is when it's quit,
+    // and wait for it to be written.
+    const GameSnapshot *snapshot = snapshotFront(&snapshots);
+    stopAudio();
+    saveGame(snapshot);
+    flushResumeState();
+    endTelemetry(snapshot->frame, snapshot->screenIndex, &snapshot->king);
+    // Keep the run, so that it can be raced against.
+    saveGhostRecording();
+    unloadGhost();
+    unloadHud();
     unloadLevel();
+#ifdef PRERENDER
+    endPrerenderSurface();
+#endif
+    kingUnloadSprites();
 }
 
 const GameState GAME = {
@@ -0,0 +1,380 @@
+#include "ghost.h"
+#include "arena.h"
+#include "checksum.h"
+#include "loader.h"
+#include "panic.h"
+#include <pspkernel.h>
+#include <string.h>
+
+#define GHOST_PATH "ghost.bin"
+#define GHOST_RECORD_PATH "lastrun.bin"
+
+#define GHOST_FRAME_SPRITE 0x0F
+#define GHOST_FRAME_FLIPPED 0x10
+#define GHOST_FRAME_NEAR 0x20
+#define GHOST_FRAME_FAR 0x40
+// The most bytes a frame takes.
+#define GHOST_MAX_FRAME_BYTES 5
+
+// The recording's buffers come from the file pool, and grow with the
+// run. They start at 4 KB and double, less the header of the pool's
+// blocks, so that each one fills a block.
+#define GHOST_RECORD_MIN_BLOCK 0x1000
+#define GHOST_RECORD_BLOCK_SLACK 64
+// A standing king takes a byte per frame and a moving one three,
+// so the recording holds well over an hour of play.
+#define GHOST_RECORD_SIZE (256 * 1024 - GHOST_RECORD_BLOCK_SLACK)
+#define GHOST_MAX_SEGMENTS 4096
+
+typedef struct {
+    unsigned int magic;
+    unsigned short version;
+    unsigned short totalSegments;
+    unsigned int size;
+    unsigned int checksum;
+} GhostHeader;
+
+// Where decoding a segment is at: the bytes after the position
+// hold the frame after the state.
+typedef struct {
+    const unsigned char *data;
+    unsigned int size, position;
+    // the frames decoded, from the start of the segment
+    unsigned int frames;
+    GhostFrame state;
+} GhostCursor;
+
+static GhostSegment *segments;
+static unsigned int totalSegments;
+static LoaderFile segmentFile;
+static int residentSegment, requestedSegment;
+static GhostCursor cursor;
+
+static unsigned char *recordData;
+static GhostSegment *recordSegments;
+static unsigned int recordDataCapacity, recordSegmentsCapacity;
+static unsigned int recordTotalSegments, recordSize, recordNextFrame;
+static GhostFrame recordLast;
+static int recordFull;
+static LoaderFence recordFence;
+
+static void startCursor(GhostCursor *c, const unsigned char *data, unsigned int size) {
+    c->data = data;
+    c->size = size;
+    c->position = 0;
+    c->frames = 0;
+    memset(&c->state, 0, sizeof(GhostFrame));
+}
+
+static int decodeFrame(GhostCursor *c) {
+    if (c->position >= c->size) {
+        return -1;
+    }
+    const unsigned char *bytes = c->data + c->position;
+    unsigned int flags = bytes[0];
+    unsigned int length = (flags & GHOST_FRAME_FAR) ? 5 : (flags & GHOST_FRAME_NEAR) ? 3 : 1;
+    if (length > c->size - c->position) {
+        return -1;
+    }
+    if (flags & GHOST_FRAME_FAR) {
+        c->state.screenX += (short) (bytes[1] | bytes[2] << 8);
+        c->state.screenY += (short) (bytes[3] | bytes[4] << 8);
+    } else if (flags & GHOST_FRAME_NEAR) {
+        c->state.screenX += (signed char) bytes[1];
+        c->state.screenY += (signed char) bytes[2];
+    }
+    c->state.spriteIndex = (SpriteIndex) (flags & GHOST_FRAME_SPRITE);
+    c->state.spriteUOffset = (flags & GHOST_FRAME_FLIPPED) ? PLAYER_SPRITE_WIDTH : 0;
+    c->position += length;
+    c->frames++;
+    return 0;
+}
+
+static unsigned int encodeFrame(const GhostFrame *last, const GhostFrame *frame, unsigned char *out) {
+    int dx = frame->screenX - last->screenX;
+    int dy = frame->screenY - last->screenY;
+    out[0] = (frame->spriteIndex & GHOST_FRAME_SPRITE) | (frame->spriteUOffset ? GHOST_FRAME_FLIPPED : 0);
+    if (dx == 0 && dy == 0) {
+        return 1;
+    }
+    if (dx >= -128 && dx <= 127 && dy >= -128 && dy <= 127) {
+        out[0] |= GHOST_FRAME_NEAR;
+        out[1] = (unsigned char) dx;
+        out[2] = (unsigned char) dy;
+        return 3;
+    }
+    out[0] |= GHOST_FRAME_FAR;
+    out[1] = dx & 0xFF;
+    out[2] = (dx >> 8) & 0xFF;
+    out[3] = dy & 0xFF;
+    out[4] = (dy >> 8) & 0xFF;
+    return 5;
+}
+
+// Playback
+
+void loadGhost(void) {
+#define loadGhostPanic(msg, ...) panic("Invalid ghost: %s\n" msg, GHOST_PATH, ##__VA_ARGS__)
+    recordData = NULL;
+    recordSegments = NULL;
+    recordDataCapacity = 0;
+    recordSegmentsCapacity = 0;
+    recordTotalSegments = 0;
+    recordSize = 0;
+    recordNextFrame = 0;
+    recordFull = 0;
+    segments = NULL;
+    totalSegments = 0;
+    residentSegment = -1;
+    requestedSegment = -1;
+    segmentFile.buffer = NULL;
+    initLoaderFence(&segmentFile.fence);
+    // Not having a ghost is fine, so the table isn't
+    // read with the loader, which panics if it's missing.
+    SceUID fd = sceIoOpen(GHOST_PATH, PSP_O_RDONLY, 0444);
+    if (fd < 0) {
+        return;
+    }
+    SceOff fileSize = sceIoLseek(fd, 0, PSP_SEEK_END);
+    sceIoLseek(fd, 0, PSP_SEEK_SET);
+    GhostHeader header;
+    if (sceIoRead(fd, &header, sizeof(header)) != sizeof(header) ||
+        header.magic != GHOST_FILE_MAGIC || header.version != GHOST_FILE_VERSION ||
+        header.size != fileSize - GHOST_HEADER_SIZE || header.totalSegments == 0) {
+        loadGhostPanic("Bad header");
+    }
+    unsigned int tableSize = header.totalSegments * sizeof(GhostSegment);
+    segments = (GhostSegment *) stateAlloc(tableSize);
+    if (tableSize > header.size || sceIoRead(fd, segments, tableSize) != (int) tableSize) {
+        loadGhostPanic("Truncated segment table");
+    }
+    sceIoClose(fd);
+    if (fnv1a(segments, tableSize) != header.checksum) {
+        loadGhostPanic("Checksum mismatch");
+    }
+    for (unsigned int i = 0; i < header.totalSegments; i++) {
+        const GhostSegment *segment = &segments[i];
+        if (segment->frames == 0 || segment->size == 0 ||
+            segment->offset < GHOST_HEADER_SIZE + tableSize || segment->offset > fileSize ||
+            segment->size > fileSize - segment->offset) {
+            loadGhostPanic("Segment %u out of bounds", i);
+        }
+        if (i > 0 && segment->firstFrame - segments[i - 1].firstFrame < segments[i - 1].frames) {
+            loadGhostPanic("Segment %u overlaps the one before", i);
+        }
+    }
+    totalSegments = header.totalSegments;
+#undef loadGhostPanic
+}
+
+// Returns the segment the frame is in, or -1.
+static int findSegment(unsigned int frame) {
+    if (totalSegments == 0 || frame < segments[0].firstFrame) {
+        return -1;
+    }
+    unsigned int low = 0, high = totalSegments;
+    while (high - low > 1) {
+        unsigned int middle = (low + high) / 2;
+        if (segments[middle].firstFrame <= frame) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return (frame - segments[low].firstFrame < segments[low].frames) ? (int) low : -1;
+}
+
+static void dropSegment(void) {
+    // A read still in flight is superseded by the next one.
+    if (LOADER_FENCE_READY(&segmentFile.fence)) {
+        unloadFile(segmentFile.buffer);
+    }
+    segmentFile.buffer = NULL;
+    residentSegment = -1;
+    requestedSegment = -1;
+}
+
+int getGhostFrame(unsigned int frame, unsigned int screenIndex, GhostFrame *outFrame) {
+    int index = findSegment(frame);
+    if (index < 0 || segments[index].screenIndex != screenIndex) {
+        return -1;
+    }
+    const GhostSegment *segment = &segments[index];
+    if (index != residentSegment) {
+        if (index != requestedSegment) {
+            dropSegment();
+            requestedSegment = index;
+            lazyReadFileRange(GHOST_PATH, segment->offset, segment->size, &segmentFile);
+            return -1;
+        }
+        if (!LOADER_FENCE_READY(&segmentFile.fence)) {
+            return -1;
+        }
+        if (fnv1a(segmentFile.buffer, segment->size) != segment->checksum) {
+            panic("Invalid ghost: %s\nSegment %d checksum mismatch", GHOST_PATH, index);
+        }
+        residentSegment = index;
+        startCursor(&cursor, segmentFile.buffer, segment->size);
+    }
+    // Frames are decoded one after the other, so going
+    // back (after a rewind) starts over from the first.
+    unsigned int frames = frame - segment->firstFrame + 1;
+    if (frames < cursor.frames) {
+        startCursor(&cursor, segmentFile.buffer, segment->size);
+    }
+    while (cursor.frames < frames) {
+        if (decodeFrame(&cursor)) {
+            panic("Invalid ghost: %s\nSegment %d is truncated", GHOST_PATH, index);
+        }
+    }
+    *outFrame = cursor.state;
+    return 0;
+}
+
+void unloadGhost(void) {
+    // The recording, unless it's been saved.
+    fileFree(recordData);
+    fileFree(recordSegments);
+    recordData = NULL;
+    recordSegments = NULL;
+    dropSegment();
+    // Drop any read still in flight.
+    ++segmentFile.fence.generation;
+    // The table goes with the state arena.
+    segments = NULL;
+    totalSegments = 0;
+}
+
+// Recording
+
+// Grows the buffer, keeping the used bytes, to hold at least size
+// bytes and at most max. Returns 0 if it can't.
+static int growRecordBuffer(void **buffer, unsigned int *capacity, unsigned int used, unsigned int size, unsigned int max) {
+    if (size <= *capacity) {
+        return 1;
+    }
+    unsigned int block = GHOST_RECORD_MIN_BLOCK;
+    while (block - GHOST_RECORD_BLOCK_SLACK < size) {
+        block <<= 1;
+    }
+    unsigned int newCapacity = block - GHOST_RECORD_BLOCK_SLACK;
+    if (newCapacity > max) {
+        newCapacity = max;
+    }
+    if (size > newCapacity) {
+        return 0;
+    }
+    void *newBuffer = fileAlloc(newCapacity);
+    if (newBuffer == NULL) {
+        return 0;
+    }
+    if (*buffer != NULL) {
+        memcpy(newBuffer, *buffer, used);
+        fileFree(*buffer);
+    }
+    *buffer = newBuffer;
+    *capacity = newCapacity;
+    return 1;
+}
+
+// Forgets the frames from the given one on.
+static void truncateRecording(unsigned int frame) {
+    while (recordTotalSegments > 0 && recordSegments[recordTotalSegments - 1].firstFrame >= frame) {
+        recordSize = recordSegments[--recordTotalSegments].offset;
+    }
+    recordNextFrame = frame;
+    // There's room again, if there wasn't.
+    recordFull = 0;
+    if (recordTotalSegments == 0) {
+        return;
+    }
+    GhostSegment *segment = &recordSegments[recordTotalSegments - 1];
+    if (frame - segment->firstFrame >= segment->frames) {
+        return;
+    }
+    GhostCursor c;
+    startCursor(&c, recordData + segment->offset, segment->size);
+    while (c.frames < frame - segment->firstFrame) {
+        decodeFrame(&c);
+    }
+    segment->frames = c.frames;
+    segment->size = c.position;
+    recordSize = segment->offset + c.position;
+    recordLast = c.state;
+}
+
+void recordGhostFrame(unsigned int frame, unsigned int screenIndex, const GhostFrame *ghostFrame) {
+    if (recordTotalSegments > 0 && frame < recordNextFrame) {
+        truncateRecording(frame);
+    }
+    if (recordFull) {
+        return;
+    }
+    if (!growRecordBuffer((void **) &recordData, &recordDataCapacity, recordSize, recordSize + GHOST_MAX_FRAME_BYTES, GHOST_RECORD_SIZE)) {
+        recordFull = 1;
+        return;
+    }
+    GhostSegment *segment = (recordTotalSegments > 0) ? &recordSegments[recordTotalSegments - 1] : NULL;
+    // A new segment starts on every new screen, after frames that
+    // weren't recorded and when the one before can't count more.
+    if (segment == NULL || segment->screenIndex != screenIndex || frame != recordNextFrame || segment->frames == 0xFFFF) {
+        if (!growRecordBuffer((void **) &recordSegments, &recordSegmentsCapacity, recordTotalSegments * sizeof(GhostSegment),
+                              (recordTotalSegments + 1) * sizeof(GhostSegment), GHOST_MAX_SEGMENTS * sizeof(GhostSegment))) {
+            recordFull = 1;
+            return;
+        }
+        segment = &recordSegments[recordTotalSegments++];
+        segment->firstFrame = frame;
+        segment->screenIndex = screenIndex;
+        segment->frames = 0;
+        segment->offset = recordSize;
+        segment->size = 0;
+        memset(&recordLast, 0, sizeof(GhostFrame));
+    }
+    unsigned int length = encodeFrame(&recordLast, ghostFrame, recordData + recordSize);
+    recordSize += length;
+    segment->size += length;
+    segment->frames++;
+    recordLast = *ghostFrame;
+    recordNextFrame = frame + 1;
+}
+
+void saveGhostRecording(void) {
+    if (recordTotalSegments == 0) {
+        return;
+    }
+    // The file is made in place, in the buffer of the frames, which
+    // are moved up to make room for the header and the table. The
+    // loader then writes the buffer as it is, and frees it.
+    unsigned int tableSize = recordTotalSegments * sizeof(GhostSegment);
+    unsigned int dataOffset = GHOST_HEADER_SIZE + tableSize;
+    unsigned int size = dataOffset + recordSize;
+    unsigned char *file = recordData;
+    if (size > recordDataCapacity) {
+        file = (unsigned char *) fileAlloc(size);
+        if (file == NULL) {
+            panic("Failed to allocate %u bytes for %s", size, GHOST_RECORD_PATH);
+        }
+        memcpy(file + dataOffset, recordData, recordSize);
+        fileFree(recordData);
+    } else {
+        memmove(file + dataOffset, recordData, recordSize);
+    }
+    recordData = NULL;
+    GhostSegment *table = (GhostSegment *) (file + GHOST_HEADER_SIZE);
+    for (unsigned int i = 0; i < recordTotalSegments; i++) {
+        table[i] = recordSegments[i];
+        table[i].offset += dataOffset;
+        table[i].checksum = fnv1a(file + table[i].offset, table[i].size);
+    }
+    GhostHeader header;
+    header.magic = GHOST_FILE_MAGIC;
+    header.version = GHOST_FILE_VERSION;
+    header.totalSegments = recordTotalSegments;
+    header.size = size - GHOST_HEADER_SIZE;
+    header.checksum = fnv1a(table, tableSize);
+    memcpy(file, &header, GHOST_HEADER_SIZE);
+    recordTotalSegments = 0;
+    lazyWriteFileBuffer(GHOST_RECORD_PATH, file, size, &recordFence);
+    waitLoaderFence(&recordFence);
+}
@@ -0,0 +1,62 @@
+#ifndef __GHOST_H__
+#define __GHOST_H__
+
+#include "king.h"
+
+// A recorded run, raced against as a translucent king. The trace
+// is split into segments, one for each stay on a screen, so that
+// only the segment the ghost is in has to be in memory:
+//
+// struct ghost_header_t {
+//     uint32_t magic;          // "JKGH"
+//     uint16_t version;        // GHOST_FILE_VERSION
+//     uint16_t totalSegments;
+//     uint32_t size;           // bytes after the header
+//     uint32_t checksum;       // FNV-1a of the segment table
+// };
+//
+// followed by a GhostSegment for each segment, sorted by frame, and
+// then the segments' frames. All values are little-endian, like the
+// PSP. Frames are numbered like the game's simulated frames. Each
+// frame starts with a byte with the sprite index (bits 0-3), whether
+// the sprite is flipped (bit 4), and whether the king has moved since
+// the frame before, by the two signed bytes (bit 5) or the two signed
+// 16-bit values (bit 6) that follow, x first. The first frame of a
+// segment moves from (0, 0).
+
+// "JKGH", as read from the file.
+#define GHOST_FILE_MAGIC 0x48474B4A
+#define GHOST_FILE_VERSION 1
+#define GHOST_HEADER_SIZE 16
+
+typedef struct {
+    unsigned int firstFrame;
+    unsigned short screenIndex;
+    unsigned short frames;
+    // where the frames are, from the start of the file
+    unsigned int offset, size;
+    // FNV-1a of the frames
+    unsigned int checksum;
+} GhostSegment;
+
+typedef struct {
+    short screenX, screenY;
+    SpriteIndex spriteIndex;
+    short spriteUOffset;
+} GhostFrame;
+
+// Reads the table of the trace to race against, if there is one.
+void loadGhost(void);
+// Returns 0 and the ghost's frame if it's on the screen at that frame,
+// and the segment it's in has been read. If it hasn't, it's read in
+// the place of the one before, and -1 is returned until it's there.
+int getGhostFrame(unsigned int frame, unsigned int screenIndex, GhostFrame *outFrame);
+void unloadGhost(void);
+
+// Records the player's run. A frame that has been recorded already
+// (after a rewind) replaces the frames from it on.
+void recordGhostFrame(unsigned int frame, unsigned int screenIndex, const GhostFrame *ghostFrame);
+// Writes the recorded run as a trace, and waits for it to be written.
+void saveGhostRecording(void);
+
+#endif
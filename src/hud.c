@@ -0,0 +1,356 @@
+#include "hud.h"
+#include "state.h"
+#include "level.h"
+#include "alloc.h"
+#ifdef DEBUG
+#include "arena.h"
+#endif
+#include <pspdisplay.h>
+#include <pspkernel.h>
+#include <string.h>
+
+// The glyphs are 5x7 pixels, with a shadow one pixel down
+// and to the right, in 8x8 cells side by side in the atlas.
+#define HUD_GLYPH_SIZE 8
+#define HUD_FONT_WIDTH 5
+#define HUD_FONT_HEIGHT 7
+#ifdef DEBUG
+#define HUD_ATLAS_WIDTH 256
+#else
+#define HUD_ATLAS_WIDTH 128
+#endif
+#define HUD_ATLAS_HEIGHT HUD_GLYPH_SIZE
+#define HUD_GLYPH_COLOR 0xFFFFFFFF
+#define HUD_SHADOW_COLOR 0xC0000000
+
+// "hh:mm:ss.cc mm:ss.cc Jjjjj Fffff"
+#define HUD_CELLS 32
+#ifdef DEBUG
+// Debug builds show where the memory has gone below it, in KB:
+// "Hhhhh/pppp Vvvvv/pppp Sssss" for the heap and VRAM used now and
+// at most, and the static pools, and "Affff ssss Pffff/tttt" for the
+// most the frame and state arenas and the file pool have held, and
+// the file pool's size.
+#define HUD_LINES 3
+#else
+#define HUD_LINES 1
+#endif
+#define HUD_WIDTH (HUD_CELLS * HUD_GLYPH_SIZE)
+#define HUD_HEIGHT (HUD_LINES * HUD_GLYPH_SIZE)
+#define HUD_X 8
+// The view scrolls by at most a tenth of PSP_SCREEN_MAX_SCROLL
+// (9 pixels) a frame. This far from the top, where the HUD was
+// drawn in a buffer is still in view when the buffer comes
+// round again, and can be painted over.
+#define HUD_Y 24
+
+#define HUD_TOTAL_TIME_CELL 0
+#define HUD_SCREEN_TIME_CELL 12
+#define HUD_JUMPS_CELL 21
+#define HUD_FALLS_CELL 27
+#define HUD_COUNT_DIGITS 4
+
+#ifdef DEBUG
+#define HUD_MEMORY_LINE (1 * HUD_CELLS)
+#define HUD_HEAP_CELL 0
+#define HUD_VRAM_CELL 11
+#define HUD_STATIC_CELL 22
+#define HUD_ARENAS_LINE (2 * HUD_CELLS)
+#define HUD_ARENAS_CELL 0
+#define HUD_POOL_CELL 11
+// The stats are gathered again once a second.
+#define HUD_MEMORY_FRAMES 60
+#endif
+
+typedef enum {
+    GLYPH_COLON = 10,
+    GLYPH_DOT,
+    GLYPH_J,
+    GLYPH_F,
+#ifdef DEBUG
+    GLYPH_H,
+    GLYPH_V,
+    GLYPH_S,
+    GLYPH_A,
+    GLYPH_P,
+    GLYPH_SLASH,
+#endif
+    HUD_GLYPHS
+} HudGlyph;
+
+// A cell with nothing drawn in it.
+#define GLYPH_BLANK 0xFF
+
+// One row per byte, the leftmost pixel in bit 4.
+static const unsigned char font[HUD_GLYPHS][HUD_FONT_HEIGHT] = {
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },
+    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },
+    { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },
+    { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },
+    { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },
+#ifdef DEBUG
+    { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },
+    { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },
+    { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+    { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },
+    { 0x01, 0x01, 0x02, 0x04, 0x08, 0x10, 0x10 },
+#endif
+};
+
+static unsigned int *atlas;
+static unsigned int framesPerKilosecond;
+// What's drawn in each cell of each buffer, and at which scroll.
+static unsigned char drawn[ENGINE_BUFFER_COUNT][HUD_LINES * HUD_CELLS];
+static short drawnScroll[ENGINE_BUFFER_COUNT];
+// Whether something else has painted over the HUD in the buffer.
+static int stale[ENGINE_BUFFER_COUNT];
+#ifdef DEBUG
+static MemoryStats memoryStats;
+static ArenaStats arenaStats;
+static unsigned int memoryFrames;
+#endif
+
+static void plotGlyph(HudGlyph glyph, short offset, unsigned int color) {
+    for (short y = 0; y < HUD_FONT_HEIGHT; y++) {
+        for (short x = 0; x < HUD_FONT_WIDTH; x++) {
+            if (font[glyph][y] & (0x10 >> x)) {
+                atlas[(y + offset) * HUD_ATLAS_WIDTH + glyph * HUD_GLYPH_SIZE + x + 1 + offset] = color;
+            }
+        }
+    }
+}
+
+void loadHud(void) {
+    unsigned int size = getVramMemorySize(HUD_ATLAS_WIDTH, HUD_ATLAS_HEIGHT, GU_PSM_8888);
+    atlas = (unsigned int *) memVramAlloc(MEMORY_SPRITES, size);
+    if (atlas == NULL) {
+        panic("Failed to allocate VRAM for the HUD");
+    }
+    memset(atlas, 0, size);
+    for (int glyph = 0; glyph < HUD_GLYPHS; glyph++) {
+        plotGlyph(glyph, 1, HUD_SHADOW_COLOR);
+        plotGlyph(glyph, 0, HUD_GLYPH_COLOR);
+    }
+    sceKernelDcacheWritebackRange(atlas, size);
+    // The timers count simulated frames, which go by at the refresh rate.
+    framesPerKilosecond = (unsigned int) (sceDisplayGetFramePerSec() * 1000.0f + 0.5f);
+    for (int i = 0; i < ENGINE_BUFFER_COUNT; i++) {
+        resetHud(i, 0);
+    }
+#ifdef DEBUG
+    memoryFrames = 0;
+#endif
+}
+
+void resetHud(unsigned int buffer, short scroll) {
+    memset(drawn[buffer], GLYPH_BLANK, sizeof(drawn[buffer]));
+    drawnScroll[buffer] = scroll;
+    stale[buffer] = 0;
+}
+
+// The rows (in level screen coordinates) the HUD may
+// have been drawn at, in any of the buffers.
+static void getHudBand(short *outTop, short *outBottom) {
+    short top = drawnScroll[0], bottom = drawnScroll[0];
+    for (int i = 1; i < ENGINE_BUFFER_COUNT; i++) {
+        if (drawnScroll[i] < top) {
+            top = drawnScroll[i];
+        } else if (drawnScroll[i] > bottom) {
+            bottom = drawnScroll[i];
+        }
+    }
+    *outTop = top + HUD_Y;
+    *outBottom = bottom + HUD_Y + HUD_HEIGHT;
+}
+
+void eraseHud(unsigned int buffer, short scroll) {
+    // Paint over the whole band, in case a copy from
+    // another buffer has brought that one's HUD in.
+    short top, bottom;
+    getHudBand(&top, &bottom);
+    renderLevelScreenSection(HUD_X, top, HUD_WIDTH, bottom - top, scroll);
+    resetHud(buffer, scroll);
+}
+
+void touchHud(short x, short y, short width, short height) {
+    short top, bottom;
+    getHudBand(&top, &bottom);
+    if (x < HUD_X + HUD_WIDTH && x + width > HUD_X && y < bottom && y + height > top) {
+        for (int i = 0; i < ENGINE_BUFFER_COUNT; i++) {
+            stale[i] = 1;
+        }
+    }
+}
+
+static int isHudBlank(unsigned int buffer) {
+    for (int i = 0; i < HUD_LINES * HUD_CELLS; i++) {
+        if (drawn[buffer][i] != GLYPH_BLANK) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void putDigits(unsigned char *cells, unsigned int value, int digits) {
+    while (digits-- > 0) {
+        cells[digits] = value % 10;
+        value /= 10;
+    }
+}
+
+// Right-aligned, without leading zeros.
+static void putCount(unsigned char *cells, unsigned int value, int digits) {
+    for (int i = digits - 1; i >= 0; i--) {
+        cells[i] = (value > 0 || i == digits - 1) ? value % 10 : GLYPH_BLANK;
+        value /= 10;
+    }
+}
+
+// Puts "mm:ss.cc", or "hh:mm:ss.cc" with the hours, capped at what fits.
+static void putTime(unsigned char *cells, unsigned int frames, int hours) {
+    unsigned int hundredths = (unsigned int) ((unsigned long long) frames * 100000 / framesPerKilosecond);
+    unsigned int max = (hours ? 100 * 60 * 60 * 100 : 100 * 60 * 100) - 1;
+    if (hundredths > max) {
+        hundredths = max;
+    }
+    if (hours) {
+        putCount(cells, hundredths / (60 * 60 * 100), 2);
+        cells[2] = GLYPH_COLON;
+        cells += 3;
+    }
+    putDigits(cells, hundredths / (60 * 100) % 60, 2);
+    cells[2] = GLYPH_COLON;
+    putDigits(cells + 3, hundredths / 100 % 60, 2);
+    cells[5] = GLYPH_DOT;
+    putDigits(cells + 6, hundredths % 100, 2);
+}
+
+#ifdef DEBUG
+static unsigned int toKilobytes(unsigned int bytes) {
+    return (bytes + 1023) / 1024;
+}
+
+// Puts "nnnn/pppp".
+static void putUsage(unsigned char *cells, unsigned int now, unsigned int peak) {
+    putCount(cells, toKilobytes(now), HUD_COUNT_DIGITS);
+    cells[HUD_COUNT_DIGITS] = GLYPH_SLASH;
+    putCount(cells + HUD_COUNT_DIGITS + 1, toKilobytes(peak), HUD_COUNT_DIGITS);
+}
+
+static void composeMemory(unsigned char *cells) {
+    // Walking the heap for its stats takes a while.
+    if (memoryFrames++ % HUD_MEMORY_FRAMES == 0) {
+        getMemoryStats(&memoryStats);
+        getArenaStats(&arenaStats);
+    }
+    unsigned char *line = cells + HUD_MEMORY_LINE;
+    const MemoryUsage *heap = &memoryStats.totals[MEMORY_HEAP];
+    const MemoryUsage *vram = &memoryStats.totals[MEMORY_VRAM];
+    line[HUD_HEAP_CELL] = GLYPH_H;
+    putUsage(line + HUD_HEAP_CELL + 1, heap->current, heap->peak);
+    line[HUD_VRAM_CELL] = GLYPH_V;
+    putUsage(line + HUD_VRAM_CELL + 1, vram->current, vram->peak);
+    line[HUD_STATIC_CELL] = GLYPH_S;
+    putCount(line + HUD_STATIC_CELL + 1, toKilobytes(memoryStats.totals[MEMORY_STATIC].current), HUD_COUNT_DIGITS);
+    line = cells + HUD_ARENAS_LINE;
+    line[HUD_ARENAS_CELL] = GLYPH_A;
+    putCount(line + HUD_ARENAS_CELL + 1, toKilobytes(arenaStats.frameHighWater), HUD_COUNT_DIGITS);
+    putCount(line + HUD_ARENAS_CELL + 2 + HUD_COUNT_DIGITS, toKilobytes(arenaStats.stateHighWater), HUD_COUNT_DIGITS);
+    line[HUD_POOL_CELL] = GLYPH_P;
+    putUsage(line + HUD_POOL_CELL + 1, arenaStats.fileHighWater, arenaStats.fileSize);
+}
+#endif
+
+static void composeHud(const HudStats *stats, unsigned char *cells) {
+    memset(cells, GLYPH_BLANK, HUD_LINES * HUD_CELLS);
+    putTime(cells + HUD_TOTAL_TIME_CELL, stats->frames, 1);
+    putTime(cells + HUD_SCREEN_TIME_CELL, stats->screenFrames, 0);
+    cells[HUD_JUMPS_CELL] = GLYPH_J;
+    putCount(cells + HUD_JUMPS_CELL + 1, stats->jumps, HUD_COUNT_DIGITS);
+    cells[HUD_FALLS_CELL] = GLYPH_F;
+    putCount(cells + HUD_FALLS_CELL + 1, stats->falls, HUD_COUNT_DIGITS);
+#ifdef DEBUG
+    composeMemory(cells);
+#endif
+}
+
+void renderHud(unsigned int buffer, const HudStats *stats, short scroll) {
+    // Once the view has scrolled, the HUD is drawn again whole where it is now.
+    if (stale[buffer] || (drawnScroll[buffer] != scroll && !isHudBlank(buffer))) {
+        eraseHud(buffer, scroll);
+    }
+    drawnScroll[buffer] = scroll;
+
+    unsigned char cells[HUD_LINES * HUD_CELLS];
+    composeHud(stats, cells);
+    unsigned char *current = drawn[buffer];
+    int glyphs = 0;
+    for (int i = 0; i < HUD_LINES * HUD_CELLS; i++) {
+        glyphs += cells[i] != current[i] && cells[i] != GLYPH_BLANK;
+    }
+    Vertex *vertices = (glyphs > 0) ? (Vertex *) sceGuGetMemory(2 * glyphs * sizeof(Vertex)) : NULL;
+    Vertex *vertex = vertices;
+
+    // Paint the level back behind each run of cells that changes,
+    // and batch the new glyphs up for a single draw. Runs don't
+    // go past the end of a line.
+    int i = 0;
+    while (i < HUD_LINES * HUD_CELLS) {
+        if (cells[i] == current[i]) {
+            ++i;
+            continue;
+        }
+        int first = i, repaint = 0;
+        int end = (i / HUD_CELLS + 1) * HUD_CELLS;
+        short y = HUD_Y + (i / HUD_CELLS) * HUD_GLYPH_SIZE;
+        for (; i < end && cells[i] != current[i]; i++) {
+            repaint |= current[i] != GLYPH_BLANK;
+            current[i] = cells[i];
+            if (cells[i] == GLYPH_BLANK) {
+                continue;
+            }
+            vertex[0].u = cells[i] * HUD_GLYPH_SIZE;
+            vertex[0].v = 0;
+            vertex[0].x = HUD_X + (i % HUD_CELLS) * HUD_GLYPH_SIZE;
+            vertex[0].y = y;
+            vertex[0].z = RENDER_LAYER_HUD;
+            vertex[1].u = vertex[0].u + HUD_GLYPH_SIZE;
+            vertex[1].v = HUD_GLYPH_SIZE;
+            vertex[1].x = vertex[0].x + HUD_GLYPH_SIZE;
+            vertex[1].y = y + HUD_GLYPH_SIZE;
+            vertex[1].z = RENDER_LAYER_HUD;
+            vertex += 2;
+        }
+        if (repaint) {
+            renderLevelScreenSection(HUD_X + (first % HUD_CELLS) * HUD_GLYPH_SIZE, scroll + y,
+                                     (i - first) * HUD_GLYPH_SIZE, HUD_GLYPH_SIZE, scroll);
+        }
+    }
+    if (glyphs == 0) {
+        return;
+    }
+
+    sceGuEnable(GU_BLEND);
+    sceGuBlendFunc(GU_ADD, GU_SRC_ALPHA, GU_ONE_MINUS_SRC_ALPHA, 0, 0);
+    sceGuTexMode(GU_PSM_8888, 0, 0, GU_FALSE);
+    sceGuTexImage(0, HUD_ATLAS_WIDTH, HUD_ATLAS_HEIGHT, HUD_ATLAS_WIDTH, atlas);
+    sceGuTexFunc(GU_TFX_REPLACE, GU_TCC_RGBA);
+    sceGuTexFilter(GU_NEAREST, GU_NEAREST);
+    sceGuDrawArray(GU_SPRITES, GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D, 2 * glyphs, NULL, vertices);
+    sceGuDisable(GU_BLEND);
+}
+
+void unloadHud(void) {
+    memVramFree(atlas);
+    atlas = NULL;
+}
@@ -0,0 +1,35 @@
+#ifndef __HUD_H__
+#define __HUD_H__
+
+// A line of text at the top of the view with the time played,
+// the time spent on the current screen and the jumps and falls.
+// Debug builds add two lines with what memory is used, and the
+// most that has been (see hud.c).
+// The color buffer is never cleared, so the HUD keeps track of
+// the glyphs it has drawn in each buffer, and only draws the
+// ones that change, painting the level back behind them first.
+
+typedef struct {
+    // frames simulated so far, and since the current screen was entered
+    unsigned int frames, screenFrames;
+    unsigned int jumps, falls;
+} HudStats;
+
+// Builds the glyph atlas in VRAM. It's small, but it has to be
+// there before the level takes what's left of VRAM.
+void loadHud(void);
+// Forgets what was drawn in the buffer, once the view has been
+// painted over whole.
+void resetHud(unsigned int buffer, short scroll);
+// Paints the level back over the HUD in the buffer. The HUD stays
+// put in the view, so this has to be done before the view scrolls.
+void eraseHud(unsigned int buffer, short scroll);
+// Tells the HUD that the area (in level screen coordinates) has
+// been painted over, in any buffer.
+void touchHud(short x, short y, short width, short height);
+// Draws the glyphs that changed in the buffer. It paints over
+// the level, so it goes before the sprites.
+void renderHud(unsigned int buffer, const HudStats *stats, short scroll);
+void unloadHud(void);
+
+#endif
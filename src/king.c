@@ -1,6 +1,4 @@
 #include "king.h"
-#include "state.h"
-#include <string.h>
 
 // Hitbox sizes
 #define PLAYER_HITBOX_WIDTH 18
@@ -29,22 +27,6 @@
 // Input constants
 #define PLAYER_JUMP_LENIENCY_FRAMES 4
 
-// Macros
-#define PLAYER_GET_SPRITE(idx) (allSprites + PLAYER_SPRITE_WIDTH * PLAYER_SPRITE_HEIGHT * 4 * (idx))
-
-// Player sprites
-typedef enum {
-    SPRITE_STANDING,
-    SPRITE_WALKING0,
-    SPRITE_WALKING1,
-    SPRITE_WALKING2,
-    SPRITE_CHARGING,
-    SPRITE_JUMPING,
-    SPRITE_FALLING,
-    SPRITE_STUNNED,
-    SPRITE_HITWALLMIDAIR,
-} SpriteIndex;
-
 // Collision modifiers
 typedef enum {
     COLLMOD_NONE = 0,
@@ -83,21 +65,6 @@ typedef struct {
     short width, height;
 } CollisionInfo;
 
-// Coordinates
-static float worldX, worldY;
-static float velocityX, velocityY;
-static short screenX, screenY;
-// Input
-static short direction, jumpPressed, leniencyFrames, leniencyDirection;
-// Flags
-static char inAir, hitWallMidair, maxJumpPowerReached, isStunned;
-// Status
-static float jumpPower, stunTime, fallTime;
-// Graphics
-static short walkAnimCycle, spriteUOffset;
-static SpriteIndex currentSpriteIndex;
-static char *currentSprite, *allSprites;
-
 static char blockCollisionData[] = {
     COLLMOD_SOLID | COLLMOD_SLOPE,
     COLLMOD_SOLID | COLLMOD_SLOPE,
@@ -114,17 +81,10 @@ static char blockCollisionData[] = {
     COLLMOD_QUARK
 };
 
-static float slopeNormals[4][2] = {
-    { -1.0f, -1.0f },
-    { +1.0f, -1.0f },
-    { -1.0f, +1.0f },
-    { +1.0f, +1.0f }
-};
-
-static short checkCollision(short sx, short sy, LevelScreen* screen, CollisionInfo* info) {
+static short checkCollision(const King *king, short sx, short sy, LevelScreen* screen, CollisionInfo* info) {
     short collisions = 0;
-    short positiveDirectionX = velocityX > 0.0f;
-    short positiveDirectionY = velocityY < 0.0f;
+    short positiveDirectionX = king->velocityX > 0.0f;
+    short positiveDirectionY = king->velocityY < 0.0f;
     sy -= PLAYER_HITBOX_HALFH;
     short borderX = sx + ((positiveDirectionX) ? +PLAYER_HITBOX_HALFW : -PLAYER_HITBOX_HALFW);
     short borderY = sy + ((positiveDirectionY) ? +PLAYER_HITBOX_HALFH : -PLAYER_HITBOX_HALFH);
@@ -132,6 +92,7 @@ static short checkCollision(short sx, short sy, LevelScreen* screen, CollisionIn
     info->tlSY = (positiveDirectionY) ? -1 : borderY;
     info->brSX = (positiveDirectionX) ? borderX : -1;
     info->brSY = (positiveDirectionY) ? borderY : -1;
+    info->modifiers = COLLMOD_NONE;
     short minDist2 = -1;
     for (short oy = -PLAYER_HITBOX_HALFH; oy < PLAYER_HITBOX_HALFH; oy += LEVEL_BLOCK_SIZE) {
         for (short ox = -PLAYER_HITBOX_HALFW; ox < PLAYER_HITBOX_HALFW; ox += LEVEL_BLOCK_SIZE) {
@@ -145,7 +106,7 @@ static short checkCollision(short sx, short sy, LevelScreen* screen, CollisionIn
             if (my < 0 || my >= LEVEL_SCREEN_BLOCK_HEIGHT) {
                 continue;
             }
-            LevelScreenBlock block = screen->blocks[my][mx];
+            LevelScreenBlock block = LEVEL_SCREEN_BLOCK(screen, mx, my);
             info->modifiers |= blockCollisionData[block];
             if (LEVEL_BLOCK_ISSOLID(block)) {
                     ++collisions;
@@ -174,27 +135,27 @@ static short checkCollision(short sx, short sy, LevelScreen* screen, CollisionIn
     return collisions;
 }
 
-static void doCollision(float newX, float newY, LevelScreen *screen) {
+static void doCollision(King *king, float newX, float newY, LevelScreen *screen) {
     // Convert new player position to screen coordinates.
     short newSX = ((short) newX) + (LEVEL_SCREEN_WIDTH / 2);
     short newSY = LEVEL_SCREEN_HEIGHT - ((short) newY);
     CollisionInfo info;
 
     // Check if the player has collided with something.
-    short collisions = checkCollision(newSX, newSY, screen, &info);
+    short collisions = checkCollision(king, newSX, newSY, screen, &info);
     if (collisions) {
         // If they have, check if the collision was along the X or the Y axis.
-        short wasVerticalCollision;
+        short wasVerticalCollision = 0;
         short isDiagonalCollision = info.width == info.height;
-        short absVX = (velocityX > 0.0f) ? velocityX : -velocityX; // |velocityX|
-        short absVY = (velocityY > 0.0f) ? velocityY : -velocityY; // |velocityY|
+        short absVX = (king->velocityX > 0.0f) ? king->velocityX : -king->velocityX; // |velocityX|
+        short absVY = (king->velocityY > 0.0f) ? king->velocityY : -king->velocityY; // |velocityY|
         if (info.width > info.height || (isDiagonalCollision && absVY >= absVX)) {
             // A collision is vertical if the intersection rectangle
             // is wider than it is tall. If the intersection is a square,
             // the collision is considered vertical if the Y component of the
             // velocity vector is greater (or equal) than its X component.
             wasVerticalCollision = 1;
-            short vDir = (velocityY < 0.0f) ? +1 : -1;
+            short vDir = (king->velocityY < 0.0f) ? +1 : -1;
             newSY -= vDir * info.height;
             newY = (float)(LEVEL_SCREEN_HEIGHT - newSY);
         } else if (info.width < info.height || (isDiagonalCollision && absVX > absVY)) {
@@ -203,176 +164,182 @@ static void doCollision(float newX, float newY, LevelScreen *screen) {
             // the collision is considered horizontal if the X component 
             // of the velocity vector is greater than its Y component.
             wasVerticalCollision = 0;
-            short hDir = (velocityX > 0.0f) ? +1 : -1;
+            short hDir = (king->velocityX > 0.0f) ? +1 : -1;
             newSX -= hDir * info.width;
             newX = (float)(newSX - (short)(LEVEL_SCREEN_WIDTH / 2));
         }
 
         // TODO: Better collision handling.
-        inAir = inAir && (!wasVerticalCollision || velocityY > 0.0f);
-        isStunned = !info.isSlope && !inAir && fallTime > PLAYER_MAX_FALL_TIME;
-        stunTime = isStunned * PLAYER_STUN_TIME;
-        hitWallMidair = (inAir || velocityY > 0.0f) && !wasVerticalCollision;
-        if (info.isSlope || (wasVerticalCollision && velocityY > 0.0f)) {
-            fallTime = 0.0f;
+        int wasInAir = king->inAir;
+        king->inAir = king->inAir && (!wasVerticalCollision || king->velocityY > 0.0f);
+        king->isStunned = !info.isSlope && !king->inAir && king->fallTime > PLAYER_MAX_FALL_TIME;
+        // Count the falls that knock the player down on landing.
+        king->falls += wasInAir && king->isStunned;
+        king->stunTime = king->isStunned * PLAYER_STUN_TIME;
+        king->hitWallMidair = (king->inAir || king->velocityY > 0.0f) && !wasVerticalCollision;
+        if (info.isSlope || (wasVerticalCollision && king->velocityY > 0.0f)) {
+            king->fallTime = 0.0f;
         }
-        velocityX = (!wasVerticalCollision || velocityY > 0.0f) * -velocityX * PLAYER_WALL_BOUNCE;
-        velocityY *= !wasVerticalCollision;
+        king->velocityX = (!wasVerticalCollision || king->velocityY > 0.0f) * -king->velocityX * PLAYER_WALL_BOUNCE;
+        king->velocityY *= !wasVerticalCollision;
     }
 
     // Update physics
     {
         // Update player position.
-        worldX = newX;
-        worldY = newY;
+        king->worldX = newX;
+        king->worldY = newY;
     }
 
     // Update graphics
     {
         // Update screeen coordinates.
-        screenX = newSX;
-        screenY = newSY;
+        king->screenX = newSX;
+        king->screenY = newSY;
     }
 }
 
-void kingCreate(void) {
-    allSprites = loadTextureVram("assets/king/base/regular.qoi", NULL, NULL);
+void kingCreate(King *king) {
     // Set the player starting position.
-    worldX = 0.0f;
-    worldY = 32.0f;
+    king->worldX = 0.0f;
+    king->worldY = 32.0f;
     // Set the player initial speed.
-    velocityX = 0.0f;
-    velocityY = 0.0f;
+    king->velocityX = 0.0f;
+    king->velocityY = 0.0f;
     // Update the player screen coordinates.
-    screenX = ((short) worldX) + (LEVEL_SCREEN_WIDTH / 2);
-    screenY = LEVEL_SCREEN_HEIGHT - ((short) worldY);
+    king->screenX = ((short) king->worldX) + (LEVEL_SCREEN_WIDTH / 2);
+    king->screenY = LEVEL_SCREEN_HEIGHT - ((short) king->worldY);
     // Reset input.
-    direction = 0;
-    jumpPressed = 0;
-    leniencyFrames = 0;
-    leniencyDirection = 0;
+    king->direction = 0;
+    king->jumpPressed = 0;
+    king->leniencyFrames = 0;
+    king->leniencyDirection = 0;
     // Reset flags.
-    inAir = 0;
-    hitWallMidair = 0;
-    maxJumpPowerReached = 0;
-    isStunned = 1;
+    king->inAir = 0;
+    king->hitWallMidair = 0;
+    king->maxJumpPowerReached = 0;
+    king->isStunned = 1;
     // Reset status.
-    jumpPower = 0.0f;
-    stunTime = 0.0f;
-    fallTime = 0.0f;
+    king->jumpPower = 0.0f;
+    king->stunTime = 0.0f;
+    king->fallTime = 0.0f;
     // Reset animation.
-    walkAnimCycle = 0;
-    spriteUOffset = 0;
+    king->walkAnimCycle = 0;
+    king->spriteUOffset = 0;
     // Set the initial sprite.
-    currentSpriteIndex = SPRITE_STUNNED;
-    currentSprite = PLAYER_GET_SPRITE(currentSpriteIndex);
+    king->spriteIndex = SPRITE_STUNNED;
+    // Reset statistics.
+    king->jumps = 0;
+    king->falls = 0;
 }
 
-void kingUpdate(float delta, LevelScreen *screen, unsigned int *outScreenIndex) {
+void kingUpdate(King *king, const KingInput *input, float delta, LevelScreen *screen, unsigned int *outScreenIndex) {
     // Update status
     {
-        if (velocityY) {
+        if (king->velocityY) {
             // If the vertical velocity is not zero,
             // the player is in the air.
-            inAir = 1;
-            if (velocityY > 0.0f) {
+            king->inAir = 1;
+            if (king->velocityY > 0.0f) {
                 // If the player is jumping up (meaning the vertical velocity is positive),
                 // reset the jump power.
                 // NOTE: This is there because the player can be falling,
                 //       and still be on a solid block (eg. sand block).
                 // TODO: This still needs to be implemented properly.
-                jumpPower = 0.0f;
+                king->jumpPower = 0.0f;
                 // Also reset the fall time.
-                fallTime = 0.0f;
-            } else if (fallTime < PLAYER_MAX_FALL_TIME) {
+                king->fallTime = 0.0f;
+            } else if (king->fallTime < PLAYER_MAX_FALL_TIME) {
                 // If the player is falling (meaning the vertical velocity is negative),
                 // count up the fall time.
-                fallTime += delta;
+                king->fallTime += delta;
             }
         } else {
             // Check if the player is standing on solid ground.
-            int mapX = LEVEL_COORDS_SCREEN2MAP(screenX);
-            int mapY = LEVEL_COORDS_SCREEN2MAP(screenY);
+            int mapX = LEVEL_COORDS_SCREEN2MAP(king->screenX);
+            int mapY = LEVEL_COORDS_SCREEN2MAP(king->screenY);
             for (int x = -PLAYER_HITBOX_BLOCK_HALFW; x <= PLAYER_HITBOX_BLOCK_HALFW; x++) {
-                LevelScreenBlock block = screen->blocks[mapY][mapX + x];
-                inAir |= LEVEL_BLOCK_ISSOLID(block) && !LEVEL_BLOCK_ISSLOPE(block);
+                LevelScreenBlock block = LEVEL_SCREEN_BLOCK(screen, mapX + x, mapY);
+                king->inAir |= LEVEL_BLOCK_ISSOLID(block) && !LEVEL_BLOCK_ISSLOPE(block);
             }
-            inAir = !inAir;
+            king->inAir = !king->inAir;
             
-            if (inAir) {
+            if (king->inAir) {
                 // Update physics
-                velocityX = direction * PLAYER_WALK_SPEED;
+                king->velocityX = king->direction * PLAYER_WALK_SPEED;
                 
                 // Update status
-                fallTime = 0.0f;
+                king->fallTime = 0.0f;
             }
         }
     }
 
-    if (!inAir) {
+    if (!king->inAir) {
         // If the player is on the ground...
         
         // Resolve input
         {
             // Check which direction the player wants to go.
-            direction = (Input.Buttons & PSP_CTRL_LEFT) ? -1 : (Input.Buttons & PSP_CTRL_RIGHT) ? +1 : 0;
+            king->direction = input->direction;
             // Handle the leniency direction.
-            if (direction) {
+            if (king->direction) {
                 // If the direction is non 0, reset the leniency time.
-                leniencyFrames = PLAYER_JUMP_LENIENCY_FRAMES;
-                leniencyDirection = direction;
+                king->leniencyFrames = PLAYER_JUMP_LENIENCY_FRAMES;
+                king->leniencyDirection = king->direction;
             } else {
                 // Otherwise, count down the leniency time.
-                --leniencyFrames;
+                --king->leniencyFrames;
             }
             // Check if the player is trying to jump.
-            jumpPressed = (Input.Buttons & PSP_CTRL_CROSS);
+            king->jumpPressed = input->jump;
         }
 
         // Update status
         {
             // Update stunned timer
-            if (stunTime > 0) {
-                stunTime -= delta;
+            if (king->stunTime > 0) {
+                king->stunTime -= delta;
             }
 
             // Un-stun the player if input was recieved
             // and the cooldown time has elapsed.
-            if (isStunned && stunTime <= 0 && (jumpPressed || direction)) {
-                isStunned = 0;
+            if (king->isStunned && king->stunTime <= 0 && (king->jumpPressed || king->direction)) {
+                king->isStunned = 0;
             }
 
             // Check if the player is pressing the jump button
             // and, if true, build up jump power.
-            if (!isStunned && jumpPressed) {
-                jumpPower += (PLAYER_JUMP_VSPEED / PLAYER_CHARGE_TIME) * delta;
-                maxJumpPowerReached = jumpPower >= PLAYER_JUMP_VSPEED;
+            if (!king->isStunned && king->jumpPressed) {
+                king->jumpPower += (PLAYER_JUMP_VSPEED / PLAYER_CHARGE_TIME) * delta;
+                king->maxJumpPowerReached = king->jumpPower >= PLAYER_JUMP_VSPEED;
             }
         }
 
         // Update physics
         {
-            if (!isStunned) {
-                if (jumpPressed && !maxJumpPowerReached) {
+            if (!king->isStunned) {
+                if (king->jumpPressed && !king->maxJumpPowerReached) {
                     // Freeze the player if the jump button is pressed.
-                    velocityX = 0.0f;
+                    king->velocityX = 0.0f;
                 } else {
-                    if (jumpPower) {
+                    if (king->jumpPower) {
                         // If the jump button was released...
                         // - set the vertical speed to the jump power that was built up
-                        velocityY = jumpPower;
+                        king->velocityY = king->jumpPower;
+                        // - count the jump
+                        ++king->jumps;
                         // - check if the input direction is 0. If it is, check if the
                         //   last non 0 direction was within the last two frames
-                        if (leniencyFrames > 0 && direction == 0) {
+                        if (king->leniencyFrames > 0 && king->direction == 0) {
                             // - if it was, override the player's direction
-                            direction = leniencyDirection;
+                            king->direction = king->leniencyDirection;
                         }
                         // - set the horizontal speed to PLAYER_JUMP_HSPEED in the direction
                         //   the player is facing
-                        velocityX = direction * PLAYER_JUMP_HSPEED;
+                        king->velocityX = king->direction * PLAYER_JUMP_HSPEED;
                     } else {
                         // Otherwise, walk at normal speed.
-                        velocityX = direction * PLAYER_WALK_SPEED;
+                        king->velocityX = king->direction * PLAYER_WALK_SPEED;
                     }
                 }
             }
@@ -384,67 +351,68 @@ void kingUpdate(float delta, LevelScreen *screen, unsigned int *outScreenIndex)
         {
             // If the falling terminal velocity has not been reached,
             // apply gravity.
-            if (velocityY > -PLAYER_MAX_FALL_SPEED) {
-                velocityY -= PLAYER_GRAVITY;
+            if (king->velocityY > -PLAYER_MAX_FALL_SPEED) {
+                king->velocityY -= PLAYER_GRAVITY;
             }
         }
     }
 
     // Compute new player position.
-    float newX = worldX + velocityX;
-    float newY = worldY + velocityY;
+    float newX = king->worldX + king->velocityX;
+    float newY = king->worldY + king->velocityY;
     
     // If the player is within the leve screen bounds,
     // handle collisions.
-    doCollision(newX, newY, screen);
+    doCollision(king, newX, newY, screen);
 
-    if (screenY - PLAYER_HITBOX_HALFH < 0) {
+    if (king->screenY - PLAYER_HITBOX_HALFH < 0) {
         // If the player has left the screen from the top side...
-        screenY += LEVEL_SCREEN_HEIGHT;
-        worldY -= LEVEL_SCREEN_HEIGHT;
+        king->screenY += LEVEL_SCREEN_HEIGHT;
+        king->worldY -= LEVEL_SCREEN_HEIGHT;
         *outScreenIndex += 1;
-    } else if (screenY - PLAYER_HITBOX_HALFH >= LEVEL_SCREEN_HEIGHT) {
+    } else if (king->screenY - PLAYER_HITBOX_HALFH >= LEVEL_SCREEN_HEIGHT) {
         // If the player has left the screen from the bottom side...
-        screenY -= LEVEL_SCREEN_HEIGHT;
-        worldY += LEVEL_SCREEN_HEIGHT;
+        king->screenY -= LEVEL_SCREEN_HEIGHT;
+        king->worldY += LEVEL_SCREEN_HEIGHT;
         *outScreenIndex -= 1;
-    } else if (screenX < 0) {
+    } else if (king->screenX < 0) {
         // If the player has left the screen from the left side...
-        screenX += LEVEL_SCREEN_WIDTH;
-        worldX += LEVEL_SCREEN_WIDTH;
+        king->screenX += LEVEL_SCREEN_WIDTH;
+        king->worldX += LEVEL_SCREEN_WIDTH;
         *outScreenIndex = screen->teleportIndex;
-    } else if (screenX > LEVEL_SCREEN_WIDTH) {
+    } else if (king->screenX > LEVEL_SCREEN_WIDTH) {
         // If the player has left the screen from the right side...
-        screenX -= LEVEL_SCREEN_WIDTH;
-        worldX -= LEVEL_SCREEN_WIDTH;
+        king->screenX -= LEVEL_SCREEN_WIDTH;
+        king->worldX -= LEVEL_SCREEN_WIDTH;
         *outScreenIndex = screen->teleportIndex;
     }
 
     // Update graphics
     {
         // If the player is not stunned...
-        if (!isStunned) {
+        if (!king->isStunned) {
             // Flip the sprite according to the player direction.
-            if (direction == +1) {
-                spriteUOffset = 0;
-            } else if (direction == -1) {
-                spriteUOffset = PLAYER_SPRITE_WIDTH;
+            if (king->direction == +1) {
+                king->spriteUOffset = 0;
+            } else if (king->direction == -1) {
+                king->spriteUOffset = PLAYER_SPRITE_WIDTH;
             }
         }
 
         // Find the appropriate sprite index for the current frame.
-        SpriteIndex newSpriteIndex;
-        if (jumpPower) {
+        // It stays the same unless one is found.
+        SpriteIndex newSpriteIndex = king->spriteIndex;
+        if (king->jumpPower) {
             newSpriteIndex = SPRITE_CHARGING;
-        } else if (isStunned) {
+        } else if (king->isStunned) {
             newSpriteIndex = SPRITE_STUNNED;
-        } else if (hitWallMidair) {
+        } else if (king->hitWallMidair) {
             newSpriteIndex = SPRITE_HITWALLMIDAIR;
-        } else if (inAir) {
-            newSpriteIndex = (velocityY > 0.0f) ? SPRITE_JUMPING : SPRITE_FALLING;
-        } else if (velocityX && direction) {
-            walkAnimCycle += 1;
-            switch (walkAnimCycle / 4) {
+        } else if (king->inAir) {
+            newSpriteIndex = (king->velocityY > 0.0f) ? SPRITE_JUMPING : SPRITE_FALLING;
+        } else if (king->velocityX && king->direction) {
+            king->walkAnimCycle += 1;
+            switch (king->walkAnimCycle / 4) {
                 case 0:
                 case 1:
                 case 2:
@@ -460,66 +428,16 @@ void kingUpdate(float delta, LevelScreen *screen, unsigned int *outScreenIndex)
                     break;
                 case 7:
                     newSpriteIndex = SPRITE_WALKING1;
-                    walkAnimCycle = 0;
+                    king->walkAnimCycle = 0;
                     break;
             }
         } else {
             newSpriteIndex = SPRITE_STANDING;
-            walkAnimCycle = 0;
+            king->walkAnimCycle = 0;
         }
 
-        // Update sprite pointer if the new sprite is different
-        // from the previous one.
-        if (currentSpriteIndex != newSpriteIndex) {
-            currentSpriteIndex = newSpriteIndex;
-            currentSprite = PLAYER_GET_SPRITE(currentSpriteIndex);
-        }
+        // Remember which sprite has to be drawn.
+        king->spriteIndex = newSpriteIndex;
     }
 }
 
-void kingRender(short *outSX, short *outSY, unsigned int currentScroll) {
-    Vertex *vertices = (Vertex*) sceGuGetMemory(2 * sizeof(Vertex));
-    // Translate the player's level screen coordinates
-    // to the PSP's screen coordinates.
-    vertices[0].x = screenX - PLAYER_SPRITE_HALFW;
-    vertices[0].y = (screenY - currentScroll) - PLAYER_SPRITE_HEIGHT;
-    vertices[1].x = screenX + PLAYER_SPRITE_HALFW;
-    vertices[1].y = (screenY - currentScroll);
-    // Set both vertices to have a depth of 1 so that the player's
-    // sprite sits on top of the background.
-    vertices[0].z = 1;
-    vertices[1].z = 1;
-    // Set the sprite's texture coordinates according to the direction
-    // the player is currently facing.
-    vertices[0].u = spriteUOffset;
-    vertices[0].v = 0;
-    vertices[1].u = PLAYER_SPRITE_WIDTH - spriteUOffset;
-    vertices[1].v = PLAYER_SPRITE_HEIGHT;
-
-    // Enable blending to account for transparency.
-    sceGuEnable(GU_BLEND);
-    sceGuBlendFunc(GU_ADD, GU_SRC_ALPHA, GU_ONE_MINUS_SRC_ALPHA, 0, 0);
-    // Set the texture as the current selected sprite for the player.
-    sceGuTexMode(GU_PSM_8888, 0, 0, GU_FALSE);
-    sceGuTexImage(0, PLAYER_SPRITE_WIDTH, PLAYER_SPRITE_HEIGHT, PLAYER_SPRITE_WIDTH, currentSprite);
-    sceGuTexFunc(GU_TFX_REPLACE, GU_TCC_RGBA);
-    sceGuTexFilter(GU_NEAREST, GU_NEAREST);
-    // Draw it!
-    sceGuDrawArray(GU_SPRITES, GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D, 2, NULL, vertices);
-    // Disable blending since it's not needed anymore.
-    sceGuDisable(GU_BLEND);
-
-
-    // Output the previous' frame level screen coordinates.
-    // This is needed by in the game's render function to paint
-    // over the player sprite in the previous frame, which is
-    // needed since we're not clearing the framebuffer every frame
-    // to avoid having to re-render the entire midground texture
-    // which is stored in RAM.
-    *outSX = screenX;
-    *outSY = screenY;
-}
-
-void kingDestroy(void) {
-    unloadTextureVram(allSprites);
-};
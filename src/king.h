@@ -9,9 +9,58 @@
 #define PLAYER_SPRITE_HALFW (PLAYER_SPRITE_WIDTH / 2)
 #define PLAYER_SPRITE_HALFH (PLAYER_SPRITE_HEIGHT / 2)
 
-void kingCreate(void);
-void kingUpdate(float delta, LevelScreen *screen, unsigned int *outScreenIndex);
-void kingRender(short *outSX, short *outSY, unsigned int currentScroll);
-void kingDestroy(void);
+// Player sprites
+typedef enum {
+    SPRITE_STANDING,
+    SPRITE_WALKING0,
+    SPRITE_WALKING1,
+    SPRITE_WALKING2,
+    SPRITE_CHARGING,
+    SPRITE_JUMPING,
+    SPRITE_FALLING,
+    SPRITE_STUNNED,
+    SPRITE_HITWALLMIDAIR,
+} SpriteIndex;
+
+// The input the player gave for a single update.
+// It's decoupled from the PSP's button state, so that
+// the simulation can also be driven by the host tools.
+typedef struct {
+    // -1 if going left, +1 if going right, 0 otherwise
+    short direction;
+    // non 0 if the jump button is held down
+    short jump;
+} KingInput;
+
+// NOTE: The fields are sorted by how often they are accessed
+//       during an update, so that the ones used by the physics
+//       and collision code share the first cache lines.
+typedef struct {
+    // Coordinates
+    float worldX, worldY;
+    float velocityX, velocityY;
+    short screenX, screenY;
+    // Flags
+    char inAir, hitWallMidair, maxJumpPowerReached, isStunned;
+    // Status
+    float jumpPower, stunTime, fallTime;
+    // Input
+    short direction, jumpPressed, leniencyFrames, leniencyDirection;
+    // Graphics
+    short walkAnimCycle, spriteUOffset;
+    SpriteIndex spriteIndex;
+    // Statistics
+    unsigned short jumps, falls;
+} King;
+
+void kingCreate(King *king);
+void kingUpdate(King *king, const KingInput *input, float delta, LevelScreen *screen, unsigned int *outScreenIndex);
+
+void kingPreloadSprites(void);
+int areKingSpritesPreloaded(void);
+void kingLoadSprites(void);
+void kingRender(const King *king, short *outSX, short *outSY, unsigned int currentScroll);
+void kingRenderGhost(short screenX, short screenY, SpriteIndex spriteIndex, short spriteUOffset, unsigned int currentScroll);
+void kingUnloadSprites(void);
 
 #endif
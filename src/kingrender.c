@@ -0,0 +1,93 @@
+#include "king.h"
+#include "state.h"
+
+// Macros
+#define PLAYER_GET_SPRITE(idx) (allSprites + PLAYER_SPRITE_WIDTH * PLAYER_SPRITE_HEIGHT * 4 * (idx))
+
+#define PLAYER_SPRITES_PATH "assets/king/base/regular.tex"
+// Half as opaque as the player.
+#define PLAYER_GHOST_COLOR 0x80FFFFFF
+
+// The sprite sheet is shared by every king instance.
+static char *allSprites;
+static LoaderFile spritesFile;
+
+// Starts reading the sprite sheet in the background,
+// for kingLoadSprites to pick up.
+void kingPreloadSprites(void) {
+    lazyReadFile(PLAYER_SPRITES_PATH, &spritesFile);
+}
+
+int areKingSpritesPreloaded(void) {
+    return LOADER_FENCE_READY(&spritesFile.fence);
+}
+
+void kingLoadSprites(void) {
+    unsigned int size;
+    void *buffer = takeLoaderFile(PLAYER_SPRITES_PATH, &spritesFile, &size);
+    allSprites = decodeTextureVram(PLAYER_SPRITES_PATH, buffer, size, MEMORY_SPRITES, NULL, NULL);
+    unloadFile(buffer);
+}
+
+static void drawSprite(short screenX, short screenY, SpriteIndex spriteIndex, short spriteUOffset, unsigned int currentScroll, int ghost) {
+    Vertex *vertices = (Vertex*) sceGuGetMemory(2 * sizeof(Vertex));
+    // Translate the player's level screen coordinates
+    // to the PSP's screen coordinates.
+    vertices[0].x = screenX - PLAYER_SPRITE_HALFW;
+    vertices[0].y = (screenY - currentScroll) - PLAYER_SPRITE_HEIGHT;
+    vertices[1].x = screenX + PLAYER_SPRITE_HALFW;
+    vertices[1].y = (screenY - currentScroll);
+    // Put the player's sprite on the sprites layer,
+    // so that it sits on top of the background.
+    vertices[0].z = RENDER_LAYER_SPRITES;
+    vertices[1].z = RENDER_LAYER_SPRITES;
+    // Set the sprite's texture coordinates according to the direction
+    // the player is currently facing.
+    vertices[0].u = spriteUOffset;
+    vertices[0].v = 0;
+    vertices[1].u = PLAYER_SPRITE_WIDTH - spriteUOffset;
+    vertices[1].v = PLAYER_SPRITE_HEIGHT;
+
+    // Enable blending to account for transparency.
+    sceGuEnable(GU_BLEND);
+    sceGuBlendFunc(GU_ADD, GU_SRC_ALPHA, GU_ONE_MINUS_SRC_ALPHA, 0, 0);
+    // Set the texture as the current selected sprite for the player.
+    // The sprites are swizzled by the asset pipeline, and each one
+    // starts on a band of blocks, so any of them can be pointed to.
+    sceGuTexMode(GU_PSM_8888, 0, 0, GU_TRUE);
+    sceGuTexImage(0, PLAYER_SPRITE_WIDTH, PLAYER_SPRITE_HEIGHT, PLAYER_SPRITE_WIDTH, PLAYER_GET_SPRITE(spriteIndex));
+    if (ghost) {
+        // The ghost's alpha is scaled down by its color.
+        sceGuColor(PLAYER_GHOST_COLOR);
+        sceGuTexFunc(GU_TFX_MODULATE, GU_TCC_RGBA);
+    } else {
+        sceGuTexFunc(GU_TFX_REPLACE, GU_TCC_RGBA);
+    }
+    sceGuTexFilter(GU_NEAREST, GU_NEAREST);
+    // Draw it!
+    sceGuDrawArray(GU_SPRITES, GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D, 2, NULL, vertices);
+    // Disable blending since it's not needed anymore.
+    sceGuDisable(GU_BLEND);
+}
+
+void kingRender(const King *king, short *outSX, short *outSY, unsigned int currentScroll) {
+    drawSprite(king->screenX, king->screenY, king->spriteIndex, king->spriteUOffset, currentScroll, 0);
+
+    // Output the previous' frame level screen coordinates.
+    // This is needed by in the game's render function to paint
+    // over the player sprite in the previous frame, which is
+    // needed since we're not clearing the framebuffer every frame
+    // to avoid having to re-render the entire midground texture
+    // which is stored in RAM.
+    *outSX = king->screenX;
+    *outSY = king->screenY;
+}
+
+// Draws a recorded king, see ghost.h, with the same sprites.
+void kingRenderGhost(short screenX, short screenY, SpriteIndex spriteIndex, short spriteUOffset, unsigned int currentScroll) {
+    drawSprite(screenX, screenY, spriteIndex, spriteUOffset, currentScroll, 1);
+}
+
+void kingUnloadSprites(void) {
+    unloadTextureVram(allSprites);
+}
@@ -1,25 +1,66 @@
 #include "level.h"
+#include "levelfile.h"
+#include "alloc.h"
 #include "loader.h"
+#include "mapslots.h"
 #include "state.h"
 #include "panic.h"
+#include "residency.h"
+#include "tiledscreens.h"
+#include <pspkernel.h>
 #include <pspgu.h>
 #include <stdio.h>
-#include <string.h>
-
-#define LEVEL_SCREEN_MAGIC 0xBABE
 
+// Screen images are stored as they are (480x360), and decoded
+// into buffers with rows as long as the Graphics Engine wants.
+// The texture's height must be a power of two too, but only the
+// rows of the screen are ever sampled, so only those are kept.
 #define LEVEL_SCREEN_IMAGEW 512
 #define LEVEL_SCREEN_IMAGEH 512
-#define LEVEL_SCREEN_BYTES (LEVEL_SCREEN_IMAGEW * LEVEL_SCREEN_IMAGEH * 4)
+#define LEVEL_SCREEN_BYTES (LEVEL_SCREEN_IMAGEW * LEVEL_SCREEN_HEIGHT * 4)
+// The layout of a swizzled texture depends on its pitch, which
+// the unpadded images don't have, so they're stored linear and
+// swizzled as they're decoded.
+#define LEVEL_SCREEN_SWIZZLED GU_TRUE
+
+#define LEVEL_MAPS_PATH "assets/level.bin"
+#define LEVEL_MAP_PATH "assets/maps/%u.bin"
+// The teleport index of screens without a teleport link.
+#define LEVEL_NO_TELEPORT 255
+#define LEVEL_NO_SCREEN ((unsigned int) -1)
+
+#ifdef TILED_SCREENS
+#define LEVEL_TILE_STORE_PATH "assets/screens/midground/tiles.bin"
+#define LEVEL_TILE_MAPS_PATH "assets/screens/midground/maps.bin"
+#endif
 
 typedef struct {
-    unsigned short totalScreens;
-    LevelScreen *screens;
+    LoaderFile mapsFile;
+    LevelMapTable maps;
+    // set by preloadLevel, until loadLevel takes over
+    int preloading;
+    unsigned int startScreen;
+    unsigned int currentMap;
+    // The current map, and the one the current screen's teleport
+    // link leads to, which is streamed in before it's needed. The
+    // update, which may run on its own thread, copies its screens
+    // out of them with copyLevelScreenData.
+    MapSlots mapSlots;
+    LoaderFile mapFiles[MAP_SLOT_COUNT];
 } Level;
 
+// The fence and the screen index travel with the pixels when the
+// handles are rotated, so that they always describe them.
+typedef struct {
+    char *pixels;
+    LoaderFence fence;
+    // the screen the pixels are (being) loaded from
+    unsigned int index;
+} LevelScreenTexture;
+
 typedef struct {
     unsigned int index;
-    char *texture;
+    LevelScreenTexture *texture;
 } LevelScreenHandle;
 
 typedef enum {
@@ -32,185 +73,455 @@ typedef enum {
 #define SCREEN_NEXT 2
 
 static Level level;
-static LevelScreen *lastScreenReturned;
+static unsigned int lastScreenReturned;
+// cleared by seekLevelScreen, until getLevelScreen loads them
+static int neighboursLoaded;
 static LevelScreenHandle screenHandlePrevious;
 static LevelScreenHandle screenHandleCurrent;
 static LevelScreenHandle screenHandleNext;
+#ifndef TILED_SCREENS
+static LevelScreenTexture screenTextures[3];
+static unsigned int residentReadyTop, residentReadyBottom;
 static __attribute__((section(".bss"), aligned(16))) char texturesPool[LEVEL_SCREEN_BYTES * 3];
+#endif
+
+unsigned int getLevelMap(unsigned int index) {
+    int map = findLevelMap(&level.maps, index);
+    return (map >= 0) ? (unsigned int) map : LEVEL_NO_MAP;
+}
 
+// Screens are only loaded and drawn from the current map.
+static int isInCurrentMap(unsigned int index) {
+    const LevelMap *map = &level.maps.maps[level.currentMap];
+    return index >= map->firstScreen && index - map->firstScreen < map->totalScreens;
+}
+
+static void openMapSlot(int slot) {
+    unsigned int map = level.mapSlots.slots[slot].map;
+    LevelFile file;
+    const char *error = openLevelFile(level.mapFiles[slot].buffer, level.mapFiles[slot].size, &file);
+    if (error != NULL) {
+        panic("Invalid map %u: %s", map, error);
+    }
+    if (file.totalScreens != level.maps.maps[map].totalScreens) {
+        panic("Invalid map %u: expected %u screens but found %u", map, level.maps.maps[map].totalScreens, file.totalScreens);
+    }
+    publishMapSlot(&level.mapSlots, slot, &file);
+}
+
+// Empties the slot, and gives it to the map if there's one.
+static void assignMapFile(int slot, unsigned int map) {
+    assignMapSlot(&level.mapSlots, slot, map);
+    LoaderFile *file = &level.mapFiles[slot];
+    if (LOADER_FENCE_READY(&file->fence)) {
+        unloadFile(file->buffer);
+    }
+    file->buffer = NULL;
+}
+
+// Starts streaming in the map's screen data, unless it's already
+// there, in the place of a map other than the current one.
+static void requestMap(unsigned int map) {
+    if (findMapSlot(&level.mapSlots, map) >= 0) {
+        return;
+    }
+    int slot = -1;
+    for (int i = 0; i < MAP_SLOT_COUNT; i++) {
+        if (level.mapSlots.slots[i].map != level.currentMap) {
+            slot = i;
+        }
+    }
+    // Reading the file again supersedes any read still in flight.
+    assignMapFile(slot, map);
+    char file[64];
+    sprintf(file, LEVEL_MAP_PATH, map);
+    lazyReadFile(file, &level.mapFiles[slot]);
+}
+
+// Opens the maps that have been read, and streams in the map the
+// current screen's teleport link leads to, if it's another one.
+static void streamMaps(void) {
+    for (int i = 0; i < MAP_SLOT_COUNT; i++) {
+        const MapSlot *slot = &level.mapSlots.slots[i];
+        if (slot->map != MAP_SLOT_EMPTY && !slot->opened && LOADER_FENCE_READY(&level.mapFiles[i].fence)) {
+            openMapSlot(i);
+        }
+    }
+    LevelScreen *screen = getLevelScreenData(screenHandleCurrent.index);
+    if (screen != NULL && screen->teleportIndex != LEVEL_NO_TELEPORT) {
+        unsigned int map = getLevelMap(screen->teleportIndex);
+        if (map != LEVEL_NO_MAP && map != level.currentMap) {
+            requestMap(map);
+        }
+    }
+}
+
+#ifndef TILED_SCREENS
 static void loadScreenImage(LevelScreenHandle *handle, LevelScreenLoadingType loadType) {
-    if (handle->index >= level.totalScreens) {
+    if (!isInCurrentMap(handle->index)) {
         return;
     }
     char file[64];
-    sprintf(file, "assets/screens/midground/%u.qoi", handle->index + 1);
+    sprintf(file, "assets/screens/midground/%u.tex", handle->index + 1);
+    // Decode first the rows that are in view when the screen
+    // is entered: the bottom of the screen above (the next one)
+    // and the top of the screen below (the previous one).
+    unsigned int firstRow = 0, rows = 0;
+    if (handle == &screenHandleNext) {
+        firstRow = PSP_SCREEN_MAX_SCROLL;
+        rows = PSP_SCREEN_HEIGHT;
+    } else if (handle == &screenHandlePrevious) {
+        firstRow = 0;
+        rows = PSP_SCREEN_HEIGHT;
+    }
+    handle->texture->index = handle->index;
     switch (loadType) {
         case LOAD_LAZY:
-            lazySwapTextureRam(file, handle->texture);
+            lazySwapTextureRam(file, handle->texture->pixels, LEVEL_SCREEN_IMAGEW, LEVEL_SCREEN_SWIZZLED, &handle->texture->fence, firstRow, rows);
             break;
         case LOAD_NOW:
-            swapTextureRam(file, handle->texture);
+            swapTextureRam(file, handle->texture->pixels, LEVEL_SCREEN_IMAGEW, LEVEL_SCREEN_SWIZZLED, &handle->texture->fence);
             break;
     }
 }
+#endif
+
+// Starts reading the map table and, once it's in, the start screen's
+// map in the background, so that loadLevel doesn't have to wait for
+// them. The reads are moved along by isLevelPreloaded.
+void preloadLevel(unsigned int startScreen) {
+    level.preloading = 1;
+    level.startScreen = startScreen;
+    level.currentMap = LEVEL_NO_MAP;
+    createMapSlots(&level.mapSlots);
+    for (int i = 0; i < MAP_SLOT_COUNT; i++) {
+        level.mapFiles[i].buffer = NULL;
+        initLoaderFence(&level.mapFiles[i].fence);
+    }
+    level.mapsFile.buffer = NULL;
+    initLoaderFence(&level.mapsFile.fence);
+    lazyReadFile(LEVEL_MAPS_PATH, &level.mapsFile);
+}
+
+int isLevelPreloaded(void) {
+    if (!LOADER_FENCE_READY(&level.mapsFile.fence)) {
+        return 0;
+    }
+    if (level.currentMap == LEVEL_NO_MAP) {
+        const char *error = openLevelMapTable(level.mapsFile.buffer, level.mapsFile.size, &level.maps);
+        if (error != NULL) {
+            panic("Invalid map table: %s", error);
+        }
+        level.currentMap = getLevelMap(level.startScreen);
+        if (level.currentMap == LEVEL_NO_MAP) {
+            panic("Invalid start screen %u", level.startScreen);
+        }
+        requestMap(level.currentMap);
+    }
+    int slot = findMapSlot(&level.mapSlots, level.currentMap);
+    if (slot < 0) {
+        return 0;
+    }
+    if (!level.mapSlots.slots[slot].opened && LOADER_FENCE_READY(&level.mapFiles[slot].fence)) {
+        openMapSlot(slot);
+    }
+    return level.mapSlots.slots[slot].opened;
+}
 
 void loadLevel(unsigned int startScreen) {
-    // Load the level data.
-    unsigned int size;
-    void *buffer = readFile("assets/level.bin", &size);
-    level.totalScreens = size / sizeof(LevelScreen);
-    level.screens = malloc(size);
-    memcpy(level.screens, buffer, size);
-    unloadFile(buffer);
+    // Load the map table, and the screen data of the starting map,
+    // unless the boot has already started reading them. Other maps
+    // are streamed in when they're about to be entered. The screens
+    // are used straight from the files' buffers, which are checked
+    // once and for all when they're opened.
+    if (!level.preloading) {
+        preloadLevel(startScreen);
+    } else if (level.startScreen != startScreen) {
+        panic("Level preloaded from screen %u but loaded from screen %u", level.startScreen, startScreen);
+    }
+    while (!isLevelPreloaded()) {
+        sceKernelDelayThreadCB(1000);
+        pollLoader();
+    }
+    level.preloading = 0;
+#ifdef TILED_SCREENS
+    // The screens are drawn from the tiles, which are
+    // streamed in as the screens they're in come near.
+    loadTiledScreens(LEVEL_TILE_STORE_PATH, LEVEL_TILE_MAPS_PATH);
+    screenHandlePrevious.index = startScreen - 1;
+    screenHandleCurrent.index = startScreen;
+    screenHandleNext.index = startScreen + 1;
+#else
+    // Set aside VRAM for the rows of the current screen's
+    // texture that are in view.
+    initResidency(LEVEL_SCREEN_IMAGEW, LEVEL_SCREEN_HEIGHT, GU_PSM_8888);
     // Initialize screen texture handles.
+    memAddStatic(MEMORY_TEXTURES, texturesPool, sizeof(texturesPool));
+    for (int i = 0; i < 3; i++) {
+        screenTextures[i].pixels = texturesPool + LEVEL_SCREEN_BYTES * i;
+        initLoaderFence(&screenTextures[i].fence);
+        screenTextures[i].index = LEVEL_NO_SCREEN;
+    }
     screenHandlePrevious.index = startScreen - 1;
-    screenHandlePrevious.texture = texturesPool;
+    screenHandlePrevious.texture = &screenTextures[0];
     screenHandleCurrent.index = startScreen;
-    screenHandleCurrent.texture = texturesPool + LEVEL_SCREEN_BYTES;
+    screenHandleCurrent.texture = &screenTextures[1];
     screenHandleNext.index = startScreen + 1;
-    screenHandleNext.texture = texturesPool + LEVEL_SCREEN_BYTES * 2;
+    screenHandleNext.texture = &screenTextures[2];
+#endif
     // Load the appropriate screen textures.
-    lastScreenReturned = NULL;
+    lastScreenReturned = LEVEL_NO_SCREEN;
     getLevelScreen(startScreen);
 }
 
-LevelScreen *getLevelScreen(unsigned int index) {
+// Returns NULL if the screen isn't in any map, or if its
+// map's screen data is still being streamed in. The screen may
+// be gone once the maps are streamed again, so this is only for
+// the render; the update copies its screens instead.
+LevelScreen *getLevelScreenData(unsigned int index) {
     // Check if the index is valid (maybe we computed the wrong index?).
-    if (index < level.totalScreens) {
-        LevelScreen *screen = &level.screens[index];
-        // Check if the screen data is intact
-        // (it's a simple check but it's better than nothing).
-        if (screen->magic != LEVEL_SCREEN_MAGIC) {
-            panic("Invalid screen %u: expected magic %04X but found %04X", index, LEVEL_SCREEN_MAGIC, screen->magic);
+    unsigned int map = getLevelMap(index);
+    if (map == LEVEL_NO_MAP) {
+        return NULL;
+    }
+    return getMapScreen(&level.mapSlots, map, index - level.maps.maps[map].firstScreen);
+}
+
+// Like getLevelScreenData, but the screen is copied to dest, which is
+// left alone if it isn't there. It's safe to call from any thread.
+int copyLevelScreenData(unsigned int index, LevelScreen *dest) {
+    unsigned int map = getLevelMap(index);
+    if (map == LEVEL_NO_MAP) {
+        return 0;
+    }
+    return copyMapScreen(&level.mapSlots, map, index - level.maps.maps[map].firstScreen, dest);
+}
+
+#ifndef TILED_SCREENS
+// Points the handles to the screen and the ones around it. Textures
+// that already hold (or are loading) one of those are kept for it,
+// and the rest are given to the others, which are loaded lazily:
+// the current screen first, then the next and previous ones, as we
+// shouldn't need them immediately. Those two are left as they are
+// unless the neighbours are asked for.
+static void selectScreenTextures(unsigned int index, int neighbours) {
+    LevelScreenHandle *handles[3];
+    handles[SCREEN_PREV] = &screenHandlePrevious;
+    handles[SCREEN_THIS] = &screenHandleCurrent;
+    handles[SCREEN_NEXT] = &screenHandleNext;
+    const int loadOrder[3] = { SCREEN_THIS, SCREEN_NEXT, SCREEN_PREV };
+    int taken[3] = { 0, 0, 0 };
+    for (int h = 0; h < 3; h++) {
+        handles[h]->index = index + h - SCREEN_THIS;
+        handles[h]->texture = NULL;
+        for (int t = 0; t < 3; t++) {
+            if (!taken[t] && screenTextures[t].index == handles[h]->index) {
+                handles[h]->texture = &screenTextures[t];
+                taken[t] = 1;
+                break;
+            }
         }
+    }
+    for (int i = 0; i < 3; i++) {
+        LevelScreenHandle *handle = handles[loadOrder[i]];
+        if (handle->texture != NULL) {
+            continue;
+        }
+        int t = 0;
+        while (taken[t]) {
+            t++;
+        }
+        handle->texture = &screenTextures[t];
+        taken[t] = 1;
+        if (handle == &screenHandleCurrent || neighbours) {
+            loadScreenImage(handle, LOAD_LAZY);
+        }
+    }
+}
+#endif
+
+static LevelScreen *selectLevelScreen(unsigned int index, int neighbours) {
+    // Check if the index is valid (maybe we computed the wrong index?).
+    unsigned int map = getLevelMap(index);
+    if (map != LEVEL_NO_MAP) {
         // Check if the screen is the same as the last we returned.
-        // If it is we don't need to load any new textures.
-        if (screen != lastScreenReturned) {
-            // If we need to load new textures we can
-            // check which one we need to load.
-            void *tmp;
-            lastScreenReturned = screen;
-            if (index == screenHandleNext.index) {
-                // If the requested screen is the next one relative to the current one...
-                // - shift each handle's indices
-                screenHandlePrevious.index = screenHandleCurrent.index;
-                screenHandleCurrent.index = index;
-                screenHandleNext.index = index + 1;
-                // - swap the texture pointers
-                tmp = screenHandlePrevious.texture;
-                screenHandlePrevious.texture = screenHandleCurrent.texture;
-                screenHandleCurrent.texture = screenHandleNext.texture;
-                screenHandleNext.texture = tmp;
-                // - and finally load (lazily) the next screen.
-                loadScreenImage(&screenHandleNext, LOAD_LAZY);
-            } else if (index == screenHandlePrevious.index) {
-                // If the requested screen is the previous one relative to the current one...
-                // - shift each handle's indices
-                screenHandleNext.index = screenHandleCurrent.index;
-                screenHandleCurrent.index = index;
-                screenHandlePrevious.index = index - 1;
-                // - swap the texture pointers
-                tmp = screenHandleNext.texture;
-                screenHandleNext.texture = screenHandleCurrent.texture;
-                screenHandleCurrent.texture = screenHandlePrevious.texture;
-                screenHandlePrevious.texture = tmp;
-                // - and finally load (lazily) the next screen.
-                loadScreenImage(&screenHandlePrevious, LOAD_LAZY);
-            } else {
-                // If the requested screen is completely new
-                // - change each handle's indices
-                screenHandlePrevious.index = index - 1;
-                screenHandleCurrent.index = index;
-                screenHandleNext.index = index + 1;
-                // Load the current screen immediately
-                // This will probably lag the game but
-                // that shouldn't be a problem as this is needed
-                // only when there is a horizontal transition.
-                loadScreenImage(&screenHandleCurrent, LOAD_NOW);
-                // Load the next and previous screen lazily as
-                // we shouldn't need the immediately.
-                loadScreenImage(&screenHandleNext, LOAD_LAZY);
-                loadScreenImage(&screenHandlePrevious, LOAD_LAZY);
+        // If it is we don't need to load any new textures, unless
+        // its neighbours have been left out.
+        if (index != lastScreenReturned || (neighbours && !neighboursLoaded)) {
+            lastScreenReturned = index;
+            neighboursLoaded = neighbours;
+            // Entering another map (through a teleport link) makes it
+            // the current one. Its screen data should have been
+            // streamed in already, but if it hasn't, it is now.
+            if (map != level.currentMap) {
+                level.currentMap = map;
+                requestMap(map);
             }
+#ifdef TILED_SCREENS
+            // The screen above is entered from the bottom,
+            // any other one from the top.
+            setCurrentTiledScreen(index, (index == screenHandleNext.index) ? PSP_SCREEN_MAX_SCROLL : 0);
+            screenHandlePrevious.index = index - 1;
+            screenHandleCurrent.index = index;
+            screenHandleNext.index = index + 1;
+#else
+            // Whatever is in VRAM belongs to the old screen.
+            if (index != screenHandleCurrent.index) {
+                invalidateResidency();
+            }
+            // Moving to the next or the previous screen keeps the
+            // textures of two of the three, and loads the other.
+            // The current screen is loaded lazily too, since the
+            // renderer holds the previous frame until the texture
+            // is ready (see isLevelScreenReady).
+            selectScreenTextures(index, neighbours);
+#endif
         }
     }
-    return lastScreenReturned;
+    return getLevelScreenData(index);
 }
 
-void renderLevelScreen(short scroll) {
-    Vertex *vertices = sceGuGetMemory(2 * sizeof(Vertex));
-    
-    vertices[0].x = 0;
-    vertices[0].y = 0;
-    vertices[0].z = 0;
-    vertices[0].u = 0;
-    vertices[0].v = scroll;
-
-    vertices[1].x = PSP_SCREEN_WIDTH;
-    vertices[1].y = PSP_SCREEN_HEIGHT;
-    vertices[1].z = 0;
-    vertices[1].u = LEVEL_SCREEN_WIDTH;
-    vertices[1].v = PSP_SCREEN_HEIGHT + scroll;
-    
-    sceGuTexMode(GU_PSM_8888, 0, 0, GU_TRUE);
-    sceGuTexImage(0, LEVEL_SCREEN_IMAGEW, LEVEL_SCREEN_IMAGEH, LEVEL_SCREEN_IMAGEW, screenHandleCurrent.texture);
-    sceGuTexFunc(GU_TFX_REPLACE, GU_TCC_RGB);
+LevelScreen *getLevelScreen(unsigned int index) {
+    return selectLevelScreen(index, 1);
+}
+
+// Like getLevelScreen, but only the screen itself is loaded, if it
+// isn't already, for when the screens are skipped through. Calling
+// getLevelScreen for it afterwards loads the neighbours.
+LevelScreen *seekLevelScreen(unsigned int index) {
+    return selectLevelScreen(index, 0);
+}
+
+// NOTE: Nothing may be drawn from the current screen's texture
+//       until this says the rows in view are ready. Until then,
+//       the last frame should be held on screen (see holdFrame).
+int isLevelScreenReady(short top, short bottom) {
+#ifdef TILED_SCREENS
+    return areTiledScreenRowsReady(screenHandleCurrent.index, top, bottom);
+#else
+    return LOADER_FENCE_ROWS_READY(&screenHandleCurrent.texture->fence, top, bottom);
+#endif
+}
+
+// NOTE: This must be called once per frame, before anything is drawn.
+//       Screen images become ready when the loader is polled, so
+//       only the maps' screen data and the tiles of TILED_SCREENS
+//       are streamed from here.
+void streamLevelScreens(void) {
+    streamMaps();
+#ifdef TILED_SCREENS
+    streamTiledScreens();
+#endif
+}
+
+#ifndef TILED_SCREENS
+// Binds the current screen's texture, using its copy in VRAM if
+// that holds the rows from top to bottom. The returned offset must
+// be subtracted from the v coordinates of what's drawn with it.
+static short bindScreenTexture(short scroll, short top, short bottom, int components) {
+    short vOffset;
+    // Rows that have been decoded since the window was
+    // uploaded aren't in it, so it has to be uploaded again.
+    const LoaderFence *fence = &screenHandleCurrent.texture->fence;
+    if (fence->readyTop != residentReadyTop || fence->readyBottom != residentReadyBottom) {
+        residentReadyTop = fence->readyTop;
+        residentReadyBottom = fence->readyBottom;
+        invalidateResidency();
+    }
+    updateResidency(screenHandleCurrent.texture->pixels, scroll, scroll + PSP_SCREEN_HEIGHT);
+    const void *texture = bindResidentRows(screenHandleCurrent.texture->pixels, top, bottom, &vOffset);
+    sceGuTexMode(GU_PSM_8888, 0, 0, LEVEL_SCREEN_SWIZZLED);
+    sceGuTexImage(0, LEVEL_SCREEN_IMAGEW, LEVEL_SCREEN_IMAGEH, LEVEL_SCREEN_IMAGEW, texture);
+    sceGuTexFunc(GU_TFX_REPLACE, components);
     sceGuTexFilter(GU_NEAREST, GU_NEAREST);
-    sceGuDrawArray(GU_SPRITES, GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D, 2, NULL, vertices);
+    return vOffset;
 }
+#endif
 
-void renderLevelScreenLinesTop(short scroll, short lines) {
+// Draws the part of the given screen from u, v to u + width,
+// v + height at x, y. The current screen is drawn from VRAM if
+// the rows in view at the given scroll are there.
+static void drawScreenRect(const LevelScreenHandle *handle, short scroll, short u, short v, short width, short height, short x, short y, int components) {
+#ifdef TILED_SCREENS
+    renderTiledScreenRect(handle->index, u, v, width, height, x, y, components);
+#else
     Vertex *vertices = sceGuGetMemory(2 * sizeof(Vertex));
+    short vOffset = 0;
+    if (handle == &screenHandleCurrent) {
+        vOffset = bindScreenTexture(scroll, v, v + height, components);
+    } else {
+        sceGuTexMode(GU_PSM_8888, 0, 0, LEVEL_SCREEN_SWIZZLED);
+        sceGuTexImage(0, LEVEL_SCREEN_IMAGEW, LEVEL_SCREEN_IMAGEH, LEVEL_SCREEN_IMAGEW, handle->texture->pixels);
+        sceGuTexFunc(GU_TFX_REPLACE, components);
+        sceGuTexFilter(GU_NEAREST, GU_NEAREST);
+    }
+
+    vertices[0].x = x;
+    vertices[0].y = y;
+    vertices[0].z = RENDER_LAYER_MIDGROUND;
+    vertices[0].u = u;
+    vertices[0].v = v - vOffset;
+
+    vertices[1].x = x + width;
+    vertices[1].y = y + height;
+    vertices[1].z = RENDER_LAYER_MIDGROUND;
+    vertices[1].u = u + width;
+    vertices[1].v = v + height - vOffset;
 
-    vertices[0].x = 0;
-    vertices[0].y = 0;
-    vertices[0].z = 1;
-    vertices[0].u = 0;
-    vertices[0].v = scroll;
-
-    vertices[1].x = PSP_SCREEN_WIDTH;
-    vertices[1].y = lines;
-    vertices[1].z = 1;
-    vertices[1].u = LEVEL_SCREEN_WIDTH;
-    vertices[1].v = scroll + lines;
-
-    sceGuTexMode(GU_PSM_8888, 0, 0, GU_TRUE);
-    sceGuTexImage(0, LEVEL_SCREEN_IMAGEW, LEVEL_SCREEN_IMAGEH, LEVEL_SCREEN_IMAGEW, screenHandleCurrent.texture);
-    sceGuTexFunc(GU_TFX_REPLACE, GU_TCC_RGB);
-    sceGuTexFilter(GU_NEAREST, GU_NEAREST);
     sceGuDrawArray(GU_SPRITES, GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D, 2, NULL, vertices);
+#endif
+}
+
+void renderLevelScreen(short scroll) {
+    drawScreenRect(&screenHandleCurrent, scroll, 0, scroll, LEVEL_SCREEN_WIDTH, PSP_SCREEN_HEIGHT, 0, 0, GU_TCC_RGB);
+}
+
+void renderLevelScreenLinesTop(short scroll, short lines) {
+    drawScreenRect(&screenHandleCurrent, scroll, 0, scroll, LEVEL_SCREEN_WIDTH, lines, 0, 0, GU_TCC_RGB);
     
     // Update the display buffer to avoid graphical glitches.
     queueDisplayBufferUpdate(0, scroll, PSP_SCREEN_WIDTH, lines);
 }
 
 void renderLevelScreenLinesBottom(short scroll, short lines) {
-    Vertex *vertices = sceGuGetMemory(2 * sizeof(Vertex));
-
     short offset = PSP_SCREEN_HEIGHT - lines;
-
-    vertices[0].x = 0;
-    vertices[0].y = offset;
-    vertices[0].z = 0;
-    vertices[0].u = 0;
-    vertices[0].v = scroll + offset;
-
-    vertices[1].x = PSP_SCREEN_WIDTH;
-    vertices[1].y = offset + lines;
-    vertices[1].z = 0;
-    vertices[1].u = LEVEL_SCREEN_WIDTH;
-    vertices[1].v = offset + scroll + lines;
-
-    sceGuTexMode(GU_PSM_8888, 0, 0, GU_TRUE);
-    sceGuTexImage(0, LEVEL_SCREEN_IMAGEW, LEVEL_SCREEN_IMAGEH, LEVEL_SCREEN_IMAGEW, screenHandleCurrent.texture);
-    sceGuTexFunc(GU_TFX_REPLACE, GU_TCC_RGB);
-    sceGuTexFilter(GU_NEAREST, GU_NEAREST);
-    sceGuDrawArray(GU_SPRITES, GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D, 2, NULL, vertices);
+    drawScreenRect(&screenHandleCurrent, scroll, 0, scroll + offset, LEVEL_SCREEN_WIDTH, lines, 0, offset, GU_TCC_RGB);
 
     // Update the display buffer to avoid graphical glitches.
     queueDisplayBufferUpdate(0, offset + scroll, PSP_SCREEN_WIDTH, lines);
 }
 
+// Draws the lines from y to y + lines of the view of the given
+// screen at the given scroll, if it's next to the current one and
+// its texture has been loaded. Returns whether it has been drawn.
+int renderAdjacentLevelScreenLines(unsigned int index, short scroll, short y, short lines) {
+    const LevelScreenHandle *handle;
+    if (index == screenHandleNext.index) {
+        handle = &screenHandleNext;
+    } else if (index == screenHandlePrevious.index) {
+        handle = &screenHandlePrevious;
+    } else {
+        return 0;
+    }
+    if (!isInCurrentMap(handle->index)) {
+        return 0;
+    }
+#ifdef TILED_SCREENS
+    if (!areTiledScreenRowsReady(handle->index, scroll + y, scroll + y + lines)) {
+        return 0;
+    }
+#else
+    // The texture may still hold another screen, if the
+    // neighbours were left out by seekLevelScreen.
+    if (handle->texture->index != handle->index ||
+        !LOADER_FENCE_ROWS_READY(&handle->texture->fence, scroll + y, scroll + y + lines)) {
+        return 0;
+    }
+#endif
+    drawScreenRect(handle, scroll, 0, scroll + y, LEVEL_SCREEN_WIDTH, lines, 0, y, GU_TCC_RGB);
+    return 1;
+}
+
 void forceCleanLevelArtifactAt(short x, short y, short width, short height) {
     // Clamp x coordinate within the screen bounds.
     if (x < 0) {
@@ -244,28 +555,35 @@ void renderLevelScreenSection(short x, short y, short width, short height, unsig
         y = LEVEL_SCREEN_HEIGHT - height;
     }
     
-    Vertex *vertices = sceGuGetMemory(2 * sizeof(Vertex));
-    
-    vertices[0].u = x;
-    vertices[0].v = y;
-    vertices[0].x = x;
-    vertices[0].y = y - currentScroll;
-    vertices[0].z = 0;
-
-    vertices[1].u = x + width;
-    vertices[1].v = y + height;
-    vertices[1].x = x + width;
-    vertices[1].y = (y - currentScroll) + height;
-    vertices[1].z = 0;
-    
-    sceGuTexMode(GU_PSM_8888, 0, 0, GU_TRUE);
-    sceGuTexImage(0, LEVEL_SCREEN_IMAGEW, LEVEL_SCREEN_IMAGEH, LEVEL_SCREEN_IMAGEW, screenHandleCurrent.texture);
-    sceGuTexFunc(GU_TFX_REPLACE, GU_TCC_RGBA);
-    sceGuTexFilter(GU_NEAREST, GU_NEAREST);
-    sceGuDrawArray(GU_SPRITES, GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D, 2, NULL, vertices);
+    drawScreenRect(&screenHandleCurrent, currentScroll, x, y, width, height, x, y - currentScroll, GU_TCC_RGBA);
 }
 
 void unloadLevel(void) {
-    free(level.screens);
-    level.screens = NULL;
+#ifdef TILED_SCREENS
+#ifdef DEBUG
+    TiledScreensStats stats;
+    getTiledScreensStats(&stats);
+    printf("Screen tiles: %u in the store, %u slots in the atlas, %u decoded, %u evicted\n",
+           stats.tiles, stats.slots, stats.decodes, stats.evictions);
+#endif
+    endTiledScreens();
+#else
+#ifdef DEBUG
+    ResidencyStats stats;
+    getResidencyStats(&stats);
+    unsigned int draws = stats.hits + stats.misses;
+    printf("Screen texture residency: %u rows in VRAM, %u/%u draws from VRAM (%u%%), %u uploads (%u KB)\n",
+           stats.rows, stats.hits, draws, draws > 0 ? stats.hits * 100 / draws : 0,
+           stats.uploads, stats.uploadedBytes / 1024);
+#endif
+    endResidency();
+#endif
+    for (int i = 0; i < MAP_SLOT_COUNT; i++) {
+        assignMapFile(i, MAP_SLOT_EMPTY);
+        // Drop any read still in flight.
+        ++level.mapFiles[i].fence.generation;
+    }
+    destroyMapSlots(&level.mapSlots);
+    unloadFile(level.mapsFile.buffer);
+    level.mapsFile.buffer = NULL;
 }
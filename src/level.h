@@ -1,8 +1,6 @@
 #ifndef __LEVEL_H__
 #define __LEVEL_H__
 
-#include "alloc.h"
-
 #define LEVEL_COORDS_SCREEN2MAP(c) (c >> 3)
 #define LEVEL_COORDS_MAP2SCREEN(c) (c << 3)
 
@@ -36,18 +34,35 @@ typedef enum {
     BLOCK_QUARK
 } LevelScreenBlock;
 
+// There are fewer than 16 kinds of blocks, so they're stored two to
+// a byte: the one of the even column in the low nibble.
 typedef struct {
-    unsigned short magic;
     unsigned char wind;
     unsigned char teleportIndex;
-    unsigned char blocks[LEVEL_SCREEN_BLOCK_HEIGHT][LEVEL_SCREEN_BLOCK_WIDTH];
+    unsigned char blocks[LEVEL_SCREEN_BLOCK_HEIGHT][LEVEL_SCREEN_BLOCK_WIDTH / 2];
 } __attribute__((packed)) LevelScreen;
 
+#define LEVEL_SCREEN_BLOCK(s, x, y) ((LevelScreenBlock) (((s)->blocks[y][(x) >> 1] >> (((x) & 1) << 2)) & 0x0F))
+
+// The map of screens that aren't in any.
+#define LEVEL_NO_MAP ((unsigned int) -1)
+// The screen the game starts from.
+#define LEVEL_START_SCREEN 0
+
+void preloadLevel(unsigned int startScreen);
+int isLevelPreloaded(void);
 void loadLevel(unsigned int startScreen);
+unsigned int getLevelMap(unsigned int index);
+LevelScreen *getLevelScreenData(unsigned int index);
+int copyLevelScreenData(unsigned int index, LevelScreen *dest);
 LevelScreen *getLevelScreen(unsigned int index);
+LevelScreen *seekLevelScreen(unsigned int index);
+int isLevelScreenReady(short top, short bottom);
+void streamLevelScreens(void);
 void renderLevelScreen(short scroll);
 void renderLevelScreenLinesTop(short scroll, short lines);
 void renderLevelScreenLinesBottom(short scroll, short lines);
+int renderAdjacentLevelScreenLines(unsigned int index, short scroll, short y, short lines);
 void renderLevelScreenSection(short x, short y, short width, short height, unsigned int currentScroll);
 void forceCleanLevelArtifactAt(short x, short y, short width, short height);
 void unloadLevel(void);
@@ -0,0 +1,105 @@
+#include "levelfile.h"
+#include "checksum.h"
+#include <stddef.h>
+
+static unsigned int readLe16(const unsigned char *bytes) {
+    return bytes[0] | bytes[1] << 8;
+}
+
+static unsigned int readLe32(const unsigned char *bytes) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (unsigned int) bytes[3] << 24;
+}
+
+static int isScreenValid(const LevelScreen *screen) {
+    for (unsigned int y = 0; y < LEVEL_SCREEN_BLOCK_HEIGHT; y++) {
+        for (unsigned int x = 0; x < LEVEL_SCREEN_BLOCK_WIDTH; x++) {
+            if (LEVEL_SCREEN_BLOCK(screen, x, y) > BLOCK_QUARK) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Checks what the level file and the map table have in common,
+// and returns the number of entries after the header.
+static const char *openHeader(unsigned char *bytes, unsigned int size, unsigned int magic, unsigned int version, unsigned int *outEntries) {
+    if (bytes == NULL || size < LEVEL_FILE_HEADER_SIZE || readLe32(bytes) != magic) {
+        return "Not a level file";
+    }
+    if (readLe16(bytes + 4) != version) {
+        return "Unsupported level file version";
+    }
+    if (readLe32(bytes + 8) != size - LEVEL_FILE_HEADER_SIZE) {
+        return "Level file size mismatch";
+    }
+    if (fnv1a(bytes + LEVEL_FILE_HEADER_SIZE, size - LEVEL_FILE_HEADER_SIZE) != readLe32(bytes + 12)) {
+        return "Level file checksum mismatch";
+    }
+    // The tables are read in place, so they must be aligned
+    // (the buffers readFile returns are).
+    if (((unsigned long) bytes) % sizeof(unsigned int) != 0) {
+        return "Level file is misaligned";
+    }
+    *outEntries = readLe16(bytes + 6);
+    return NULL;
+}
+
+const char *openLevelFile(void *data, unsigned int size, LevelFile *file) {
+    unsigned char *bytes = (unsigned char *) data;
+    unsigned int totalScreens;
+    const char *error = openHeader(bytes, size, LEVEL_FILE_MAGIC, LEVEL_FILE_VERSION, &totalScreens);
+    if (error != NULL) {
+        return error;
+    }
+    if (totalScreens == 0 || totalScreens > (size - LEVEL_FILE_HEADER_SIZE) / sizeof(unsigned int)) {
+        return "Invalid screen table";
+    }
+    file->totalScreens = totalScreens;
+    file->offsets = (const unsigned int *) (bytes + LEVEL_FILE_HEADER_SIZE);
+    file->data = bytes;
+    unsigned int tableEnd = LEVEL_FILE_HEADER_SIZE + totalScreens * sizeof(unsigned int);
+    for (unsigned int i = 0; i < totalScreens; i++) {
+        unsigned int offset = file->offsets[i];
+        if (offset < tableEnd || offset > size || size - offset < sizeof(LevelScreen)) {
+            return "Screen out of bounds";
+        }
+        if (!isScreenValid(getLevelFileScreen(file, i))) {
+            return "Invalid block in screen";
+        }
+    }
+    return NULL;
+}
+
+const char *openLevelMapTable(void *data, unsigned int size, LevelMapTable *table) {
+    unsigned char *bytes = (unsigned char *) data;
+    unsigned int totalMaps;
+    const char *error = openHeader(bytes, size, LEVEL_MAPS_MAGIC, LEVEL_MAPS_VERSION, &totalMaps);
+    if (error != NULL) {
+        return error;
+    }
+    if (totalMaps == 0 || totalMaps > (size - LEVEL_FILE_HEADER_SIZE) / sizeof(LevelMap)) {
+        return "Invalid map table";
+    }
+    table->totalMaps = totalMaps;
+    table->maps = (const LevelMap *) (bytes + LEVEL_FILE_HEADER_SIZE);
+    // The maps must not overlap, so that each screen has one.
+    unsigned int nextScreen = 0;
+    for (unsigned int i = 0; i < totalMaps; i++) {
+        if (table->maps[i].totalScreens == 0 || table->maps[i].firstScreen < nextScreen) {
+            return "Invalid map";
+        }
+        nextScreen = table->maps[i].firstScreen + table->maps[i].totalScreens;
+    }
+    return NULL;
+}
+
+int findLevelMap(const LevelMapTable *table, unsigned int screen) {
+    for (unsigned int i = 0; i < table->totalMaps; i++) {
+        const LevelMap *map = &table->maps[i];
+        if (screen >= map->firstScreen && screen - map->firstScreen < map->totalScreens) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,65 @@
+#ifndef __LEVELFILE_H__
+#define __LEVELFILE_H__
+
+#include "level.h"
+
+// Each map of the level (the main one, New Babe+ and Ghost of the
+// Babe) is stored in a file of its own, read whole and used in place:
+//
+// struct level_header_t {
+//     uint32_t magic;        // "JKLV"
+//     uint16_t version;      // LEVEL_FILE_VERSION
+//     uint16_t totalScreens;
+//     uint32_t size;         // bytes after the header
+//     uint32_t checksum;     // FNV-1a of the bytes after the header
+// };
+//
+// followed by a table of totalScreens offsets (uint32_t, from the
+// start of the file) to the screens, each of which is a LevelScreen.
+// All values are little-endian, like the PSP. The whole file is
+// checked once, when it's opened, so the screens can then be used
+// without any further checks.
+//
+// Which screens belong to which map is told by the map table, which
+// has the same header (with the magic "JKMT"), followed by a
+// LevelMap for each map. Screens are numbered across the maps, like
+// their textures and the teleport links, and each map takes a range.
+
+// "JKLV", as read from the file.
+#define LEVEL_FILE_MAGIC 0x564C4B4A
+#define LEVEL_FILE_VERSION 2
+#define LEVEL_FILE_HEADER_SIZE 16
+// "JKMT", as read from the file.
+#define LEVEL_MAPS_MAGIC 0x544D4B4A
+#define LEVEL_MAPS_VERSION 1
+
+typedef struct {
+    unsigned int totalScreens;
+    const unsigned int *offsets;
+    unsigned char *data;
+} LevelFile;
+
+typedef struct {
+    unsigned short firstScreen;
+    unsigned short totalScreens;
+} __attribute__((packed)) LevelMap;
+
+typedef struct {
+    unsigned int totalMaps;
+    const LevelMap *maps;
+} LevelMapTable;
+
+// Checks the size bytes of data, and on success points file to them.
+// Returns NULL on success, or what is wrong with the data.
+const char *openLevelFile(void *data, unsigned int size, LevelFile *file);
+
+// Like openLevelFile, for the map table.
+const char *openLevelMapTable(void *data, unsigned int size, LevelMapTable *table);
+// Returns the index of the map the screen belongs to, or -1.
+int findLevelMap(const LevelMapTable *table, unsigned int screen);
+
+static inline LevelScreen *getLevelFileScreen(const LevelFile *file, unsigned int index) {
+    return (LevelScreen *) (file->data + file->offsets[index]);
+}
+
+#endif
@@ -1,14 +1,28 @@
 #include "loader.h"
 #include "alloc.h"
+#include "arena.h"
 #include "panic.h"
-#include "qoi.h"
+#include "codec.h"
+#include "decoder.h"
+#include "swizzle.h"
 #include <pspuser.h>
+#include <pspkernel.h>
 #include <pspdisplay.h>
 #include <pspgu.h>
 #include <string.h>
 
-#define LOADER_MAX_LAZYJOBS 5
+// Room for what a screen change queues at once: the screens, the
+// next map, a chunk of music, a ghost segment, the resume save and
+// a telemetry flush. Each job may submit up to three decodes.
+#define LOADER_MAX_LAZYJOBS 10
 #define LOADER_MAX_PATH_LENGTH 64
+// Lower than the main and the update thread, so that
+// decoding only uses the time they leave free.
+#define LOADER_DECODER_PRIORITY 0x30
+// More than any texture has, for decoding up to the last row.
+#define LOADER_ALL_ROWS 0xFFFF
+// The row index of a texture is next to it, with this extension.
+#define LOADER_ROW_INDEX_EXTENSION ".qri"
 
 typedef enum {
     LAZYJOB_IDLE,
@@ -17,77 +31,280 @@ typedef enum {
     LAZYJOB_REWIND,
     LAZYJOB_READ,
     LAZYJOB_CLOSE,
-    LAZYJOB_DONE,
+    LAZYJOB_CLOSED,
+    LAZYJOB_OPEN_INDEX,
+    LAZYJOB_DECODE,
+    LAZYJOB_DECODING,
+    LAZYJOB_WRITE,
+    LAZYJOB_WRITE_CLOSE,
+    LAZYJOB_WRITE_CLOSED,
 } LoaderLazyJobStatus;
 
+typedef enum {
+    LAZYFILE_IMAGE,
+    LAZYFILE_INDEX,
+} LoaderLazyJobFile;
+
 typedef struct {
     LoaderLazyJobStatus status;
     char path[LOADER_MAX_PATH_LENGTH];
+    // if set, the file is handed over as it is, instead
+    // of being decoded into dest
+    LoaderFile *target;
+    // if set, the image buffer is written to the file
+    // instead of the file being read, at its end if append
+    // is set, in which case the job is never dropped
+    int write, append;
+    // if size isn't 0, only those bytes of the file are read
+    unsigned int rangeOffset, rangeSize;
     void *dest;
-    void *readBuffer;
-    unsigned int size;
+    unsigned int pitch;
+    int swizzle;
+    LoaderFence *fence;
+    unsigned int generation;
+    // the rows to decode first (if any), using the row index
+    // if the codec needs one
+    unsigned int firstRow, rows;
+    const TextureCodec *codec;
+    // the file being read, and what has been read of each
+    LoaderLazyJobFile file;
+    void *buffers[2];
+    unsigned int sizes[2];
     SceUID fd;
+    QoiRowIndex rowIndex;
+    // the first rows, the ones above them and the ones below
+    DecodeJob decodes[3];
+    int decodesPending;
 } LoaderLazyJob;
 
 static SceUID asyncCallbackId;
 static int queueEnd, queueStart;
 static LoaderLazyJob lazyJobs[LOADER_MAX_LAZYJOBS];
 
+static int loaderAsyncCallback(int arg1, int jobPtr, void *argp);
+
+// A job is stale if its texture has been requested again since it was queued.
+static int isLazyJobStale(const LoaderLazyJob *job) {
+    return job->generation != job->fence->generation;
+}
+
+static void freeLazyJob(LoaderLazyJob *job) {
+    fileFree(job->buffers[LAZYFILE_IMAGE]);
+    fileFree(job->buffers[LAZYFILE_INDEX]);
+    job->buffers[LAZYFILE_IMAGE] = NULL;
+    job->buffers[LAZYFILE_INDEX] = NULL;
+    job->status = LAZYJOB_IDLE;
+}
+
+static void openLazyJobFile(LoaderLazyJob *job, LoaderLazyJobFile file) {
+#define lazyLoaderPanic(msg, ...) panic("Error while lazy loading %s\n" msg, job->path, ##__VA_ARGS__)
+    char path[LOADER_MAX_PATH_LENGTH + sizeof(LOADER_ROW_INDEX_EXTENSION)];
+    strcpy(path, job->path);
+    if (file == LAZYFILE_INDEX) {
+        char *extension = strrchr(path, '.');
+        strcpy((extension != NULL) ? extension : path + strlen(path), LOADER_ROW_INDEX_EXTENSION);
+    }
+    job->file = file;
+    job->status = LAZYJOB_SEEK;
+    job->fd = sceIoOpenAsync(path, PSP_O_RDONLY, 0444);
+    if (job->fd < 0) {
+        lazyLoaderPanic("Could not open %s", path);
+    }
+    sceIoSetAsyncCallback(job->fd, asyncCallbackId, job);
+#undef lazyLoaderPanic
+}
+
+static void openLazyJobWrite(LoaderLazyJob *job) {
+    job->status = LAZYJOB_WRITE;
+    int flags = PSP_O_WRONLY | PSP_O_CREAT | (job->append ? PSP_O_APPEND : PSP_O_TRUNC);
+    job->fd = sceIoOpenAsync(job->path, flags, 0777);
+    if (job->fd < 0) {
+        panic("Error while writing %s\nCould not open it", job->path);
+    }
+    sceIoSetAsyncCallback(job->fd, asyncCallbackId, job);
+}
+
+static void submitLazyDecode(LoaderLazyJob *job, const QoiRowIndex *rowIndex, unsigned int firstRow, unsigned int rows) {
+    DecodeJob *decode = &job->decodes[job->decodesPending++];
+    decode->data = job->buffers[LAZYFILE_IMAGE];
+    decode->size = job->sizes[LAZYFILE_IMAGE];
+    decode->dest = job->dest;
+    decode->pitch = job->pitch;
+    decode->swizzle = job->swizzle;
+    decode->rowIndex = rowIndex;
+    decode->firstRow = firstRow;
+    decode->rows = rows;
+    decode->currentGeneration = &job->fence->generation;
+    decode->generation = job->generation;
+    decode->user = job;
+    if (!submitDecodeJob(decode)) {
+        panic("Error while lazy loading %s\nToo many jobs waiting for the decoder", job->path);
+    }
+}
+
+static void advanceLazyQueue(void) {
+    if (++queueStart == LOADER_MAX_LAZYJOBS) {
+        queueStart = 0;
+    }
+}
+
+// Starts the job at the front of the queue, skipping
+// (and dropping) the ones that have become stale.
+static void startNextLazyJob(void) {
+    for (;;) {
+        LoaderLazyJob *job = &lazyJobs[queueStart];
+        if (job->status != LAZYJOB_PENDING) {
+            return;
+        }
+        if (job->append || !isLazyJobStale(job)) {
+            if (job->write) {
+                openLazyJobWrite(job);
+            } else {
+                openLazyJobFile(job, LAZYFILE_IMAGE);
+            }
+            return;
+        }
+        // A dropped write still holds its copy of the data.
+        freeLazyJob(job);
+        advanceLazyQueue();
+    }
+}
+
 static int loaderAsyncCallback(int arg1, int jobPtr, void *argp) {
 #define lazyLoaderPanic(msg, ...) panic("Error while lazy loading %s\n" msg, job->path, ##__VA_ARGS__)
     SceInt64 res;
-    QoiDescriptor desc;
     LoaderLazyJob *job = (LoaderLazyJob *) jobPtr;
     if (sceIoPollAsync(job->fd, &res) < 0) {
         lazyLoaderPanic("Could not poll fd %d", job->fd);
     }
     switch (job->status) {
         case LAZYJOB_SEEK:
+            if (job->rangeSize > 0) {
+                job->sizes[job->file] = job->rangeSize;
+                sceIoLseekAsync(job->fd, job->rangeOffset, PSP_SEEK_SET);
+                job->status = LAZYJOB_READ;
+                break;
+            }
             sceIoLseekAsync(job->fd, 0, PSP_SEEK_END);
             job->status = LAZYJOB_REWIND;
             break;
         
         case LAZYJOB_REWIND:
-            job->size = (unsigned int) res;
+            job->sizes[job->file] = (unsigned int) res;
             sceIoLseekAsync(job->fd, 0, PSP_SEEK_SET);
             job->status = LAZYJOB_READ;
             break;
         
         case LAZYJOB_READ:
-            job->readBuffer = malloc(job->size);
-            sceIoReadAsync(job->fd, job->readBuffer, job->size);
+            job->buffers[job->file] = fileAlloc(job->sizes[job->file]);
+            sceIoReadAsync(job->fd, job->buffers[job->file], job->sizes[job->file]);
             job->status = LAZYJOB_CLOSE;
             break;
         
         case LAZYJOB_CLOSE:
-            if (job->size != (unsigned int) res) {
-                lazyLoaderPanic("Read bytes mismatch: read %lu bytes out of %u", res, job->fd);
+            if (job->sizes[job->file] != (unsigned int) res) {
+                lazyLoaderPanic("Read bytes mismatch: read %lu bytes out of %u", res, job->sizes[job->file]);
             }
             sceIoCloseAsync(job->fd);
-            if (qoiDecode(job->readBuffer, job->size, &desc, job->dest)) {
-                lazyLoaderPanic("Failed to decode QOI");
+            if (job->target != NULL) {
+                if (!isLazyJobStale(job)) {
+                    job->target->buffer = job->buffers[LAZYFILE_IMAGE];
+                    job->target->size = job->sizes[LAZYFILE_IMAGE];
+                    job->buffers[LAZYFILE_IMAGE] = NULL;
+                    job->fence->completed = job->generation;
+                }
+                // The slot is given back once the file is closed,
+                // since the close calls back with this job.
+                job->status = LAZYJOB_CLOSED;
+                break;
             }
-            job->status = LAZYJOB_DONE;
+            if (job->file == LAZYFILE_IMAGE) {
+                job->codec = findTextureCodec(job->buffers[LAZYFILE_IMAGE], job->sizes[LAZYFILE_IMAGE]);
+                if (job->codec == NULL) {
+                    lazyLoaderPanic("Unknown texture format");
+                }
+                // Some codecs can only decode the whole texture.
+                if (job->codec->decodeRows == NULL) {
+                    job->rows = 0;
+                }
+            }
+            // The row index is only needed to decode some rows first.
+            if (job->file == LAZYFILE_IMAGE && job->rows > 0 && job->codec->needsRowIndex && !isLazyJobStale(job)) {
+                job->status = LAZYJOB_OPEN_INDEX;
+            } else {
+                job->status = LAZYJOB_DECODE;
+            }
+            break;
+
+        case LAZYJOB_CLOSED:
+            freeLazyJob(job);
+            advanceLazyQueue();
+            startNextLazyJob();
+            break;
+
+        case LAZYJOB_OPEN_INDEX:
+            openLazyJobFile(job, LAZYFILE_INDEX);
             break;
         
-        case LAZYJOB_DONE:
-            free(job->readBuffer);
-            ++queueStart;
-            if (queueStart == LOADER_MAX_LAZYJOBS) {
-                queueStart = 0;
-            }
-            job->status = LAZYJOB_IDLE;
-            job = &lazyJobs[queueStart];
-            if (job->status == LAZYJOB_PENDING) {
-                job->status = LAZYJOB_SEEK;
-                job->fd = sceIoOpenAsync(job->path, PSP_O_RDONLY, 0444);
-                if (job->fd < 0) {
-                    lazyLoaderPanic("Could not open file");
+        case LAZYJOB_DECODE:
+            // Don't bother decoding if a newer request for
+            // the same texture has been made in the meantime.
+            if (isLazyJobStale(job)) {
+                freeLazyJob(job);
+            } else {
+                // Hand the file to the decoder thread. The job's slot
+                // is given back once pollLoader() has collected all
+                // the results.
+                job->decodesPending = 0;
+                if (job->rows > 0) {
+                    const QoiRowIndex *rowIndex = NULL;
+                    if (job->file == LAZYFILE_INDEX) {
+                        if (qoiParseRowIndex(job->buffers[LAZYFILE_INDEX], job->sizes[LAZYFILE_INDEX], &job->rowIndex)) {
+                            lazyLoaderPanic("Invalid row index");
+                        }
+                        rowIndex = &job->rowIndex;
+                    }
+                    // The requested rows go first, then the ones
+                    // above and below them, so that the decoded rows
+                    // always form a single range.
+                    submitLazyDecode(job, rowIndex, job->firstRow, job->rows);
+                    if (job->firstRow > 0) {
+                        submitLazyDecode(job, rowIndex, 0, job->firstRow);
+                    }
+                    submitLazyDecode(job, rowIndex, job->firstRow + job->rows, LOADER_ALL_ROWS);
+                } else {
+                    submitLazyDecode(job, NULL, 0, 0);
                 }
-                sceIoSetAsyncCallback(job->fd, asyncCallbackId, job);
+                job->status = LAZYJOB_DECODING;
             }
+            // The file is closed, so the next one can be read
+            // while this one is being decoded.
+            advanceLazyQueue();
+            startNextLazyJob();
             break;
         
+        case LAZYJOB_WRITE:
+            sceIoWriteAsync(job->fd, job->buffers[LAZYFILE_IMAGE], job->sizes[LAZYFILE_IMAGE]);
+            job->status = LAZYJOB_WRITE_CLOSE;
+            break;
+
+        case LAZYJOB_WRITE_CLOSE:
+            if (job->sizes[LAZYFILE_IMAGE] != (unsigned int) res) {
+                panic("Error while writing %s\nWrote %lu bytes out of %u", job->path, res, job->sizes[LAZYFILE_IMAGE]);
+            }
+            sceIoCloseAsync(job->fd);
+            job->status = LAZYJOB_WRITE_CLOSED;
+            break;
+
+        case LAZYJOB_WRITE_CLOSED:
+            // The file is only whole once it's closed, which is
+            // what whoever waits on the fence relies on.
+            job->fence->completed = job->generation;
+            freeLazyJob(job);
+            advanceLazyQueue();
+            startNextLazyJob();
+            break;
+
         // This should never be executed.
         default:
             break;
@@ -104,12 +321,59 @@ void initLoader(void) {
     memset(lazyJobs, 0, sizeof(lazyJobs));
     queueEnd = 0;
     queueStart = 0;
+    if (startDecoder(LOADER_DECODER_PRIORITY) < 0) {
+        panic("Failed to start the decoder thread.");
+    }
 }
 
 void endLoader(void) {
+    stopDecoder();
     sceKernelDeleteCallback(asyncCallbackId);
 }
 
+// NOTE: This must be called once per frame, from the main thread.
+//       It's where lazily loaded textures become ready.
+void pollLoader(void) {
+    DecodeJob *decode;
+    while ((decode = pollDecodedJob()) != NULL) {
+        LoaderLazyJob *job = (LoaderLazyJob *) decode->user;
+        LoaderFence *fence = job->fence;
+        if (decode->result == DECODE_FAILED) {
+            panic("Error while lazy loading %s\nFailed to decode", job->path);
+        }
+        // The decoder has already written the pixels back from
+        // the data cache. If the texture has been requested again
+        // since, the rows belong to an old version of it.
+        if (decode->result == DECODE_DONE && job->generation == fence->generation) {
+            unsigned int height = decode->desc.height;
+            unsigned int top = (decode->firstRow < height) ? decode->firstRow : height;
+            unsigned int bottom = (decode->rows < height - top) ? top + decode->rows : height;
+            if (fence->readyTop == fence->readyBottom) {
+                fence->readyTop = top;
+                fence->readyBottom = bottom;
+            } else {
+                fence->readyTop = (top < fence->readyTop) ? top : fence->readyTop;
+                fence->readyBottom = (bottom > fence->readyBottom) ? bottom : fence->readyBottom;
+            }
+            if (fence->readyTop == 0 && fence->readyBottom == height) {
+                fence->completed = job->generation;
+            }
+        }
+        if (--job->decodesPending == 0) {
+            freeLazyJob(job);
+        }
+    }
+}
+
+static int isDecodingInto(const void *dest) {
+    for (int i = 0; i < LOADER_MAX_LAZYJOBS; i++) {
+        if (lazyJobs[i].status == LAZYJOB_DECODING && lazyJobs[i].dest == dest) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 void *readFile(const char *path, unsigned int *outSize) {
 #define readFilePanic(msg, ...) panic("Error while reading file: %s\n" msg, path, ##__VA_ARGS__)
     SceUID fd = sceIoOpen(path, PSP_O_RDONLY, 0444);
@@ -118,7 +382,7 @@ void *readFile(const char *path, unsigned int *outSize) {
     }
     SceOff size = sceIoLseek(fd, 0, PSP_SEEK_END);
     sceIoLseek(fd, 0, PSP_SEEK_SET);
-    void *buffer = malloc(size);
+    void *buffer = fileAlloc(size);
     unsigned long bytes = sceIoRead(fd, buffer, size);
     sceIoClose(fd);
     if (bytes < size) {
@@ -131,54 +395,233 @@ void *readFile(const char *path, unsigned int *outSize) {
 #undef readFilePanic
 }
 
-void lazySwapTextureRam(const char *path, void *dest) {
-#define swapTexturePanic(msg, ...) panic("Error while swapping texture %s\n" msg, path, ##__VA_ARGS__)
+void initLoaderFence(LoaderFence *fence) {
+    fence->generation = 0;
+    fence->completed = 0;
+    fence->readyTop = 0;
+    fence->readyBottom = 0;
+}
+
+// Returns the slot at the end of the queue if it's free, to be queued
+// once it's filled in.
+static LoaderLazyJob *tryReserveLazyJob(void) {
     LoaderLazyJob *job = &lazyJobs[queueEnd];
-    while (job->status != LAZYJOB_IDLE) {
+    return (job->status == LAZYJOB_IDLE) ? job : NULL;
+}
+
+// Like tryReserveLazyJob, but waits for the slot.
+static LoaderLazyJob *reserveLazyJob(void) {
+    LoaderLazyJob *job;
+    while ((job = tryReserveLazyJob()) == NULL) {
         sceKernelDelayThreadCB(1000);
+        pollLoader();
+    }
+    return job;
+}
+
+static void queueLazyJob(LoaderLazyJob *job) {
+    job->status = LAZYJOB_PENDING;
+    int wasEmpty = queueEnd == queueStart;
+    if (++queueEnd == LOADER_MAX_LAZYJOBS) {
+        queueEnd = 0;
+    }
+    if (wasEmpty) {
+        startNextLazyJob();
     }
+}
+
+// The texture is decoded into dest with rows pitch pixels apart,
+// and swizzled if asked to.
+// If rows isn't 0, the given rows are decoded (and become ready)
+// before the rest of the texture. This needs the texture's row
+// index, which is loaded from the file next to it.
+void lazySwapTextureRam(const char *path, void *dest, unsigned int pitch, int swizzle, LoaderFence *fence, unsigned int firstRow, unsigned int rows) {
+    LoaderLazyJob *job = reserveLazyJob();
     strcpy(job->path, path);
+    job->target = NULL;
+    job->write = 0;
+    job->append = 0;
+    job->rangeSize = 0;
     job->dest = dest;
-    if (queueEnd == queueStart) {
-        job->status = LAZYJOB_SEEK;
-        job->fd = sceIoOpenAsync(job->path, PSP_O_RDONLY, 0444);
-        if (job->fd < 0) {
-            swapTexturePanic("Could not open file");
-        }
-        sceIoSetAsyncCallback(job->fd, asyncCallbackId, job);
-    } else {
-        job->status = LAZYJOB_PENDING;
+    job->pitch = pitch;
+    job->swizzle = swizzle;
+    job->fence = fence;
+    // Swizzled rows are only whole in bands, so the rows
+    // decoded first grow to the bands they touch.
+    if (swizzle && rows > 0) {
+        unsigned int endRow = firstRow + rows + SWIZZLE_BLOCK_HEIGHT - 1;
+        firstRow -= firstRow % SWIZZLE_BLOCK_HEIGHT;
+        rows = endRow - endRow % SWIZZLE_BLOCK_HEIGHT - firstRow;
     }
-    if (++queueEnd == LOADER_MAX_LAZYJOBS) {
-        queueEnd = 0;
+    job->firstRow = firstRow;
+    job->rows = rows;
+    // The decoder thread reads the generation to skip stale jobs.
+    job->generation = __atomic_add_fetch(&fence->generation, 1, __ATOMIC_RELAXED);
+    // Nothing of the texture can be used until the new version arrives.
+    fence->readyTop = 0;
+    fence->readyBottom = 0;
+    queueLazyJob(job);
+}
+
+// Reads the file into a new buffer, which is handed to file once it's
+// all been read. If the file is requested again before then, only the
+// newest read is handed over. Any buffer the file had is left alone.
+void lazyReadFile(const char *path, LoaderFile *file) {
+    lazyReadFileRange(path, 0, 0, file);
+}
+
+// Like lazyReadFile, but only size bytes are read, from the offset
+// on. A size of 0 reads the whole file.
+void lazyReadFileRange(const char *path, unsigned int offset, unsigned int size, LoaderFile *file) {
+    LoaderLazyJob *job = reserveLazyJob();
+    strcpy(job->path, path);
+    job->target = file;
+    job->write = 0;
+    job->append = 0;
+    job->rangeOffset = offset;
+    job->rangeSize = size;
+    job->dest = NULL;
+    job->fence = &file->fence;
+    job->rows = 0;
+    job->generation = __atomic_add_fetch(&file->fence.generation, 1, __ATOMIC_RELAXED);
+    queueLazyJob(job);
+}
+
+// The buffer, from fileAlloc, is freed once it's been written.
+static void queueLazyWrite(LoaderLazyJob *job, const char *path, void *buffer, unsigned int size, LoaderFence *fence, int append) {
+    strcpy(job->path, path);
+    job->target = NULL;
+    job->write = 1;
+    job->append = append;
+    job->rangeSize = 0;
+    job->dest = NULL;
+    job->fence = fence;
+    job->rows = 0;
+    job->buffers[LAZYFILE_IMAGE] = buffer;
+    job->sizes[LAZYFILE_IMAGE] = size;
+    job->generation = __atomic_add_fetch(&fence->generation, 1, __ATOMIC_RELAXED);
+    queueLazyJob(job);
+}
+
+static void *copyFileBuffer(const void *data, unsigned int size) {
+    void *buffer = fileAlloc(size);
+    memcpy(buffer, data, size);
+    return buffer;
+}
+
+// Writes a copy of the data to the file, after the jobs queued before
+// it. The fence is ready once it's written. If the file is written
+// again before this write has started, this one is dropped.
+void lazyWriteFile(const char *path, const void *data, unsigned int size, LoaderFence *fence) {
+    queueLazyWrite(reserveLazyJob(), path, copyFileBuffer(data, size), size, fence, 0);
+}
+
+// Like lazyWriteFile, but the buffer, which must come from fileAlloc,
+// is written as it is instead of a copy, and freed once it's written.
+void lazyWriteFileBuffer(const char *path, void *buffer, unsigned int size, LoaderFence *fence) {
+    queueLazyWrite(reserveLazyJob(), path, buffer, size, fence, 0);
+}
+
+// Like lazyWriteFile, but if the queue is full nothing is
+// written and 0 is returned, instead of waiting for room.
+int tryLazyWriteFile(const char *path, const void *data, unsigned int size, LoaderFence *fence) {
+    LoaderLazyJob *job = tryReserveLazyJob();
+    if (job == NULL) {
+        return 0;
+    }
+    queueLazyWrite(job, path, copyFileBuffer(data, size), size, fence, 0);
+    return 1;
+}
+
+// Like lazyWriteFile, but the data goes at the end of the file, and
+// every append is written, in order. The fence is ready once they all are.
+void lazyAppendFile(const char *path, const void *data, unsigned int size, LoaderFence *fence) {
+    queueLazyWrite(reserveLazyJob(), path, copyFileBuffer(data, size), size, fence, 1);
+}
+
+// Like lazyAppendFile, but if the queue is full nothing is
+// appended and 0 is returned, instead of waiting for room.
+int tryLazyAppendFile(const char *path, const void *data, unsigned int size, LoaderFence *fence) {
+    LoaderLazyJob *job = tryReserveLazyJob();
+    if (job == NULL) {
+        return 0;
     }
-#undef swapTexturePanic
+    queueLazyWrite(job, path, copyFileBuffer(data, size), size, fence, 1);
+    return 1;
 }
 
-void swapTextureRam(const char *path, void *dest) {
+void waitLoaderFence(const LoaderFence *fence) {
+    while (!LOADER_FENCE_READY(fence)) {
+        sceKernelDelayThreadCB(1000);
+        pollLoader();
+    }
+}
+
+void swapTextureRam(const char *path, void *dest, unsigned int pitch, int swizzle, LoaderFence *fence) {
+    // Supersede any lazy load of the same texture still in flight,
+    // and wait for the decoder if it's already writing to it.
+    unsigned int generation = __atomic_add_fetch(&fence->generation, 1, __ATOMIC_RELAXED);
+    while (isDecodingInto(dest)) {
+        sceKernelDelayThreadCB(1000);
+        pollLoader();
+    }
     unsigned int size;
     void *buffer = readFile(path, &size);
-    QoiDescriptor desc;
-    if (qoiDecode(buffer, size, &desc, dest)) {
-        panic("Error while swapping texture: %s\nFailed to decode QOI", path);
+    const TextureCodec *codec = findTextureCodec(buffer, size);
+    TextureDescriptor desc;
+    if (codec == NULL || codec->decode(buffer, size, &desc, dest, pitch)) {
+        panic("Error while swapping texture: %s\nFailed to decode", path);
     }
     unloadFile(buffer);
+    if (swizzle && !desc.swizzled) {
+        unsigned int rowBytes = pitch * desc.channels;
+        if (rowBytes % SWIZZLE_BLOCK_WIDTH != 0 || desc.height % SWIZZLE_BLOCK_HEIGHT != 0) {
+            panic("Error while swapping texture: %s\nCan't be swizzled", path);
+        }
+        void *staging = frameAlloc(rowBytes * SWIZZLE_BLOCK_HEIGHT);
+        unsigned int width = (desc.width * desc.channels + SWIZZLE_BLOCK_WIDTH - 1) & ~(SWIZZLE_BLOCK_WIDTH - 1);
+        swizzleRows(dest, rowBytes, width, 0, desc.height, staging);
+    }
+    // The Graphics Engine doesn't see the data cache,
+    // so the texture must be written back to RAM
+    // before it's marked as complete.
+    sceKernelDcacheWritebackRange(dest, pitch * desc.height * desc.channels);
+    fence->readyTop = 0;
+    fence->readyBottom = desc.height;
+    fence->completed = generation;
+}
+
+// Waits for the file's read in the background, if it's been asked for,
+// and hands its buffer over. If it hasn't, the file is read now.
+void *takeLoaderFile(const char *path, LoaderFile *file, unsigned int *outSize) {
+    waitLoaderFence(&file->fence);
+    void *buffer = file->buffer;
+    file->buffer = NULL;
+    if (buffer == NULL) {
+        return readFile(path, outSize);
+    }
+    if (outSize != NULL) {
+        *outSize = file->size;
+    }
+    return buffer;
 }
 
-void *loadTextureVram(const char *path, unsigned int *outWidth, unsigned int *outHeight) {
+// The path is only used to report errors.
+void *decodeTextureVram(const char *path, const void *buffer, unsigned int size, MemoryCategory category, unsigned int *outWidth, unsigned int *outHeight) {
 #define loadTexturePanic(msg, ...) panic("Error while loading texture: %s\n" msg, path, ##__VA_ARGS__)
-    unsigned int size;
-    void *buffer = readFile(path, &size);
-    QoiDescriptor desc;
-    qoiDecode(buffer, size, &desc, NULL);
-    void *texture = vramalloc(desc.width * desc.height * desc.channels);
+    const TextureCodec *codec = findTextureCodec(buffer, size);
+    TextureDescriptor desc;
+    if (codec == NULL || codec->probe(buffer, size, &desc)) {
+        loadTexturePanic("Unknown texture format");
+    }
+    // The texture keeps the pitch it's stored with.
+    void *texture = memVramAlloc(category, desc.pitch * desc.height * desc.channels);
     if (texture == NULL) {
         loadTexturePanic("Failed to allocate VRAM");
     }
-    if (qoiDecode(buffer, size, &desc, texture)) {
-        loadTexturePanic("Failed to decode QOI");
+    if (codec->decode(buffer, size, &desc, texture, desc.pitch)) {
+        loadTexturePanic("Failed to decode");
     }
-    unloadFile(buffer);
     if (outWidth != NULL) {
         *outWidth = desc.width;
     }
@@ -188,10 +631,18 @@ void *loadTextureVram(const char *path, unsigned int *outWidth, unsigned int *ou
     return texture;
 }
 
+void *loadTextureVram(const char *path, MemoryCategory category, unsigned int *outWidth, unsigned int *outHeight) {
+    unsigned int size;
+    void *buffer = readFile(path, &size);
+    void *texture = decodeTextureVram(path, buffer, size, category, outWidth, outHeight);
+    unloadFile(buffer);
+    return texture;
+}
+
 void unloadFile(void *buffer) {
-    free(buffer);
+    fileFree(buffer);
 }
 
 void unloadTextureVram(void *texturePtr) {
-    vfree(texturePtr);
+    memVramFree(texturePtr);
 }
@@ -1,18 +1,53 @@
 #ifndef __LOADER_H__
 #define __LOADER_H__
 
+#include "alloc.h"
 #include <pspkerneltypes.h>
 
+// Tells whether a texture loaded in RAM is ready to be sampled.
+// Every request for a texture bumps the generation, and the texture
+// is complete once the completed generation has caught up with it.
+// Before that, the rows from readyTop to readyBottom may be used.
+typedef struct {
+    unsigned int generation;
+    unsigned int completed;
+    unsigned int readyTop, readyBottom;
+} LoaderFence;
+
+#define LOADER_FENCE_READY(f) ((f)->completed == (f)->generation)
+#define LOADER_FENCE_ROWS_READY(f, top, bottom) \
+    (LOADER_FENCE_READY(f) || ((f)->readyTop <= (unsigned int) (top) && (unsigned int) (bottom) <= (f)->readyBottom))
+
+// A file read in the background. Once the fence is ready, the
+// buffer belongs to whoever asked for it, and is freed with unloadFile.
+typedef struct {
+    void *buffer;
+    unsigned int size;
+    LoaderFence fence;
+} LoaderFile;
+
 void initLoader(void);
 void endLoader(void);
+void pollLoader(void);
 
-void lazySwapTextureRam(const char *path, void *dest);
-void swapTextureRam(const char *path, void *dest);
+void initLoaderFence(LoaderFence *fence);
+void lazySwapTextureRam(const char *path, void *dest, unsigned int pitch, int swizzle, LoaderFence *fence, unsigned int firstRow, unsigned int rows);
+void swapTextureRam(const char *path, void *dest, unsigned int pitch, int swizzle, LoaderFence *fence);
 
+void lazyReadFile(const char *path, LoaderFile *file);
+void lazyReadFileRange(const char *path, unsigned int offset, unsigned int size, LoaderFile *file);
+void lazyWriteFile(const char *path, const void *data, unsigned int size, LoaderFence *fence);
+void lazyWriteFileBuffer(const char *path, void *buffer, unsigned int size, LoaderFence *fence);
+int tryLazyWriteFile(const char *path, const void *data, unsigned int size, LoaderFence *fence);
+void lazyAppendFile(const char *path, const void *data, unsigned int size, LoaderFence *fence);
+int tryLazyAppendFile(const char *path, const void *data, unsigned int size, LoaderFence *fence);
+void waitLoaderFence(const LoaderFence *fence);
 void *readFile(const char *path, unsigned int *outSize);
+void *takeLoaderFile(const char *path, LoaderFile *file, unsigned int *outSize);
 void unloadFile(void *buffer);
 
-void *loadTextureVram(const char *path, unsigned int *outWidth, unsigned int *outHeight);
+void *decodeTextureVram(const char *path, const void *buffer, unsigned int size, MemoryCategory category, unsigned int *outWidth, unsigned int *outHeight);
+void *loadTextureVram(const char *path, MemoryCategory category, unsigned int *outWidth, unsigned int *outHeight);
 void unloadTextureVram(void *texturePtr);
 
 #endif
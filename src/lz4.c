@@ -0,0 +1,71 @@
+#include "lz4.h"
+#include <string.h>
+
+// Every match is at least this long.
+#define LZ4_MIN_MATCH 4
+
+// Lengths that don't fit in their 4 bits go on in
+// the next bytes, for as long as those are 255.
+static int lz4ReadLength(const unsigned char **in, const unsigned char *end, unsigned int *length) {
+    unsigned int byte;
+    do {
+        if (*in >= end) {
+            return -1;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+int lz4Decompress(const void *src, unsigned int srcSize, void *dest, unsigned int destSize) {
+    const unsigned char *in = (const unsigned char *) src;
+    const unsigned char *inEnd = in + srcSize;
+    unsigned char *out = (unsigned char *) dest;
+    unsigned char *outEnd = out + destSize;
+    while (in < inEnd) {
+        unsigned int token = *in++;
+        unsigned int literals = token >> 4;
+        if (literals == 15 && lz4ReadLength(&in, inEnd, &literals)) {
+            return -1;
+        }
+        if (literals > (unsigned int) (inEnd - in) || literals > (unsigned int) (outEnd - out)) {
+            return -1;
+        }
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        // The last sequence has no match.
+        if (in == inEnd) {
+            break;
+        }
+        if (inEnd - in < 2) {
+            return -1;
+        }
+        unsigned int offset = in[0] | in[1] << 8;
+        in += 2;
+        if (offset == 0 || offset > (unsigned int) (out - (unsigned char *) dest)) {
+            return -1;
+        }
+        unsigned int length = token & 0x0F;
+        if (length == 15 && lz4ReadLength(&in, inEnd, &length)) {
+            return -1;
+        }
+        length += LZ4_MIN_MATCH;
+        if (length > (unsigned int) (outEnd - out)) {
+            return -1;
+        }
+        // A match that overlaps what it copies repeats
+        // it, so that one goes a byte at a time.
+        const unsigned char *match = out - offset;
+        if (offset >= length) {
+            memcpy(out, match, length);
+        } else {
+            for (unsigned int i = 0; i < length; i++) {
+                out[i] = match[i];
+            }
+        }
+        out += length;
+    }
+    return (int) (out - (unsigned char *) dest);
+}
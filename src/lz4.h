@@ -0,0 +1,10 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+
+// Decompresses a raw LZ4 block (no frame around it), as written by
+// lz4.block.compress(data, store_size=False) in the asset pipeline.
+// Returns the number of bytes written to dest, or -1 if the block
+// is malformed or wouldn't fit in destSize bytes.
+int lz4Decompress(const void *src, unsigned int srcSize, void *dest, unsigned int destSize);
+
+#endif
@@ -0,0 +1,55 @@
+#include "mapslots.h"
+#include <string.h>
+
+void createMapSlots(MapSlots *slots) {
+    for (int i = 0; i < MAP_SLOT_COUNT; i++) {
+        slots->slots[i].map = MAP_SLOT_EMPTY;
+        slots->slots[i].opened = 0;
+    }
+    semaphoreCreate(&slots->lock, "map slots", 1);
+}
+
+void destroyMapSlots(MapSlots *slots) {
+    semaphoreDestroy(&slots->lock);
+}
+
+void assignMapSlot(MapSlots *slots, int slot, unsigned int map) {
+    semaphoreWait(&slots->lock);
+    slots->slots[slot].opened = 0;
+    slots->slots[slot].map = map;
+    semaphoreSignal(&slots->lock);
+}
+
+void publishMapSlot(MapSlots *slots, int slot, const LevelFile *file) {
+    semaphoreWait(&slots->lock);
+    slots->slots[slot].level = *file;
+    slots->slots[slot].opened = 1;
+    semaphoreSignal(&slots->lock);
+}
+
+int findMapSlot(const MapSlots *slots, unsigned int map) {
+    for (int i = 0; i < MAP_SLOT_COUNT; i++) {
+        if (slots->slots[i].map == map) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+LevelScreen *getMapScreen(const MapSlots *slots, unsigned int map, unsigned int screen) {
+    int slot = findMapSlot(slots, map);
+    if (slot < 0 || !slots->slots[slot].opened) {
+        return NULL;
+    }
+    return getLevelFileScreen(&slots->slots[slot].level, screen);
+}
+
+int copyMapScreen(MapSlots *slots, unsigned int map, unsigned int screen, LevelScreen *dest) {
+    semaphoreWait(&slots->lock);
+    const LevelScreen *source = getMapScreen(slots, map, screen);
+    if (source != NULL) {
+        memcpy(dest, source, sizeof(LevelScreen));
+    }
+    semaphoreSignal(&slots->lock);
+    return source != NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef __MAPSLOTS_H__
+#define __MAPSLOTS_H__
+
+#include "levelfile.h"
+#include "thread.h"
+
+// The maps whose screen data is in memory. One thread streams them in
+// and out of the slots, and only it may change them. Any thread may
+// copy screens out of them: the lock keeps a slot from being emptied
+// while a screen is copied out of it, so the copy never reads a file
+// that has been freed. The streaming thread can use the screens in
+// place, since nothing else empties the slots.
+
+#define MAP_SLOT_COUNT 2
+// The map of an empty slot.
+#define MAP_SLOT_EMPTY ((unsigned int) -1)
+
+typedef struct {
+    unsigned int map;
+    // set once the map's file has been read and checked
+    int opened;
+    LevelFile level;
+} MapSlot;
+
+typedef struct {
+    MapSlot slots[MAP_SLOT_COUNT];
+    Semaphore lock;
+} MapSlots;
+
+void createMapSlots(MapSlots *slots);
+void destroyMapSlots(MapSlots *slots);
+// Gives the slot to the map, whose file is still to be read, or empties
+// it if map is MAP_SLOT_EMPTY. Once this returns, nothing is reading
+// the file the slot had, which can be freed.
+void assignMapSlot(MapSlots *slots, int slot, unsigned int map);
+// Makes the screens of the slot's map, in the opened file, available.
+void publishMapSlot(MapSlots *slots, int slot, const LevelFile *file);
+// Returns the slot the map has been given, or -1.
+int findMapSlot(const MapSlots *slots, unsigned int map);
+// Returns the screen of the map, in place, or NULL if the map's slot
+// hasn't been published. Only for the thread that streams the maps.
+LevelScreen *getMapScreen(const MapSlots *slots, unsigned int map, unsigned int screen);
+// Copies the screen of the map to dest, from any thread. Returns 0,
+// and leaves dest alone, if the map's slot hasn't been published.
+int copyMapScreen(MapSlots *slots, unsigned int map, unsigned int screen, LevelScreen *dest);
+
+#endif
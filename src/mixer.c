@@ -0,0 +1,40 @@
+#include "mixer.h"
+#include <string.h>
+
+void clearMix(int *mix, unsigned int frames) {
+    memset(mix, 0, frames * 2 * sizeof(int));
+}
+
+unsigned int mixVoice(int *mix, unsigned int frames, MixerVoice *voice) {
+    unsigned int count = voice->length - voice->position;
+    if (count > frames) {
+        count = frames;
+    }
+    int volume = voice->volume;
+    if (voice->channels == 1) {
+        // Mono voices are played on both sides.
+        const short *in = voice->samples + voice->position;
+        for (unsigned int i = 0; i < count; i++) {
+            int sample = (in[i] * volume) >> 8;
+            mix[2 * i] += sample;
+            mix[2 * i + 1] += sample;
+        }
+    } else {
+        const short *in = voice->samples + 2 * voice->position;
+        for (unsigned int i = 0; i < 2 * count; i++) {
+            mix[i] += (in[i] * volume) >> 8;
+        }
+    }
+    voice->position += count;
+    return count;
+}
+
+void resolveMix(short *out, const int *mix, unsigned int frames) {
+    for (unsigned int i = 0; i < 2 * frames; i++) {
+        int sample = mix[i];
+        if ((unsigned int) (sample + 32768) > 65535) {
+            sample = (sample < 0) ? -32768 : 32767;
+        }
+        out[i] = (short) sample;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef __MIXER_H__
+#define __MIXER_H__
+
+// Mixes sounds into the game's output, which is 16-bit stereo.
+// The voices are summed up in 32 bits, so that loud moments
+// only clip once, when the mix is turned into the output.
+// None of it depends on the PSP, so the host tools can time it.
+
+// The volume a voice plays at as it was recorded.
+#define MIXER_VOLUME_MAX 256
+
+typedef struct {
+    // mono, or stereo with the channels interleaved
+    const short *samples;
+    unsigned int channels;
+    // how many samples (per channel) there are,
+    // and the next one to be mixed
+    unsigned int length, position;
+    int volume;
+} MixerVoice;
+
+void clearMix(int *mix, unsigned int frames);
+// Adds the voice to the frames of the mix, until either runs out,
+// and moves the voice along. Returns how many frames were mixed.
+unsigned int mixVoice(int *mix, unsigned int frames, MixerVoice *voice);
+// Clips the mix into the output.
+void resolveMix(short *out, const int *mix, unsigned int frames);
+
+#endif
@@ -0,0 +1,141 @@
+#include "qoa.h"
+
+// The scale factors, (s + 1)^2.75 rounded, times the dequantized
+// residuals, 0.75, 2.5, 4.5 and 7 with their signs, rounded
+// away from zero. The same table as the reference one.
+static const int dequantTable[16][8] = {
+    {    1,    -1,    3,    -3,    5,    -5,     7,     -7 },
+    {    5,    -5,   18,   -18,   32,   -32,    49,    -49 },
+    {   16,   -16,   53,   -53,   95,   -95,   147,   -147 },
+    {   34,   -34,  113,  -113,  203,  -203,   315,   -315 },
+    {   63,   -63,  210,  -210,  378,  -378,   588,   -588 },
+    {  104,  -104,  345,  -345,  621,  -621,   966,   -966 },
+    {  158,  -158,  528,  -528,  950,  -950,  1477,  -1477 },
+    {  228,  -228,  760,  -760, 1368, -1368,  2128,  -2128 },
+    {  316,  -316, 1053, -1053, 1895, -1895,  2947,  -2947 },
+    {  422,  -422, 1405, -1405, 2529, -2529,  3934,  -3934 },
+    {  548,  -548, 1828, -1828, 3290, -3290,  5117,  -5117 },
+    {  696,  -696, 2320, -2320, 4176, -4176,  6496,  -6496 },
+    {  868,  -868, 2893, -2893, 5207, -5207,  8099,  -8099 },
+    { 1064, -1064, 3548, -3548, 6386, -6386,  9933,  -9933 },
+    { 1286, -1286, 4288, -4288, 7718, -7718, 12005, -12005 },
+    { 1536, -1536, 5120, -5120, 9216, -9216, 14336, -14336 },
+};
+
+// The predictor of a channel, which guesses each
+// sample from the four that came before it.
+typedef struct {
+    int history[QOA_LMS_LEN];
+    int weights[QOA_LMS_LEN];
+} QoaLms;
+
+static inline unsigned int readU32(const unsigned char *bytes) {
+    return ((unsigned int) bytes[0] << 24) | ((unsigned int) bytes[1] << 16) | ((unsigned int) bytes[2] << 8) | bytes[3];
+}
+
+static inline int clampS16(int value) {
+    if ((unsigned int) (value + 32768) > 65535) {
+        return (value < -32768) ? -32768 : 32767;
+    }
+    return value;
+}
+
+int qoaDecodeHeader(const void *data, unsigned int size, QoaDesc *desc) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    if (size < QOA_HEADER_SIZE + 8 || readU32(bytes) != QOA_MAGIC) {
+        return -1;
+    }
+    desc->samples = readU32(bytes + 4);
+    desc->channels = bytes[8];
+    desc->samplerate = readU32(bytes + 8) & 0xFFFFFF;
+    if (desc->samples == 0 || desc->channels == 0 || desc->channels > QOA_MAX_CHANNELS || desc->samplerate == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+unsigned int qoaFrameCount(const QoaDesc *desc) {
+    return (desc->samples + QOA_FRAME_LEN - 1) / QOA_FRAME_LEN;
+}
+
+unsigned int qoaFrameOffset(const QoaDesc *desc, unsigned int frame) {
+    unsigned int count = qoaFrameCount(desc);
+    if (frame < count) {
+        return QOA_HEADER_SIZE + frame * QOA_FRAME_SIZE(desc->channels, QOA_SLICES_PER_FRAME);
+    }
+    unsigned int lastSamples = desc->samples - (count - 1) * QOA_FRAME_LEN;
+    unsigned int lastSlices = (lastSamples + QOA_SLICE_LEN - 1) / QOA_SLICE_LEN;
+    return qoaFrameOffset(desc, count - 1) + QOA_FRAME_SIZE(desc->channels, lastSlices);
+}
+
+// Decodes count (up to 10) samples, from the top 30 bits of bits.
+static inline void decodeResiduals(unsigned int bits, const int *dequant, QoaLms *lms, short *out, unsigned int count, unsigned int stride) {
+    int *history = lms->history, *weights = lms->weights;
+    for (unsigned int i = 0; i < count; i++) {
+        // Only broken files make the sum overflow, in which case it wraps.
+        int predicted = (int) ((unsigned int) (history[0] * weights[0]) + (unsigned int) (history[1] * weights[1]) +
+                               (unsigned int) (history[2] * weights[2]) + (unsigned int) (history[3] * weights[3])) >> 13;
+        int residual = dequant[bits >> 29];
+        bits <<= 3;
+        int sample = clampS16(predicted + residual);
+        *out = (short) sample;
+        out += stride;
+
+        int delta = residual >> 4;
+        weights[0] += (history[0] < 0) ? -delta : delta;
+        weights[1] += (history[1] < 0) ? -delta : delta;
+        weights[2] += (history[2] < 0) ? -delta : delta;
+        weights[3] += (history[3] < 0) ? -delta : delta;
+        history[0] = history[1];
+        history[1] = history[2];
+        history[2] = history[3];
+        history[3] = sample;
+    }
+}
+
+unsigned int qoaDecodeFrame(const void *data, unsigned int size, unsigned int channels, short *out, unsigned int *outSamples) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    if (size < QOA_FRAME_SIZE(channels, 0) || bytes[0] != channels) {
+        return 0;
+    }
+    unsigned int samples = (bytes[4] << 8) | bytes[5];
+    unsigned int frameSize = (bytes[6] << 8) | bytes[7];
+    if (frameSize > size || frameSize < QOA_FRAME_SIZE(channels, 0) || samples == 0 || samples > QOA_FRAME_LEN) {
+        return 0;
+    }
+    unsigned int slices = (frameSize - QOA_FRAME_SIZE(channels, 0)) / 8;
+    if (slices < (samples + QOA_SLICE_LEN - 1) / QOA_SLICE_LEN * channels) {
+        return 0;
+    }
+    bytes += 8;
+
+    QoaLms lms[QOA_MAX_CHANNELS];
+    for (unsigned int c = 0; c < channels; c++) {
+        for (int i = 0; i < QOA_LMS_LEN; i++) {
+            lms[c].history[i] = (short) ((bytes[2 * i] << 8) | bytes[2 * i + 1]);
+            lms[c].weights[i] = (short) ((bytes[8 + 2 * i] << 8) | bytes[8 + 2 * i + 1]);
+        }
+        bytes += 16;
+    }
+
+    // The slices of the channels take turns, 20 samples at a time.
+    // Each is a 4-bit scale factor followed by twenty 3-bit residuals,
+    // which are taken 10 at a time from a 32-bit word.
+    for (unsigned int first = 0; first < samples; first += QOA_SLICE_LEN) {
+        unsigned int count = samples - first;
+        if (count > QOA_SLICE_LEN) {
+            count = QOA_SLICE_LEN;
+        }
+        for (unsigned int c = 0; c < channels; c++) {
+            unsigned int high = readU32(bytes), low = readU32(bytes + 4);
+            bytes += 8;
+            const int *dequant = dequantTable[high >> 28];
+            short *dest = out + first * channels + c;
+            unsigned int head = (count > QOA_SLICE_LEN / 2) ? QOA_SLICE_LEN / 2 : count;
+            decodeResiduals((high << 4) | (low >> 28), dequant, &lms[c], dest, head, channels);
+            decodeResiduals(low << 2, dequant, &lms[c], dest + head * channels, count - head, channels);
+        }
+    }
+    *outSamples = samples;
+    return frameSize;
+}
@@ -0,0 +1,65 @@
+#ifndef __QOA_H__
+#define __QOA_H__
+
+// A decoder for QOA, the "Quite OK Audio" format, which is to
+// sound what QOI is to images (https://qoaformat.org). Files are
+// made with the reference encoder (qoaconv), and laid out as:
+//
+// struct qoa_file_t {
+//     uint32_t magic;         // "qoaf"
+//     uint32_t samples;       // per channel, in the whole file
+//     qoa_frame_t frames[];
+// };
+//
+// struct qoa_frame_t {
+//     uint8_t  channels;
+//     uint24_t samplerate;
+//     uint16_t samples;       // per channel, in this frame
+//     uint16_t size;          // of the whole frame, in bytes
+//     struct {
+//         int16_t history[4];
+//         int16_t weights[4];
+//     } lms[channels];
+//     uint64_t slices[][channels];
+// };
+//
+// everything big-endian. Each frame holds the state its predictor
+// starts from, so frames can be decoded on their own, and since all
+// of them but the last are full, where each starts is known from the
+// header alone. That's what lets the game stream a file in chunks.
+//
+// The decoder only uses 32-bit arithmetic, which the PSP's CPU
+// does natively; it has no 64-bit registers.
+
+#define QOA_MAGIC 0x716F6166
+#define QOA_HEADER_SIZE 8
+#define QOA_MAX_CHANNELS 8
+#define QOA_LMS_LEN 4
+#define QOA_SLICE_LEN 20
+#define QOA_SLICES_PER_FRAME 256
+// Samples per channel in a full frame.
+#define QOA_FRAME_LEN (QOA_SLICES_PER_FRAME * QOA_SLICE_LEN)
+#define QOA_FRAME_SIZE(channels, slices) (8 + QOA_LMS_LEN * 4 * (channels) + 8 * (slices) * (channels))
+
+typedef struct {
+    unsigned int channels;
+    unsigned int samplerate;
+    // per channel, in the whole file
+    unsigned int samples;
+} QoaDesc;
+
+// Reads the description of the file from its header and its first
+// frame; size only needs to cover those. Files written as a stream,
+// without their length, aren't supported. Returns 0 on success.
+int qoaDecodeHeader(const void *data, unsigned int size, QoaDesc *desc);
+unsigned int qoaFrameCount(const QoaDesc *desc);
+// Where the frame starts in the file. The frame after the
+// last one "starts" at the end of the file.
+unsigned int qoaFrameOffset(const QoaDesc *desc, unsigned int frame);
+// Decodes the frame at data into out, with the channels interleaved,
+// and stores how many samples (per channel) it had in outSamples.
+// out must have room for QOA_FRAME_LEN samples of every channel.
+// Returns the size of the frame, or 0 if it's not a valid one.
+unsigned int qoaDecodeFrame(const void *data, unsigned int size, unsigned int channels, short *out, unsigned int *outSamples);
+
+#endif
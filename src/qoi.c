@@ -31,6 +31,15 @@ typedef union {
 	unsigned int v;
 } QoiRgba;
 
+/* Where the decoder is in the chunks: the offset of the next one, the previous
+pixel, what's left of the current run and the color index. */
+typedef struct {
+	int p;
+	QoiRgba px;
+	int run;
+	QoiRgba index[64];
+} QoiDecoderState;
+
 static const unsigned char qoiPadding[8] = {0,0,0,0,0,0,0,1};
 
 static unsigned int qoiRead32(const unsigned char *bytes, int *p) {
@@ -41,24 +50,17 @@ static unsigned int qoiRead32(const unsigned char *bytes, int *p) {
 	return a << 24 | b << 16 | c << 8 | d;
 }
 
-int qoiDecode(const void *data, int size, QoiDescriptor *desc, void *out) {
-	const unsigned char *bytes;
+static int qoiReadHeader(const unsigned char *bytes, int size, QoiDescriptor *desc) {
 	unsigned int header_magic;
-	unsigned char *pixels, channels;
-	QoiRgba index[64];
-	QoiRgba px;
-	int px_len, chunks_len, px_pos;
-	int p = 0, run = 0;
+	int p = 0;
 
 	if (
-		data == NULL || desc == NULL ||
+		bytes == NULL || desc == NULL ||
 		size < QOI_HEADER_SIZE + (int)sizeof(qoiPadding)
 	) {
 		return -1;
 	}
 
-	bytes = (const unsigned char *)data;
-
 	header_magic = qoiRead32(bytes, &p);
 	desc->width = qoiRead32(bytes, &p);
 	desc->height = qoiRead32(bytes, &p);
@@ -70,75 +72,181 @@ int qoiDecode(const void *data, int size, QoiDescriptor *desc, void *out) {
 		desc->channels < 3 || desc->channels > 4 ||
 		desc->colorspace > 1 ||
 		header_magic != QOI_MAGIC ||
-		desc->height >= QOI_PIXELS_MAX / desc->width ||
-        out == NULL
+		desc->height >= QOI_PIXELS_MAX / desc->width
 	) {
 		return -1;
 	}
+	return 0;
+}
+
+/* Decodes the given number of rows, starting from the given decoder state,
+which is left where the last row ends. The first row goes to row, and every
+next one pitch bytes after the one before it. */
+static void qoiDecodePixels(
+	const unsigned char *bytes, int size, QoiDecoderState *state,
+	unsigned char *row, int pitch, unsigned int width, unsigned int rows, unsigned char channels
+) {
+	int chunks_len = size - (int)sizeof(qoiPadding);
+	int row_len = width * channels;
+	int p = state->p;
+	QoiRgba px = state->px;
+	QoiRgba *index = state->index;
+	int run = state->run;
+	for (; rows > 0; rows--, row += pitch) {
+		for (int px_pos = 0; px_pos < row_len; px_pos += channels) {
+			if (run > 0) {
+				run--;
+			}
+			else if (p < chunks_len) {
+				int b1 = bytes[p++];
+
+				if (b1 == QOI_OP_RGB) {
+					px.rgba.r = bytes[p++];
+					px.rgba.g = bytes[p++];
+					px.rgba.b = bytes[p++];
+				}
+				else if (b1 == QOI_OP_RGBA) {
+					px.rgba.r = bytes[p++];
+					px.rgba.g = bytes[p++];
+					px.rgba.b = bytes[p++];
+					px.rgba.a = bytes[p++];
+				}
+				else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+					px = index[b1];
+				}
+				else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+					px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+					px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+					px.rgba.b += ( b1       & 0x03) - 2;
+				}
+				else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+					int b2 = bytes[p++];
+					int vg = (b1 & 0x3f) - 32;
+					px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+					px.rgba.g += vg;
+					px.rgba.b += vg - 8 +  (b2       & 0x0f);
+				}
+				else if ((b1 & QOI_MASK_2) == QOI_OP_RUN) {
+					run = (b1 & 0x3f);
+				}
+
+				index[QOI_COLOR_HASH(px) % 64] = px;
+			}
+
+			row[px_pos + 0] = px.rgba.r;
+			row[px_pos + 1] = px.rgba.g;
+			row[px_pos + 2] = px.rgba.b;
+		
+			if (channels == 4) {
+				row[px_pos + 3] = px.rgba.a;
+			}
+		}
+	}
+	state->p = p;
+	state->px = px;
+	state->run = run;
+}
 
-	channels = desc->channels;
+int qoiProbe(const void *data, int size, QoiDescriptor *desc) {
+	return qoiReadHeader((const unsigned char *)data, size, desc);
+}
 
-	px_len = desc->width * desc->height * channels;
-	pixels = out;
-	if (!pixels) {
+int qoiDecode(const void *data, int size, QoiDescriptor *desc, void *out) {
+	if (qoiReadHeader((const unsigned char *)data, size, desc)) {
 		return -1;
 	}
+	return qoiDecodeRect(data, size, desc, out, desc->width, 0, 0);
+}
 
-	QOI_ZEROARR(index);
-	px.rgba.r = 0;
-	px.rgba.g = 0;
-	px.rgba.b = 0;
-	px.rgba.a = 255;
+int qoiDecodeRect(
+	const void *data, int size, QoiDescriptor *desc,
+	void *out, unsigned int pitch, unsigned int x, unsigned int y
+) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	QoiDecoderState state;
 
-	chunks_len = size - (int)sizeof(qoiPadding);
-	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
-		if (run > 0) {
-			run--;
-		}
-		else if (p < chunks_len) {
-			int b1 = bytes[p++];
+	if (qoiReadHeader(bytes, size, desc) || out == NULL || x > pitch || desc->width > pitch - x) {
+		return -1;
+	}
 
-			if (b1 == QOI_OP_RGB) {
-				px.rgba.r = bytes[p++];
-				px.rgba.g = bytes[p++];
-				px.rgba.b = bytes[p++];
-			}
-			else if (b1 == QOI_OP_RGBA) {
-				px.rgba.r = bytes[p++];
-				px.rgba.g = bytes[p++];
-				px.rgba.b = bytes[p++];
-				px.rgba.a = bytes[p++];
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
-				px = index[b1];
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
-				px.rgba.r += ((b1 >> 4) & 0x03) - 2;
-				px.rgba.g += ((b1 >> 2) & 0x03) - 2;
-				px.rgba.b += ( b1       & 0x03) - 2;
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
-				int b2 = bytes[p++];
-				int vg = (b1 & 0x3f) - 32;
-				px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
-				px.rgba.g += vg;
-				px.rgba.b += vg - 8 +  (b2       & 0x0f);
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_RUN) {
-				run = (b1 & 0x3f);
-			}
+	QOI_ZEROARR(state.index);
+	state.p = QOI_HEADER_SIZE;
+	state.px.rgba.r = 0;
+	state.px.rgba.g = 0;
+	state.px.rgba.b = 0;
+	state.px.rgba.a = 255;
+	state.run = 0;
+
+	qoiDecodePixels(
+		bytes, size, &state,
+		(unsigned char *)out + (y * pitch + x) * desc->channels, pitch * desc->channels,
+		desc->width, desc->height, desc->channels
+	);
+	return 0;
+}
 
-			index[QOI_COLOR_HASH(px) % 64] = px;
-		}
+int qoiParseRowIndex(const void *data, int size, QoiRowIndex *rowIndex) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	if (bytes == NULL || size < QOI_ROW_INDEX_HEADER_SIZE) {
+		return -1;
+	}
+	int p = 0;
+	unsigned int magic = qoiRead32(bytes, &p);
+	rowIndex->rowsPerEntry = bytes[p] | bytes[p + 1] << 8;
+	rowIndex->entries = bytes[p + 2] | bytes[p + 3] << 8;
+	rowIndex->width = bytes[p + 4] | bytes[p + 5] << 8 | bytes[p + 6] << 16 | (unsigned int)bytes[p + 7] << 24;
+	if (
+		magic != QOI_ROW_INDEX_MAGIC ||
+		rowIndex->rowsPerEntry == 0 || rowIndex->entries == 0 ||
+		size < QOI_ROW_INDEX_HEADER_SIZE + rowIndex->entries * (int)sizeof(QoiRestartPoint)
+	) {
+		return -1;
+	}
+	rowIndex->points = (const QoiRestartPoint *)(bytes + QOI_ROW_INDEX_HEADER_SIZE);
+	return 0;
+}
 
-		pixels[px_pos + 0] = px.rgba.r;
-		pixels[px_pos + 1] = px.rgba.g;
-		pixels[px_pos + 2] = px.rgba.b;
-		
-		if (channels == 4) {
-			pixels[px_pos + 3] = px.rgba.a;
-		}
+int qoiDecodeRows(
+	const void *data, int size, const QoiRowIndex *rowIndex,
+	unsigned int firstRow, unsigned int rows, unsigned int pitch, QoiDescriptor *desc, void *out
+) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	QoiDecoderState state;
+
+	if (
+		qoiReadHeader(bytes, size, desc) || out == NULL ||
+		rowIndex->width != desc->width || desc->width > pitch
+	) {
+		return -1;
+	}
+	if (firstRow >= desc->height || rows == 0) {
+		return 0;
 	}
+	unsigned int endRow = (rows > desc->height - firstRow) ? desc->height : firstRow + rows;
 
+	// Restart from the closest point at or above the first row.
+	unsigned int entry = firstRow / rowIndex->rowsPerEntry;
+	if (entry >= rowIndex->entries) {
+		entry = rowIndex->entries - 1;
+	}
+	const QoiRestartPoint *point = &rowIndex->points[entry];
+	if (point->offset < QOI_HEADER_SIZE || point->offset > (unsigned int)size) {
+		return -1;
+	}
+	state.p = point->offset;
+	memcpy(&state.px, point->px, sizeof(state.px));
+	state.run = point->run;
+	memcpy(state.index, point->index, sizeof(state.index));
+
+	unsigned int startRow = entry * rowIndex->rowsPerEntry;
+	int pitchBytes = pitch * desc->channels;
+	unsigned char *row = (unsigned char *)out + firstRow * pitchBytes;
+	// The rows between the restart point and the first row belong to
+	// someone else, who may be reading them already: they're decoded
+	// on top of each other into the first row, which comes next anyway.
+	if (startRow < firstRow) {
+		qoiDecodePixels(bytes, size, &state, row, 0, desc->width, firstRow - startRow, desc->channels);
+	}
+	qoiDecodePixels(bytes, size, &state, row, pitchBytes, desc->width, endRow - firstRow, desc->channels);
 	return 0;
 }
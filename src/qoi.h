@@ -243,16 +243,92 @@ typedef struct {
 	unsigned char colorspace;
 } QoiDescriptor;
 
-/* Decode a QOI image from memory.
+/* Read the header of a QOI image from memory, without decoding it.
+
+The function returns -1 if the header is invalid. Otherwise the QoiDescriptor
+struct is filled with the description from the file header, so that the
+destination of the pixels can be sized before decoding them. */
+
+int qoiProbe(const void *data, int size, QoiDescriptor *desc);
 
-The function either returns NULL on failure (invalid parameters or malloc
-failed) or a pointer to the decoded pixels. On success, the qoi_desc struct
-is filled with the description from the file header.
+/* Decode a QOI image from memory.
 
-The returned pixel data should be free()d after use. */
+The function returns -1 on failure (invalid parameters). On success, the
+QoiDescriptor struct is filled with the description from the file header and
+the pixels are written, tightly packed, to out. */
 
 int qoiDecode(const void *data, int size, QoiDescriptor *desc, void *out);
 
+/* Decode a QOI image from memory into a part of a bigger image.
+
+Rows of out are pitch pixels apart, and the image is put with its top left
+corner at x, y. This lets an image that isn't padded land directly in a buffer
+with the pitch the Graphics Engine wants. The function returns -1 if the image
+doesn't fit in a row of out. */
+
+int qoiDecodeRect(
+	const void *data, int size, QoiDescriptor *desc,
+	void *out, unsigned int pitch, unsigned int x, unsigned int y
+);
+
+/* Row index (.qri) sidecar files.
+
+QOI can only be decoded from the start, so the asset pipeline stores, every
+few rows, the state the decoder is in when it reaches that row: the offset of
+the next chunk, the previous pixel, what's left of the current run and the
+color index. Decoding can then restart at any of those rows, which lets a part
+of an image be decoded before (or without) the rest, and lets an image be split
+across threads. All values are little-endian.
+
+struct qri_header_t {
+	char     magic[4];     // magic bytes "qoir"
+	uint16_t rowsPerEntry; // rows between restart points
+	uint16_t entries;      // restart points
+	uint32_t width;        // width of the indexed image
+};
+
+followed by one QoiRestartPoint for each restart point. */
+
+#define QOI_ROW_INDEX_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'i') <<  8 | ((unsigned int)'r'))
+#define QOI_ROW_INDEX_HEADER_SIZE 12
+
+typedef struct {
+	/* offset of the next chunk from the start of the file */
+	unsigned int offset;
+	/* previous pixel (r, g, b, a) */
+	unsigned char px[4];
+	/* pixels left in the current run */
+	unsigned char run;
+	unsigned char padding[3];
+	/* color index (r, g, b, a) */
+	unsigned char index[64][4];
+} QoiRestartPoint;
+
+typedef struct {
+	unsigned int rowsPerEntry;
+	unsigned int entries;
+	unsigned int width;
+	const QoiRestartPoint *points;
+} QoiRowIndex;
+
+/* Parse a row index file. The returned index points into data, which must be
+kept around (and 4 byte aligned) for as long as the index is used. */
+
+int qoiParseRowIndex(const void *data, int size, QoiRowIndex *rowIndex);
+
+/* Decode rows firstRow to firstRow + rows of a QOI image into out, which must
+be big enough for the whole image: the rows are put where qoiDecodeRect would
+put them with the same pitch (in pixels) and no offset. The rows from the
+closest restart point up to firstRow have to be decoded as well, but they
+aren't stored: nothing outside of the given rows is written. */
+
+int qoiDecodeRows(
+	const void *data, int size, const QoiRowIndex *rowIndex,
+	unsigned int firstRow, unsigned int rows, unsigned int pitch, QoiDescriptor *desc, void *out
+);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,111 @@
+#include "residency.h"
+#include "alloc.h"
+#include <pspkernel.h>
+#include <pspgu.h>
+#include <string.h>
+
+// Rows are moved in groups of 8, the height of a swizzled block.
+// This way a range of rows is contiguous in memory, and can be
+// copied as is, both for linear and swizzled textures.
+#define RESIDENCY_ROW_ALIGN 8
+#define RESIDENCY_ALIGN_DOWN(r) ((r) & ~(RESIDENCY_ROW_ALIGN - 1))
+
+static char *window;
+static unsigned int windowRows, rowBytes;
+static unsigned int textureWidth, texturePsm, textureRows;
+static const void *residentTexture;
+static short firstRow;
+static ResidencyStats stats;
+
+void initResidency(unsigned int width, unsigned int maxRows, unsigned int psm) {
+    memset(&stats, 0, sizeof(stats));
+    textureWidth = width;
+    texturePsm = psm;
+    textureRows = maxRows;
+    rowBytes = getVramMemorySize(width, 1, psm);
+    // Take the biggest window that fits in the VRAM that's left.
+    unsigned int rows = vlargestblock() / rowBytes;
+    if (rows > maxRows) {
+        rows = maxRows;
+    }
+    rows = RESIDENCY_ALIGN_DOWN(rows);
+    window = (rows > 0) ? memVramAlloc(MEMORY_TEXTURES, rows * rowBytes) : NULL;
+    windowRows = (window != NULL) ? rows : 0;
+    stats.rows = windowRows;
+    residentTexture = NULL;
+}
+
+void endResidency(void) {
+    if (window != NULL) {
+        memVramFree(window);
+        window = NULL;
+    }
+    windowRows = 0;
+    residentTexture = NULL;
+}
+
+void invalidateResidency(void) {
+    residentTexture = NULL;
+}
+
+static int isResident(const void *texture, short top, short bottom) {
+    return texture == residentTexture && top >= firstRow && bottom <= firstRow + (short) windowRows;
+}
+
+static void upload(void) {
+    const char *source = ((const char *) residentTexture) + firstRow * rowBytes;
+    unsigned int bytes = windowRows * rowBytes;
+    // The copy reads RAM directly, so the texture
+    // must not be sitting in the data cache.
+    sceKernelDcacheWritebackRange(source, bytes);
+    sceGuCopyImage(texturePsm, 0, 0, textureWidth, windowRows, textureWidth, (void *) source, 0, 0, textureWidth, window);
+    // Wait for the copy before anything samples the window,
+    // and drop what the texture cache has seen of the old one.
+    sceGuTexSync();
+    sceGuTexFlush();
+    ++stats.uploads;
+    stats.uploadedBytes += bytes;
+}
+
+// NOTE: This must be called while building a display list,
+//       since the upload is done by the Graphics Engine.
+void updateResidency(const void *texture, short top, short bottom) {
+    if (window == NULL || isResident(texture, top, bottom)) {
+        return;
+    }
+    // If the window can't hold all the requested rows, it
+    // would have to be uploaded again every time they move,
+    // so it stays where it was put for this texture.
+    if (texture == residentTexture && bottom - top > (short) windowRows) {
+        return;
+    }
+    // Center the window on the requested rows.
+    short row = top - ((short) windowRows - (bottom - top)) / 2;
+    if (row < 0) {
+        row = 0;
+    } else if (row + windowRows > textureRows) {
+        row = textureRows - windowRows;
+    }
+    row = RESIDENCY_ALIGN_DOWN(row);
+    if (row + (short) windowRows < bottom && row + windowRows + RESIDENCY_ROW_ALIGN <= textureRows) {
+        row += RESIDENCY_ROW_ALIGN;
+    }
+    residentTexture = texture;
+    firstRow = row;
+    upload();
+}
+
+const void *bindResidentRows(const void *texture, short top, short bottom, short *outVOffset) {
+    if (isResident(texture, top, bottom)) {
+        ++stats.hits;
+        *outVOffset = firstRow;
+        return window;
+    }
+    ++stats.misses;
+    *outVOffset = 0;
+    return texture;
+}
+
+void getResidencyStats(ResidencyStats *outStats) {
+    *outStats = stats;
+}
@@ -0,0 +1,28 @@
+#ifndef __RESIDENCY_H__
+#define __RESIDENCY_H__
+
+// Keeps a copy of a range of rows of a texture stored in RAM
+// in a window of VRAM, which the Graphics Engine samples faster.
+// The window takes the VRAM that is left when it's initialized,
+// so it has to be the last thing allocated in VRAM.
+
+typedef struct {
+    // draws sampled from the VRAM window
+    unsigned int hits;
+    // draws that had to sample the texture in RAM
+    unsigned int misses;
+    // copies of the texture to the window
+    unsigned int uploads;
+    unsigned int uploadedBytes;
+    // the number of rows the window can hold
+    unsigned int rows;
+} ResidencyStats;
+
+void initResidency(unsigned int width, unsigned int maxRows, unsigned int psm);
+void endResidency(void);
+void invalidateResidency(void);
+void updateResidency(const void *texture, short top, short bottom);
+const void *bindResidentRows(const void *texture, short top, short bottom, short *outVOffset);
+void getResidencyStats(ResidencyStats *outStats);
+
+#endif
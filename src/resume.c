@@ -0,0 +1,78 @@
+#include "resume.h"
+#include "checksum.h"
+#include "state.h"
+#include <pspkernel.h>
+#include <string.h>
+
+#define RESUME_PATH "resume.bin"
+// "JKRS", as read from the file.
+#define RESUME_MAGIC 0x53524B4A
+#define RESUME_VERSION 2
+
+typedef struct {
+    unsigned int magic;
+    unsigned short version;
+    unsigned short size;
+    unsigned int checksum;
+    ResumeState state;
+} ResumeFile;
+
+static ResumeFile saved;
+static int savedRead, savedValid;
+// The newest save, until the loader's queue has room for it.
+static ResumeFile pending;
+static int savePending;
+static LoaderFence writeFence;
+
+const ResumeState *loadResumeState(void) {
+    if (!savedRead) {
+        savedRead = 1;
+        // Not having a saved state is fine, so the file isn't
+        // read with the loader, which panics if it's missing.
+        SceUID fd = sceIoOpen(RESUME_PATH, PSP_O_RDONLY, 0444);
+        if (fd >= 0) {
+            int bytes = sceIoRead(fd, &saved, sizeof(saved));
+            sceIoClose(fd);
+            savedValid = bytes == sizeof(saved) &&
+                saved.magic == RESUME_MAGIC && saved.version == RESUME_VERSION &&
+                saved.size == sizeof(ResumeState) &&
+                saved.checksum == fnv1a(&saved.state, sizeof(ResumeState)) &&
+                saved.state.scroll >= 0 && saved.state.scroll <= PSP_SCREEN_MAX_SCROLL;
+        }
+    }
+    return savedValid ? &saved.state : NULL;
+}
+
+unsigned int getStartScreen(void) {
+    const ResumeState *state = loadResumeState();
+    return (state != NULL) ? state->screenIndex : LEVEL_START_SCREEN;
+}
+
+short getStartScroll(void) {
+    const ResumeState *state = loadResumeState();
+    return (state != NULL) ? state->scroll : PSP_SCREEN_MAX_SCROLL;
+}
+
+void saveResumeState(const ResumeState *state) {
+    pending.magic = RESUME_MAGIC;
+    pending.version = RESUME_VERSION;
+    pending.size = sizeof(ResumeState);
+    memcpy(&pending.state, state, sizeof(ResumeState));
+    pending.checksum = fnv1a(&pending.state, sizeof(ResumeState));
+    savePending = 1;
+    retryResumeState();
+}
+
+void retryResumeState(void) {
+    if (savePending && tryLazyWriteFile(RESUME_PATH, &pending, sizeof(pending), &writeFence)) {
+        savePending = 0;
+    }
+}
+
+void flushResumeState(void) {
+    if (savePending) {
+        lazyWriteFile(RESUME_PATH, &pending, sizeof(pending), &writeFence);
+        savePending = 0;
+    }
+    waitLoaderFence(&writeFence);
+}
@@ -0,0 +1,43 @@
+#ifndef __RESUME_H__
+#define __RESUME_H__
+
+#include "king.h"
+
+// Where the player left off, saved to a small file:
+//
+// struct resume_header_t {
+//     uint32_t magic;     // "JKRS"
+//     uint16_t version;   // RESUME_VERSION
+//     uint16_t size;      // bytes after the header
+//     uint32_t checksum;  // FNV-1a of the bytes after the header
+// };
+//
+// followed by a ResumeState, laid out as it is in memory. Only
+// the game reads it back, so RESUME_VERSION has to be bumped
+// whenever ResumeState or King change.
+typedef struct {
+    King king;
+    // the screen the player is in, and the scroll it's shown at
+    unsigned int screenIndex;
+    short scroll;
+    // the number of frames simulated so far
+    unsigned int frame;
+} ResumeState;
+
+// Returns the saved state, read on the first call,
+// or NULL if there isn't one that can be used.
+const ResumeState *loadResumeState(void);
+// The screen and scroll the game starts from: the saved
+// ones, or those the level starts from.
+unsigned int getStartScreen(void);
+short getStartScroll(void);
+// Writes the state in the background, without waiting for the
+// writes before it. If the loader's queue is full, the state is kept
+// until retryResumeState finds room for it, and a newer save
+// replaces it meanwhile. flushResumeState writes it regardless, and
+// waits for all the writes.
+void saveResumeState(const ResumeState *state);
+void retryResumeState(void);
+void flushResumeState(void);
+
+#endif
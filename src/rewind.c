@@ -0,0 +1,231 @@
+#include "rewind.h"
+#include "alloc.h"
+#include <string.h>
+
+// 1024 snapshots, a quarter of a second apart, are a bit over four
+// minutes of history. The snapshots' data and the inputs take about
+// 32 KB, and the entries describing the snapshots another 12 KB.
+#define REWIND_MAX_SNAPSHOTS 1024
+#define REWIND_MAX_FRAMES (REWIND_MAX_SNAPSHOTS * REWIND_INTERVAL)
+// The snapshots between keyframes, counting the keyframe.
+#define REWIND_KEYFRAME_INTERVAL 16
+#define REWIND_DATA_SIZE (24 * 1024)
+// Every other byte changed takes three bytes for each two.
+#define REWIND_MAX_ENCODED (sizeof(RewindState) * 2 + 2)
+
+typedef struct {
+    unsigned int frame;
+    // where the encoded snapshot is in the data ring
+    unsigned short offset, size;
+    int keyframe;
+} RewindEntry;
+
+static RewindEntry entries[REWIND_MAX_SNAPSHOTS];
+static unsigned int firstEntry, totalEntries;
+// Snapshots are kept whole, so one that doesn't fit
+// at the end of the ring goes at the start instead.
+static unsigned char data[REWIND_DATA_SIZE];
+static unsigned int dataHead;
+// Two inputs per byte, indexed by frame.
+static unsigned char inputs[REWIND_MAX_FRAMES / 2];
+static unsigned int nextFrame;
+static int recording;
+// The newest keyframe, which new snapshots are encoded against,
+// and the number of snapshots taken since it, counting it.
+static RewindState keyframe;
+static unsigned int sinceKeyframe;
+// What keyframes are encoded against.
+static const RewindState noState;
+
+// The delta is XORed against the reference, as runs of unchanged
+// bytes (a count) each followed by a run of changed ones (a count
+// and the XORed bytes).
+static unsigned int encodeDelta(const void *state, const void *reference, unsigned int size, unsigned char *out) {
+    const unsigned char *bytes = (const unsigned char *) state;
+    const unsigned char *ref = (const unsigned char *) reference;
+    unsigned int i = 0, written = 0;
+    while (i < size) {
+        unsigned int same = 0, changed = 0;
+        while (i < size && same < 255 && bytes[i] == ref[i]) {
+            same++;
+            i++;
+        }
+        while (i + changed < size && changed < 255 && bytes[i + changed] != ref[i + changed]) {
+            changed++;
+        }
+        out[written++] = same;
+        out[written++] = changed;
+        for (unsigned int j = 0; j < changed; j++) {
+            out[written++] = bytes[i + j] ^ ref[i + j];
+        }
+        i += changed;
+    }
+    return written;
+}
+
+static void decodeDelta(const unsigned char *in, unsigned int inSize, const void *reference, unsigned int size, void *state) {
+    unsigned char *bytes = (unsigned char *) state;
+    unsigned int i = 0, o = 0;
+    memcpy(state, reference, size);
+    while (i + 2 <= inSize) {
+        o += in[i++];
+        unsigned int changed = in[i++];
+        for (unsigned int j = 0; j < changed; j++) {
+            bytes[o++] ^= in[i++];
+        }
+    }
+}
+
+static const RewindEntry *getEntry(unsigned int i) {
+    return &entries[(firstEntry + i) % REWIND_MAX_SNAPSHOTS];
+}
+
+// Snapshots can only be dropped along with the ones encoded
+// against them, so the oldest keyframe goes with its deltas.
+static void dropOldestGroup(void) {
+    do {
+        firstEntry = (firstEntry + 1) % REWIND_MAX_SNAPSHOTS;
+        totalEntries--;
+    } while (totalEntries > 0 && !getEntry(0)->keyframe);
+}
+
+// Returns where in the data ring size bytes can go, or -1
+// if they don't fit. The head never catches up with the
+// oldest snapshot, so that a full ring isn't an empty one.
+static int reserveData(unsigned int size) {
+    if (totalEntries == 0) {
+        return 0;
+    }
+    unsigned int tail = getEntry(0)->offset;
+    if (dataHead > tail) {
+        if (REWIND_DATA_SIZE - dataHead >= size) {
+            return dataHead;
+        }
+        return (size < tail) ? 0 : -1;
+    }
+    return (tail - dataHead > size) ? (int) dataHead : -1;
+}
+
+static void decodeEntry(unsigned int i, RewindState *outState) {
+    unsigned int key = i;
+    while (!getEntry(key)->keyframe) {
+        key--;
+    }
+    const RewindEntry *entry = getEntry(key);
+    decodeDelta(data + entry->offset, entry->size, &noState, sizeof(RewindState), outState);
+    if (key != i) {
+        RewindState reference = *outState;
+        entry = getEntry(i);
+        decodeDelta(data + entry->offset, entry->size, &reference, sizeof(RewindState), outState);
+    }
+}
+
+static void storeInput(unsigned int frame, const KingInput *input) {
+    unsigned int index = frame % REWIND_MAX_FRAMES;
+    unsigned int shift = (index & 1) << 2;
+    unsigned int value = (input->direction + 1) | (input->jump ? 4 : 0);
+    inputs[index >> 1] = (inputs[index >> 1] & ~(0x0F << shift)) | value << shift;
+}
+
+void initRewind(void) {
+    memAddStatic(MEMORY_REPLAY, entries, sizeof(entries));
+    memAddStatic(MEMORY_REPLAY, data, sizeof(data));
+    memAddStatic(MEMORY_REPLAY, inputs, sizeof(inputs));
+    firstEntry = 0;
+    totalEntries = 0;
+    dataHead = 0;
+    sinceKeyframe = 0;
+    recording = 0;
+}
+
+void recordRewindFrame(unsigned int frame, const RewindState *state, const KingInput *input) {
+    // Frames that weren't recorded leave a gap
+    // the history can't be rewound across.
+    if (recording && frame != nextFrame) {
+        initRewind();
+    }
+    // The input takes the place of that of the frame the history is
+    // too long for, so the snapshots that needed it are dropped.
+    while (totalEntries > 0 && frame - getEntry(0)->frame >= REWIND_MAX_FRAMES) {
+        dropOldestGroup();
+    }
+    storeInput(frame, input);
+    nextFrame = frame + 1;
+    recording = 1;
+    if (state == NULL || frame % REWIND_INTERVAL != 0) {
+        return;
+    }
+
+    unsigned char encoded[REWIND_MAX_ENCODED];
+    int isKeyframe = totalEntries == 0 || sinceKeyframe == REWIND_KEYFRAME_INTERVAL;
+    unsigned int size = encodeDelta(state, isKeyframe ? &noState : &keyframe, sizeof(RewindState), encoded);
+    int offset;
+    while (totalEntries == REWIND_MAX_SNAPSHOTS || (offset = reserveData(size)) < 0) {
+        dropOldestGroup();
+    }
+    // Making room may have dropped the keyframe too.
+    if (totalEntries == 0 && !isKeyframe) {
+        isKeyframe = 1;
+        size = encodeDelta(state, &noState, sizeof(RewindState), encoded);
+        offset = 0;
+    }
+    if (isKeyframe) {
+        keyframe = *state;
+        sinceKeyframe = 0;
+    }
+    memcpy(data + offset, encoded, size);
+    dataHead = offset + size;
+    RewindEntry *entry = &entries[(firstEntry + totalEntries) % REWIND_MAX_SNAPSHOTS];
+    entry->frame = frame;
+    entry->offset = offset;
+    entry->size = size;
+    entry->keyframe = isKeyframe;
+    totalEntries++;
+    sinceKeyframe++;
+}
+
+unsigned int getRewindStart(unsigned int frame) {
+    if (totalEntries == 0 || getEntry(0)->frame > frame) {
+        return frame;
+    }
+    return getEntry(0)->frame;
+}
+
+int findRewindSnapshot(unsigned int frame, RewindState *outState, unsigned int *outFrame) {
+    for (unsigned int i = totalEntries; i-- > 0;) {
+        if (getEntry(i)->frame <= frame) {
+            decodeEntry(i, outState);
+            *outFrame = getEntry(i)->frame;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void getRewindInput(unsigned int frame, KingInput *outInput) {
+    unsigned int index = frame % REWIND_MAX_FRAMES;
+    unsigned int value = (inputs[index >> 1] >> ((index & 1) << 2)) & 0x0F;
+    outInput->direction = (short) (value & 3) - 1;
+    outInput->jump = (value & 4) != 0;
+}
+
+void truncateRewind(unsigned int frame) {
+    // The frame itself is recorded again when it's simulated.
+    while (totalEntries > 0 && getEntry(totalEntries - 1)->frame >= frame) {
+        totalEntries--;
+    }
+    nextFrame = frame;
+    if (totalEntries == 0) {
+        initRewind();
+        return;
+    }
+    const RewindEntry *newest = getEntry(totalEntries - 1);
+    dataHead = newest->offset + newest->size;
+    // The snapshots after the keyframe carry on from it.
+    unsigned int key = totalEntries - 1;
+    while (!getEntry(key)->keyframe) {
+        key--;
+    }
+    sinceKeyframe = totalEntries - key;
+    decodeEntry(key, &keyframe);
+}
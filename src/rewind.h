@@ -0,0 +1,37 @@
+#ifndef __REWIND_H__
+#define __REWIND_H__
+
+#include "king.h"
+
+// The history of the simulation, for rewinding it. The input of
+// every frame is kept, and the state the simulation starts a frame
+// from is kept every REWIND_INTERVAL frames, as a delta against the
+// latest keyframe. Rewinding to a frame restores the snapshot before
+// it and simulates forward from there with the recorded inputs.
+// The oldest history is dropped to make room for the new one.
+
+// The frames between snapshots.
+#define REWIND_INTERVAL 15
+
+typedef struct {
+    King king;
+    unsigned int screenIndex;
+} RewindState;
+
+void initRewind(void);
+// Records the input the frame is simulated with, and the state it
+// starts from if it's time for a snapshot. The state may be NULL if
+// it can't be restored (e.g. the screen data isn't there).
+void recordRewindFrame(unsigned int frame, const RewindState *state, const KingInput *input);
+// Returns the oldest frame the history reaches back to,
+// or the given frame if there's no history before it.
+unsigned int getRewindStart(unsigned int frame);
+// Gets the newest snapshot taken at or before the frame.
+// Returns 0 on success, -1 if there is none.
+int findRewindSnapshot(unsigned int frame, RewindState *outState, unsigned int *outFrame);
+void getRewindInput(unsigned int frame, KingInput *outInput);
+// Forgets the history after the frame, once the
+// simulation has been rewound to it and goes on.
+void truncateRewind(unsigned int frame);
+
+#endif
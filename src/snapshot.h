@@ -0,0 +1,86 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "king.h"
+
+// Everything the renderer needs to know about a simulated frame.
+// Once published, a snapshot is never modified.
+typedef struct {
+    // the number of the simulated frame
+    unsigned int frame;
+    // the player's state at the end of the frame
+    King king;
+    // the screen the player is in
+    unsigned int screenIndex;
+    // incremented every time the player changes screen
+    unsigned int screenChanges;
+    // the scroll the current screen has to be shown from
+    // when it's entered, or -1 to keep the current scroll
+    short entryScroll;
+    // set while the player is rewinding the game
+    int rewinding;
+} GameSnapshot;
+
+// A lock-free double buffer, with a single writer (the update)
+// and a single reader (the renderer). The writer fills the back
+// slot and then publishes it by flipping the front index.
+// The reader must not hold on to a snapshot for longer than
+// one publish, which the engine guarantees by never letting
+// the update run more than one frame ahead of the renderer.
+typedef struct {
+    GameSnapshot slots[2];
+    int front;
+} SnapshotBuffer;
+
+static inline GameSnapshot *snapshotBack(SnapshotBuffer *buffer) {
+    return &buffer->slots[!__atomic_load_n(&buffer->front, __ATOMIC_RELAXED)];
+}
+
+static inline void snapshotPublish(SnapshotBuffer *buffer) {
+    int front = __atomic_load_n(&buffer->front, __ATOMIC_RELAXED);
+    __atomic_store_n(&buffer->front, !front, __ATOMIC_RELEASE);
+}
+
+static inline const GameSnapshot *snapshotFront(SnapshotBuffer *buffer) {
+    return &buffer->slots[__atomic_load_n(&buffer->front, __ATOMIC_ACQUIRE)];
+}
+
+// The update's side: counts the player's move into another screen
+// into the state the next snapshot is made from. Going up, the new
+// screen is shown from the bottom (maxScroll), going down from the
+// top, and through a teleport link from the scroll it was at.
+static inline void snapshotChangeScreen(GameSnapshot *state, unsigned int newScreenIndex, int teleported, short maxScroll) {
+    if (teleported) {
+        state->entryScroll = -1;
+    } else {
+        state->entryScroll = (newScreenIndex > state->screenIndex) ? maxScroll : 0;
+    }
+    state->screenIndex = newScreenIndex;
+    ++state->screenChanges;
+}
+
+// What the renderer has taken in of the snapshots.
+typedef struct {
+    unsigned int screenIndex;
+    unsigned int screenChanges;
+    // the frame the screen was entered at
+    unsigned int entryFrame;
+    // the scroll it has to be shown from, or -1 to keep the current one
+    short entryScroll;
+} SnapshotView;
+
+// The renderer's side: takes in the screen the snapshot is on, if the
+// player has changed screen since the last one taken in. Returns 1 if
+// it has. Any number of changes may have been published in between.
+static inline int snapshotTakeScreen(SnapshotView *view, const GameSnapshot *snapshot) {
+    if (snapshot->screenChanges == view->screenChanges) {
+        return 0;
+    }
+    view->screenIndex = snapshot->screenIndex;
+    view->screenChanges = snapshot->screenChanges;
+    view->entryFrame = snapshot->frame;
+    view->entryScroll = snapshot->entryScroll;
+    return 1;
+}
+
+#endif
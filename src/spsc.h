@@ -0,0 +1,47 @@
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+// A lock-free queue of pointers, with a single producer and a
+// single consumer, each of which may run on its own thread.
+// The producer only writes the tail and the consumer only
+// writes the head, so no locks are needed.
+
+// This must be a power of two. The loader's decodes
+// need room for three for each of its lazy jobs.
+#define SPSC_CAPACITY 32
+
+typedef struct {
+    void *slots[SPSC_CAPACITY];
+    unsigned int head, tail;
+} SpscQueue;
+
+static inline void spscInit(SpscQueue *queue) {
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+// Returns 0 if the queue is full.
+static inline int spscPush(SpscQueue *queue, void *item) {
+    unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == SPSC_CAPACITY) {
+        return 0;
+    }
+    queue->slots[tail & (SPSC_CAPACITY - 1)] = item;
+    // Publish the item along with the new tail.
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Returns NULL if the queue is empty.
+static inline void *spscPop(SpscQueue *queue) {
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) {
+        return (void *) 0;
+    }
+    void *item = queue->slots[head & (SPSC_CAPACITY - 1)];
+    // Give the slot back to the producer.
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+#endif
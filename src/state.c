@@ -1,13 +1,29 @@
 #include "state.h"
+#include "alloc.h"
+#include "arena.h"
 
 static const GameState *currentState = NULL;
 
 void switchState(const GameState *new) {
     if (currentState != NULL) {
         currentState->cleanup();
+#ifdef DEBUG
+        // How much of the arenas the state has needed.
+        dumpArenaStats();
+#endif
     }
+    // Whatever the state allocated from its arena goes with it.
+    releaseStateArena();
     currentState = new;
     currentState->init();
+#ifdef DEBUG
+    // What the state has allocated, and what it has left behind.
+    dumpMemoryStats();
+#endif
+}
+
+const GameState *getCurrentState(void) {
+    return currentState;
 }
 
 void renderCurrentState(void) {
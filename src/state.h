@@ -18,6 +18,7 @@ typedef struct {
 #define Latch __latchData
 
 void switchState(const GameState *new);
+const GameState *getCurrentState(void);
 void renderCurrentState(void);
 void updateCurrentState(float delta);
 void cleanupCurrentState(void);
@@ -26,6 +27,11 @@ void cleanupCurrentState(void);
 #define STATE_SCREEN_WIDTH 480
 #define STATE_SCREEN_HEIGHT 360
 
+extern const GameState BOOT;
 extern const GameState GAME;
 
+// Reports the boot's timings, once, on the first frame
+// the game can be played in.
+void markBootInteractive(void);
+
 #endif
@@ -0,0 +1,70 @@
+#include "swizzle.h"
+#include <string.h>
+
+// Buffers are expected to be 4 byte aligned, so that the rows
+// of a block can be moved a word at a time.
+#define SWIZZLE_BLOCK_WORDS (SWIZZLE_BLOCK_WIDTH / sizeof(unsigned int))
+
+void swizzleRect(
+    void *dest, unsigned int destPitch, unsigned int x, unsigned int y,
+    const void *src, unsigned int srcPitch, unsigned int width, unsigned int height
+) {
+    unsigned int blocksPerRow = width / SWIZZLE_BLOCK_WIDTH;
+    unsigned int bandSize = destPitch * SWIZZLE_BLOCK_HEIGHT;
+    char *band = ((char *) dest) + (y / SWIZZLE_BLOCK_HEIGHT) * bandSize + (x / SWIZZLE_BLOCK_WIDTH) * SWIZZLE_BLOCK_SIZE;
+    const char *srcBand = (const char *) src;
+    for (unsigned int by = 0; by < height; by += SWIZZLE_BLOCK_HEIGHT) {
+        unsigned int *block = (unsigned int *) band;
+        for (unsigned int bx = 0; bx < blocksPerRow; bx++) {
+            const char *srcRow = srcBand + bx * SWIZZLE_BLOCK_WIDTH;
+            for (unsigned int row = 0; row < SWIZZLE_BLOCK_HEIGHT; row++) {
+                const unsigned int *words = (const unsigned int *) srcRow;
+                block[0] = words[0];
+                block[1] = words[1];
+                block[2] = words[2];
+                block[3] = words[3];
+                block += SWIZZLE_BLOCK_WORDS;
+                srcRow += srcPitch;
+            }
+        }
+        band += bandSize;
+        srcBand += srcPitch * SWIZZLE_BLOCK_HEIGHT;
+    }
+}
+
+void unswizzleRect(
+    void *dest, unsigned int destPitch,
+    const void *src, unsigned int srcPitch, unsigned int x, unsigned int y,
+    unsigned int width, unsigned int height
+) {
+    unsigned int blocksPerRow = width / SWIZZLE_BLOCK_WIDTH;
+    unsigned int bandSize = srcPitch * SWIZZLE_BLOCK_HEIGHT;
+    const char *band = ((const char *) src) + (y / SWIZZLE_BLOCK_HEIGHT) * bandSize + (x / SWIZZLE_BLOCK_WIDTH) * SWIZZLE_BLOCK_SIZE;
+    char *destBand = (char *) dest;
+    for (unsigned int by = 0; by < height; by += SWIZZLE_BLOCK_HEIGHT) {
+        const unsigned int *block = (const unsigned int *) band;
+        for (unsigned int bx = 0; bx < blocksPerRow; bx++) {
+            char *destRow = destBand + bx * SWIZZLE_BLOCK_WIDTH;
+            for (unsigned int row = 0; row < SWIZZLE_BLOCK_HEIGHT; row++) {
+                unsigned int *words = (unsigned int *) destRow;
+                words[0] = block[0];
+                words[1] = block[1];
+                words[2] = block[2];
+                words[3] = block[3];
+                block += SWIZZLE_BLOCK_WORDS;
+                destRow += destPitch;
+            }
+        }
+        band += bandSize;
+        destBand += destPitch * SWIZZLE_BLOCK_HEIGHT;
+    }
+}
+
+void swizzleRows(void *pixels, unsigned int pitch, unsigned int width, unsigned int firstRow, unsigned int rows, void *staging) {
+    unsigned int bandSize = pitch * SWIZZLE_BLOCK_HEIGHT;
+    for (unsigned int y = firstRow; y < firstRow + rows; y += SWIZZLE_BLOCK_HEIGHT) {
+        char *band = ((char *) pixels) + y * pitch;
+        memcpy(staging, band, bandSize);
+        swizzleRect(band, pitch, 0, 0, staging, pitch, width, SWIZZLE_BLOCK_HEIGHT);
+    }
+}
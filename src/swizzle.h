@@ -0,0 +1,36 @@
+#ifndef __SWIZZLE_H__
+#define __SWIZZLE_H__
+
+// The Graphics Engine fetches textures faster when they're swizzled:
+// cut in blocks of 16 bytes by 8 rows, each of which is stored as
+// 128 contiguous bytes, left to right and then top to bottom.
+// Swizzling only moves bytes around, so it works with any pixel
+// format, and a texture keeps its size and pitch.
+// Every width, pitch and x below is in bytes, and must be a multiple
+// of SWIZZLE_BLOCK_WIDTH. Every height and y must be a multiple of
+// SWIZZLE_BLOCK_HEIGHT.
+
+#define SWIZZLE_BLOCK_WIDTH 16
+#define SWIZZLE_BLOCK_HEIGHT 8
+#define SWIZZLE_BLOCK_SIZE (SWIZZLE_BLOCK_WIDTH * SWIZZLE_BLOCK_HEIGHT)
+
+// Swizzles a linear image of the given size into the rectangle at
+// x, y of a swizzled texture.
+void swizzleRect(
+    void *dest, unsigned int destPitch, unsigned int x, unsigned int y,
+    const void *src, unsigned int srcPitch, unsigned int width, unsigned int height
+);
+// Unswizzles the rectangle at x, y of a swizzled texture into a
+// linear image of the given size.
+void unswizzleRect(
+    void *dest, unsigned int destPitch,
+    const void *src, unsigned int srcPitch, unsigned int x, unsigned int y,
+    unsigned int width, unsigned int height
+);
+// Swizzles the given rows of a linear texture where they are, one
+// band of SWIZZLE_BLOCK_HEIGHT rows at a time. A band takes up the
+// same bytes either way, so the other rows are left alone; staging
+// must hold a band (pitch * SWIZZLE_BLOCK_HEIGHT bytes).
+void swizzleRows(void *pixels, unsigned int pitch, unsigned int width, unsigned int firstRow, unsigned int rows, void *staging);
+
+#endif
@@ -0,0 +1,156 @@
+#include "telemetry.h"
+#include "alloc.h"
+#include "loader.h"
+#include <pspdisplay.h>
+#include <pspiofilemgr.h>
+#include <psprtc.h>
+#include <stdio.h>
+
+// "JKTL", as read from the file.
+#define TELEMETRY_MAGIC 0x4C544B4A
+#define TELEMETRY_VERSION 1
+
+// The events wait in a ring until there's a batch of them
+// (8 KB) to write. The ring holds four batches, so that it
+// has room while the writes are in flight.
+#define TELEMETRY_RING_EVENTS 2048
+#define TELEMETRY_BATCH_EVENTS 512
+// A smaller batch is written after about a minute, so
+// that little is lost if the game doesn't quit cleanly.
+#define TELEMETRY_FLUSH_FRAMES 3600
+
+typedef struct {
+    unsigned int magic;
+    unsigned short version;
+    unsigned short eventSize;
+    unsigned int framesPerKilosecond;
+    unsigned int reserved;
+} TelemetryHeader;
+
+// The simulation pushes events at the tail,
+// and the writes take them from the head.
+static TelemetryEvent ring[TELEMETRY_RING_EVENTS];
+static unsigned int ringHead, ringTail;
+static unsigned int droppedEvents, lastFlushFrame;
+static char sessionPath[64];
+static LoaderFence writeFence;
+// How high the king was when he left the ground, or at the
+// top of his jump. It's only touched by the simulation.
+static int fallTop;
+
+static void pushEvent(TelemetryEventType type, unsigned int frame, unsigned int screenIndex, const King *king, int distance, unsigned int from) {
+    unsigned int tail = __atomic_load_n(&ringTail, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE) == TELEMETRY_RING_EVENTS) {
+        // The writes can't keep up, so the event is lost.
+        ++droppedEvents;
+        return;
+    }
+    TelemetryEvent *event = &ring[tail % TELEMETRY_RING_EVENTS];
+    event->frame = frame;
+    event->type = type;
+    event->screenIndex = screenIndex;
+    event->x = king->screenX;
+    event->y = king->screenY;
+    event->distance = (distance < 0) ? 0 : (distance > 0xFFFF) ? 0xFFFF : distance;
+    event->from = from;
+    // Publish the event along with the new tail.
+    __atomic_store_n(&ringTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Unless wait is set, the events are only queued while the loader
+// has room for them, and 0 is returned if some of them are left for
+// the next flush.
+static int writeEvents(int wait) {
+    unsigned int head = __atomic_load_n(&ringHead, __ATOMIC_RELAXED);
+    unsigned int count = __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE) - head;
+    // The loader copies the events, so their
+    // slots can be given back right away.
+    while (count > 0) {
+        unsigned int index = head % TELEMETRY_RING_EVENTS;
+        unsigned int run = TELEMETRY_RING_EVENTS - index;
+        if (run > count) {
+            run = count;
+        }
+        if (wait) {
+            lazyAppendFile(sessionPath, &ring[index], run * sizeof(TelemetryEvent), &writeFence);
+        } else if (!tryLazyAppendFile(sessionPath, &ring[index], run * sizeof(TelemetryEvent), &writeFence)) {
+            break;
+        }
+        head += run;
+        count -= run;
+    }
+    __atomic_store_n(&ringHead, head, __ATOMIC_RELEASE);
+    return count == 0;
+}
+
+// How high the king is in the level, counting the screens below.
+// Teleport links aren't accounted for, so a fall through one is off.
+static int getHeight(unsigned int screenIndex, const King *king) {
+    return screenIndex * LEVEL_SCREEN_HEIGHT + LEVEL_SCREEN_HEIGHT - king->screenY;
+}
+
+void startTelemetry(unsigned int frame, unsigned int screenIndex, const King *king) {
+    memAddStatic(MEMORY_TELEMETRY, ring, sizeof(ring));
+    ringHead = 0;
+    ringTail = 0;
+    droppedEvents = 0;
+    lastFlushFrame = frame;
+    fallTop = getHeight(screenIndex, king);
+    initLoaderFence(&writeFence);
+    // The folder is usually there already.
+    sceIoMkdir(TELEMETRY_FOLDER, 0777);
+    pspTime now;
+    sceRtcGetCurrentClockLocalTime(&now);
+    snprintf(sessionPath, sizeof(sessionPath), TELEMETRY_FOLDER "/%04u%02u%02u-%02u%02u%02u.jkt",
+             now.year, now.month, now.day, now.hour, now.minutes, now.seconds);
+
+    TelemetryHeader header;
+    header.magic = TELEMETRY_MAGIC;
+    header.version = TELEMETRY_VERSION;
+    header.eventSize = sizeof(TelemetryEvent);
+    header.framesPerKilosecond = (unsigned int) (sceDisplayGetFramePerSec() * 1000.0f + 0.5f);
+    header.reserved = 0;
+    lazyAppendFile(sessionPath, &header, sizeof(header), &writeFence);
+    pushEvent(TELEMETRY_START, frame, screenIndex, king, 0, TELEMETRY_NO_SCREEN);
+}
+
+void flushTelemetry(unsigned int frame) {
+    unsigned int pending = __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE) - ringHead;
+    // A flush never waits for the loader: whatever it
+    // has no room for is tried again on the next frame.
+    if (pending >= TELEMETRY_BATCH_EVENTS || (pending > 0 && frame - lastFlushFrame >= TELEMETRY_FLUSH_FRAMES)) {
+        if (writeEvents(0)) {
+            lastFlushFrame = frame;
+        }
+    }
+}
+
+void endTelemetry(unsigned int frame, unsigned int screenIndex, const King *king) {
+    pushEvent(TELEMETRY_END, frame, screenIndex, king, 0, TELEMETRY_NO_SCREEN);
+    writeEvents(1);
+    waitLoaderFence(&writeFence);
+#ifdef DEBUG
+    if (droppedEvents > 0) {
+        printf("Telemetry: %u events dropped\n", droppedEvents);
+    }
+#endif
+}
+
+void recordTelemetry(unsigned int frame, unsigned int fromScreen, unsigned int screenIndex, const King *before, const King *after) {
+    if (screenIndex != fromScreen) {
+        pushEvent(TELEMETRY_SCREEN, frame, screenIndex, after, 0, fromScreen);
+    }
+    if (!before->inAir) {
+        fallTop = getHeight(fromScreen, before);
+    }
+    int height = getHeight(screenIndex, after);
+    if (after->inAir) {
+        if (height > fallTop) {
+            fallTop = height;
+        }
+    } else if (before->inAir) {
+        // The falls counter only goes up when the landing knocks the king down.
+        TelemetryEventType type = (after->falls != before->falls) ? TELEMETRY_STUN : TELEMETRY_LAND;
+        pushEvent(type, frame, screenIndex, after, fallTop - height, TELEMETRY_NO_SCREEN);
+    }
+}
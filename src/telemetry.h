@@ -0,0 +1,62 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include "king.h"
+
+// Where players land, fall and spend their time, recorded for tuning
+// the level (see scripts/telemetry). Each session is written to a
+// file of its own, named after when it started, in TELEMETRY_FOLDER:
+//
+// struct telemetry_header_t {
+//     uint32_t magic;                // "JKTL"
+//     uint16_t version;              // TELEMETRY_VERSION
+//     uint16_t eventSize;            // sizeof(TelemetryEvent)
+//     uint32_t framesPerKilosecond;  // the rate frames are simulated at
+//     uint32_t reserved;
+// };
+//
+// followed by TelemetryEvents, laid out as they are in memory.
+
+#define TELEMETRY_FOLDER "telemetry"
+// The screen of events that don't come from another one.
+#define TELEMETRY_NO_SCREEN 0xFFFF
+
+typedef enum {
+    // the session started on the screen
+    TELEMETRY_START,
+    // the player entered the screen from another one
+    TELEMETRY_SCREEN,
+    // the player landed after falling some distance
+    TELEMETRY_LAND,
+    // the player landed and was knocked down
+    TELEMETRY_STUN,
+    // the session ended on the screen
+    TELEMETRY_END,
+} TelemetryEventType;
+
+typedef struct {
+    unsigned int frame;
+    unsigned short type;
+    unsigned short screenIndex;
+    // where the king is, in level screen coordinates
+    short x, y;
+    // how far (in pixels) the king fell before landing
+    unsigned short distance;
+    // the screen the king came from
+    unsigned short from;
+} TelemetryEvent;
+
+// Starts the session's file. Everything is written by the
+// loader, so these are called from the thread it runs on.
+void startTelemetry(unsigned int frame, unsigned int screenIndex, const King *king);
+// Writes the events recorded so far, if there are enough
+// of them or they have been waiting for long enough.
+void flushTelemetry(unsigned int frame);
+// Ends the session, and waits for all of it to be written.
+void endTelemetry(unsigned int frame, unsigned int screenIndex, const King *king);
+
+// Records the events of a simulated frame, from the king before and
+// after it. It can be called from another thread than the others.
+void recordTelemetry(unsigned int frame, unsigned int fromScreen, unsigned int screenIndex, const King *before, const King *after);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __THREAD_H__
+#define __THREAD_H__
+
+// A thin layer over the threads and semaphores of the PSP's
+// kernel, which maps to pthreads when building for the host.
+// This lets the portable parts of the game that use threads
+// be run (and checked with ThreadSanitizer) by the host tools.
+
+#include <stddef.h>
+
+typedef void (*ThreadEntry)(void *arg);
+
+#ifdef __psp__
+#include <pspthreadman.h>
+
+typedef struct {
+    SceUID id;
+    ThreadEntry entry;
+    void *arg;
+} Thread;
+
+typedef SceUID Semaphore;
+
+static inline int threadTrampoline(SceSize args, void *argp) {
+    Thread *thread = *((Thread **) argp);
+    thread->entry(thread->arg);
+    return 0;
+}
+
+// The thread structure must outlive the thread.
+static inline int threadCreate(Thread *thread, const char *name, int priority, unsigned int stackSize, ThreadEntry entry, void *arg) {
+    thread->entry = entry;
+    thread->arg = arg;
+    thread->id = sceKernelCreateThread(name, &threadTrampoline, priority, stackSize, THREAD_ATTR_USER, NULL);
+    if (thread->id < 0) {
+        return -1;
+    }
+    // The kernel copies the argument, which is the pointer to the structure.
+    sceKernelStartThread(thread->id, sizeof(thread), &thread);
+    return 0;
+}
+
+static inline void threadJoin(Thread *thread) {
+    sceKernelWaitThreadEnd(thread->id, NULL);
+    sceKernelDeleteThread(thread->id);
+}
+
+static inline int semaphoreCreate(Semaphore *sema, const char *name, int initial) {
+    *sema = sceKernelCreateSema(name, 0, initial, 0x7FFFFFFF, NULL);
+    return (*sema < 0) ? -1 : 0;
+}
+
+static inline void semaphoreWait(Semaphore *sema) {
+    sceKernelWaitSema(*sema, 1, NULL);
+}
+
+static inline void semaphoreSignal(Semaphore *sema) {
+    sceKernelSignalSema(*sema, 1);
+}
+
+static inline void semaphoreDestroy(Semaphore *sema) {
+    sceKernelDeleteSema(*sema);
+}
+#else
+#include <pthread.h>
+#include <semaphore.h>
+
+typedef struct {
+    pthread_t id;
+    ThreadEntry entry;
+    void *arg;
+} Thread;
+
+typedef sem_t Semaphore;
+
+static inline void *threadTrampoline(void *arg) {
+    Thread *thread = (Thread *) arg;
+    thread->entry(thread->arg);
+    return NULL;
+}
+
+// The priority and the stack size only matter on the PSP.
+static inline int threadCreate(Thread *thread, const char *name, int priority, unsigned int stackSize, ThreadEntry entry, void *arg) {
+    thread->entry = entry;
+    thread->arg = arg;
+    return (pthread_create(&thread->id, NULL, &threadTrampoline, thread) != 0) ? -1 : 0;
+}
+
+static inline void threadJoin(Thread *thread) {
+    pthread_join(thread->id, NULL);
+}
+
+static inline int semaphoreCreate(Semaphore *sema, const char *name, int initial) {
+    return sem_init(sema, 0, initial);
+}
+
+static inline void semaphoreWait(Semaphore *sema) {
+    while (sem_wait(sema) != 0) {
+        // Interrupted by a signal, try again.
+    }
+}
+
+static inline void semaphoreSignal(Semaphore *sema) {
+    sem_post(sema);
+}
+
+static inline void semaphoreDestroy(Semaphore *sema) {
+    sem_destroy(sema);
+}
+#endif
+
+#endif
@@ -0,0 +1,356 @@
+#include "tiledscreens.h"
+#include "level.h"
+#include "state.h"
+#include "alloc.h"
+#include "arena.h"
+#include "qoi.h"
+#include "swizzle.h"
+#include <pspkernel.h>
+#include <pspgu.h>
+#include <string.h>
+
+// The atlas is a single texture, as big as the Graphics Engine allows.
+// It's swizzled, so every tile has to start and end on a block.
+#define TILED_ATLAS_SIZE 512
+#define TILED_ATLAS_BYTES (TILED_ATLAS_SIZE * TILED_ATLAS_SIZE * 4)
+// How many tiles may be decoded in a frame.
+#define TILED_TILES_PER_FRAME 64
+// "TILS" and "TMAP", as read from the files.
+#define TILED_STORE_MAGIC 0x534C4954
+#define TILED_MAPS_MAGIC 0x50414D54
+#define TILED_NO_SLOT -1
+
+// The tile store: every tile is a small QOI image, found
+// through a table of offsets from the start of the file.
+// The table has an extra entry, for the end of the last tile.
+typedef struct {
+    unsigned int magic;
+    unsigned short tileWidth, tileHeight;
+    unsigned int tiles;
+    unsigned int offsets[];
+} TileStore;
+
+// The tile maps of all the screens, one after the other.
+typedef struct {
+    unsigned int magic;
+    unsigned short columns, rows;
+    unsigned int screens;
+    unsigned short tiles[];
+} TileMaps;
+
+// The screens that are streamed, in order. The current one
+// goes first, starting from the rows that are needed first.
+typedef enum {
+    STREAM_CURRENT,
+    STREAM_NEXT,
+    STREAM_PREVIOUS,
+    STREAM_DONE,
+} TiledStreamStage;
+
+static TileStore *store;
+static unsigned int storeSize;
+static TileMaps *maps;
+static unsigned int tileWidth, tileHeight, mapTiles;
+static char *atlas;
+// Tiles are decoded here, and swizzled into their slot.
+static char *tileStaging;
+static unsigned int slotColumns, slotCount;
+// The slot each tile is in (if any), and the tile in each slot.
+static short *tileSlots;
+static short *slotTiles;
+// A slot is pinned while a screen near the current one uses its
+// tile. Pins from before the current screen was set don't count.
+static unsigned int *slotPins;
+static unsigned int pinEpoch, clockHand;
+static unsigned int currentScreen;
+static TiledStreamStage streamStage;
+static unsigned int streamCursor, streamFirstRow;
+static int atlasDirty;
+static TiledScreensStats stats;
+
+#define PIN_NEARBY (pinEpoch * 2)
+#define PIN_CURRENT (pinEpoch * 2 + 1)
+
+static const unsigned short *getScreenMap(unsigned int index) {
+    return &maps->tiles[index * mapTiles];
+}
+
+static void pinScreen(unsigned int index, unsigned int pin) {
+    if (index >= maps->screens) {
+        return;
+    }
+    const unsigned short *map = getScreenMap(index);
+    for (unsigned int i = 0; i < mapTiles; i++) {
+        short slot = tileSlots[map[i]];
+        if (slot != TILED_NO_SLOT && slotPins[slot] < pin) {
+            slotPins[slot] = pin;
+        }
+    }
+}
+
+// Returns a slot with a pin lower than the given one,
+// or TILED_NO_SLOT if they're all pinned.
+static short findFreeSlot(unsigned int pin) {
+    for (unsigned int i = 0; i < slotCount; i++) {
+        unsigned int slot = clockHand;
+        if (++clockHand == slotCount) {
+            clockHand = 0;
+        }
+        if (slotPins[slot] < pin) {
+            return (short) slot;
+        }
+    }
+    return TILED_NO_SLOT;
+}
+
+// Returns 0 if the atlas has no room for the tile.
+static int loadTile(unsigned short tile, unsigned int pin) {
+    short slot = tileSlots[tile];
+    if (slot != TILED_NO_SLOT) {
+        if (slotPins[slot] < pin) {
+            slotPins[slot] = pin;
+        }
+        return 1;
+    }
+    // Take a tile no nearby screen uses first. Only
+    // the current screen may take those of the others.
+    slot = findFreeSlot(PIN_NEARBY);
+    if (slot == TILED_NO_SLOT && pin == PIN_CURRENT) {
+        slot = findFreeSlot(PIN_CURRENT);
+    }
+    if (slot == TILED_NO_SLOT) {
+        return 0;
+    }
+    if (slotTiles[slot] != TILED_NO_SLOT) {
+        tileSlots[slotTiles[slot]] = TILED_NO_SLOT;
+        ++stats.evictions;
+    }
+    unsigned int x = (slot % slotColumns) * tileWidth;
+    unsigned int y = (slot / slotColumns) * tileHeight;
+    unsigned int offset = store->offsets[tile];
+    QoiDescriptor desc;
+    if (
+        qoiProbe(((char *) store) + offset, store->offsets[tile + 1] - offset, &desc) ||
+        desc.width != tileWidth || desc.height != tileHeight || desc.channels != 4 ||
+        qoiDecode(((char *) store) + offset, store->offsets[tile + 1] - offset, &desc, tileStaging)
+    ) {
+        panic("Invalid tile %u in the tile store", tile);
+    }
+    swizzleRect(atlas, TILED_ATLAS_SIZE * 4, x * 4, y, tileStaging, tileWidth * 4, tileWidth * 4, tileHeight);
+    // The Graphics Engine doesn't see the data cache. Each band
+    // of the tile is in one piece once swizzled.
+    char *band = atlas + y * TILED_ATLAS_SIZE * 4 + x * 4 * SWIZZLE_BLOCK_HEIGHT;
+    for (unsigned int row = 0; row < tileHeight; row += SWIZZLE_BLOCK_HEIGHT) {
+        sceKernelDcacheWritebackRange(band, tileWidth * 4 * SWIZZLE_BLOCK_HEIGHT);
+        band += TILED_ATLAS_SIZE * 4 * SWIZZLE_BLOCK_HEIGHT;
+    }
+    tileSlots[tile] = slot;
+    slotTiles[slot] = tile;
+    slotPins[slot] = pin;
+    atlasDirty = 1;
+    ++stats.decodes;
+    return 1;
+}
+
+void loadTiledScreens(const char *storePath, const char *mapsPath) {
+    memset(&stats, 0, sizeof(stats));
+    store = readFile(storePath, &storeSize);
+    if (
+        store->magic != TILED_STORE_MAGIC || store->tiles == 0 ||
+        storeSize < sizeof(TileStore) + (store->tiles + 1) * sizeof(unsigned int) ||
+        store->offsets[store->tiles] > storeSize
+    ) {
+        panic("Invalid tile store %s", storePath);
+    }
+    unsigned int mapsSize;
+    maps = readFile(mapsPath, &mapsSize);
+    if (maps->magic != TILED_MAPS_MAGIC || mapsSize < sizeof(TileMaps)) {
+        panic("Invalid tile maps %s", mapsPath);
+    }
+    tileWidth = store->tileWidth;
+    tileHeight = store->tileHeight;
+    if (
+        tileWidth == 0 || tileHeight == 0 ||
+        TILED_ATLAS_SIZE % tileWidth != 0 || TILED_ATLAS_SIZE % tileHeight != 0 ||
+        (tileWidth * 4) % SWIZZLE_BLOCK_WIDTH != 0 || tileHeight % SWIZZLE_BLOCK_HEIGHT != 0 ||
+        maps->columns * tileWidth < LEVEL_SCREEN_WIDTH || maps->rows * tileHeight < LEVEL_SCREEN_HEIGHT
+    ) {
+        panic("Tiles of %ux%u can't make up the screens", tileWidth, tileHeight);
+    }
+    mapTiles = maps->columns * maps->rows;
+    if (mapsSize < sizeof(TileMaps) + maps->screens * mapTiles * sizeof(unsigned short)) {
+        panic("Invalid tile maps %s", mapsPath);
+    }
+    for (unsigned int i = 0; i < maps->screens * mapTiles; i++) {
+        if (maps->tiles[i] >= store->tiles) {
+            panic("Tile %u of the tile maps isn't in the tile store", maps->tiles[i]);
+        }
+    }
+    slotColumns = TILED_ATLAS_SIZE / tileWidth;
+    slotCount = slotColumns * (TILED_ATLAS_SIZE / tileHeight);
+    // These last as long as the level, so they come from the state arena.
+    atlas = stateAlloc(TILED_ATLAS_BYTES);
+    tileStaging = stateAlloc(tileWidth * tileHeight * 4);
+    tileSlots = stateAlloc(store->tiles * sizeof(short));
+    slotTiles = stateAlloc(slotCount * sizeof(short));
+    slotPins = stateAlloc(slotCount * sizeof(unsigned int));
+    memset(tileSlots, 0xFF, store->tiles * sizeof(short));
+    memset(slotTiles, 0xFF, slotCount * sizeof(short));
+    memset(slotPins, 0, slotCount * sizeof(unsigned int));
+    pinEpoch = 1;
+    clockHand = 0;
+    atlasDirty = 1;
+    streamStage = STREAM_DONE;
+    stats.tiles = store->tiles;
+    stats.slots = slotCount;
+}
+
+void endTiledScreens(void) {
+    // The atlas and the tables go with the state arena.
+    unloadFile(maps);
+    unloadFile(store);
+    atlas = NULL;
+    maps = NULL;
+    store = NULL;
+}
+
+// Makes the given screen the current one. Its tiles are decoded
+// from firstRow down first, then the rest of them, and then the
+// tiles of the screens above and below.
+void setCurrentTiledScreen(unsigned int index, short firstRow) {
+    if (index >= maps->screens) {
+        panic("Screen %u has no tile map", index);
+    }
+    currentScreen = index;
+    ++pinEpoch;
+    // Keep what's already in the atlas for the screens
+    // nearby, before any of it can be replaced.
+    pinScreen(index, PIN_CURRENT);
+    pinScreen(index + 1, PIN_NEARBY);
+    pinScreen(index - 1, PIN_NEARBY);
+    streamStage = STREAM_CURRENT;
+    streamCursor = 0;
+    streamFirstRow = (firstRow > 0) ? firstRow / tileHeight : 0;
+}
+
+// NOTE: This must be called once per frame, before anything is drawn.
+void streamTiledScreens(void) {
+    int budget = TILED_TILES_PER_FRAME;
+    while (budget > 0 && streamStage != STREAM_DONE) {
+        unsigned int index = currentScreen;
+        unsigned int pin = PIN_CURRENT;
+        if (streamStage == STREAM_NEXT) {
+            index = currentScreen + 1;
+            pin = PIN_NEARBY;
+        } else if (streamStage == STREAM_PREVIOUS) {
+            index = currentScreen - 1;
+            pin = PIN_NEARBY;
+        }
+        if (index >= maps->screens || streamCursor == mapTiles) {
+            // Move on to the next screen, starting from the rows
+            // in view when it's entered: the bottom of the one
+            // above and the top of the one below.
+            ++streamStage;
+            streamCursor = 0;
+            streamFirstRow = (streamStage == STREAM_NEXT) ? PSP_SCREEN_MAX_SCROLL / tileHeight : 0;
+            continue;
+        }
+        unsigned int row = (streamFirstRow + streamCursor / maps->columns) % maps->rows;
+        unsigned int column = streamCursor % maps->columns;
+        unsigned short tile = getScreenMap(index)[row * maps->columns + column];
+        unsigned int decodes = stats.decodes;
+        if (!loadTile(tile, pin)) {
+            // The atlas is full of tiles of the screens nearby.
+            streamStage = STREAM_DONE;
+            break;
+        }
+        if (stats.decodes != decodes) {
+            --budget;
+        }
+        ++streamCursor;
+    }
+}
+
+int areTiledScreenRowsReady(unsigned int index, short top, short bottom) {
+    if (index >= maps->screens || top >= bottom) {
+        return index < maps->screens;
+    }
+    const unsigned short *map = getScreenMap(index);
+    for (unsigned int row = top / tileHeight; row <= (unsigned int) (bottom - 1) / tileHeight && row < maps->rows; row++) {
+        for (unsigned int column = 0; column < maps->columns; column++) {
+            if (tileSlots[map[row * maps->columns + column]] == TILED_NO_SLOT) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Draws the part of the given screen from u, v to u + width,
+// v + height at x, y, as a single batch of sprites, one for each
+// (part of a) tile. Tiles that aren't in the atlas are left out.
+void renderTiledScreenRect(unsigned int index, short u, short v, short width, short height, short x, short y, int components) {
+    if (index >= maps->screens || width <= 0 || height <= 0) {
+        return;
+    }
+    unsigned int firstColumn = u / tileWidth, lastColumn = (u + width - 1) / tileWidth;
+    unsigned int firstRow = v / tileHeight, lastRow = (v + height - 1) / tileHeight;
+    if (lastColumn >= maps->columns) {
+        lastColumn = maps->columns - 1;
+    }
+    if (lastRow >= maps->rows) {
+        lastRow = maps->rows - 1;
+    }
+    unsigned int count = (lastColumn - firstColumn + 1) * (lastRow - firstRow + 1);
+    Vertex *vertices = sceGuGetMemory(count * 2 * sizeof(Vertex));
+    const unsigned short *map = getScreenMap(index);
+    unsigned int sprites = 0;
+    for (unsigned int row = firstRow; row <= lastRow; row++) {
+        // Clip the tiles to the rectangle.
+        short top = row * tileHeight, bottom = top + tileHeight;
+        top = (top < v) ? v : top;
+        bottom = (bottom > v + height) ? v + height : bottom;
+        for (unsigned int column = firstColumn; column <= lastColumn; column++) {
+            short slot = tileSlots[map[row * maps->columns + column]];
+            if (slot == TILED_NO_SLOT) {
+                continue;
+            }
+            short left = column * tileWidth, right = left + tileWidth;
+            left = (left < u) ? u : left;
+            right = (right > u + width) ? u + width : right;
+            short slotU = (slot % slotColumns) * tileWidth - column * tileWidth;
+            short slotV = (slot / slotColumns) * tileHeight - row * tileHeight;
+
+            Vertex *sprite = &vertices[sprites * 2];
+            sprite[0].u = left + slotU;
+            sprite[0].v = top + slotV;
+            sprite[0].x = x + left - u;
+            sprite[0].y = y + top - v;
+            sprite[0].z = RENDER_LAYER_MIDGROUND;
+
+            sprite[1].u = right + slotU;
+            sprite[1].v = bottom + slotV;
+            sprite[1].x = x + right - u;
+            sprite[1].y = y + bottom - v;
+            sprite[1].z = RENDER_LAYER_MIDGROUND;
+            ++sprites;
+        }
+    }
+    if (sprites == 0) {
+        return;
+    }
+    sceGuTexMode(GU_PSM_8888, 0, 0, GU_TRUE);
+    sceGuTexImage(0, TILED_ATLAS_SIZE, TILED_ATLAS_SIZE, TILED_ATLAS_SIZE, atlas);
+    sceGuTexFunc(GU_TFX_REPLACE, components);
+    sceGuTexFilter(GU_NEAREST, GU_NEAREST);
+    // Drop what the texture cache has seen of replaced tiles.
+    if (atlasDirty) {
+        sceGuTexFlush();
+        atlasDirty = 0;
+    }
+    sceGuDrawArray(GU_SPRITES, GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D, sprites * 2, NULL, vertices);
+}
+
+void getTiledScreensStats(TiledScreensStats *outStats) {
+    *outStats = stats;
+}
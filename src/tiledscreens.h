@@ -0,0 +1,31 @@
+#ifndef __TILEDSCREENS_H__
+#define __TILEDSCREENS_H__
+
+// Draws the screens from a set of tiles shared by all of them,
+// instead of from a full image for each. The tiles are cut and
+// deduplicated by the asset pipeline (see textures.py), and each
+// screen is a map of which tile goes where.
+// Tiles are decoded on demand into an atlas, which is a cache:
+// a tile stays there for as long as a screen near the current
+// one uses it, so moving to a screen only costs its unseen tiles.
+
+typedef struct {
+    // tiles in the tile store
+    unsigned int tiles;
+    // tiles the atlas can hold
+    unsigned int slots;
+    // tiles decoded into the atlas
+    unsigned int decodes;
+    // decoded tiles that took the place of another
+    unsigned int evictions;
+} TiledScreensStats;
+
+void loadTiledScreens(const char *storePath, const char *mapsPath);
+void endTiledScreens(void);
+void setCurrentTiledScreen(unsigned int index, short firstRow);
+void streamTiledScreens(void);
+int areTiledScreenRowsReady(unsigned int index, short top, short bottom);
+void renderTiledScreenRect(unsigned int index, short u, short v, short width, short height, short x, short y, int components);
+void getTiledScreensStats(TiledScreensStats *outStats);
+
+#endif
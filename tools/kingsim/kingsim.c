@@ -0,0 +1,564 @@
+// Host tool that runs the king's simulation over thousands of input
+// sequences, to find out which charge times reach which ledges.
+//
+// Usage: kingsim -l <maps/N.bin> [-s screen] [-x worldX] [-y worldY]
+//                [-w maxWalkFrames] [-j threads] [-p]
+//
+// The level is one of the maps' files, written by level.py, and the
+// screens are numbered from the first one of the map.
+//
+// Every sequence walks for a number of frames in one direction,
+// charges a jump for a number of frames and releases it. The
+// simulation then runs until the king lands, and one CSV line is
+// printed for each sequence. The list of the reached ledges is
+// printed to stderr at the end.
+//
+// With -p, every sequence is instead simulated twice: once on a
+// single thread, and once pipelined the way the game does it with
+// PIPELINED_UPDATE. The update runs on its own thread and counts
+// screen changes into its snapshots with snapshotChangeScreen. The
+// consumer takes them in through the snapshot double buffer with
+// snapshotTakeScreen, as the game's update and render do. Every
+// snapshot the consumer sees must match the single threaded run,
+// frame by frame. The screen and scroll it ends up showing must
+// also match what the single threaded run expects. Meanwhile the
+// consumer streams the map out and in again every few frames, like
+// the game's render does with the maps it's done with, while the
+// update copies its screens out of it. Each time, the map's old
+// buffer is overwritten and freed, so a screen copied out of it
+// while it's emptied makes the run diverge (or trips ASan).
+
+#include "king.h"
+#include "levelfile.h"
+#include "mapslots.h"
+#include "snapshot.h"
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIM_DELTA (1.0f / 60.0f)
+#define SIM_MAX_CHARGE_FRAMES 36
+#define SIM_MAX_AIR_FRAMES 600
+#define SIM_SETTLE_FRAMES 120
+#define SIM_MAX_THREADS 64
+#define SIM_PIPELINE_FRAMES (SIM_SETTLE_FRAMES + SIM_MAX_AIR_FRAMES)
+// PSP_SCREEN_MAX_SCROLL, whose header needs the PSP's.
+#define SIM_MAX_SCROLL (360 - 272)
+// How often the pipelined run's map is streamed out and in again.
+#define SIM_RELOAD_FRAMES 4
+#define SIM_POISON_BYTE 0xDD
+
+typedef struct {
+    short walkFrames, walkDirection;
+    short chargeFrames, jumpDirection;
+} Sequence;
+
+typedef struct {
+    unsigned int screenIndex;
+    short screenX, screenY;
+    short frames;
+    char stunned, outOfLevel;
+    // frames where the pipelined run diverged (-p only)
+    unsigned int mismatches;
+} Result;
+
+// State shared by the two threads of a pipelined run.
+typedef struct {
+    const Sequence *sequence;
+    SnapshotBuffer snapshots;
+    // the level as the map with the index 0, in a copy of its file
+    MapSlots maps;
+    void *mapData;
+    sem_t startSema, doneSema;
+} Pipeline;
+
+// Every worker owns a range of sequence indices. The owner
+// takes work from the back of its range, thieves from the front.
+typedef struct {
+    pthread_mutex_t lock;
+    unsigned int front, back;
+} WorkQueue;
+
+typedef struct {
+    unsigned int id;
+    unsigned int stolen;
+} Worker;
+
+static LevelFile level;
+static unsigned int levelSize;
+static unsigned int totalScreens;
+static unsigned int startScreen;
+static float startX, startY;
+static int hasStartPosition;
+
+static Sequence *sequences;
+static Result *results;
+static unsigned int totalSequences;
+
+static WorkQueue queues[SIM_MAX_THREADS];
+static unsigned int totalWorkers;
+static int checkPipeline;
+
+static void loadLevelFile(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: could not open %s\n", path);
+        exit(-1);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    void *data = malloc(size);
+    if (fread(data, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "Error: could not read %s\n", path);
+        exit(-1);
+    }
+    fclose(file);
+    const char *error = openLevelFile(data, size, &level);
+    if (error != NULL) {
+        fprintf(stderr, "Error: invalid level %s: %s\n", path, error);
+        exit(-1);
+    }
+    levelSize = size;
+    totalScreens = level.totalScreens;
+}
+
+// Streams the pipelined run's map in again, in a new copy of its file.
+// The old copy, if there's one, is overwritten and freed.
+static void reloadPipelineMap(Pipeline *pipeline) {
+    assignMapSlot(&pipeline->maps, 0, 0);
+    if (pipeline->mapData != NULL) {
+        memset(pipeline->mapData, SIM_POISON_BYTE, levelSize);
+        free(pipeline->mapData);
+    }
+    pipeline->mapData = malloc(levelSize);
+    memcpy(pipeline->mapData, level.data, levelSize);
+    LevelFile file;
+    openLevelFile(pipeline->mapData, levelSize, &file);
+    publishMapSlot(&pipeline->maps, 0, &file);
+}
+
+// Returns 0 if the king has left the level.
+static int stepOnScreen(King *king, const KingInput *input, LevelScreen *screen, unsigned int *screenIndex) {
+    kingUpdate(king, input, SIM_DELTA, screen, screenIndex);
+    return *screenIndex < totalScreens;
+}
+
+// Like stepOnScreen, against the king's screen in the level.
+static int step(King *king, const KingInput *input, unsigned int *screenIndex) {
+    return stepOnScreen(king, input, getLevelFileScreen(&level, *screenIndex), screenIndex);
+}
+
+// Returns the index of the frame the jump is released at.
+static int getReleaseFrame(const Sequence *sequence) {
+    return SIM_SETTLE_FRAMES + sequence->walkFrames + sequence->chargeFrames;
+}
+
+static void getSequenceInput(const Sequence *sequence, int frame, KingInput *input) {
+    if (frame < SIM_SETTLE_FRAMES) {
+        // Let the king fall to the ground first.
+        input->direction = 0;
+        input->jump = 0;
+    } else if (frame < SIM_SETTLE_FRAMES + sequence->walkFrames) {
+        // Walk.
+        input->direction = sequence->walkDirection;
+        input->jump = 0;
+    } else if (frame < getReleaseFrame(sequence)) {
+        // Charge the jump.
+        input->direction = sequence->jumpDirection;
+        input->jump = 1;
+    } else {
+        // Release it.
+        input->direction = sequence->jumpDirection;
+        input->jump = 0;
+    }
+}
+
+static void createKing(King *king) {
+    // Clear the padding too, so that whole instances can be compared.
+    memset(king, 0, sizeof(King));
+    kingCreate(king);
+    if (hasStartPosition) {
+        king->worldX = startX;
+        king->worldY = startY;
+        king->screenX = ((short) startX) + (LEVEL_SCREEN_WIDTH / 2);
+        king->screenY = LEVEL_SCREEN_HEIGHT - ((short) startY);
+    }
+}
+
+static void simulate(const Sequence *sequence, Result *result) {
+    King king;
+    KingInput input;
+    unsigned int screenIndex = startScreen;
+    int releaseFrame = getReleaseFrame(sequence);
+
+    createKing(&king);
+    memset(result, 0, sizeof(Result));
+
+    for (int frame = 0; frame < releaseFrame; frame++) {
+        getSequenceInput(sequence, frame, &input);
+        if (!step(&king, &input, &screenIndex)) {
+            result->outOfLevel = 1;
+            return;
+        }
+    }
+    // Wait for the king to land.
+    short frames;
+    int leftGround = 0;
+    for (frames = 0; frames < SIM_MAX_AIR_FRAMES; frames++) {
+        getSequenceInput(sequence, releaseFrame + frames, &input);
+        if (!step(&king, &input, &screenIndex)) {
+            result->outOfLevel = 1;
+            return;
+        }
+        leftGround |= king.inAir;
+        if (leftGround && !king.inAir) {
+            break;
+        }
+    }
+
+    result->screenIndex = screenIndex;
+    result->screenX = king.screenX;
+    result->screenY = king.screenY;
+    result->frames = frames;
+    result->stunned = king.isStunned;
+}
+
+// Mirrors the engine's update thread and the game's update: wait
+// for the go, simulate one frame, publish it and report back.
+static void *pipelineUpdateThread(void *arg) {
+    Pipeline *pipeline = arg;
+    GameSnapshot sim;
+    KingInput input;
+    LevelScreen screen;
+
+    memset(&sim, 0, sizeof(GameSnapshot));
+    createKing(&sim.king);
+    sim.screenIndex = startScreen;
+    sim.entryScroll = -1;
+    for (int frame = 0; frame < SIM_PIPELINE_FRAMES; frame++) {
+        sem_wait(&pipeline->startSema);
+        if (sim.screenIndex < totalScreens) {
+            // The map is never out for long: the consumer
+            // streams it in again in the same frame.
+            while (!copyMapScreen(&pipeline->maps, 0, sim.screenIndex, &screen)) {
+                sched_yield();
+            }
+            unsigned int newScreenIndex = sim.screenIndex;
+            getSequenceInput(pipeline->sequence, frame, &input);
+            stepOnScreen(&sim.king, &input, &screen, &newScreenIndex);
+            if (newScreenIndex != sim.screenIndex) {
+                snapshotChangeScreen(&sim, newScreenIndex, newScreenIndex == screen.teleportIndex, SIM_MAX_SCROLL);
+            }
+        }
+        sim.frame = frame;
+        *snapshotBack(&pipeline->snapshots) = sim;
+        snapshotPublish(&pipeline->snapshots);
+        sem_post(&pipeline->doneSema);
+    }
+    return NULL;
+}
+
+static void checkPipelined(const Sequence *sequence, Result *result) {
+    static __thread King reference[SIM_PIPELINE_FRAMES];
+    static __thread unsigned int referenceScreens[SIM_PIPELINE_FRAMES];
+    // the scroll each frame's screen has to be shown at
+    static __thread short referenceScrolls[SIM_PIPELINE_FRAMES];
+    King king;
+    KingInput input;
+    unsigned int screenIndex = startScreen;
+
+    memset(result, 0, sizeof(Result));
+
+    // Single threaded run. Going up a screen shows the new one from
+    // the bottom, going down from the top, and going through a
+    // teleport link keeps the scroll.
+    short scroll = SIM_MAX_SCROLL;
+    createKing(&king);
+    for (int frame = 0; frame < SIM_PIPELINE_FRAMES; frame++) {
+        if (screenIndex < totalScreens) {
+            unsigned int teleportIndex = getLevelFileScreen(&level, screenIndex)->teleportIndex;
+            unsigned int newScreenIndex = screenIndex;
+            getSequenceInput(sequence, frame, &input);
+            step(&king, &input, &newScreenIndex);
+            if (newScreenIndex != screenIndex && newScreenIndex != teleportIndex) {
+                scroll = (newScreenIndex > screenIndex) ? SIM_MAX_SCROLL : 0;
+            }
+            screenIndex = newScreenIndex;
+        }
+        reference[frame] = king;
+        referenceScreens[frame] = screenIndex;
+        referenceScrolls[frame] = scroll;
+    }
+
+    // Pipelined run, with this thread acting as the renderer.
+    SnapshotView shown;
+    memset(&shown, 0, sizeof(SnapshotView));
+    shown.screenIndex = startScreen;
+    short shownScroll = SIM_MAX_SCROLL;
+    Pipeline pipeline;
+    pthread_t updateThreadId;
+    memset(&pipeline, 0, sizeof(Pipeline));
+    pipeline.sequence = sequence;
+    createMapSlots(&pipeline.maps);
+    reloadPipelineMap(&pipeline);
+    sem_init(&pipeline.startSema, 0, 0);
+    sem_init(&pipeline.doneSema, 0, 0);
+    pthread_create(&updateThreadId, NULL, &pipelineUpdateThread, &pipeline);
+    sem_post(&pipeline.startSema);
+    for (int frame = 0; frame < SIM_PIPELINE_FRAMES; frame++) {
+        sem_wait(&pipeline.doneSema);
+        if (frame + 1 < SIM_PIPELINE_FRAMES) {
+            sem_post(&pipeline.startSema);
+        }
+        // The update may already be writing the next frame
+        // while we look at this one.
+        const GameSnapshot *snapshot = snapshotFront(&pipeline.snapshots);
+        if (frame % SIM_RELOAD_FRAMES == 0) {
+            reloadPipelineMap(&pipeline);
+        }
+        if (snapshotTakeScreen(&shown, snapshot) && shown.entryScroll >= 0) {
+            shownScroll = shown.entryScroll;
+        }
+        unsigned int f = snapshot->frame;
+        if (f >= SIM_PIPELINE_FRAMES ||
+            snapshot->screenIndex != referenceScreens[f] ||
+            memcmp(&snapshot->king, &reference[f], sizeof(King)) ||
+            shown.screenIndex != referenceScreens[f] ||
+            shownScroll != referenceScrolls[f]) {
+            ++result->mismatches;
+        }
+    }
+    pthread_join(updateThreadId, NULL);
+    sem_destroy(&pipeline.doneSema);
+    sem_destroy(&pipeline.startSema);
+    destroyMapSlots(&pipeline.maps);
+    free(pipeline.mapData);
+
+    result->screenIndex = screenIndex;
+    result->screenX = king.screenX;
+    result->screenY = king.screenY;
+    result->outOfLevel = screenIndex >= totalScreens;
+}
+
+static void runSequence(unsigned int index) {
+    if (checkPipeline) {
+        checkPipelined(&sequences[index], &results[index]);
+    } else {
+        simulate(&sequences[index], &results[index]);
+    }
+}
+
+static int popBack(WorkQueue *queue, unsigned int *outIndex) {
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->front < queue->back) {
+        *outIndex = --queue->back;
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static int stealFront(WorkQueue *queue, unsigned int *outIndex) {
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->front < queue->back) {
+        *outIndex = queue->front++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static void *workerThread(void *arg) {
+    Worker *worker = arg;
+    unsigned int index;
+    for (;;) {
+        if (popBack(&queues[worker->id], &index)) {
+            runSequence(index);
+            continue;
+        }
+        // Our queue is empty, look for someone to steal from.
+        int stole = 0;
+        for (unsigned int i = 1; i < totalWorkers && !stole; i++) {
+            stole = stealFront(&queues[(worker->id + i) % totalWorkers], &index);
+        }
+        if (!stole) {
+            // Nothing is left anywhere, since no new work is ever queued.
+            break;
+        }
+        ++worker->stolen;
+        runSequence(index);
+    }
+    return NULL;
+}
+
+static void buildSequences(short maxWalkFrames) {
+    static const short directions[] = { -1, 0, +1 };
+    unsigned int walkSteps = maxWalkFrames + 1;
+    totalSequences = walkSteps * 2 * 3 * SIM_MAX_CHARGE_FRAMES;
+    sequences = malloc(totalSequences * sizeof(Sequence));
+    results = malloc(totalSequences * sizeof(Result));
+    unsigned int n = 0;
+    for (short walk = 0; walk <= maxWalkFrames; walk++) {
+        for (short walkDirection = -1; walkDirection <= +1; walkDirection += 2) {
+            for (int d = 0; d < 3; d++) {
+                for (short charge = 1; charge <= SIM_MAX_CHARGE_FRAMES; charge++) {
+                    sequences[n].walkFrames = walk;
+                    sequences[n].walkDirection = walkDirection;
+                    sequences[n].jumpDirection = directions[d];
+                    sequences[n].chargeFrames = charge;
+                    ++n;
+                }
+            }
+        }
+    }
+}
+
+static int printPipelineResults(void) {
+    unsigned int failed = 0;
+    for (unsigned int i = 0; i < totalSequences; i++) {
+        Sequence *s = &sequences[i];
+        Result *r = &results[i];
+        if (r->mismatches) {
+            printf("Sequence %d,%d,%d,%d diverged on %u frames\n", s->walkFrames, s->walkDirection, s->jumpDirection, s->chargeFrames, r->mismatches);
+            ++failed;
+        }
+    }
+    printf("%u of %u pipelined runs matched the single threaded path\n", totalSequences - failed, totalSequences);
+    return failed ? -1 : 0;
+}
+
+static void printResults(void) {
+    printf("walk_frames,walk_dir,jump_dir,charge_frames,screen,x,y,air_frames,stunned\n");
+    for (unsigned int i = 0; i < totalSequences; i++) {
+        Sequence *s = &sequences[i];
+        Result *r = &results[i];
+        if (r->outOfLevel) {
+            printf("%d,%d,%d,%d,-1,,,,\n", s->walkFrames, s->walkDirection, s->jumpDirection, s->chargeFrames);
+        } else {
+            printf("%d,%d,%d,%d,%u,%d,%d,%d,%d\n", s->walkFrames, s->walkDirection, s->jumpDirection, s->chargeFrames,
+                   r->screenIndex, r->screenX, r->screenY, r->frames, r->stunned);
+        }
+    }
+
+    // A ledge is identified by the screen and the height the king lands at.
+    // List each one with the shortest charge time that reaches it.
+    fprintf(stderr, "Ledges reached (screen, y, shortest charge in frames, sequences):\n");
+    char *seen = calloc(totalSequences, 1);
+    for (unsigned int i = 0; i < totalSequences; i++) {
+        Result *r = &results[i];
+        if (seen[i] || r->outOfLevel || r->stunned) {
+            continue;
+        }
+        short minCharge = sequences[i].chargeFrames;
+        unsigned int count = 0;
+        for (unsigned int j = i; j < totalSequences; j++) {
+            Result *o = &results[j];
+            if (!o->outOfLevel && !o->stunned && o->screenIndex == r->screenIndex && o->screenY == r->screenY) {
+                seen[j] = 1;
+                ++count;
+                if (sequences[j].chargeFrames < minCharge) {
+                    minCharge = sequences[j].chargeFrames;
+                }
+            }
+        }
+        fprintf(stderr, "  %u, %d, %d, %u\n", r->screenIndex, r->screenY, minCharge, count);
+    }
+    free(seen);
+}
+
+int main(int argc, char **argv) {
+    const char *levelPath = NULL;
+    short maxWalkFrames = 60;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:s:x:y:w:j:p")) != -1) {
+        switch (opt) {
+            case 'l':
+                levelPath = optarg;
+                break;
+            case 's':
+                startScreen = strtoul(optarg, NULL, 10);
+                break;
+            case 'x':
+                startX = strtof(optarg, NULL);
+                hasStartPosition = 1;
+                break;
+            case 'y':
+                startY = strtof(optarg, NULL);
+                hasStartPosition = 1;
+                break;
+            case 'w':
+                maxWalkFrames = (short) strtol(optarg, NULL, 10);
+                break;
+            case 'j':
+                threads = strtol(optarg, NULL, 10);
+                break;
+            case 'p':
+                checkPipeline = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s -l <maps/N.bin> [-s screen] [-x worldX] [-y worldY] [-w maxWalkFrames] [-j threads] [-p]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (levelPath == NULL) {
+        fprintf(stderr, "Error: no level file given (-l)\n");
+        return -1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    } else if (threads > SIM_MAX_THREADS) {
+        threads = SIM_MAX_THREADS;
+    }
+
+    loadLevelFile(levelPath);
+    if (startScreen >= totalScreens) {
+        fprintf(stderr, "Error: screen %u is out of range (the level has %u screens)\n", startScreen, totalScreens);
+        return -1;
+    }
+    buildSequences(maxWalkFrames);
+
+    // Split the sequences evenly, work stealing takes care of the imbalance.
+    pthread_t ids[SIM_MAX_THREADS];
+    Worker workers[SIM_MAX_THREADS];
+    totalWorkers = (unsigned int) threads;
+    for (unsigned int i = 0; i < totalWorkers; i++) {
+        pthread_mutex_init(&queues[i].lock, NULL);
+        queues[i].front = (totalSequences * i) / totalWorkers;
+        queues[i].back = (totalSequences * (i + 1)) / totalWorkers;
+        workers[i].id = i;
+        workers[i].stolen = 0;
+    }
+    for (unsigned int i = 0; i < totalWorkers; i++) {
+        pthread_create(&ids[i], NULL, &workerThread, &workers[i]);
+    }
+    unsigned int stolen = 0;
+    for (unsigned int i = 0; i < totalWorkers; i++) {
+        pthread_join(ids[i], NULL);
+        stolen += workers[i].stolen;
+    }
+    // Other workers can look into any queue until they're all done.
+    for (unsigned int i = 0; i < totalWorkers; i++) {
+        pthread_mutex_destroy(&queues[i].lock);
+    }
+    fprintf(stderr, "Simulated %u sequences on %u threads (%u stolen)\n", totalSequences, totalWorkers, stolen);
+
+    int ret = 0;
+    if (checkPipeline) {
+        ret = printPipelineResults();
+    } else {
+        printResults();
+    }
+    free(sequences);
+    free(results);
+    free(level.data);
+    return ret;
+}
@@ -0,0 +1,332 @@
+// Host tool that checks the game's QOA decoder and mixer, and
+// reports how fast they are next to how fast the audio plays.
+//
+// Usage: qoabench [-n rounds] [-s slowdown] [file.qoa]...
+//
+// Every file (or, without any, ten seconds of made up stereo) is
+// decoded a frame at a time, the way the game streams music, and
+// compared with a plain transcription of the reference decoder,
+// which works on 64-bit slices; where the frames start must also
+// match what the header tells. The mixer is checked for putting
+// mono on both sides, for its volume and for clipping. Then the
+// decoding and the mixing of an output buffer (music and a few
+// effects) are each run the given number of rounds. Times are
+// multiplied by the slowdown, to get from the host's speed to the
+// PSP's. The exit code is 1 if any check fails.
+
+#include "mixer.h"
+#include "qoa.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// As the game plays them.
+#define AUDIO_RATE 44100
+#define AUDIO_SAMPLES 1024
+#define AUDIO_EFFECTS 3
+#define SYNTHETIC_SECONDS 10
+
+static int failures;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned char *readWholeFile(const char *path, unsigned int *outSize) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    *outSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *data = malloc(*outSize);
+    if (fread(data, 1, *outSize, file) != *outSize) {
+        fprintf(stderr, "Could not read %s\n", path);
+        exit(1);
+    }
+    fclose(file);
+    return data;
+}
+
+static void writeU64(unsigned char *bytes, unsigned long long value) {
+    for (int i = 7; i >= 0; i--) {
+        bytes[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+static unsigned long long readU64(const unsigned char *bytes) {
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+// A file of random slices, which is as hard to decode as music is.
+// The predictors start out as the reference encoder's do.
+static unsigned char *makeSynthetic(unsigned int *outSize) {
+    QoaDesc desc = { 2, AUDIO_RATE, SYNTHETIC_SECONDS * AUDIO_RATE };
+    unsigned int frames = qoaFrameCount(&desc);
+    unsigned int size = qoaFrameOffset(&desc, frames);
+    unsigned char *data = malloc(size), *bytes = data;
+    writeU64(bytes, ((unsigned long long) QOA_MAGIC << 32) | desc.samples);
+    bytes += 8;
+    for (unsigned int frame = 0; frame < frames; frame++) {
+        unsigned int samples = desc.samples - frame * QOA_FRAME_LEN;
+        if (samples > QOA_FRAME_LEN) {
+            samples = QOA_FRAME_LEN;
+        }
+        unsigned int slices = (samples + QOA_SLICE_LEN - 1) / QOA_SLICE_LEN;
+        unsigned int frameSize = QOA_FRAME_SIZE(desc.channels, slices);
+        writeU64(bytes, ((unsigned long long) desc.channels << 56) | ((unsigned long long) desc.samplerate << 32) |
+                        ((unsigned long long) samples << 16) | frameSize);
+        bytes += 8;
+        for (unsigned int c = 0; c < desc.channels; c++) {
+            writeU64(bytes, 0);
+            writeU64(bytes + 8, (unsigned long long) (unsigned short) -(1 << 13) << 16 | (1 << 14));
+            bytes += 16;
+        }
+        for (unsigned int i = 0; i < slices * desc.channels; i++) {
+            // Mostly small scale factors, like quiet passages have.
+            unsigned long long slice = (unsigned long long) (rand() % 12) << 60;
+            for (int j = 0; j < 4; j++) {
+                slice |= (unsigned long long) (rand() & 0x7FFF) << (j * 15);
+            }
+            writeU64(bytes, slice);
+            bytes += 8;
+        }
+    }
+    *outSize = size;
+    return data;
+}
+
+// The reference decoder, as the reference qoa.h has it.
+static int clampS16(int v) {
+    if ((unsigned int) (v + 32768) > 65535) {
+        return (v < -32768) ? -32768 : 32767;
+    }
+    return v;
+}
+
+static unsigned int referenceDecodeFrame(const unsigned char *bytes, unsigned int channels, short *out, unsigned int *outSamples) {
+    static const double dequant[8] = { 0.75, -0.75, 2.5, -2.5, 4.5, -4.5, 7, -7 };
+    unsigned long long header = readU64(bytes);
+    unsigned int samples = (header >> 16) & 0xFFFF, frameSize = header & 0xFFFF;
+    unsigned int p = 8;
+    int history[QOA_MAX_CHANNELS][QOA_LMS_LEN], weights[QOA_MAX_CHANNELS][QOA_LMS_LEN];
+    for (unsigned int c = 0; c < channels; c++) {
+        unsigned long long h = readU64(bytes + p), w = readU64(bytes + p + 8);
+        p += 16;
+        for (int i = 0; i < QOA_LMS_LEN; i++) {
+            history[c][i] = (short) (h >> 48);
+            h <<= 16;
+            weights[c][i] = (short) (w >> 48);
+            w <<= 16;
+        }
+    }
+    for (unsigned int first = 0; first < samples; first += QOA_SLICE_LEN) {
+        for (unsigned int c = 0; c < channels; c++) {
+            unsigned long long slice = readU64(bytes + p);
+            p += 8;
+            int scaleFactor = (slice >> 60) & 0xF;
+            slice <<= 4;
+            unsigned int end = (first + QOA_SLICE_LEN < samples) ? first + QOA_SLICE_LEN : samples;
+            for (unsigned int s = first; s < end; s++) {
+                // Wrapping when random slices make it overflow, like the game does.
+                unsigned int sum = 0;
+                for (int i = 0; i < QOA_LMS_LEN; i++) {
+                    sum += (unsigned int) (weights[c][i] * history[c][i]);
+                }
+                int predicted = (int) sum >> 13;
+                int quantized = (slice >> 61) & 0x7;
+                slice <<= 3;
+                // The reference table, worked out from its definition.
+                int dequantized = (int) round(round(pow(scaleFactor + 1, 2.75)) * dequant[quantized]);
+                int sample = clampS16(predicted + dequantized);
+                out[s * channels + c] = sample;
+                int delta = dequantized >> 4;
+                for (int i = 0; i < QOA_LMS_LEN; i++) {
+                    weights[c][i] += (history[c][i] < 0) ? -delta : delta;
+                }
+                for (int i = 0; i < QOA_LMS_LEN - 1; i++) {
+                    history[c][i] = history[c][i + 1];
+                }
+                history[c][QOA_LMS_LEN - 1] = sample;
+            }
+        }
+    }
+    *outSamples = samples;
+    return frameSize;
+}
+
+static void checkFile(const char *name, const unsigned char *data, unsigned int size, QoaDesc *desc) {
+    if (qoaDecodeHeader(data, size, desc)) {
+        fprintf(stderr, "%s: bad header\n", name);
+        ++failures;
+        return;
+    }
+    unsigned int frames = qoaFrameCount(desc);
+    if (qoaFrameOffset(desc, frames) != size) {
+        fprintf(stderr, "%s: the frames should end at %u, the file is %u bytes\n", name, qoaFrameOffset(desc, frames), size);
+        ++failures;
+    }
+    short *decoded = malloc(QOA_FRAME_LEN * desc->channels * sizeof(short));
+    short *expected = malloc(QOA_FRAME_LEN * desc->channels * sizeof(short));
+    unsigned int offset = QOA_HEADER_SIZE, total = 0;
+    for (unsigned int frame = 0; frame < frames; frame++) {
+        if (offset != qoaFrameOffset(desc, frame)) {
+            fprintf(stderr, "%s: frame %u is at %u, not %u\n", name, frame, offset, qoaFrameOffset(desc, frame));
+            ++failures;
+            break;
+        }
+        unsigned int samples, expectedSamples;
+        unsigned int frameSize = qoaDecodeFrame(data + offset, size - offset, desc->channels, decoded, &samples);
+        if (frameSize == 0 || referenceDecodeFrame(data + offset, desc->channels, expected, &expectedSamples) != frameSize ||
+            samples != expectedSamples || memcmp(decoded, expected, samples * desc->channels * sizeof(short)) != 0) {
+            fprintf(stderr, "%s: frame %u doesn't decode like the reference\n", name, frame);
+            ++failures;
+            break;
+        }
+        offset += frameSize;
+        total += samples;
+    }
+    if (total != desc->samples && failures == 0) {
+        fprintf(stderr, "%s: %u samples decoded out of %u\n", name, total, desc->samples);
+        ++failures;
+    }
+    free(decoded);
+    free(expected);
+}
+
+static void checkMixer(void) {
+    static const short mono[4] = { 1000, 30000, -30000, -30000 };
+    static const short stereo[8] = { 100, 200, -100, -200, 30000, 30000, -30000, -30000 };
+    int mix[8];
+    short out[8];
+    MixerVoice a = { mono, 1, 4, 0, MIXER_VOLUME_MAX };
+    MixerVoice b = { stereo, 2, 4, 1, MIXER_VOLUME_MAX / 2 };
+    clearMix(mix, 4);
+    if (mixVoice(mix, 4, &a) != 4 || a.position != 4 || mixVoice(mix, 4, &b) != 3 || b.position != 4) {
+        fprintf(stderr, "Mixer: voices moved along wrong\n");
+        ++failures;
+    }
+    resolveMix(out, mix, 4);
+    static const short expected[8] = { 950, 900, 32767, 32767, -32768, -32768, -30000, -30000 };
+    if (memcmp(out, expected, sizeof(out)) != 0) {
+        fprintf(stderr, "Mixer: wrong output\n");
+        ++failures;
+    }
+}
+
+static void benchDecode(const char *name, const unsigned char *data, unsigned int size, const QoaDesc *desc, unsigned int rounds, double slowdown) {
+    short *out = malloc(QOA_FRAME_LEN * desc->channels * sizeof(short));
+    unsigned int frames = qoaFrameCount(desc);
+    double start = now();
+    for (unsigned int i = 0; i < rounds; i++) {
+        unsigned int offset = QOA_HEADER_SIZE, samples;
+        for (unsigned int frame = 0; frame < frames; frame++) {
+            offset += qoaDecodeFrame(data + offset, size - offset, desc->channels, out, &samples);
+        }
+    }
+    double elapsed = (now() - start) * slowdown;
+    double seconds = (double) desc->samples / desc->samplerate * rounds;
+    printf("%s: decoded %.3f ms per frame, %.1f MB/s, %.0fx as fast as it plays\n", name,
+           elapsed * 1000 / ((double) frames * rounds), (double) size * rounds / elapsed / 1e6, seconds / elapsed);
+    free(out);
+}
+
+// Music and all of the effects at once, which is as busy as the game gets.
+static void benchMix(unsigned int rounds, double slowdown) {
+    unsigned int length = AUDIO_SAMPLES * rounds;
+    short *music = malloc(length * 2 * sizeof(short));
+    short *effect = malloc(length * sizeof(short));
+    for (unsigned int i = 0; i < length * 2; i++) {
+        music[i] = rand();
+    }
+    for (unsigned int i = 0; i < length; i++) {
+        effect[i] = rand();
+    }
+    MixerVoice voices[1 + AUDIO_EFFECTS];
+    voices[0] = (MixerVoice) { music, 2, length, 0, 160 };
+    for (int i = 1; i <= AUDIO_EFFECTS; i++) {
+        voices[i] = (MixerVoice) { effect, 1, length, 0, MIXER_VOLUME_MAX };
+    }
+    int mix[AUDIO_SAMPLES * 2];
+    short out[AUDIO_SAMPLES * 2];
+    double start = now();
+    for (unsigned int i = 0; i < rounds; i++) {
+        clearMix(mix, AUDIO_SAMPLES);
+        for (int v = 0; v <= AUDIO_EFFECTS; v++) {
+            mixVoice(mix, AUDIO_SAMPLES, &voices[v]);
+        }
+        resolveMix(out, mix, AUDIO_SAMPLES);
+    }
+    double elapsed = (now() - start) * slowdown;
+    double period = (double) AUDIO_SAMPLES / AUDIO_RATE;
+    printf("mix: %.1f us per buffer of %d samples, %.2f%% of the time it plays for\n",
+           elapsed * 1e6 / rounds, AUDIO_SAMPLES, elapsed / rounds / period * 100);
+    free(music);
+    free(effect);
+}
+
+int main(int argc, char **argv) {
+    unsigned int rounds = 20;
+    double slowdown = 1.0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+            case 's':
+                slowdown = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n rounds] [-s slowdown] [file.qoa]...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (rounds == 0 || slowdown <= 0) {
+        fprintf(stderr, "Usage: %s [-n rounds] [-s slowdown] [file.qoa]...\n", argv[0]);
+        return 1;
+    }
+    srand(1);
+
+    int count = argc - optind;
+    int synthetic = count == 0;
+    if (synthetic) {
+        count = 1;
+    }
+    unsigned char **files = malloc(count * sizeof(unsigned char *));
+    unsigned int *sizes = malloc(count * sizeof(unsigned int));
+    QoaDesc *descs = malloc(count * sizeof(QoaDesc));
+    for (int i = 0; i < count; i++) {
+        const char *name = synthetic ? "synthetic" : argv[optind + i];
+        files[i] = synthetic ? makeSynthetic(&sizes[i]) : readWholeFile(name, &sizes[i]);
+        checkFile(name, files[i], sizes[i], &descs[i]);
+    }
+    checkMixer();
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+
+    for (int i = 0; i < count; i++) {
+        benchDecode(synthetic ? "synthetic" : argv[optind + i], files[i], sizes[i], &descs[i], rounds, slowdown);
+        free(files[i]);
+    }
+    benchMix(rounds * 100, slowdown);
+    free(files);
+    free(sizes);
+    free(descs);
+    return 0;
+}
@@ -0,0 +1,207 @@
+// Host tool that checks the game's swizzling against the layout the
+// Graphics Engine expects, and reports how long it takes to swizzle
+// the textures the game swizzles as it loads them.
+//
+// Usage: swizzlebench [-n rounds]
+//
+// First, textures and rectangles of a few sizes are swizzled and
+// unswizzled back, and the result must match what went in; the
+// swizzled bytes must also be where the reference layout puts them
+// (the same one as in textures.py), and swizzling rows in place must
+// leave the other rows alone. Then a screen and the tiles of the
+// tile atlas are swizzled the given number of times. The exit code
+// is 1 if any check fails.
+
+#include "swizzle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The screens and the tile atlas, as the game has them.
+#define SCREEN_PITCH (512 * 4)
+#define SCREEN_WIDTH (480 * 4)
+#define SCREEN_HEIGHT 360
+#define ATLAS_PITCH (512 * 4)
+#define ATLAS_HEIGHT 512
+#define TILE_WIDTH (16 * 4)
+#define TILE_HEIGHT 16
+
+typedef struct {
+    unsigned int pitch, height;
+    unsigned int x, y, width, rows;
+} RectCase;
+
+static const RectCase rectCases[] = {
+    { 16, 8, 0, 0, 16, 8 },
+    { 128, 32, 0, 0, 128, 32 },
+    { 128, 416, 0, 0, 128, 416 },
+    { SCREEN_PITCH, SCREEN_HEIGHT, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT },
+    { ATLAS_PITCH, ATLAS_HEIGHT, 0, 0, ATLAS_PITCH, ATLAS_HEIGHT },
+    { ATLAS_PITCH, ATLAS_HEIGHT, 64, 16, TILE_WIDTH, TILE_HEIGHT },
+    { ATLAS_PITCH, ATLAS_HEIGHT, ATLAS_PITCH - TILE_WIDTH, ATLAS_HEIGHT - TILE_HEIGHT, TILE_WIDTH, TILE_HEIGHT },
+    { 256, 64, 48, 24, 160, 40 },
+};
+
+static int failures;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *allocRandom(unsigned int size) {
+    unsigned char *data = aligned_alloc(16, size);
+    for (unsigned int i = 0; i < size; i++) {
+        data[i] = rand();
+    }
+    return data;
+}
+
+// Where byte x of row y of a texture goes once it's swizzled.
+static unsigned int referenceOffset(unsigned int pitch, unsigned int x, unsigned int y) {
+    unsigned int block = (y / SWIZZLE_BLOCK_HEIGHT) * (pitch / SWIZZLE_BLOCK_WIDTH) + x / SWIZZLE_BLOCK_WIDTH;
+    return block * SWIZZLE_BLOCK_SIZE + (y % SWIZZLE_BLOCK_HEIGHT) * SWIZZLE_BLOCK_WIDTH + x % SWIZZLE_BLOCK_WIDTH;
+}
+
+static void fail(const char *what, const RectCase *c) {
+    fprintf(stderr, "%s: pitch %u, height %u, rect %ux%u at %u,%u\n", what, c->pitch, c->height, c->width, c->rows, c->x, c->y);
+    ++failures;
+}
+
+static void checkRect(const RectCase *c) {
+    unsigned int size = c->pitch * c->height;
+    unsigned char *src = allocRandom(c->width * c->rows);
+    unsigned char *texture = allocRandom(size);
+    unsigned char *before = malloc(size);
+    unsigned char *back = malloc(c->width * c->rows);
+    memcpy(before, texture, size);
+
+    swizzleRect(texture, c->pitch, c->x, c->y, src, c->width, c->width, c->rows);
+    unswizzleRect(back, c->width, texture, c->pitch, c->x, c->y, c->width, c->rows);
+    if (memcmp(src, back, c->width * c->rows) != 0) {
+        fail("Round trip mismatch", c);
+    }
+    // Every byte of the rectangle must be where the reference puts
+    // it, and every byte outside of it must be left as it was.
+    unsigned char *covered = calloc(size, 1);
+    for (unsigned int y = 0; y < c->rows; y++) {
+        for (unsigned int x = 0; x < c->width; x++) {
+            unsigned int offset = referenceOffset(c->pitch, c->x + x, c->y + y);
+            covered[offset] = 1;
+            if (texture[offset] != src[y * c->width + x]) {
+                fail("Layout mismatch", c);
+                goto done;
+            }
+        }
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        if (!covered[i] && texture[i] != before[i]) {
+            fail("Bytes outside of the rectangle changed", c);
+            break;
+        }
+    }
+done:
+    free(covered);
+    free(src);
+    free(texture);
+    free(before);
+    free(back);
+}
+
+// Swizzles some bands of a screen in place, like the decoder does,
+// and compares them with swizzling a copy of the whole screen.
+static void checkRows(unsigned int firstRow, unsigned int rows) {
+    RectCase c = { SCREEN_PITCH, SCREEN_HEIGHT, 0, firstRow, SCREEN_WIDTH, rows };
+    unsigned int size = SCREEN_PITCH * SCREEN_HEIGHT;
+    unsigned char *pixels = allocRandom(size);
+    unsigned char *expected = malloc(size);
+    unsigned char *staging = aligned_alloc(16, SCREEN_PITCH * SWIZZLE_BLOCK_HEIGHT);
+    memcpy(expected, pixels, size);
+    swizzleRect(
+        expected, SCREEN_PITCH, 0, firstRow,
+        pixels + firstRow * SCREEN_PITCH, SCREEN_PITCH, SCREEN_WIDTH, rows
+    );
+    swizzleRows(pixels, SCREEN_PITCH, SCREEN_WIDTH, firstRow, rows, staging);
+    // The padding of the swizzled bands is left unspecified.
+    for (unsigned int y = 0; y < SCREEN_HEIGHT; y += SWIZZLE_BLOCK_HEIGHT) {
+        unsigned int bytes = (y >= firstRow && y < firstRow + rows) ? SCREEN_WIDTH * SWIZZLE_BLOCK_HEIGHT : SCREEN_PITCH * SWIZZLE_BLOCK_HEIGHT;
+        if (memcmp(pixels + y * SCREEN_PITCH, expected + y * SCREEN_PITCH, bytes) != 0) {
+            fail("In place mismatch", &c);
+            break;
+        }
+    }
+    free(pixels);
+    free(expected);
+    free(staging);
+}
+
+static void benchScreen(unsigned int rounds) {
+    unsigned char *pixels = allocRandom(SCREEN_PITCH * SCREEN_HEIGHT);
+    unsigned char *staging = aligned_alloc(16, SCREEN_PITCH * SWIZZLE_BLOCK_HEIGHT);
+    double start = now();
+    for (unsigned int i = 0; i < rounds; i++) {
+        swizzleRows(pixels, SCREEN_PITCH, SCREEN_WIDTH, 0, SCREEN_HEIGHT, staging);
+    }
+    double elapsed = now() - start;
+    double bytes = (double) SCREEN_WIDTH * SCREEN_HEIGHT * rounds;
+    printf("screen: %.3f ms per screen, %.1f MB/s\n", elapsed * 1000 / rounds, bytes / elapsed / 1e6);
+    free(pixels);
+    free(staging);
+}
+
+static void benchTiles(unsigned int rounds) {
+    unsigned char *atlas = allocRandom(ATLAS_PITCH * ATLAS_HEIGHT);
+    unsigned char *tile = allocRandom(TILE_WIDTH * TILE_HEIGHT);
+    unsigned int columns = ATLAS_PITCH / TILE_WIDTH, tiles = columns * (ATLAS_HEIGHT / TILE_HEIGHT);
+    double start = now();
+    for (unsigned int i = 0; i < rounds; i++) {
+        for (unsigned int slot = 0; slot < tiles; slot++) {
+            unsigned int x = (slot % columns) * TILE_WIDTH, y = (slot / columns) * TILE_HEIGHT;
+            swizzleRect(atlas, ATLAS_PITCH, x, y, tile, TILE_WIDTH, TILE_WIDTH, TILE_HEIGHT);
+        }
+    }
+    double elapsed = now() - start;
+    printf("tiles: %.3f us per tile, %.1f MB/s\n", elapsed * 1e6 / ((double) rounds * tiles), (double) ATLAS_PITCH * ATLAS_HEIGHT * rounds / elapsed / 1e6);
+    free(atlas);
+    free(tile);
+}
+
+int main(int argc, char **argv) {
+    unsigned int rounds = 100;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n rounds]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (rounds == 0) {
+        rounds = 1;
+    }
+    srand(1);
+
+    for (unsigned int i = 0; i < sizeof(rectCases) / sizeof(rectCases[0]); i++) {
+        checkRect(&rectCases[i]);
+    }
+    // The bands the loader decodes a screen in.
+    checkRows(0, SCREEN_HEIGHT);
+    checkRows(88, 272);
+    checkRows(0, 88);
+    checkRows(352, 8);
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+
+    benchScreen(rounds);
+    benchTiles(rounds);
+    return 0;
+}
@@ -0,0 +1,215 @@
+// Host tool that measures how long textures take to get onscreen
+// with each codec: the time to read the file, at a given bandwidth,
+// plus the time to decode it with the game's codecs.
+//
+// Usage: texbench [-n rounds] [-b bytes/s] [-s slowdown] [-c costs.json] <file>...
+//
+// Every file is decoded the given number of rounds. Files written by
+// textures.py -k, named <asset>.<codec>.tex, are grouped by asset, and
+// the fastest codec of each is marked; other files are reported on
+// their own. Decoding times are multiplied by the slowdown, to get
+// from the host's speed to the PSP's. With -c, the decoding speed of
+// each codec (in bytes of pixels per second, over all of the files)
+// is written as JSON, for textures.py --codec-costs.
+
+#include "codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CODECS 8
+
+typedef struct {
+    const char *path;
+    // the asset the file belongs to, and its length
+    const char *asset;
+    int assetLength;
+    const TextureCodec *codec;
+    unsigned int size;
+    unsigned int pixelBytes;
+    double decodeTime, readTime;
+} Result;
+
+typedef struct {
+    const char *name;
+    double pixelBytes, decodeTime;
+} CodecTotal;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *readWholeFile(const char *path, unsigned int *outSize) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    *outSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    void *data = malloc(*outSize);
+    if (fread(data, 1, *outSize, file) != *outSize) {
+        fprintf(stderr, "Could not read %s\n", path);
+        exit(1);
+    }
+    fclose(file);
+    return data;
+}
+
+// <asset>.<codec>.tex belongs to <asset>; anything else is its own.
+static void findAsset(Result *result) {
+    const char *name = strrchr(result->path, '/');
+    name = (name != NULL) ? name + 1 : result->path;
+    int length = (int) strlen(result->path);
+    const char *suffix = strstr(name, ".tex");
+    if (suffix != NULL && suffix[4] == '\0') {
+        const char *dot = suffix - 1;
+        while (dot > name && *dot != '.') {
+            dot--;
+        }
+        if (dot > name && strncmp(dot + 1, result->codec->name, suffix - dot - 1) == 0) {
+            length = (int) (dot - result->path);
+        }
+    }
+    result->asset = result->path;
+    result->assetLength = length;
+}
+
+static void benchFile(Result *result, int rounds, double bandwidth, double slowdown) {
+    void *data = readWholeFile(result->path, &result->size);
+    TextureDescriptor desc;
+    result->codec = findTextureCodec(data, result->size);
+    if (result->codec == NULL || result->codec->probe(data, result->size, &desc)) {
+        fprintf(stderr, "%s is not a texture\n", result->path);
+        exit(1);
+    }
+    result->pixelBytes = desc.pitch * desc.height * desc.channels;
+    void *pixels = malloc(result->pixelBytes);
+    double start = now();
+    for (int round = 0; round < rounds; round++) {
+        if (result->codec->decode(data, result->size, &desc, pixels, desc.pitch)) {
+            fprintf(stderr, "Failed to decode %s\n", result->path);
+            exit(1);
+        }
+    }
+    result->decodeTime = (now() - start) / rounds * slowdown;
+    result->readTime = result->size / bandwidth;
+    findAsset(result);
+    free(pixels);
+    free(data);
+}
+
+static int sameAsset(const Result *a, const Result *b) {
+    return a->assetLength == b->assetLength && strncmp(a->asset, b->asset, a->assetLength) == 0;
+}
+
+static int writeCosts(const char *path, const CodecTotal *totals, int count) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return 1;
+    }
+    int first = 1;
+    fprintf(file, "{");
+    for (int i = 0; i < count; i++) {
+        // Too fast to measure: leave the codec's guess alone.
+        if (totals[i].decodeTime <= 0.0) {
+            continue;
+        }
+        fprintf(file, "%s\n    \"%s\": %.0f", first ? "" : ",", totals[i].name, totals[i].pixelBytes / totals[i].decodeTime);
+        first = 0;
+    }
+    fprintf(file, "\n}\n");
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int rounds = 10, opt;
+    double bandwidth = 4e6, slowdown = 1.0;
+    const char *costsPath = NULL;
+    while ((opt = getopt(argc, argv, "n:b:s:c:")) != -1) {
+        switch (opt) {
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+            case 'b':
+                bandwidth = atof(optarg);
+                break;
+            case 's':
+                slowdown = atof(optarg);
+                break;
+            case 'c':
+                costsPath = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n rounds] [-b bytes/s] [-s slowdown] [-c costs.json] <file>...\n", argv[0]);
+                return 1;
+        }
+    }
+    int count = argc - optind;
+    if (count <= 0 || rounds <= 0 || bandwidth <= 0 || slowdown <= 0) {
+        fprintf(stderr, "Usage: %s [-n rounds] [-b bytes/s] [-s slowdown] [-c costs.json] <file>...\n", argv[0]);
+        return 1;
+    }
+
+    Result *results = calloc(count, sizeof(Result));
+    CodecTotal totals[MAX_CODECS];
+    int codecs = 0;
+    for (int i = 0; i < count; i++) {
+        results[i].path = argv[optind + i];
+        benchFile(&results[i], rounds, bandwidth, slowdown);
+        int codec = 0;
+        while (codec < codecs && strcmp(totals[codec].name, results[i].codec->name) != 0) {
+            codec++;
+        }
+        if (codec == codecs) {
+            totals[codecs].name = results[i].codec->name;
+            totals[codecs].pixelBytes = 0.0;
+            totals[codecs].decodeTime = 0.0;
+            codecs++;
+        }
+        totals[codec].pixelBytes += results[i].pixelBytes;
+        totals[codec].decodeTime += results[i].decodeTime;
+    }
+
+    printf("%-40s %-5s %10s %10s %10s %10s\n", "asset", "codec", "bytes", "read ms", "decode ms", "total ms");
+    for (int i = 0; i < count; i++) {
+        // Each asset is reported once, with all of its files.
+        int first = 1;
+        for (int j = 0; j < i && first; j++) {
+            first = !sameAsset(&results[i], &results[j]);
+        }
+        if (!first) {
+            continue;
+        }
+        int best = i;
+        for (int j = i; j < count; j++) {
+            if (sameAsset(&results[i], &results[j]) &&
+                results[j].readTime + results[j].decodeTime < results[best].readTime + results[best].decodeTime) {
+                best = j;
+            }
+        }
+        for (int j = i; j < count; j++) {
+            if (!sameAsset(&results[i], &results[j])) {
+                continue;
+            }
+            const Result *result = &results[j];
+            printf("%-40.*s %-5s %10u %10.3f %10.3f %10.3f%s\n",
+                   result->assetLength, result->asset, result->codec->name, result->size,
+                   result->readTime * 1000.0, result->decodeTime * 1000.0,
+                   (result->readTime + result->decodeTime) * 1000.0, (j == best) ? " *" : "");
+        }
+    }
+    printf("\n");
+    for (int i = 0; i < codecs; i++) {
+        printf("%s: %.1f MB/s of pixels\n", totals[i].name, totals[i].pixelBytes / totals[i].decodeTime / 1e6);
+    }
+    free(results);
+    return (costsPath != NULL) ? writeCosts(costsPath, totals, codecs) : 0;
+}
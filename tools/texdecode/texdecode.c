@@ -0,0 +1,284 @@
+// Host tool that decodes textures through the game's decoder
+// thread, the same way the loader does it, and reports the time
+// it took. Build the tools with SANITIZE_THREADS to check the
+// decoder and its queues with ThreadSanitizer.
+//
+// Usage: texdecode [-n rounds] [-j threads] [-p pitch] <file>...
+//
+// Every file is decoded once per round. Jobs are submitted from
+// this thread and collected from it too, like the game does once
+// per frame. Every other round, the jobs are made stale right after
+// being submitted, so the decoder has to skip them.
+//
+// With -j, every file (which must be a QOI image) is instead split in
+// bands of rows, using the row index (.qri) next to it, which are decoded on the given number
+// of threads. The result must match decoding the file in one go.
+//
+// With -p, the images are decoded into buffers with rows of the
+// given number of pixels, like the game does with the screens.
+
+#include "decoder.h"
+#include "spsc.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+
+typedef struct {
+    const char *path;
+    void *data;
+    unsigned int size;
+    void *pixels;
+    unsigned int pixelBytes;
+    // the length of a row of pixels, in pixels
+    unsigned int pitch;
+    // bumped to make the jobs stale
+    unsigned int generation;
+    // the row index, for -j
+    void *indexData;
+    QoiRowIndex rowIndex;
+    unsigned int height;
+} Image;
+
+// A band of rows decoded by one thread, for -j.
+typedef struct {
+    const Image *image;
+    void *pixels;
+    unsigned int firstRow, rows;
+    int failed;
+} Band;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *readWholeFile(const char *path, unsigned int *outSize) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    *outSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    void *data = malloc(*outSize);
+    if (fread(data, 1, *outSize, file) != *outSize) {
+        fprintf(stderr, "Could not read %s\n", path);
+        exit(1);
+    }
+    fclose(file);
+    return data;
+}
+
+static void loadImage(Image *image, const char *path, unsigned int pitch) {
+    image->data = readWholeFile(path, &image->size);
+    const TextureCodec *codec = findTextureCodec(image->data, image->size);
+    TextureDescriptor desc;
+    if (codec == NULL || codec->probe(image->data, image->size, &desc)) {
+        fprintf(stderr, "%s is not a texture\n", path);
+        exit(1);
+    }
+    if (pitch == 0) {
+        pitch = desc.pitch;
+    } else if (pitch < desc.width) {
+        fprintf(stderr, "%s is wider than the pitch\n", path);
+        exit(1);
+    }
+    image->path = path;
+    image->pitch = pitch;
+    image->pixelBytes = pitch * desc.height * desc.channels;
+    image->pixels = malloc(image->pixelBytes);
+    image->generation = 0;
+    image->height = desc.height;
+    image->indexData = NULL;
+}
+
+static void loadRowIndex(Image *image) {
+    char path[4096];
+    snprintf(path, sizeof(path) - 4, "%s", image->path);
+    char *extension = strrchr(path, '.');
+    strcpy((extension != NULL) ? extension : path + strlen(path), ".qri");
+    unsigned int size;
+    image->indexData = readWholeFile(path, &size);
+    if (qoiParseRowIndex(image->indexData, size, &image->rowIndex)) {
+        fprintf(stderr, "%s is not a valid row index\n", path);
+        exit(1);
+    }
+}
+
+static void decodeBand(void *arg) {
+    Band *band = (Band *) arg;
+    QoiDescriptor desc;
+    band->failed = qoiDecodeRows(band->image->data, band->image->size, &band->image->rowIndex,
+                                 band->firstRow, band->rows, band->image->pitch, &desc, band->pixels);
+}
+
+// Decodes every image split across threads, and checks the
+// result against the single threaded decode.
+static int decodeSplit(Image *images, int count, int rounds, int threads) {
+    Thread workers[MAX_THREADS];
+    Band bands[MAX_THREADS];
+    double splitTime = 0.0, wholeTime = 0.0;
+    for (int i = 0; i < count; i++) {
+        Image *image = &images[i];
+        loadRowIndex(image);
+        // The padding of the rows is never written.
+        void *pixels = calloc(1, image->pixelBytes);
+        memset(image->pixels, 0, image->pixelBytes);
+        // Split at restart points, so that no row is decoded twice.
+        unsigned int step = image->rowIndex.rowsPerEntry;
+        unsigned int entries = (image->height + step - 1) / step;
+        for (int round = 0; round < rounds; round++) {
+            double start = now();
+            for (int t = 0; t < threads; t++) {
+                unsigned int first = entries * t / threads;
+                unsigned int last = entries * (t + 1) / threads;
+                bands[t].image = image;
+                bands[t].pixels = pixels;
+                bands[t].firstRow = first * step;
+                bands[t].rows = (last - first) * step;
+                if (threadCreate(&workers[t], "DecodeBand", 0, 0, &decodeBand, &bands[t]) < 0) {
+                    fprintf(stderr, "Failed to start a thread\n");
+                    return 1;
+                }
+            }
+            for (int t = 0; t < threads; t++) {
+                threadJoin(&workers[t]);
+                if (bands[t].failed) {
+                    fprintf(stderr, "Failed to decode rows %u to %u of %s\n",
+                            bands[t].firstRow, bands[t].firstRow + bands[t].rows, image->path);
+                    return 1;
+                }
+            }
+            splitTime += now() - start;
+            start = now();
+            QoiDescriptor desc;
+            qoiDecodeRect(image->data, image->size, &desc, image->pixels, image->pitch, 0, 0);
+            wholeTime += now() - start;
+        }
+        if (memcmp(pixels, image->pixels, image->pixelBytes) != 0) {
+            fprintf(stderr, "%s: the split decode doesn't match\n", image->path);
+            return 1;
+        }
+        free(pixels);
+    }
+    int decodes = rounds * count;
+    printf("%.3f ms per image on %d threads, %.3f ms on one\n",
+           splitTime * 1000.0 / decodes, threads, wholeTime * 1000.0 / decodes);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int rounds = 10, threads = 0, pitch = 0, opt;
+    while ((opt = getopt(argc, argv, "n:j:p:")) != -1) {
+        switch (opt) {
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'p':
+                pitch = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n rounds] [-j threads] [-p pitch] <file>...\n", argv[0]);
+                return 1;
+        }
+    }
+    int count = argc - optind;
+    if (count <= 0 || rounds <= 0 || threads < 0 || threads > MAX_THREADS || pitch < 0) {
+        fprintf(stderr, "Usage: %s [-n rounds] [-j threads] [-p pitch] <file>...\n", argv[0]);
+        return 1;
+    }
+
+    Image *images = calloc(count, sizeof(Image));
+    for (int i = 0; i < count; i++) {
+        loadImage(&images[i], argv[optind + i], pitch);
+    }
+    if (threads > 0) {
+        return decodeSplit(images, count, rounds, threads);
+    }
+    DecodeJob *jobs = calloc(SPSC_CAPACITY, sizeof(DecodeJob));
+    int freeJobs[SPSC_CAPACITY];
+    int freeCount = SPSC_CAPACITY;
+    for (int i = 0; i < SPSC_CAPACITY; i++) {
+        freeJobs[i] = i;
+    }
+
+    if (startDecoder(0) < 0) {
+        fprintf(stderr, "Failed to start the decoder\n");
+        return 1;
+    }
+    int total = rounds * count, submitted = 0, collected = 0;
+    unsigned int decoded = 0, skipped = 0;
+    unsigned long long decodedBytes = 0;
+    double start = now();
+    while (collected < total) {
+        // Keep the decoder fed, without ever having more
+        // jobs in flight than the queues can hold.
+        while (submitted < total && freeCount > 0) {
+            Image *image = &images[submitted % count];
+            int staleRound = (submitted / count) % 2;
+            DecodeJob *job = &jobs[freeJobs[--freeCount]];
+            job->data = image->data;
+            job->size = image->size;
+            job->dest = image->pixels;
+            job->pitch = image->pitch;
+            job->firstRow = 0;
+            job->rows = 0;
+            job->currentGeneration = &image->generation;
+            job->generation = __atomic_load_n(&image->generation, __ATOMIC_RELAXED);
+            job->user = image;
+            if (!submitDecodeJob(job)) {
+                fprintf(stderr, "The decoder refused a job\n");
+                return 1;
+            }
+            if (staleRound) {
+                __atomic_add_fetch(&image->generation, 1, __ATOMIC_RELAXED);
+            }
+            ++submitted;
+        }
+        DecodeJob *job;
+        while ((job = pollDecodedJob()) != NULL) {
+            Image *image = (Image *) job->user;
+            switch (job->result) {
+                case DECODE_DONE:
+                    ++decoded;
+                    decodedBytes += image->pixelBytes;
+                    break;
+                case DECODE_SKIPPED:
+                    ++skipped;
+                    break;
+                default:
+                    fprintf(stderr, "Failed to decode %s\n", image->path);
+                    return 1;
+            }
+            freeJobs[freeCount++] = (int) (job - jobs);
+            ++collected;
+        }
+    }
+    double elapsed = now() - start;
+    stopDecoder();
+
+    printf("%u decoded, %u skipped in %.3f s\n", decoded, skipped, elapsed);
+    if (decoded > 0) {
+        printf("%.3f ms per image, %.1f MB/s of pixels\n",
+               elapsed * 1000.0 / decoded, decodedBytes / elapsed / (1024.0 * 1024.0));
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(images[i].data);
+        free(images[i].pixels);
+        free(images[i].indexData);
+    }
+    free(images);
+    free(jobs);
+    return 0;
+}